@@ -3,6 +3,7 @@
 #import "FPCrypto.h"
 #import "FPAnalyticsConfiguration.h"
 #import "FPSerializableValue.h"
+#import "FPDeliveryMetrics.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -164,6 +165,32 @@ NS_SWIFT_NAME(Freshpaint)
  */
 - (void)flush;
 
+/*!
+ @method
+
+ @abstract
+ Upload queued events batch after batch until the queue is empty.
+
+ @discussion
+ Unlike `flush`, which sends a single batch, this keeps uploading until no events are left, an upload
+ fails, or the background task the upload runs in expires. The completion handler is called on the main
+ queue with the number of events delivered. Events queued while draining are uploaded as well.
+ */
+- (void)drainWithCompletion:(void (^_Nullable)(NSUInteger deliveredCount))completion NS_SWIFT_NAME(drain(completion:));
+
+/*!
+ @method
+
+ @abstract
+ Pass on the background session events the app was launched for.
+
+ @discussion
+ Call this from `application:handleEventsForBackgroundURLSession:completionHandler:` when
+ `shouldUseBackgroundUploads` is on. Returns NO if the session is not one of Freshpaint's, in which
+ case the completion handler is left for the app to call.
+ */
+- (BOOL)handleEventsForBackgroundURLSession:(NSString *)identifier completionHandler:(void (^)(void))completionHandler;
+
 /*!
  @method
 
@@ -212,6 +239,9 @@ NS_SWIFT_NAME(Freshpaint)
  */
 - (NSDictionary *)bundledIntegrations;
 
+/** Counters describing dropped and truncated events. */
+@property (nonatomic, strong, readonly) FPDeliveryMetrics *deliveryMetrics;
+
 /** Returns the anonymous ID of the current user. */
 - (NSString *)getAnonymousId;
 
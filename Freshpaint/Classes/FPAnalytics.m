@@ -32,6 +32,7 @@ static FPAnalytics *__sharedInstance = nil;
 @property (nonatomic, strong) FPIntegrationsManager *integrationsManager;
 @property (nonatomic, strong) FPMiddlewareRunner *runner;
 @property (nonatomic, strong) FPState *state;
+@property (nonatomic, strong, readwrite) FPDeliveryMetrics *deliveryMetrics;
 
 - (void)_handleDidBecomeActiveForATT;
 
@@ -57,6 +58,7 @@ static FPAnalytics *__sharedInstance = nil;
 
         self.oneTimeConfiguration = configuration;
         self.enabled = YES;
+        self.deliveryMetrics = [[FPDeliveryMetrics alloc] init];
 
         // In swift this would not have been OK... But hey.. It's objc
         // TODO: Figure out if this is really the best way to do things here.
@@ -710,6 +712,16 @@ NSString *const FPBuildKeyV2 = @"FPBuildKeyV2";
     [self run:FPEventTypeFlush payload:nil];
 }
 
+- (void)drainWithCompletion:(void (^)(NSUInteger))completion
+{
+    [self.integrationsManager drainWithCompletion:completion];
+}
+
+- (BOOL)handleEventsForBackgroundURLSession:(NSString *)identifier completionHandler:(void (^)(void))completionHandler
+{
+    return [self.integrationsManager handleEventsForBackgroundURLSession:identifier completionHandler:completionHandler];
+}
+
 - (void)enable
 {
     _enabled = YES;
@@ -36,10 +36,33 @@ NS_SWIFT_NAME(ApplicationProtocol)
 
 
 typedef NSMutableURLRequest *_Nonnull (^FPRequestFactory)(NSURL *_Nonnull);
+
+/**
+ * What to do with an event whose JSON encoding is too large to fit in a batch upload.
+ */
+typedef NS_ENUM(NSInteger, FPOversizedEventPolicy) {
+    /// Remove the largest `properties`, `traits` and `context` values until the event fits. Drop it if it still does not.
+    FPOversizedEventPolicyTruncate,
+    /// Drop the event.
+    FPOversizedEventPolicyDrop,
+} NS_SWIFT_NAME(OversizedEventPolicy);
+
+/**
+ * How queued events are persisted, trading what a crash or power loss can take for the cost of each event.
+ */
+typedef NS_ENUM(NSInteger, FPDurabilityMode) {
+    /// Write and sync every event to disk before the next one is queued.
+    FPDurabilityModePerEvent,
+    /// Write and sync the events queued within a short window together. A crash loses at most that window.
+    FPDurabilityModeGroupCommit,
+    /// Keep events in memory and write them when the app enters the background or terminates.
+    FPDurabilityModeMemoryOnly,
+} NS_SWIFT_NAME(DurabilityMode);
 typedef NSString *_Nonnull (^FPAdSupportBlock)(void);
 
 @protocol FPIntegrationFactory;
 @protocol FPCrypto;
+@protocol FPTransport;
 @protocol FPMiddleware;
 @protocol FPEdgeFunctionMiddleware;
 
@@ -87,15 +110,105 @@ NS_SWIFT_NAME(FreshpaintConfiguration)
  * The amount of time to wait before each tick of the flush timer.
  * Smaller values will make events delivered in a more real-time manner and also use more battery.
  * A value smaller than 10 seconds will seriously degrade overall performance.
+ * The timer only runs while events are queued. It ticks sooner as the queue fills up towards `flushAt` and
+ * later while uploads are failing, within `minFlushInterval` and `maxFlushInterval`. `0` turns it off.
  * 30 seconds by default.
  */
 @property (nonatomic, assign) NSTimeInterval flushInterval;
 
+/**
+ * Shortest interval the flush timer adapts down to. 10 seconds by default.
+ */
+@property (nonatomic, assign) NSTimeInterval minFlushInterval;
+
+/**
+ * Longest interval the flush timer adapts up to. 5 minutes by default.
+ */
+@property (nonatomic, assign) NSTimeInterval maxFlushInterval;
+
 /**
  * The maximum number of items to queue before starting to drop old ones. This should be a value greater than zero, the behaviour is undefined otherwise. `1000` by default.
+ * Track and screen events are dropped first; identify, alias, group and `criticalTrackEvents` only go once nothing else is left.
  */
 @property (nonatomic, assign) NSUInteger maxQueueSize;
 
+/**
+ * Names of track events kept in the queue as long as identify, alias and group calls when it overflows, e.g. "Order Completed".
+ * Empty by default.
+ */
+@property (nonatomic, copy) NSSet<NSString *> *criticalTrackEvents;
+
+/**
+ * The maximum number of events waiting for a single integration. Every integration is called on its own serial queue,
+ * so a slow one only holds up its own events; once this many are waiting, it misses the next ones. Its delays and
+ * misses are counted in `deliveryMetrics.destinationMetrics`. Events bound for Freshpaint.io are never missed; its
+ * queue applies `maxQueueSize` instead. `1000` by default.
+ */
+@property (nonatomic, assign) NSUInteger integrationInboxCapacity;
+
+/**
+ * Keys of the integrations whose queues run at a higher quality of service, for destinations that need their events
+ * as soon as possible, e.g. "Freshpaint.io". Empty by default.
+ */
+@property (nonatomic, copy) NSSet<NSString *> *latencyCriticalIntegrations;
+
+/**
+ * The maximum number of batch uploads running at the same time. Several batches in flight drain a large backlog faster
+ * when latency dominates, e.g. on reconnecting after a long time offline. Events are still acknowledged in queue order.
+ * `2` by default.
+ */
+@property (nonatomic, assign) NSUInteger maxInFlightBatches;
+
+/**
+ * Whether to upload the queue through a background `NSURLSession` when the app enters the background. Batches are
+ * written to files and uploaded by the system, so the uploads carry on after the app is suspended and their results
+ * are picked up on the next launch. Forward `application:handleEventsForBackgroundURLSession:completionHandler:` to
+ * `FPAnalytics` so the app can be woken up when they finish. `NO` by default.
+ */
+@property (nonatomic, assign) BOOL shouldUseBackgroundUploads;
+
+/**
+ * Whether to upload batches in a compact binary encoding rather than JSON. Keys are sent once per batch and timestamps
+ * as integers, which makes bodies smaller and cheaper to compress. Uploads switch back to JSON for the rest of the
+ * session if the server does not accept it. Background uploads are always JSON. `NO` by default.
+ */
+@property (nonatomic, assign) BOOL shouldUseCompactEncoding;
+
+/**
+ * Whether to compress batches with a preset dictionary of the keys and values every event repeats, rather than plain
+ * gzip. Small batches come out noticeably smaller. Uploads switch back to gzip for the rest of the session if the
+ * server does not accept it. Background uploads are always gzipped. `NO` by default.
+ */
+@property (nonatomic, assign) BOOL shouldUseCompressionDictionary;
+
+#if TARGET_OS_IOS
+/**
+ * Multipath TCP service used for batch uploads, letting them move between Wi-Fi and cellular without reconnecting.
+ * Any value other than `NSURLSessionMultipathServiceTypeNone` requires the Multipath entitlement.
+ * `NSURLSessionMultipathServiceTypeNone` by default.
+ */
+@property (nonatomic, assign) NSURLSessionMultipathServiceType multipathServiceType;
+#endif
+
+/**
+ * How to handle an event too large to fit in a batch upload on its own. Batches are packed by size as well as by count,
+ * so these are the only events that cannot be delivered as is. Every truncated or dropped event is counted in
+ * `FPAnalytics.deliveryMetrics`. `FPOversizedEventPolicyTruncate` by default.
+ */
+@property (nonatomic, assign) FPOversizedEventPolicy oversizedEventPolicy;
+
+/**
+ * How queued events are persisted. Entering the background and terminating always write and sync every queued event.
+ * `FPDurabilityModePerEvent` by default. Apps that can lose the last `groupCommitInterval` of events in a crash can
+ * choose `FPDurabilityModeGroupCommit` to write them less often.
+ */
+@property (nonatomic, assign) FPDurabilityMode durabilityMode;
+
+/**
+ * How long events are gathered before being written together under `FPDurabilityModeGroupCommit`. 0.5 seconds by default.
+ */
+@property (nonatomic, assign) NSTimeInterval groupCommitInterval;
+
 /**
  * Whether the analytics client should automatically make a track call for application lifecycle events, such as "Application Installed", "Application Updated" and "Application Opened".
  */
@@ -137,6 +250,12 @@ NS_SWIFT_NAME(FreshpaintConfiguration)
  */
 @property (nonatomic, strong, nullable) FPRequestFactory requestFactory;
 
+/**
+ * Carries batch uploads and webhook requests instead of `NSURLSession`, e.g. an `FPLoopbackTransport` for load tests.
+ * Background uploads are turned off while it is set. `nil` by default.
+ */
+@property (nonatomic, strong, nullable) id<FPTransport> transport;
+
 /**
  * Set a custom crypto
  */
@@ -149,6 +268,19 @@ NS_SWIFT_NAME(FreshpaintConfiguration)
  */
 @property (nonatomic, strong, nullable) NSDictionary *defaultSettings;
 
+/**
+ * Whether to fetch the project settings from the settings CDN. Integrations start from the settings fetched last time,
+ * or from `defaultSettings` until a fetch succeeds, and refreshed settings are picked up on the next launch. `NO` by
+ * default: only `defaultSettings` are used.
+ */
+@property (nonatomic, assign) BOOL shouldFetchSettings;
+
+/**
+ * How long fetched settings are used before they are checked for changes again, at launch or when the app comes to the
+ * foreground. Unchanged settings are not downloaded again. 1 hour by default.
+ */
+@property (nonatomic, assign) NSTimeInterval settingsTTL;
+
 /**
  * Set custom middlewares. Will be run before all integrations.
  *  This property is deprecated in favor of the `sourceMiddleware` property.
@@ -69,7 +69,24 @@ static const NSTimeInterval DefaultSessionTimeout = 1800;
         self.shouldUseBluetooth = NO;
         self.flushAt = 20;
         self.flushInterval = 30;
+        self.minFlushInterval = 10;
+        self.maxFlushInterval = 5 * 60;
         self.maxQueueSize = 1000;
+        self.criticalTrackEvents = [NSSet set];
+        self.integrationInboxCapacity = 1000;
+        self.latencyCriticalIntegrations = [NSSet set];
+        self.maxInFlightBatches = 2;
+        self.shouldUseBackgroundUploads = NO;
+        self.shouldUseCompactEncoding = NO;
+        self.shouldUseCompressionDictionary = NO;
+#if TARGET_OS_IOS
+        self.multipathServiceType = NSURLSessionMultipathServiceTypeNone;
+#endif
+        self.oversizedEventPolicy = FPOversizedEventPolicyTruncate;
+        self.durabilityMode = FPDurabilityModePerEvent;
+        self.groupCommitInterval = 0.5;
+        self.shouldFetchSettings = NO;
+        self.settingsTTL = 60 * 60;
         self.payloadFilters = @{
             @"(fb\\d+://authorize#access_token=)([^ ]+)": @"$1((redacted/fb-auth-token))"
         };
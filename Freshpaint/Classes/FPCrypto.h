@@ -12,4 +12,17 @@
 - (NSData *_Nullable)encrypt:(NSData *_Nonnull)data;
 - (NSData *_Nullable)decrypt:(NSData *_Nonnull)data;
 
+@optional
+
+// Chunked variants of encrypt:/decrypt: producing the same bytes. When implemented, file backed storage
+// streams data through these instead of holding both the plain and the cipher text in memory.
+- (BOOL)encryptFromStream:(NSInputStream *_Nonnull)input toStream:(NSOutputStream *_Nonnull)output NS_SWIFT_NAME(encrypt(from:to:));
+- (BOOL)decryptFromStream:(NSInputStream *_Nonnull)input toStream:(NSOutputStream *_Nonnull)output NS_SWIFT_NAME(decrypt(from:to:));
+
+// Record level envelope. Each record is sealed on its own with a fresh nonce and an authentication tag, so
+// append-only stores such as the event queue can add and drop records without re-encrypting the rest.
+// When not implemented, records are passed through encrypt:/decrypt: individually instead.
+- (NSData *_Nullable)sealRecord:(NSData *_Nonnull)record;
+- (NSData *_Nullable)openRecord:(NSData *_Nonnull)envelope;
+
 @end
@@ -0,0 +1,113 @@
+//
+//  FPDeliveryMetrics.h
+//  Freshpaint
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Running counters describing what happened to events on their way to Freshpaint.
+ * Counters start at zero when the analytics client is created and are not persisted.
+ */
+NS_SWIFT_NAME(DeliveryMetrics)
+@interface FPDeliveryMetrics : NSObject
+
+/**
+ * Events that were too large to fit in a batch, even after truncation, and were dropped.
+ */
+@property (atomic, assign, readonly) NSUInteger oversizedEventsDropped;
+
+/**
+ * Events that were too large to fit in a batch and had values removed so that they fit.
+ */
+@property (atomic, assign, readonly) NSUInteger oversizedEventsTruncated;
+
+/**
+ * Events evicted from the queue because it reached `maxQueueSize`, whatever their priority.
+ */
+@property (atomic, assign, readonly) NSUInteger queueOverflowEventsDropped;
+
+/**
+ * Part of `queueOverflowEventsDropped` made of identify, alias, group and critical track events. These are only
+ * evicted once the queue holds nothing else.
+ */
+@property (atomic, assign, readonly) NSUInteger queueOverflowCriticalEventsDropped;
+
+/**
+ * Batch uploads accepted by the server, including batches it rejected for good.
+ */
+@property (atomic, assign, readonly) NSUInteger uploadsSucceeded;
+
+/**
+ * Batch uploads that failed and will be retried: network errors, 3xx, 429 and 5xx responses.
+ */
+@property (atomic, assign, readonly) NSUInteger uploadsFailed;
+
+/**
+ * Uploads that failed since the last successful one. Retries back off exponentially with it.
+ */
+@property (atomic, assign, readonly) NSUInteger consecutiveUploadFailures;
+
+/**
+ * Whether uploads are paused because too many of them failed in a row.
+ */
+@property (atomic, assign, readonly, getter=isCircuitBreakerOpen) BOOL circuitBreakerOpen;
+
+/**
+ * Earliest time the next upload will be attempted, or nil when uploads are not backing off.
+ */
+@property (atomic, strong, readonly, nullable) NSDate *nextUploadAttemptDate;
+
+/**
+ * Batch uploads whose timing was measured, successful or not.
+ */
+@property (atomic, assign, readonly) NSUInteger measuredUploads;
+
+/**
+ * Part of `measuredUploads` sent over a connection that was already open.
+ */
+@property (atomic, assign, readonly) NSUInteger reusedConnectionUploads;
+
+/**
+ * Total time the measured uploads spent on DNS, TCP and TLS before their request went out.
+ */
+@property (atomic, assign, readonly) NSTimeInterval uploadConnectionSetupDuration;
+
+/**
+ * Total time the measured uploads spent between sending their request and receiving the whole response.
+ */
+@property (atomic, assign, readonly) NSTimeInterval uploadTransferDuration;
+
+/**
+ * Events an integration was called with, counted in `destinationMetrics`.
+ */
+@property (atomic, assign, readonly) NSUInteger dispatchedEvents;
+
+/**
+ * Events an integration never got because `integrationInboxCapacity` of its events were already waiting, counted in
+ * `destinationMetrics`.
+ */
+@property (atomic, assign, readonly) NSUInteger dispatchDroppedEvents;
+
+/**
+ * Total time `dispatchedEvents` waited in the inbox of their integration before it was called with them.
+ */
+@property (atomic, assign, readonly) NSTimeInterval dispatchLag;
+
+/**
+ * Longest time a single event waited in the inbox of its integration.
+ */
+@property (atomic, assign, readonly) NSTimeInterval maxDispatchLag;
+
+/**
+ * Counters of each integration, by integration key: how its inbox kept up, and for the destinations that queue and
+ * upload events on their own, such as webhooks, their queue overflow, oversized event and upload counters. Those
+ * uploads are not counted above.
+ */
+@property (atomic, copy, readonly) NSDictionary<NSString *, FPDeliveryMetrics *> *destinationMetrics;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,142 @@
+//
+//  FPDeliveryMetrics.m
+//  Freshpaint
+//
+
+#import "FPDeliveryMetrics.h"
+#import "FPDeliveryMetrics+FPRecording.h"
+
+
+@interface FPDeliveryMetrics ()
+
+@property (atomic, assign, readwrite) NSUInteger oversizedEventsDropped;
+@property (atomic, assign, readwrite) NSUInteger oversizedEventsTruncated;
+@property (atomic, assign, readwrite) NSUInteger queueOverflowEventsDropped;
+@property (atomic, assign, readwrite) NSUInteger queueOverflowCriticalEventsDropped;
+@property (atomic, assign, readwrite) NSUInteger uploadsSucceeded;
+@property (atomic, assign, readwrite) NSUInteger uploadsFailed;
+@property (atomic, assign, readwrite) NSUInteger consecutiveUploadFailures;
+@property (atomic, assign, readwrite) BOOL circuitBreakerOpen;
+@property (atomic, strong, readwrite, nullable) NSDate *nextUploadAttemptDate;
+@property (atomic, assign, readwrite) NSUInteger measuredUploads;
+@property (atomic, assign, readwrite) NSUInteger reusedConnectionUploads;
+@property (atomic, assign, readwrite) NSTimeInterval uploadConnectionSetupDuration;
+@property (atomic, assign, readwrite) NSTimeInterval uploadTransferDuration;
+@property (atomic, assign, readwrite) NSUInteger dispatchedEvents;
+@property (atomic, assign, readwrite) NSUInteger dispatchDroppedEvents;
+@property (atomic, assign, readwrite) NSTimeInterval dispatchLag;
+@property (atomic, assign, readwrite) NSTimeInterval maxDispatchLag;
+@property (atomic, copy, readwrite) NSDictionary<NSString *, FPDeliveryMetrics *> *destinationMetrics;
+
+@end
+
+
+@implementation FPDeliveryMetrics
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        _destinationMetrics = @{};
+    }
+    return self;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%p:%@, %@>", self, self.class, [self dictionaryWithValuesForKeys:@[ @"oversizedEventsDropped", @"oversizedEventsTruncated", @"queueOverflowEventsDropped", @"queueOverflowCriticalEventsDropped", @"uploadsSucceeded", @"uploadsFailed", @"consecutiveUploadFailures", @"circuitBreakerOpen", @"measuredUploads", @"reusedConnectionUploads", @"uploadConnectionSetupDuration", @"uploadTransferDuration", @"dispatchedEvents", @"dispatchDroppedEvents", @"dispatchLag", @"maxDispatchLag", @"destinationMetrics" ]]];
+}
+
+@end
+
+
+@implementation FPDeliveryMetrics (FPRecording)
+
+- (void)fp_recordOversizedEventsDropped:(NSUInteger)count
+{
+    @synchronized(self) {
+        self.oversizedEventsDropped += count;
+    }
+}
+
+- (void)fp_recordOversizedEventsTruncated:(NSUInteger)count
+{
+    @synchronized(self) {
+        self.oversizedEventsTruncated += count;
+    }
+}
+
+- (void)fp_recordQueueOverflowEventsDropped:(NSUInteger)count
+{
+    @synchronized(self) {
+        self.queueOverflowEventsDropped += count;
+    }
+}
+
+- (void)fp_recordQueueOverflowCriticalEventsDropped:(NSUInteger)count
+{
+    @synchronized(self) {
+        self.queueOverflowCriticalEventsDropped += count;
+    }
+}
+
+- (void)fp_recordUploadSucceeded
+{
+    @synchronized(self) {
+        self.uploadsSucceeded += 1;
+        self.consecutiveUploadFailures = 0;
+        self.circuitBreakerOpen = NO;
+        self.nextUploadAttemptDate = nil;
+    }
+}
+
+- (void)fp_recordUploadFailedWithConsecutiveFailures:(NSUInteger)consecutiveFailures circuitBreakerOpen:(BOOL)circuitBreakerOpen nextAttemptDate:(NSDate *)nextAttemptDate
+{
+    @synchronized(self) {
+        self.uploadsFailed += 1;
+        self.consecutiveUploadFailures = consecutiveFailures;
+        self.circuitBreakerOpen = circuitBreakerOpen;
+        self.nextUploadAttemptDate = nextAttemptDate;
+    }
+}
+
+- (void)fp_recordUploadWithConnectionSetupDuration:(NSTimeInterval)connectionSetupDuration transferDuration:(NSTimeInterval)transferDuration reusedConnection:(BOOL)reusedConnection
+{
+    @synchronized(self) {
+        self.measuredUploads += 1;
+        self.reusedConnectionUploads += reusedConnection ? 1 : 0;
+        self.uploadConnectionSetupDuration += connectionSetupDuration;
+        self.uploadTransferDuration += transferDuration;
+    }
+}
+
+- (void)fp_recordDispatchWithLag:(NSTimeInterval)lag
+{
+    @synchronized(self) {
+        self.dispatchedEvents += 1;
+        self.dispatchLag += lag;
+        self.maxDispatchLag = MAX(self.maxDispatchLag, lag);
+    }
+}
+
+- (void)fp_recordDispatchDropped
+{
+    @synchronized(self) {
+        self.dispatchDroppedEvents += 1;
+    }
+}
+
+- (FPDeliveryMetrics *)fp_metricsForDestination:(NSString *)key
+{
+    @synchronized(self) {
+        FPDeliveryMetrics *metrics = self.destinationMetrics[key];
+        if (metrics == nil) {
+            metrics = [[FPDeliveryMetrics alloc] init];
+            NSMutableDictionary<NSString *, FPDeliveryMetrics *> *destinationMetrics = [self.destinationMetrics mutableCopy];
+            destinationMetrics[key] = metrics;
+            self.destinationMetrics = destinationMetrics;
+        }
+        return metrics;
+    }
+}
+
+@end
@@ -5,6 +5,10 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
+/**
+ * Posted around batch uploads. The notification object is the batch, an array holding the
+ * dictionary of each event.
+ */
 extern NSString *const FPFreshpaintDidSendRequest;
 extern NSString *const FPFreshpaintRequestDidSucceedNotification;
 extern NSString *const FPFreshpaintRequestDidFailNotification;
@@ -14,6 +18,7 @@ extern NSString *const FPFreshpaintRequestDidFailNotification;
  */
 extern NSString *const kFPUserIdFilename;
 extern NSString *const kFPQueueFilename;
+extern NSString *const kFPQueueJournalFilename;
 extern NSString *const kFPTraitsFilename;
 
 
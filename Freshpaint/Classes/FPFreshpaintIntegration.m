@@ -6,8 +6,16 @@
 #import "FPReachability.h"
 #import "FPHTTPClient.h"
 #import "FPStorage.h"
+#import "FPFileStorage.h"
+#import "FPEventJournal.h"
+#import "FPEventQueue.h"
+#import "FPGZIPBatchBuilder.h"
+#import "FPCompactBatchCodec.h"
+#import "FPRetryScheduler.h"
+#import "FPDeliveryMetrics+FPRecording.h"
 #import "FPMacros.h"
 #import "FPState.h"
+#import "NSData+FPGZIP.h"
 
 #if TARGET_OS_IPHONE
 #import <UIKit/UIKit.h>
@@ -24,17 +32,121 @@ NSString *const FPTraitsKey = @"FPTraits";
 
 NSString *const kFPUserIdFilename = @"freshpaintio.userId";
 NSString *const kFPQueueFilename = @"freshpaintio.queue.plist";
+NSString *const kFPQueueJournalFilename = @"freshpaintio.queue.journal";
 NSString *const kFPTraitsFilename = @"freshpaintio.traits.plist";
 
 // Equiv to UIBackgroundTaskInvalid.
 NSUInteger const kFPBackgroundTaskInvalid = 0;
 
+// Bytes of a batch body taken by everything but the events: `{"batch":[`, `],"sentAt":"..."}`.
+static const NSUInteger kFPBatchEnvelopeReserve = 64;
+
+// How long after the enqueue that calls for it the queue is compacted.
+static const NSTimeInterval kFPCompactionDelay = 1;
+
+// Folder holding the bodies of batches handed to the background session.
+static NSString *const kFPBackgroundUploadsFilename = @"freshpaintio.uploads";
+
+// A batch uploaded from the head of the queue. Batches sit back to back in queue order and are
+// acknowledged in that order, whatever order their responses arrive in.
+@interface FPInFlightBatch : NSObject
+// Sequence numbers of the first event of the batch and of the event following its last one.
+@property (nonatomic, assign) uint64_t firstSequence;
+@property (nonatomic, assign) uint64_t endSequence;
+// Events of the batch still queued; evicting the queue on overflow may take some of them.
+@property (nonatomic, assign) NSUInteger count;
+@property (nonatomic, assign) BOOL sending;
+@property (nonatomic, assign) BOOL delivered;
+// `retryScheduler.failureCount` when the batch was last sent, so a wave of failures is counted once.
+@property (nonatomic, assign) NSUInteger startFailureCount;
+@property (nonatomic, strong) id<FPTransportTask> task;
+// Name of the file the background session uploads the batch from, while it does.
+@property (nonatomic, copy) NSString *uploadFileName;
+@end
+
+@implementation FPInFlightBatch
+@end
+
+
+// The events of a batch as dictionaries, the object of the request notifications. Events are kept
+// serialized, so each one is only decoded when an observer reads it.
+@interface FPDecodedBatch : NSArray
+- (instancetype)initWithRecords:(NSArray<NSData *> *)records;
+@end
+
+@implementation FPDecodedBatch {
+    NSArray<NSData *> *_records;
+    NSMutableArray *_events;
+}
+
+- (instancetype)initWithRecords:(NSArray<NSData *> *)records
+{
+    if (self = [super init]) {
+        _records = [records copy];
+        _events = [NSMutableArray arrayWithCapacity:_records.count];
+        for (NSUInteger i = 0; i < _records.count; i++) {
+            [_events addObject:[NSNull null]];
+        }
+    }
+    return self;
+}
+
+- (NSUInteger)count
+{
+    return _records.count;
+}
+
+- (id)objectAtIndex:(NSUInteger)index
+{
+    // Observers may read the batch from any thread.
+    @synchronized(self) {
+        id event = _events[index];
+        if (event == [NSNull null]) {
+            event = [NSJSONSerialization JSONObjectWithData:_records[index] options:0 error:nil] ?: @{};
+            _events[index] = event;
+        }
+        return event;
+    }
+}
+
+@end
+
+
 @interface FPFreshpaintIntegration ()
 
-@property (nonatomic, strong) NSMutableArray *queue;
-@property (nonatomic, strong) NSURLSessionUploadTask *batchRequest;
+// Queued events, each frozen into its UTF-8 JSON encoding at enqueue time. Sequence numbers
+// follow the journal's, so acknowledging is a cursor move rather than a search for the events.
+@property (nonatomic, strong) FPEventQueue *queue;
+@property (nonatomic, strong) FPEventJournal *journal;
+// Batches covering the head of `queue`, oldest first. Failed batches stay until they are resent.
+@property (nonatomic, strong) NSMutableArray<FPInFlightBatch *> *inFlightBatches;
+// Events at the head of `queue` covered by `inFlightBatches`.
+@property (nonatomic, assign, readonly) NSUInteger inFlightCount;
+// Sequence number following the last in-flight batch, where the next batch starts.
+@property (nonatomic, assign, readonly) uint64_t inFlightEndSequence;
+// Batches with an upload currently running.
+@property (nonatomic, assign, readonly) NSUInteger sendingCount;
+@property (nonatomic, assign, readonly) NSUInteger maxInFlightBatches;
+@property (nonatomic, strong, readonly) id<FPTransportTask> batchRequest;
+// Set while uploads are chained back to back until the queue is empty.
+@property (nonatomic, assign) BOOL draining;
+@property (nonatomic, assign) NSUInteger drainDeliveredCount;
+@property (nonatomic, strong) NSMutableArray<void (^)(NSUInteger)> *drainCompletions;
+// Compresses the next batch as events arrive. Holds the events of `queue` numbered from
+// `builderStartSequence` up to `builderEndSequence`.
+@property (nonatomic, strong) FPGZIPBatchBuilder *batchBuilder;
+@property (nonatomic, assign) uint64_t builderStartSequence;
+@property (nonatomic, assign) uint64_t builderEndSequence;
+// Backs uploads off after failures and flushes again once the delay elapses.
+@property (nonatomic, strong) FPRetryScheduler *retryScheduler;
 @property (nonatomic, strong) FPReachability *reachability;
-@property (nonatomic, strong) NSTimer *flushTimer;
+// Flushes on the serial queue. Armed only while events are queued, see `rearmFlushTimer`.
+@property (nonatomic, strong) dispatch_source_t flushTimer;
+@property (nonatomic, assign) NSTimeInterval flushTimerInterval;
+// Set while a group commit of the journal is scheduled.
+@property (nonatomic, assign) BOOL commitScheduled;
+// Set while a compaction of the queue is scheduled.
+@property (nonatomic, assign) BOOL compactionScheduled;
 @property (nonatomic, strong) dispatch_queue_t serialQueue;
 @property (nonatomic, strong) dispatch_queue_t backgroundTaskQueue;
 @property (nonatomic, strong) NSDictionary *traits;
@@ -68,13 +180,37 @@ NSUInteger const kFPBackgroundTaskInvalid = 0;
         self.configuration = analytics.oneTimeConfiguration;
         self.httpClient = httpClient;
         self.httpClient.httpSessionDelegate = analytics.oneTimeConfiguration.httpSessionDelegate;
+        // One connection per batch in flight.
+        self.httpClient.maximumConnectionsPerHost = MAX(analytics.oneTimeConfiguration.maxInFlightBatches, 1u);
+        self.httpClient.usesCompressionDictionary = analytics.oneTimeConfiguration.shouldUseCompressionDictionary;
+#if TARGET_OS_IOS
+        self.httpClient.multipathServiceType = analytics.oneTimeConfiguration.multipathServiceType;
+#endif
         self.fileStorage = fileStorage;
         self.userDefaultsStorage = userDefaultsStorage;
         self.apiURL = [FRESHPAINT_API_BASE URLByAppendingPathComponent:@"import"];
+        self.batchBuilder = [[FPGZIPBatchBuilder alloc] init];
+        self.inFlightBatches = [NSMutableArray array];
+        self.drainCompletions = [NSMutableArray array];
         self.reachability = [FPReachability reachabilityWithHostname:@"google.com"];
         [self.reachability startNotifier];
         self.serialQueue = seg_dispatch_queue_create_specific("io.freshpaint.analytics.freshpaintio", DISPATCH_QUEUE_SERIAL);
         self.backgroundTaskQueue = seg_dispatch_queue_create_specific("io.freshpaint.analytics.backgroundTask", DISPATCH_QUEUE_SERIAL);
+        weakify(self);
+        self.retryScheduler = [[FPRetryScheduler alloc] initWithQueue:self.serialQueue retryHandler:^{
+            strongify(self);
+            [self flush];
+        }];
+        self.httpClient.backgroundUploadCompletionHandler = ^(NSString *fileName, BOOL retry, NSTimeInterval retryAfter) {
+            strongify(self);
+            [self dispatchBackground:^{
+                [self completeBackgroundUploadNamed:fileName retry:retry retryAfter:retryAfter];
+            }];
+        };
+        FPDeliveryMetrics *deliveryMetrics = analytics.deliveryMetrics;
+        self.httpClient.uploadMetricsHandler = ^(NSTimeInterval connectionSetupDuration, NSTimeInterval transferDuration, BOOL reusedConnection) {
+            [deliveryMetrics fp_recordUploadWithConnectionSetupDuration:connectionSetupDuration transferDuration:transferDuration reusedConnection:reusedConnection];
+        };
 #if TARGET_OS_IPHONE
         self.flushTaskID = UIBackgroundTaskInvalid;
 #else
@@ -85,7 +221,18 @@ NSUInteger const kFPBackgroundTaskInvalid = 0;
         [self loadUserId];
         [self loadTraits];
 
+        self.flushTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.serialQueue);
+        dispatch_source_set_event_handler(self.flushTimer, ^{
+            strongify(self);
+            [self flushTimerFired];
+        });
+        dispatch_resume(self.flushTimer);
+
         [self dispatchBackground:^{
+            // Opens the upload connection now, off the main thread, rather than on the first flush.
+            [self.httpClient prewarmSessionForWriteKey:self.configuration.writeKey];
+            [self restoreBackgroundUploads];
+            [self rearmFlushTimer];
             // Check for previous queue data in NSUserDefaults and remove if present.
             if ([[NSUserDefaults standardUserDefaults] objectForKey:FPQueueKey]) {
                 [[NSUserDefaults standardUserDefaults] removeObjectForKey:FPQueueKey];
@@ -97,19 +244,15 @@ NSUInteger const kFPBackgroundTaskInvalid = 0;
             }
 #endif
         }];
-
-        self.flushTimer = [NSTimer timerWithTimeInterval:self.configuration.flushInterval
-                                                  target:self
-                                                selector:@selector(flush)
-                                                userInfo:nil
-                                                 repeats:YES];
-        
-        [NSRunLoop.mainRunLoop addTimer:self.flushTimer
-                                forMode:NSDefaultRunLoopMode];        
     }
     return self;
 }
 
+- (void)dealloc
+{
+    dispatch_source_cancel(_flushTimer);
+}
+
 - (void)dispatchBackground:(void (^)(void))block
 {
     seg_dispatch_specific_async(_serialQueue, block);
@@ -130,6 +273,9 @@ NSUInteger const kFPBackgroundTaskInvalid = 0;
         if (application && [application respondsToSelector:@selector(seg_beginBackgroundTaskWithName:expirationHandler:)]) {
             self.flushTaskID = [application seg_beginBackgroundTaskWithName:@"Freshpaintio.Flush"
                                                           expirationHandler:^{
+                                                              [self dispatchBackground:^{
+                                                                  [self finishDrain];
+                                                              }];
                                                               [self endBackgroundTask];
                                                           }];
         }
@@ -358,17 +504,38 @@ NSUInteger const kFPBackgroundTaskInvalid = 0;
                 queuePayload = [tempPayload copy];
             }
         }
-        [self queuePayload:queuePayload];
+        // Serialize once; persistence and uploads only ever see these bytes from here on.
+        NSData *record = [self recordFromPayload:queuePayload];
+        if (record.length > kFPMaxBatchSize - kFPBatchEnvelopeReserve) {
+            record = [self recordFittingBatchFromPayload:queuePayload];
+        }
+        if (record != nil) {
+            [self queueRecord:record lane:[self laneForAction:queuePayload[@"type"] event:queuePayload[@"event"]]];
+        }
     }];
 }
 
-- (void)queuePayload:(NSDictionary *)payload
+- (void)queueRecord:(NSData *)record lane:(FPEventLane)lane
 {
     @try {
         // Trim the queue to maxQueueSize - 1 before we add a new element.
-        trimQueue(self.queue, self.analytics.oneTimeConfiguration.maxQueueSize - 1);
-        [self.queue addObject:payload];
-        [self persistQueue];
+        NSUInteger maxCount = self.analytics.oneTimeConfiguration.maxQueueSize - 1;
+        while (self.queue.count > maxCount) {
+            if (![self evictEventForOverflow]) {
+                // Every queued event is being uploaded; the queue shrinks back once the requests return.
+                break;
+            }
+        }
+        if (self.queue.span >= 2 * self.configuration.maxQueueSize) {
+            [self scheduleCompaction];
+        }
+        [self.queue pushRecord:record lane:lane];
+        [self.journal appendRecord:record flags:(uint8_t)lane];
+        [self commitJournal];
+        [self feedBatchBuilder];
+        if (self.flushTimerInterval == 0) {
+            [self rearmFlushTimer];
+        }
         [self flushQueueByLength];
     }
     @catch (NSException *exception) {
@@ -383,37 +550,127 @@ NSUInteger const kFPBackgroundTaskInvalid = 0;
 
 - (void)flushWithMaxSize:(NSUInteger)maxBatchSize
 {
-    void (^startBatch)(void) = ^{
-        NSArray *batch;
-        if ([self.queue count] >= maxBatchSize) {
-            batch = [self.queue subarrayWithRange:NSMakeRange(0, maxBatchSize)];
-        } else {
-            batch = [NSArray arrayWithArray:self.queue];
-        }
-        [self sendData:batch];
-    };
-    
     [self dispatchBackground:^{
         if ([self.queue count] == 0) {
             FPLog(@"%@ No queued API calls to flush.", self);
             [self endBackgroundTask];
             return;
         }
-        if (self.batchRequest != nil) {
-            FPLog(@"%@ API request already in progress, not flushing again.", self);
+        if (self.sendingCount >= self.maxInFlightBatches) {
+            FPLog(@"%@ %lu API requests already in progress, not flushing again.", self, (unsigned long)self.sendingCount);
+            return;
+        }
+        if (![self.retryScheduler canAttempt]) {
+            FPLog(@"%@ Backing off after failed uploads until %@, not flushing.", self, self.retryScheduler.nextAttemptDate);
+            return;
+        }
+        [self startBatchesWithMaxSize:maxBatchSize];
+    }];
+}
+
+// Fills the free upload slots: failed batches are resent first since they sit ahead of
+// everything else in the queue, then new batches are cut from the events that follow.
+- (void)startBatchesWithMaxSize:(NSUInteger)maxBatchSize
+{
+    for (FPInFlightBatch *batch in [self.inFlightBatches copy]) {
+        if (self.sendingCount >= self.maxInFlightBatches) {
+            return;
+        }
+        if (batch.sending || batch.delivered) {
+            continue;
+        }
+        if (batch.count == 0) {
+            // Every event of the batch was evicted while it waited to be resent.
+            batch.delivered = YES;
+            [self acknowledgeDeliveredBatches];
+            continue;
+        }
+        [self sendBatch:batch records:[self.queue recordsFromSequence:batch.firstSequence toSequence:batch.endSequence] body:nil];
+    }
+
+    while (self.sendingCount < self.maxInFlightBatches && self.inFlightCount < self.queue.count) {
+        NSArray<NSData *> *records = nil;
+        NSData *body = nil;
+        FPInFlightBatch *batch = [self cutBatchWithMaxSize:maxBatchSize records:&records body:&body];
+        [self sendBatch:batch records:records body:body];
+    }
+}
+
+// Registers a new batch made of the events following the in-flight ones.
+- (FPInFlightBatch *)cutBatchWithMaxSize:(NSUInteger)maxBatchSize records:(NSArray<NSData *> **)records body:(NSData **)body
+{
+    uint64_t start = self.inFlightEndSequence;
+    NSUInteger count = 0;
+    uint64_t end = [self batchEndFromSequence:start maxCount:maxBatchSize count:&count];
+    // The builder holds the events following the in-flight ones, so finish it before registering the batch.
+    *records = [self.queue recordsFromSequence:start toSequence:end];
+    // Compact bodies are encoded when the batch is sent, and bodies deflated with the dictionary by the HTTP client.
+    *body = [self usesBatchBuilder] ? [self batchBodyFromSequence:start toSequence:end records:*records] : nil;
+    FPInFlightBatch *batch = [[FPInFlightBatch alloc] init];
+    batch.firstSequence = start;
+    batch.endSequence = end;
+    batch.count = count;
+    [self.inFlightBatches addObject:batch];
+    return batch;
+}
+
+- (void)drainWithCompletion:(void (^)(NSUInteger))completion
+{
+    [self dispatchBackground:^{
+        if (completion) {
+            [self.drainCompletions addObject:[completion copy]];
+        }
+        // A second caller joins the drain already running.
+        if (self.draining) {
             return;
         }
-        // here
-        startBatch();
+        self.draining = YES;
+        self.drainDeliveredCount = 0;
+        [self continueDrain];
     }];
 }
 
+- (void)continueDrain
+{
+    if (!self.draining) {
+        return;
+    }
+    // Backing off ends the drain; the retry scheduler flushes again later.
+    if (self.queue.count == 0 || ![self.retryScheduler canAttempt]) {
+        [self finishDrain];
+        return;
+    }
+    if (self.sendingCount < self.maxInFlightBatches) {
+        [self startBatchesWithMaxSize:self.maxBatchSize];
+    }
+}
+
+- (void)finishDrain
+{
+    if (!self.draining) {
+        return;
+    }
+    FPLog(@"%@ Drained %lu events.", self, (unsigned long)self.drainDeliveredCount);
+    self.draining = NO;
+    NSUInteger delivered = self.drainDeliveredCount;
+    NSArray<void (^)(NSUInteger)> *completions = [self.drainCompletions copy];
+    [self.drainCompletions removeAllObjects];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        for (void (^completion)(NSUInteger) in completions) {
+            completion(delivered);
+        }
+    });
+    if (self.sendingCount == 0) {
+        [self endBackgroundTask];
+    }
+}
+
 - (void)flushQueueByLength
 {
     [self dispatchBackground:^{
         FPLog(@"%@ Length is %lu.", self, (unsigned long)self.queue.count);
 
-        if (self.batchRequest == nil && [self.queue count] >= self.configuration.flushAt) {
+        if (self.sendingCount < self.maxInFlightBatches && self.queue.count - self.inFlightCount >= self.configuration.flushAt) {
             [self flush];
         }
     }];
@@ -434,72 +691,775 @@ NSUInteger const kFPBackgroundTaskInvalid = 0;
     }];
 }
 
-- (void)notifyForName:(NSString *)name userInfo:(id)userInfo
+- (void)notifyForName:(NSString *)name records:(NSArray<NSData *> *)records
 {
+    NSArray *batch = [[FPDecodedBatch alloc] initWithRecords:records];
     dispatch_async(dispatch_get_main_queue(), ^{
-        [[NSNotificationCenter defaultCenter] postNotificationName:name object:userInfo];
+        [[NSNotificationCenter defaultCenter] postNotificationName:name object:batch];
         FPLog(@"sent notification %@", name);
     });
 }
 
-- (void)sendData:(NSArray *)batch
+- (void)sendBatch:(FPInFlightBatch *)batch records:(NSArray<NSData *> *)records body:(NSData *)body
 {
-    NSMutableDictionary *payload = [[NSMutableDictionary alloc] init];
-    [payload setObject:iso8601FormattedString([NSDate date]) forKey:@"sentAt"];
-    [payload setObject:batch forKey:@"batch"];
+    BOOL compact = NO;
+    BOOL dictionary = [self usesCompressionDictionary];
+    if (body == nil && [self usesCompactEncoding]) {
+        body = [FPCompactBatchCodec encodeRecords:records sentAt:iso8601FormattedString([NSDate date])];
+        compact = body != nil;
+    }
+    if (body == nil) {
+        body = [[self class] batchBodyWithRecords:records sentAt:iso8601FormattedString([NSDate date])];
+    }
 
-    FPLog(@"%@ Flushing %lu of %lu queued API calls.", self, (unsigned long)batch.count, (unsigned long)self.queue.count);
-    FPLog(@"Flushing batch %@.", payload);
+    FPLog(@"%@ Flushing %lu of %lu queued API calls.", self, (unsigned long)records.count, (unsigned long)self.queue.count);
 
-    self.batchRequest = [self.httpClient upload:payload forWriteKey:self.configuration.writeKey completionHandler:^(BOOL retry) {
-        void (^completion)(void) = ^{
-            if (retry) {
-                [self notifyForName:FPFreshpaintRequestDidFailNotification userInfo:batch];
-                self.batchRequest = nil;
-                [self endBackgroundTask];
+    batch.sending = YES;
+    batch.startFailureCount = self.retryScheduler.failureCount;
+    void (^completionHandler)(BOOL, NSTimeInterval) = ^(BOOL retry, NSTimeInterval retryAfter) {
+        [self dispatchBackground:^{
+            if (retry && ((compact && self.httpClient.compactEncodingRejected) || (dictionary && self.httpClient.compressionDictionaryRejected))) {
+                // Not a failed upload: the same events go out again right away, as JSON or gzipped.
+                batch.sending = NO;
+                batch.task = nil;
+                [self sendBatch:batch records:records body:nil];
                 return;
             }
+            [self completeBatch:batch records:records retry:retry retryAfter:retryAfter];
+        }];
+    };
+    if (compact) {
+        batch.task = [self.httpClient uploadCompactData:body forWriteKey:self.configuration.writeKey completionHandler:completionHandler];
+    } else {
+        batch.task = [self.httpClient uploadData:body forWriteKey:self.configuration.writeKey completionHandler:completionHandler];
+    }
 
-            [self.queue removeObjectsInArray:batch];
-            [self persistQueue];
-            [self notifyForName:FPFreshpaintRequestDidSucceedNotification userInfo:batch];
-            self.batchRequest = nil;
-            [self endBackgroundTask];
-        };
-        
-        [self dispatchBackground:completion];
+    [self notifyForName:FPFreshpaintDidSendRequest records:records];
+}
+
+- (void)completeBatch:(FPInFlightBatch *)batch records:(NSArray<NSData *> *)records retry:(BOOL)retry retryAfter:(NSTimeInterval)retryAfter
+{
+    batch.sending = NO;
+    batch.task = nil;
+    if (retry) {
+        // The batch keeps its place at the head of the queue and is resent once the backoff elapses.
+        NSTimeInterval delay = [self.retryScheduler recordFailureWithRetryAfter:retryAfter startFailureCount:batch.startFailureCount];
+        FPLog(@"%@ Upload failed, retrying in %.1fs.", self, delay);
+        [self.analytics.deliveryMetrics fp_recordUploadFailedWithConsecutiveFailures:self.retryScheduler.consecutiveFailures
+                                                                circuitBreakerOpen:self.retryScheduler.breakerOpen
+                                                                   nextAttemptDate:self.retryScheduler.nextAttemptDate];
+        [self notifyForName:FPFreshpaintRequestDidFailNotification records:records];
+        [self finishDrain];
+    } else {
+        [self.retryScheduler recordSuccess];
+        [self.analytics.deliveryMetrics fp_recordUploadSucceeded];
+        batch.delivered = YES;
+        self.drainDeliveredCount += batch.count;
+        [self acknowledgeDeliveredBatches];
+        [self notifyForName:FPFreshpaintRequestDidSucceedNotification records:records];
+        [self continueDrain];
+    }
+    if (self.sendingCount == 0 && !self.draining) {
+        [self endBackgroundTask];
+    }
+}
+
+#pragma mark - Background uploads
+
+// Hands every batch not already uploading to the background session, which carries on once the app is suspended.
+// Batches go out all at once rather than `maxInFlightBatches` at a time: the system schedules them.
+- (void)startBackgroundUploads
+{
+    if (![self.retryScheduler canAttempt]) {
+        FPLog(@"%@ Backing off after failed uploads until %@, not uploading in the background.", self, self.retryScheduler.nextAttemptDate);
+        return;
+    }
+    for (FPInFlightBatch *batch in [self.inFlightBatches copy]) {
+        if (batch.sending || batch.delivered || batch.count == 0) {
+            continue;
+        }
+        NSArray<NSData *> *records = [self.queue recordsFromSequence:batch.firstSequence toSequence:batch.endSequence];
+        [self uploadBatchInBackground:batch records:records body:[[self class] batchBodyWithRecords:records sentAt:iso8601FormattedString([NSDate date])]];
+    }
+    while (self.inFlightCount < self.queue.count) {
+        NSArray<NSData *> *records = nil;
+        NSData *body = nil;
+        FPInFlightBatch *batch = [self cutBatchWithMaxSize:self.maxBatchSize records:&records body:&body];
+        if (body == nil) {
+            body = [[self class] batchBodyWithRecords:records sentAt:iso8601FormattedString([NSDate date])];
+        }
+        [self uploadBatchInBackground:batch records:records body:body];
+    }
+}
+
+- (void)uploadBatchInBackground:(FPInFlightBatch *)batch records:(NSArray<NSData *> *)records body:(NSData *)body
+{
+    NSString *fileName = [NSString stringWithFormat:@"%020llu-%020llu.batch", batch.firstSequence, batch.endSequence];
+    NSURL *folderURL = self.backgroundUploadsURL;
+    NSURL *fileURL = [folderURL URLByAppendingPathComponent:fileName];
+    NSDataWritingOptions options = NSDataWritingAtomic;
+#if TARGET_OS_IPHONE
+    // The device may lock before the system gets to the upload.
+    options |= NSDataWritingFileProtectionCompleteUntilFirstUserAuthentication;
+#endif
+    NSError *error = nil;
+    [[NSFileManager defaultManager] createDirectoryAtURL:folderURL withIntermediateDirectories:YES attributes:nil error:nil];
+    if (![[body seg_gzippedData] writeToURL:fileURL options:options error:&error]) {
+        FPLog(@"%@ Unable to write batch for background upload, uploading it now: %@", self, error);
+        [self sendBatch:batch records:records body:body];
+        return;
+    }
+
+    FPLog(@"%@ Uploading %lu queued API calls in the background.", self, (unsigned long)records.count);
+    batch.sending = YES;
+    batch.startFailureCount = self.retryScheduler.failureCount;
+    batch.uploadFileName = fileName;
+    batch.task = [self.httpClient uploadFile:fileURL forWriteKey:self.configuration.writeKey];
+    [self notifyForName:FPFreshpaintDidSendRequest records:records];
+}
+
+- (void)completeBackgroundUploadNamed:(NSString *)fileName retry:(BOOL)retry retryAfter:(NSTimeInterval)retryAfter
+{
+    [[NSFileManager defaultManager] removeItemAtURL:[self.backgroundUploadsURL URLByAppendingPathComponent:fileName] error:nil];
+    for (FPInFlightBatch *batch in self.inFlightBatches) {
+        if (batch.sending && [batch.uploadFileName isEqualToString:fileName]) {
+            batch.uploadFileName = nil;
+            [self completeBatch:batch
+                        records:[self.queue recordsFromSequence:batch.firstSequence toSequence:batch.endSequence]
+                          retry:retry
+                     retryAfter:retryAfter];
+            return;
+        }
+    }
+    // The batch was given up on and its events are queued for another upload.
+    FPLog(@"%@ Background upload %@ finished after its batch was released.", self, fileName);
+}
+
+// Background uploads started before the app was last suspended keep their batches in flight until they report back,
+// so their events are not sent twice meanwhile. Batches are contiguous from the head of the queue, and sequence
+// numbers survive relaunches, so a file still lines up with the queue unless its events were acknowledged since.
+- (void)restoreBackgroundUploads
+{
+    NSArray<NSURL *> *files = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:self.backgroundUploadsURL
+                                                            includingPropertiesForKeys:nil
+                                                                               options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                                 error:nil];
+    if (files.count == 0) {
+        return;
+    }
+    files = [files sortedArrayUsingComparator:^NSComparisonResult(NSURL *a, NSURL *b) {
+        return [a.lastPathComponent compare:b.lastPathComponent];
+    }];
+    for (NSURL *url in files) {
+        unsigned long long first = 0;
+        unsigned long long end = 0;
+        BOOL parsed = sscanf(url.lastPathComponent.UTF8String, "%llu-%llu.batch", &first, &end) == 2;
+        if (!parsed || first != self.inFlightEndSequence || end <= first || end > self.queue.endSequence) {
+            [[NSFileManager defaultManager] removeItemAtURL:url error:nil];
+            continue;
+        }
+        FPInFlightBatch *batch = [[FPInFlightBatch alloc] init];
+        batch.firstSequence = first;
+        batch.endSequence = end;
+        batch.count = [self.queue countFromSequence:first toSequence:end];
+        batch.sending = YES;
+        batch.uploadFileName = url.lastPathComponent;
+        [self.inFlightBatches addObject:batch];
+    }
+    if (self.inFlightBatches.count == 0) {
+        return;
+    }
+
+    FPLog(@"%@ Waiting on %lu background uploads from the last launch.", self, (unsigned long)self.inFlightBatches.count);
+    [self.httpClient getBackgroundUploadsForWriteKey:self.configuration.writeKey completionHandler:^(NSSet<NSString *> *fileNames) {
+        [self dispatchBackground:^{
+            for (FPInFlightBatch *batch in self.inFlightBatches) {
+                if (batch.uploadFileName != nil && batch.task == nil && ![fileNames containsObject:batch.uploadFileName]) {
+                    // The session no longer knows about the upload; the batch is sent again like a failed one.
+                    [[NSFileManager defaultManager] removeItemAtURL:[self.backgroundUploadsURL URLByAppendingPathComponent:batch.uploadFileName] error:nil];
+                    batch.uploadFileName = nil;
+                    batch.sending = NO;
+                }
+            }
+        }];
+    }];
+}
+
+// Removes delivered batches from the head of the queue. A batch answered ahead of an older one
+// waits for it, so the journal cursor only ever moves over a contiguous delivered prefix.
+- (void)acknowledgeDeliveredBatches
+{
+    while (self.inFlightBatches.firstObject.delivered) {
+        [self acknowledgeEventsBeforeSequence:self.inFlightBatches.firstObject.endSequence];
+    }
+}
+
+// Drops every event numbered below `sequence` from the head of the queue, along with the batches
+// that no longer cover any event, and advances the journal cursor past them. A batch being uploaded
+// stays until its request returns, and so do its events.
+- (void)acknowledgeEventsBeforeSequence:(uint64_t)sequence
+{
+    for (FPInFlightBatch *batch in self.inFlightBatches) {
+        if (batch.sending) {
+            sequence = MIN(sequence, batch.firstSequence);
+            break;
+        }
+    }
+    uint64_t head = self.queue.headSequence;
+    if (sequence <= head) {
+        return;
+    }
+    [self.queue removeEventsBeforeSequence:sequence];
+    while (self.inFlightBatches.count > 0 && self.inFlightBatches.firstObject.endSequence <= self.queue.headSequence) {
+        [self.inFlightBatches removeObjectAtIndex:0];
+    }
+    [self.journal acknowledgeRecords:(NSUInteger)(self.queue.headSequence - head)];
+    if (self.queue.count == 0) {
+        [self rearmFlushTimer];
+    }
+}
+
+// Makes room for one event. The lowest lane goes first, so identify, alias, group and critical track events
+// outlive bursts of ordinary ones. Within a lane, the oldest event not yet in a batch goes first, then the oldest
+// of the batches waiting to be resent. Events of batches being uploaded or already delivered are never evicted:
+// they are on their way. An evicted event leaves a hole in the queue and is marked removed in the journal, so
+// that it stays a hole after a relaunch, until the head moves past it. Returns NO when nothing can be evicted.
+- (BOOL)evictEventForOverflow
+{
+    FPEventLane lane = FPEventLaneStandard;
+    uint64_t sequence = 0;
+    while (![self evictUnsentEventInLane:lane sequence:&sequence]) {
+        if (++lane == FPEventLaneCount) {
+            return NO;
+        }
+    }
+
+    for (FPInFlightBatch *batch in self.inFlightBatches) {
+        if (sequence >= batch.firstSequence && sequence < batch.endSequence) {
+            batch.count -= 1;
+            break;
+        }
+    }
+    if (sequence >= self.builderStartSequence && sequence < self.builderEndSequence) {
+        // The builder already compressed the evicted event.
+        [self.batchBuilder reset];
+        self.builderEndSequence = self.builderStartSequence;
+    }
+    [self.analytics.deliveryMetrics fp_recordQueueOverflowEventsDropped:1];
+    if (lane == FPEventLaneCritical) {
+        [self.analytics.deliveryMetrics fp_recordQueueOverflowCriticalEventsDropped:1];
+    }
+    // Holes at the head are released right away; the others have to outlive a relaunch.
+    if (self.queue.firstLiveSequence < sequence) {
+        [self.journal removeRecordAtSequence:sequence];
+    }
+    [self acknowledgeEventsBeforeSequence:self.queue.firstLiveSequence];
+    return YES;
+}
+
+// Evicts the oldest event of `lane` not yet in a batch, or else the oldest of the batches waiting to be resent.
+- (BOOL)evictUnsentEventInLane:(FPEventLane)lane sequence:(uint64_t *)sequence
+{
+    if ([self.queue evictEventInLane:lane fromSequence:self.inFlightEndSequence toSequence:self.queue.endSequence sequence:sequence]) {
+        return YES;
+    }
+    for (FPInFlightBatch *batch in self.inFlightBatches) {
+        if (!batch.sending && !batch.delivered && [self.queue evictEventInLane:lane fromSequence:batch.firstSequence toSequence:batch.endSequence sequence:sequence]) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+// Compacts the queue shortly after the enqueue that found it full of holes, rather than during that enqueue.
+- (void)scheduleCompaction
+{
+    if (self.compactionScheduled) {
+        return;
+    }
+    self.compactionScheduled = YES;
+    weakify(self);
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kFPCompactionDelay * NSEC_PER_SEC)), self.serialQueue, ^{
+        strongify(self);
+        self.compactionScheduled = NO;
+        // Uploads read their events by sequence number, so the queue is only rewritten while none is running.
+        if (self.queue.span >= 2 * self.configuration.maxQueueSize && self.sendingCount == 0) {
+            [self compactQueue];
+        }
+    }];
+}
+
+// Rewrites the live events at the end of the journal so the holes left by evictions are reclaimed. Holes pile
+// up behind a critical event pinning the head of the queue, e.g. an identify that outlived a storm of track
+// events while offline. Runs once holes make up half the queue, so its cost is spread over as many evictions.
+- (void)compactQueue
+{
+    FPEventQueue *queue = self.queue;
+    FPLog(@"%@ Compacting %lu queued events spread over %lu.", self, (unsigned long)queue.count, (unsigned long)queue.span);
+    // Append before acknowledging: a crash in between delivers some events twice rather than losing them.
+    NSMutableArray<NSData *> *records = [NSMutableArray arrayWithCapacity:queue.count];
+    NSMutableArray<NSNumber *> *lanes = [NSMutableArray arrayWithCapacity:queue.count];
+    NSMutableArray<NSNumber *> *sequences = [NSMutableArray arrayWithCapacity:queue.count];
+    [queue enumerateRecordsUsingBlock:^(NSData *record, FPEventLane lane, uint64_t sequence) {
+        [records addObject:record];
+        [lanes addObject:@(lane)];
+        [sequences addObject:@(sequence)];
+        [self.journal appendRecord:record flags:(uint8_t)lane];
     }];
+    [self.journal synchronize];
+    [self.journal acknowledgeRecords:queue.span];
+
+    FPEventQueue *compacted = [self emptyQueue];
+    [records enumerateObjectsUsingBlock:^(NSData *record, NSUInteger idx, BOOL *stop) {
+        [compacted pushRecord:record lane:lanes[idx].unsignedIntegerValue];
+    }];
+    self.queue = compacted;
+
+    // Nothing is being sent. Batches keep their events: failed ones are resent as they were, and delivered ones
+    // still wait for the failed ones ahead of them rather than having their events cut into a new batch.
+    NSUInteger position = 0;
+    for (FPInFlightBatch *batch in [self.inFlightBatches copy]) {
+        uint64_t first = compacted.headSequence + position;
+        while (position < sequences.count && sequences[position].unsignedLongLongValue < batch.endSequence) {
+            position++;
+        }
+        uint64_t end = compacted.headSequence + position;
+        if (end == first) {
+            // Every event of the batch was evicted.
+            [self.inFlightBatches removeObject:batch];
+            continue;
+        }
+        batch.firstSequence = first;
+        batch.endSequence = end;
+        batch.count = (NSUInteger)(end - first);
+    }
+    [self acknowledgeDeliveredBatches];
+    [self.batchBuilder reset];
+    self.builderStartSequence = self.inFlightEndSequence;
+    self.builderEndSequence = self.inFlightEndSequence;
+    [self feedBatchBuilder];
+}
+
+- (NSUInteger)inFlightCount
+{
+    NSUInteger count = 0;
+    for (FPInFlightBatch *batch in self.inFlightBatches) {
+        count += batch.count;
+    }
+    return count;
+}
+
+// Batches are contiguous from the head of the queue, so the next one starts where the last one ends.
+- (uint64_t)inFlightEndSequence
+{
+    return MAX(self.inFlightBatches.lastObject.endSequence, self.queue.headSequence);
+}
+
+- (NSUInteger)sendingCount
+{
+    NSUInteger count = 0;
+    for (FPInFlightBatch *batch in self.inFlightBatches) {
+        count += batch.sending ? 1 : 0;
+    }
+    return count;
+}
+
+// While uploads are failing, a single batch probes the server instead of a whole wave.
+- (NSUInteger)maxInFlightBatches
+{
+    if (self.retryScheduler.consecutiveFailures > 0) {
+        return 1;
+    }
+    return MAX(self.configuration.maxInFlightBatches, 1u);
+}
+
+// The oldest request still running; kept for callers that expect a single upload.
+- (id<FPTransportTask>)batchRequest
+{
+    for (FPInFlightBatch *batch in self.inFlightBatches) {
+        if (batch.task != nil) {
+            return batch.task;
+        }
+    }
+    return nil;
+}
+
+#pragma mark - Flush timer
+
+- (void)flushTimerFired
+{
+    self.flushTimerInterval = 0;
+    [self flush];
+    [self rearmFlushTimer];
+}
+
+// Schedules the next tick of the flush timer, or parks it while the queue is empty so an idle app is not woken up.
+// Re-armed on enqueue. A parked dispatch timer costs nothing, and unlike a suspended one it can be released as is.
+- (void)rearmFlushTimer
+{
+    NSTimeInterval interval = self.queue.count > 0 ? [self nextFlushInterval] : 0;
+    if (interval == self.flushTimerInterval) {
+        return;
+    }
+    self.flushTimerInterval = interval;
+    if (interval == 0) {
+        dispatch_source_set_timer(self.flushTimer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        return;
+    }
+    // Generous leeway lets the system fire it together with other wakeups.
+    uint64_t leeway = (uint64_t)(MAX(interval / 4, 1) * NSEC_PER_SEC);
+    dispatch_source_set_timer(self.flushTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(interval * NSEC_PER_SEC)), DISPATCH_TIME_FOREVER, leeway);
+}
+
+// `flushInterval`, shortened down to half as the events not yet in flight approach `flushAt`, and doubled for every
+// upload failure in a row, up to 32 times; the retry scheduler takes care of the retries themselves.
+- (NSTimeInterval)nextFlushInterval
+{
+    FPAnalyticsConfiguration *configuration = self.configuration;
+    if (configuration.flushInterval <= 0) {
+        return 0;
+    }
+    NSTimeInterval interval = configuration.flushInterval;
+    if (configuration.flushAt > 0) {
+        double fill = MIN((double)(self.queue.count - MIN(self.inFlightCount, self.queue.count)) / configuration.flushAt, 1.0);
+        interval *= 1 - fill / 2;
+    }
+    interval *= pow(2, MIN(self.retryScheduler.consecutiveFailures, 5u));
+    NSTimeInterval minInterval = MAX(configuration.minFlushInterval, 0.001);
+    return MIN(MAX(interval, minInterval), MAX(configuration.maxFlushInterval, minInterval));
+}
 
-    [self notifyForName:FPFreshpaintDidSendRequest userInfo:batch];
+- (void)applicationWillEnterForeground
+{
+    // The system closes idle connections while the app is suspended.
+    [self dispatchBackground:^{
+        [self.httpClient prewarmSessionForWriteKey:self.configuration.writeKey];
+    }];
 }
 
 - (void)applicationDidEnterBackground
 {
     [self beginBackgroundTask];
+    [self dispatchBackground:^{
+        [self.journal synchronize];
+    }];
+    // A background session cannot go through a custom transport.
+    if (self.configuration.shouldUseBackgroundUploads && self.httpClient.transport == nil) {
+        // Only the files need writing while the app runs; the system uploads them.
+        [self dispatchBackground:^{
+            [self startBackgroundUploads];
+            [self endBackgroundTask];
+        }];
+        return;
+    }
     // We are gonna try to flush as much as we reasonably can when we enter background
     // since there is a chance that the user will never launch the app again.
-    [self flush];
+    [self drainWithCompletion:nil];
 }
 
 - (void)applicationWillTerminate
 {
     [self dispatchBackgroundAndWait:^{
-        if (self.queue.count)
-            [self persistQueue];
+        [self.journal synchronize];
     }];
 }
 
+#pragma mark - Durability
+
+// Persists the events just appended to the journal as `durabilityMode` asks.
+- (void)commitJournal
+{
+    switch (self.configuration.durabilityMode) {
+        case FPDurabilityModePerEvent:
+            [self.journal synchronize];
+            break;
+        case FPDurabilityModeGroupCommit: {
+            if (self.commitScheduled) {
+                break;
+            }
+            self.commitScheduled = YES;
+            NSTimeInterval window = MAX(self.configuration.groupCommitInterval, 0);
+            weakify(self);
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(window * NSEC_PER_SEC)), self.serialQueue, ^{
+                strongify(self);
+                self.commitScheduled = NO;
+                [self.journal synchronize];
+            });
+            break;
+        }
+        case FPDurabilityModeMemoryOnly:
+            break;
+    }
+}
+
 #pragma mark - Private
 
-- (NSMutableArray *)queue
+// Whether batches go out in the compact encoding rather than as JSON.
+- (BOOL)usesCompactEncoding
+{
+    return self.configuration.shouldUseCompactEncoding && !self.httpClient.compactEncodingRejected;
+}
+
+// Whether the HTTP client deflates batches with the preset dictionary rather than gzipping them.
+- (BOOL)usesCompressionDictionary
+{
+    return self.httpClient.usesCompressionDictionary && !self.httpClient.compressionDictionaryRejected;
+}
+
+// Whether batch bodies are gzipped by the batch builder as events are enqueued.
+- (BOOL)usesBatchBuilder
+{
+    return ![self usesCompactEncoding] && ![self usesCompressionDictionary];
+}
+
+// Pushes queued events past the in-flight batch into the batch builder, up to one batch worth.
+- (void)feedBatchBuilder
+{
+    if (![self usesBatchBuilder]) {
+        return;
+    }
+    uint64_t start = self.inFlightEndSequence;
+    if ([self.queue isRecordPagedOutAtSequence:start]) {
+        // Events restored at launch are read when their batch is cut, not on the enqueue path.
+        return;
+    }
+    [self syncBatchBuilderFromSequence:start toSequence:[self batchEndFromSequence:start maxCount:self.maxBatchSize count:NULL]];
+}
+
+// Makes the builder hold exactly the events numbered from `start` to `end`, compressing only the ones it is missing.
+- (void)syncBatchBuilderFromSequence:(uint64_t)start toSequence:(uint64_t)end
+{
+    if (self.builderStartSequence != start || self.builderEndSequence > end) {
+        [self.batchBuilder reset];
+        self.builderStartSequence = start;
+        self.builderEndSequence = start;
+    }
+    for (uint64_t sequence = self.builderEndSequence; sequence < end; sequence++) {
+        NSData *record = [self.queue recordAtSequence:sequence];
+        if (record != nil) {
+            [self.batchBuilder appendRecord:record];
+        }
+    }
+    self.builderEndSequence = end;
+}
+
+// End of the batch starting at `start`: as many queued events as fit in one batch, both by count and
+// by serialized size. `count` receives the number of events, which skips the evicted ones.
+- (uint64_t)batchEndFromSequence:(uint64_t)start maxCount:(NSUInteger)maxCount count:(NSUInteger *)count
+{
+    NSUInteger length = kFPBatchEnvelopeReserve;
+    NSUInteger taken = 0;
+    uint64_t end = MAX(start, self.queue.headSequence);
+    while (taken < maxCount && end < self.queue.endSequence) {
+        NSData *record = [self.queue recordAtSequence:end];
+        if (record != nil) {
+            // One byte for the separating comma.
+            NSUInteger recordLength = record.length + 1;
+            // Always take at least one event so an oversized one left over by older versions cannot stall the queue.
+            if (taken > 0 && length + recordLength > kFPMaxBatchSize) {
+                break;
+            }
+            length += recordLength;
+            taken++;
+        }
+        end++;
+    }
+    if (count) {
+        *count = taken;
+    }
+    return end;
+}
+
+// Returns the gzipped body for `records`, the events numbered from `start` to `end`, finishing the
+// stream the batch builder has been compressing as they were enqueued.
+- (NSData *)batchBodyFromSequence:(uint64_t)start toSequence:(uint64_t)end records:(NSArray<NSData *> *)records
+{
+    NSString *sentAt = iso8601FormattedString([NSDate date]);
+    [self syncBatchBuilderFromSequence:start toSequence:end];
+    NSData *body = [self.batchBuilder finishWithSentAt:sentAt];
+    // The builder is empty again and picks up from the end of this batch.
+    self.builderStartSequence = end;
+    self.builderEndSequence = end;
+    if (body == nil) {
+        // Compression failed; the HTTP client gzips plain bodies itself.
+        body = [[self class] batchBodyWithRecords:records sentAt:sentAt];
+    }
+    return body;
+}
+
+// Splices already serialized events into a batch body without decoding or re-encoding them.
++ (NSData *)batchBodyWithRecords:(NSArray<NSData *> *)records sentAt:(NSString *)sentAt
+{
+    static const char kBatchPrefix[] = "{\"batch\":[";
+    NSData *suffix = [[NSString stringWithFormat:@"],\"sentAt\":\"%@\"}", sentAt] dataUsingEncoding:NSUTF8StringEncoding];
+
+    NSUInteger length = strlen(kBatchPrefix) + suffix.length + records.count;
+    for (NSData *record in records) {
+        length += record.length;
+    }
+    NSMutableData *body = [NSMutableData dataWithCapacity:length];
+    [body appendBytes:kBatchPrefix length:strlen(kBatchPrefix)];
+    [records enumerateObjectsUsingBlock:^(NSData *record, NSUInteger idx, BOOL *stop) {
+        if (idx > 0) {
+            [body appendBytes:"," length:1];
+        }
+        [body appendData:record];
+    }];
+    [body appendData:suffix];
+    return body;
+}
+
+- (FPEventQueue *)queue
 {
     if (!_queue) {
-        _queue = [[self.fileStorage arrayForKey:kFPQueueFilename] ?: @[] mutableCopy];
+        // Only the journal index is read here; event bodies are paged in as batches are cut.
+        _queue = [self emptyQueue];
+        uint64_t end = self.journal.firstSequence + self.journal.count;
+        for (uint64_t sequence = self.journal.firstSequence; sequence < end; sequence++) {
+            if ([self.journal isRecordRemovedAtSequence:sequence]) {
+                // Evicted on overflow during an earlier launch.
+                [_queue pushHole];
+                continue;
+            }
+            uint8_t flags = FPEventLaneStandard;
+            [self.journal getFlags:&flags ofRecordAtSequence:sequence];
+            [_queue pushPagedOutRecordInLane:flags];
+        }
+        _builderStartSequence = _queue.headSequence;
+        _builderEndSequence = _queue.headSequence;
+        [self migrateLegacyQueue];
     }
 
     return _queue;
 }
 
+- (FPEventQueue *)emptyQueue
+{
+    FPEventQueue *queue = [[FPEventQueue alloc] initWithFirstSequence:self.journal.firstSequence capacity:2 * self.configuration.maxQueueSize];
+    weakify(self);
+    queue.recordLoader = ^NSData *(uint64_t sequence) {
+        strongify(self);
+        return [self.journal recordAtSequence:sequence];
+    };
+    return queue;
+}
+
+- (FPEventJournal *)journal
+{
+    if (!_journal) {
+        _journal = [[FPEventJournal alloc] initWithFolder:[self storageURLForKey:kFPQueueJournalFilename] crypto:self.fileStorage.crypto];
+        // Per event durability writes through; the other modes gather events and commit them together.
+        _journal.buffersWrites = self.configuration.durabilityMode != FPDurabilityModePerEvent;
+    }
+    return _journal;
+}
+
+- (NSURL *)backgroundUploadsURL
+{
+    return [self storageURLForKey:kFPBackgroundUploadsFilename];
+}
+
+// Location of a file or folder kept next to the ones of `fileStorage`.
+- (NSURL *)storageURLForKey:(NSString *)key
+{
+    if ([self.fileStorage isKindOfClass:[FPFileStorage class]]) {
+        return [(FPFileStorage *)self.fileStorage urlForKey:key];
+    }
+#if TARGET_OS_TV
+    return [[FPFileStorage cachesDirectoryURL] URLByAppendingPathComponent:key];
+#else
+    return [[FPFileStorage applicationSupportDirectoryURL] URLByAppendingPathComponent:key];
+#endif
+}
+
+// Moves events persisted by older versions as a single plist/JSON array into the journal.
+- (void)migrateLegacyQueue
+{
+    NSArray *legacyQueue = [self.fileStorage arrayForKey:kFPQueueFilename];
+    if (legacyQueue == nil) {
+        return;
+    }
+    FPLog(@"%@ Migrating %lu queued events to the event journal.", self, (unsigned long)legacyQueue.count);
+    for (id payload in legacyQueue) {
+        NSData *record = [payload isKindOfClass:[NSDictionary class]] ? [self recordFromPayload:payload] : nil;
+        FPEventLane lane = [self laneForAction:payload[@"type"] event:payload[@"event"]];
+        if (record != nil && [self.journal appendRecord:record flags:(uint8_t)lane]) {
+            [_queue pushRecord:record lane:lane];
+        }
+    }
+    [self.journal synchronize];
+    [self.fileStorage removeKey:kFPQueueFilename];
+}
+
+- (NSData *)recordFromPayload:(NSDictionary *)payload
+{
+    NSError *error = nil;
+    NSData *record = nil;
+    @try {
+        record = [NSJSONSerialization dataWithJSONObject:payload options:0 error:&error];
+    } @catch (NSException *exception) {
+        FPLog(@"%@ Unable to serialize payload, dropping it: %@", self, exception);
+        return nil;
+    }
+    if (error) {
+        FPLog(@"%@ Unable to serialize payload, dropping it: %@", self, error);
+    }
+    return record;
+}
+
+- (FPEventLane)laneForAction:(NSString *)action event:(id)event
+{
+    if ([action isEqualToString:@"identify"] || [action isEqualToString:@"alias"] || [action isEqualToString:@"group"]) {
+        return FPEventLaneCritical;
+    }
+    if ([action isEqualToString:@"track"] && [event isKindOfClass:[NSString class]] && [self.configuration.criticalTrackEvents containsObject:event]) {
+        return FPEventLaneCritical;
+    }
+    return FPEventLaneStandard;
+}
+
+// Applies the oversized event policy to an event whose encoding cannot fit in a batch.
+- (NSData *)recordFittingBatchFromPayload:(NSDictionary *)payload
+{
+    NSUInteger maxLength = kFPMaxBatchSize - kFPBatchEnvelopeReserve;
+    if (self.configuration.oversizedEventPolicy == FPOversizedEventPolicyTruncate) {
+        NSMutableDictionary *truncated = [payload mutableCopy];
+        NSUInteger length = [self recordFromPayload:truncated].length;
+        for (NSString *section in @[ @"properties", @"traits", @"context" ]) {
+            if (![truncated[section] isKindOfClass:[NSDictionary class]]) {
+                continue;
+            }
+            NSMutableDictionary *values = [truncated[section] mutableCopy];
+            truncated[section] = values;
+            // Bytes each member takes in the encoding, its separating comma included.
+            NSMutableDictionary<NSString *, NSNumber *> *sizes = [NSMutableDictionary dictionaryWithCapacity:values.count];
+            for (NSString *key in values) {
+                NSUInteger memberLength = [self recordFromPayload:@{ key : values[key] }].length;
+                sizes[key] = @(memberLength > 0 ? memberLength - 1 : 0);
+            }
+            // Remove the largest values first; they are the ones pushing the event over the limit. The event is
+            // only encoded again once the sizes of the members removed so far bring it under the limit.
+            for (NSString *key in [sizes keysSortedByValueUsingSelector:@selector(compare:)].reverseObjectEnumerator) {
+                [values removeObjectForKey:key];
+                length -= MIN(sizes[key].unsignedIntegerValue, length);
+                if (length > maxLength) {
+                    continue;
+                }
+                NSData *record = [self recordFromPayload:truncated];
+                length = record.length;
+                if (record.length <= maxLength) {
+                    FPLog(@"%@ Truncated oversized %@ event to %lu bytes.", self, payload[@"type"], (unsigned long)record.length);
+                    [self.analytics.deliveryMetrics fp_recordOversizedEventsTruncated:1];
+                    return record;
+                }
+            }
+        }
+    }
+    FPLog(@"%@ Dropping %@ event larger than the %luKB batch limit.", self, payload[@"type"], (unsigned long)(kFPMaxBatchSize / 1000));
+    [self.analytics.deliveryMetrics fp_recordOversizedEventsDropped:1];
+    return nil;
+}
+
 - (void)loadTraits
 {
     if (![FPState sharedInstance].userInfo.traits) {
@@ -529,9 +1489,4 @@ NSUInteger const kFPBackgroundTaskInvalid = 0;
     [FPState sharedInstance].userInfo.userId = result;
 }
 
-- (void)persistQueue
-{
-    [self.fileStorage setArray:[self.queue copy] forKey:kFPQueueFilename];
-}
-
 @end
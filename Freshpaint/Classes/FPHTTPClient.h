@@ -1,5 +1,6 @@
 #import <Foundation/Foundation.h>
 #import "FPAnalytics.h"
+#import "FPTransport.h"
 
 // TODO: Make this configurable via FPAnalyticsConfiguration
 // NOTE: `/` at the end kind of screws things up. So don't use it
@@ -10,6 +11,11 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
+/**
+ * Largest serialized batch, in bytes, that the API accepts.
+ */
+extern NSUInteger const kFPMaxBatchSize;
+
 
 NS_SWIFT_NAME(HTTPClient)
 @interface FPHTTPClient : NSObject
@@ -19,6 +25,35 @@ NS_SWIFT_NAME(HTTPClient)
 @property (nonatomic, readonly) NSURLSession *genericSession;
 @property (nonatomic, weak)  id<NSURLSessionDelegate> httpSessionDelegate;
 
+/**
+ * Carries batch uploads and webhook requests in place of the client's `NSURLSession`s when set. `nil` by default.
+ */
+@property (nonatomic, strong, nullable) id<FPTransport> transport;
+
+/**
+ * Transport for requests that are not batch uploads: `transport` when set, otherwise one over `genericSession`.
+ */
+@property (nonatomic, readonly) id<FPTransport> genericTransport;
+
+/**
+ * Connections the upload session opens to the API host at most. Applies to sessions created afterwards. `2` by default.
+ */
+@property (nonatomic, assign) NSInteger maximumConnectionsPerHost;
+
+#if TARGET_OS_IOS
+/**
+ * Multipath TCP service of the upload session. Applies to sessions created afterwards. `NSURLSessionMultipathServiceTypeNone` by default.
+ */
+@property (nonatomic, assign) NSURLSessionMultipathServiceType multipathServiceType;
+#endif
+
+/**
+ * Called on a queue internal to FPHTTPClient with the timing of every finished batch upload: the time spent on DNS,
+ * TCP and TLS before the request went out, 0 on a reused connection, and the time from sending the request to
+ * receiving the whole response.
+ */
+@property (nonatomic, copy, nullable) void (^uploadMetricsHandler)(NSTimeInterval connectionSetupDuration, NSTimeInterval transferDuration, BOOL reusedConnection);
+
 + (FPRequestFactory)defaultRequestFactory;
 + (NSString *)authorizationHeader:(NSString *)writeKey;
 
@@ -32,10 +67,91 @@ NS_SWIFT_NAME(HTTPClient)
  * NOTE: You need to re-dispatch within the completionHandler onto a desired queue to avoid threading issues.
  * Completion handlers are called on a dispatch queue internal to FPHTTPClient. 
  */
-- (nullable NSURLSessionUploadTask *)upload:(JSON_DICT)batch forWriteKey:(NSString *)writeKey completionHandler:(void (^)(BOOL retry))completionHandler;
+- (nullable id<FPTransportTask>)upload:(JSON_DICT)batch forWriteKey:(NSString *)writeKey completionHandler:(void (^)(BOOL retry))completionHandler;
+
+/**
+ * Same as upload:forWriteKey:completionHandler: for a batch that is already serialized to JSON.
+ * The body is gzipped, unless it already is or usesCompressionDictionary is set, and uploaded without being validated or re-encoded.
+ * `retryAfter` is the delay in seconds requested by a 429 or 503 response's Retry-After header, 0 otherwise.
+ */
+- (nullable id<FPTransportTask>)uploadData:(NSData *)body forWriteKey:(NSString *)writeKey completionHandler:(void (^)(BOOL retry, NSTimeInterval retryAfter))completionHandler;
+
+/**
+ * Set once the server answered a compact upload with 415 Unsupported Media Type. The batch is reported as to be
+ * retried, and should be sent again as JSON.
+ */
+@property (atomic, assign, readonly) BOOL compactEncodingRejected;
+
+/**
+ * Same as uploadData:forWriteKey:completionHandler: for a batch in the compact encoding of FPCompactBatchCodec,
+ * sent with its own `Content-Type`.
+ */
+- (nullable id<FPTransportTask>)uploadCompactData:(NSData *)body forWriteKey:(NSString *)writeKey completionHandler:(void (^)(BOOL retry, NSTimeInterval retryAfter))completionHandler;
+
+/**
+ * Whether bodies that are not already gzipped are deflated with the preset dictionary of FPCompressionDictionary
+ * rather than gzipped. The dictionary version is sent in the `X-Freshpaint-Dictionary` header. `NO` by default.
+ */
+@property (nonatomic, assign) BOOL usesCompressionDictionary;
+
+/**
+ * Set once the server answered an upload deflated with the dictionary with 415 Unsupported Media Type. The batch is
+ * reported as to be retried, and is gzipped from then on.
+ */
+@property (atomic, assign, readonly) BOOL compressionDictionaryRejected;
+
+/**
+ * Posts a webhook body to `url` through `genericTransport`. With `compress` set, the body is gzipped, unless it
+ * already is, and sent with `Content-Encoding: gzip`. The response is classified as for uploadData:forWriteKey:completionHandler:.
+ */
+- (nullable id<FPTransportTask>)uploadData:(NSData *)body toURL:(NSURL *)url compress:(BOOL)compress completionHandler:(void (^)(BOOL retry, NSTimeInterval retryAfter))completionHandler;
+
+/**
+ * Creates the upload session for `writeKey` and opens a connection to the API host with a HEAD request, so that
+ * the first upload does not pay for DNS, TCP and TLS. Connections stay open between uploads for as long as the
+ * system keeps them alive. Does nothing when `transport` is set.
+ */
+- (void)prewarmSessionForWriteKey:(NSString *)writeKey;
+
+/**
+ * Uploads a gzipped batch body from a file through a background `NSURLSession`, which keeps going while the
+ * app is suspended. The result is reported to `backgroundUploadCompletionHandler` with the file name, in
+ * this process or the next one to create the session. The file is left in place; the caller deletes it.
+ */
+- (nullable NSURLSessionUploadTask *)uploadFile:(NSURL *)fileURL forWriteKey:(NSString *)writeKey;
+
+/**
+ * Called on a queue internal to FPHTTPClient when a background upload finishes, with the name of the uploaded file.
+ */
+@property (nonatomic, copy, nullable) void (^backgroundUploadCompletionHandler)(NSString *fileName, BOOL retry, NSTimeInterval retryAfter);
+
+/**
+ * Names of the files whose background upload is still running.
+ */
+- (void)getBackgroundUploadsForWriteKey:(NSString *)writeKey completionHandler:(void (^)(NSSet<NSString *> *fileNames))completionHandler;
+
+/**
+ * Reconnects to a background session the system relaunched the app for. Returns NO if the session is not one of ours.
+ * `completionHandler` is called on the main queue once the session has delivered all its events.
+ */
+- (BOOL)handleEventsForBackgroundURLSession:(NSString *)identifier completionHandler:(void (^)(void))completionHandler;
+
+// Exposed for testing.
++ (NSTimeInterval)retryAfterFromResponse:(NSHTTPURLResponse *)response;
++ (NSString *)backgroundSessionIdentifierForWriteKey:(NSString *)writeKey;
++ (NSDictionary<NSString *, NSString *> *)settingsValidatorsFromResponse:(NSHTTPURLResponse *)response;
 
 - (NSURLSessionDataTask *)settingsForWriteKey:(NSString *)writeKey completionHandler:(void (^)(BOOL success, JSON_DICT _Nullable settings))completionHandler;
 
+/**
+ * Fetches the settings only if they changed since they were last fetched. `validators` are the `ETag` and
+ * `Last-Modified` headers of that response, as returned by the previous call, and are sent back as `If-None-Match`
+ * and `If-Modified-Since`. When the server answers 304, `notModified` is YES and `settings` is nil.
+ */
+- (NSURLSessionDataTask *)settingsForWriteKey:(NSString *)writeKey
+                                   validators:(NSDictionary<NSString *, NSString *> *_Nullable)validators
+                            completionHandler:(void (^)(BOOL success, BOOL notModified, JSON_DICT _Nullable settings, NSDictionary<NSString *, NSString *> *_Nullable validators))completionHandler;
+
 @end
 
 NS_ASSUME_NONNULL_END
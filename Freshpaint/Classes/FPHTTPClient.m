@@ -1,8 +1,99 @@
 #import "FPHTTPClient.h"
 #import "NSData+FPGZIP.h"
 #import "FPAnalyticsUtils.h"
+#import "FPCompactBatchCodec.h"
+#import "FPCompressionDictionary.h"
+
+NSUInteger const kFPMaxBatchSize = 475000; // 475KB
+
+static NSString *const kFPBackgroundSessionPrefix = @"io.freshpaint.analytics.uploads.";
+static NSString *const kFPPrewarmTaskDescription = @"io.freshpaint.analytics.prewarm";
+
+@interface FPHTTPClient ()
+@property (atomic, assign, readwrite) BOOL compactEncodingRejected;
+@property (atomic, assign, readwrite) BOOL compressionDictionaryRejected;
+@property (nonatomic, strong) FPURLSessionTransport *genericSessionTransport;
+- (void)classifyUploadResponse:(NSURLResponse *)response error:(NSError *)error completionHandler:(void (^)(BOOL retry, NSTimeInterval retryAfter))completionHandler;
+@end
+
+// Delegate of the upload sessions. Collects task metrics and passes everything else on to `httpSessionDelegate`.
+@interface FPUploadSessionDelegate : NSObject <NSURLSessionTaskDelegate>
+@property (nonatomic, weak) FPHTTPClient *client;
+@end
+
+@implementation FPUploadSessionDelegate
+
+- (BOOL)respondsToSelector:(SEL)selector
+{
+    return [super respondsToSelector:selector] || [self.client.httpSessionDelegate respondsToSelector:selector];
+}
+
+- (id)forwardingTargetForSelector:(SEL)selector
+{
+    return self.client.httpSessionDelegate;
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didFinishCollectingMetrics:(NSURLSessionTaskMetrics *)metrics
+{
+    FPHTTPClient *client = self.client;
+    id<NSURLSessionDelegate> delegate = client.httpSessionDelegate;
+    if ([delegate respondsToSelector:_cmd]) {
+        [(id<NSURLSessionTaskDelegate>)delegate URLSession:session task:task didFinishCollectingMetrics:metrics];
+    }
+
+    NSURLSessionTaskTransactionMetrics *transaction = metrics.transactionMetrics.lastObject;
+    void (^handler)(NSTimeInterval, NSTimeInterval, BOOL) = client.uploadMetricsHandler;
+    if (handler == nil || transaction == nil || [task.taskDescription isEqualToString:kFPPrewarmTaskDescription]) {
+        return;
+    }
+    NSTimeInterval setup = 0;
+    NSDate *setupStart = transaction.domainLookupStartDate ?: transaction.connectStartDate;
+    if (!transaction.isReusedConnection && setupStart && transaction.connectEndDate) {
+        setup = MAX([transaction.connectEndDate timeIntervalSinceDate:setupStart], 0);
+    }
+    NSTimeInterval transfer = 0;
+    if (transaction.requestStartDate && transaction.responseEndDate) {
+        transfer = MAX([transaction.responseEndDate timeIntervalSinceDate:transaction.requestStartDate], 0);
+    }
+    handler(setup, transfer, transaction.isReusedConnection);
+}
+
+@end
+
+
+// Receives the events of a background session. Sessions retain their delegate, and a background session
+// identifier can only be in use once per process, so the session and its delegate outlive the clients.
+@interface FPBackgroundUploadDelegate : NSObject <NSURLSessionDataDelegate>
+@property (nonatomic, weak) FPHTTPClient *client;
+@property (nonatomic, copy) void (^eventsCompletionHandler)(void);
+@end
+
+@implementation FPBackgroundUploadDelegate
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error
+{
+    FPHTTPClient *client = self.client;
+    NSString *fileName = task.taskDescription;
+    void (^handler)(NSString *, BOOL, NSTimeInterval) = client.backgroundUploadCompletionHandler;
+    if (client == nil || fileName == nil || handler == nil) {
+        return;
+    }
+    [client classifyUploadResponse:task.response error:error completionHandler:^(BOOL retry, NSTimeInterval retryAfter) {
+        handler(fileName, retry, retryAfter);
+    }];
+}
+
+- (void)URLSessionDidFinishEventsForBackgroundURLSession:(NSURLSession *)session
+{
+    void (^completionHandler)(void) = self.eventsCompletionHandler;
+    self.eventsCompletionHandler = nil;
+    if (completionHandler) {
+        dispatch_async(dispatch_get_main_queue(), completionHandler);
+    }
+}
+
+@end
 
-static const NSUInteger kMaxBatchSize = 475000; // 475KB
 
 @implementation FPHTTPClient
 
@@ -30,16 +121,28 @@ static const NSUInteger kMaxBatchSize = 475000; // 475KB
             self.requestFactory = requestFactory;
         }
         _sessionsByWriteKey = [NSMutableDictionary dictionary];
+        _maximumConnectionsPerHost = 2;
         NSURLSessionConfiguration *config = [NSURLSessionConfiguration defaultSessionConfiguration];
         config.HTTPAdditionalHeaders = @{
             @"Accept-Encoding" : @"gzip",
             @"User-Agent" : [NSString stringWithFormat:@"freshpaint-ios/%@", [FPAnalytics version]],
         };
         _genericSession = [NSURLSession sessionWithConfiguration:config];
+        _genericSessionTransport = [[FPURLSessionTransport alloc] initWithSession:_genericSession];
     }
     return self;
 }
 
+- (id<FPTransport>)genericTransport
+{
+    return self.transport ?: self.genericSessionTransport;
+}
+
+- (id<FPTransport>)transportForWriteKey:(NSString *)writeKey
+{
+    return self.transport ?: [[FPURLSessionTransport alloc] initWithSession:[self sessionForWriteKey:writeKey]];
+}
+
 - (NSURLSession *)sessionForWriteKey:(NSString *)writeKey
 {
     NSURLSession *session = self.sessionsByWriteKey[writeKey];
@@ -52,7 +155,16 @@ static const NSUInteger kMaxBatchSize = 475000; // 475KB
             @"Authorization" : [@"Basic " stringByAppendingString:[[self class] authorizationHeader:writeKey]],
             @"User-Agent" : [NSString stringWithFormat:@"freshpaint-ios/%@", [FPAnalytics version]],
         };
-        session = [NSURLSession sessionWithConfiguration:config delegate:self.httpSessionDelegate delegateQueue:NULL];
+        // Batches in flight each get a connection; idle ones are kept alive and reused by the next upload.
+        config.HTTPMaximumConnectionsPerHost = MAX(self.maximumConnectionsPerHost, 1);
+        config.HTTPShouldSetCookies = NO;
+        config.URLCache = nil;
+#if TARGET_OS_IOS
+        config.multipathServiceType = self.multipathServiceType;
+#endif
+        FPUploadSessionDelegate *delegate = [[FPUploadSessionDelegate alloc] init];
+        delegate.client = self;
+        session = [NSURLSession sessionWithConfiguration:config delegate:delegate delegateQueue:NULL];
         self.sessionsByWriteKey[writeKey] = session;
     }
     return session;
@@ -67,19 +179,27 @@ static const NSUInteger kMaxBatchSize = 475000; // 475KB
 }
 
 
-- (nullable NSURLSessionUploadTask *)upload:(NSDictionary *)batch forWriteKey:(NSString *)writeKey completionHandler:(void (^)(BOOL retry))completionHandler
+- (void)prewarmSessionForWriteKey:(NSString *)writeKey
 {
-    //    batch = FPCoerceDictionary(batch);
+    if (self.transport != nil) {
+        return;
+    }
     NSURLSession *session = [self sessionForWriteKey:writeKey];
+    NSMutableURLRequest *request = self.requestFactory(FRESHPAINT_API_BASE);
+    [request setHTTPMethod:@"HEAD"];
+    NSURLSessionDataTask *task = [session dataTaskWithRequest:request completionHandler:^(NSData *_Nullable data, NSURLResponse *_Nullable response, NSError *_Nullable error) {
+        // Any response means the connection is up; the status does not matter.
+        if (error) {
+            FPLog(@"Unable to prewarm the upload connection %@.", error);
+        }
+    }];
+    task.taskDescription = kFPPrewarmTaskDescription;
+    [task resume];
+}
 
-    NSURL *url = [FRESHPAINT_API_BASE URLByAppendingPathComponent:@"/"];
-    NSMutableURLRequest *request = self.requestFactory(url);
-
-    // This is a workaround for an IOS 8.3 bug that causes Content-Type to be incorrectly set
-    [request addValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
-
-    [request setHTTPMethod:@"POST"];
-
+- (nullable id<FPTransportTask>)upload:(NSDictionary *)batch forWriteKey:(NSString *)writeKey completionHandler:(void (^)(BOOL retry))completionHandler
+{
+    //    batch = FPCoerceDictionary(batch);
     NSError *error = nil;
     NSException *exception = nil;
     NSData *payload = nil;
@@ -94,85 +214,295 @@ static const NSUInteger kMaxBatchSize = 475000; // 475KB
         completionHandler(NO); // Don't retry this batch.
         return nil;
     }
-    if (payload.length >= kMaxBatchSize) {
-        FPLog(@"Payload exceeded the limit of %luKB per batch", kMaxBatchSize / 1000);
-        completionHandler(NO);
+    return [self uploadData:payload forWriteKey:writeKey completionHandler:^(BOOL retry, NSTimeInterval retryAfter) {
+        completionHandler(retry);
+    }];
+}
+
+- (nullable id<FPTransportTask>)uploadData:(NSData *)payload forWriteKey:(NSString *)writeKey completionHandler:(void (^)(BOOL retry, NSTimeInterval retryAfter))completionHandler
+{
+    return [self uploadData:payload contentType:@"application/json" forWriteKey:writeKey completionHandler:completionHandler];
+}
+
+- (nullable id<FPTransportTask>)uploadCompactData:(NSData *)payload forWriteKey:(NSString *)writeKey completionHandler:(void (^)(BOOL retry, NSTimeInterval retryAfter))completionHandler
+{
+    return [self uploadData:payload contentType:kFPCompactBatchContentType forWriteKey:writeKey completionHandler:completionHandler];
+}
+
+- (nullable id<FPTransportTask>)uploadData:(NSData *)payload contentType:(NSString *)contentType forWriteKey:(NSString *)writeKey completionHandler:(void (^)(BOOL retry, NSTimeInterval retryAfter))completionHandler
+{
+    NSURL *url = [FRESHPAINT_API_BASE URLByAppendingPathComponent:@"/"];
+    NSMutableURLRequest *request = self.requestFactory(url);
+
+    // This is a workaround for an IOS 8.3 bug that causes Content-Type to be incorrectly set
+    [request setValue:contentType forHTTPHeaderField:@"Content-Type"];
+    // Also set by the upload session; repeated so that the request is complete on any transport.
+    [request setValue:[@"Basic " stringByAppendingString:[[self class] authorizationHeader:writeKey]] forHTTPHeaderField:@"Authorization"];
+
+    [request setHTTPMethod:@"POST"];
+
+    if (payload.length >= kFPMaxBatchSize) {
+        FPLog(@"Payload exceeded the limit of %luKB per batch", kFPMaxBatchSize / 1000);
+        completionHandler(NO, 0);
         return nil;
     }
-    NSData *gzippedPayload = [payload seg_gzippedData];
 
-    NSURLSessionUploadTask *task = [session uploadTaskWithRequest:request fromData:gzippedPayload completionHandler:^(NSData *_Nullable data, NSURLResponse *_Nullable response, NSError *_Nullable error) {
-        if (error) {
-            // Network error. Retry.
-            FPLog(@"Error uploading request %@.", error);
-            completionHandler(YES);
-            return;
-        }
+    NSData *compressedPayload = nil;
+    if (self.usesCompressionDictionary && !self.compressionDictionaryRejected && ![payload seg_isGzippedData]) {
+        compressedPayload = [payload seg_deflatedDataWithDictionary:[FPCompressionDictionary dictionaryData]];
+    }
+    BOOL dictionary = compressedPayload != nil;
+    if (dictionary) {
+        [request setValue:kFPCompressionDictionaryContentEncoding forHTTPHeaderField:@"Content-Encoding"];
+        [request setValue:kFPCompressionDictionaryVersion forHTTPHeaderField:kFPCompressionDictionaryHeader];
+    } else {
+        compressedPayload = [payload seg_gzippedData];
+        [request setValue:@"gzip" forHTTPHeaderField:@"Content-Encoding"];
+    }
+    BOOL compact = [contentType isEqualToString:kFPCompactBatchContentType];
 
-        NSInteger code = ((NSHTTPURLResponse *)response).statusCode;
-        if (code < 300) {
-            // 2xx response codes. Don't retry.
-            completionHandler(NO);
-            return;
-        }
-        if (code < 400) {
-            // 3xx response codes. Retry.
-            FPLog(@"Server responded with unexpected HTTP code %d.", code);
-            completionHandler(YES);
-            return;
-        }
-        if (code == 429) {
-          // 429 response codes. Retry.
-          FPLog(@"Server limited client with response code %d.", code);
-          completionHandler(YES);
-          return;
-        }
-        if (code < 500) {
-            // non-429 4xx response codes. Don't retry.
-            FPLog(@"Server rejected payload with HTTP code %d.", code);
-            completionHandler(NO);
+    return [[self transportForWriteKey:writeKey] sendRequest:request body:compressedPayload completionHandler:^(NSData *_Nullable data, NSHTTPURLResponse *_Nullable response, NSError *_Nullable error) {
+        if (error == nil && response.statusCode == 415 && (compact || dictionary)) {
+            // Not a rejection of the events themselves; the caller resends them the usual way. The response does not
+            // say which of the two it refused, so the compact encoding goes first and the dictionary on a second 415.
+            if (compact) {
+                FPLog(@"Server does not accept the compact encoding, falling back to JSON.");
+                self.compactEncodingRejected = YES;
+            } else {
+                FPLog(@"Server does not accept compression dictionary %@, falling back to gzip.", kFPCompressionDictionaryVersion);
+                self.compressionDictionaryRejected = YES;
+            }
+            completionHandler(YES, 0);
             return;
         }
+        [self classifyUploadResponse:response error:error completionHandler:completionHandler];
+    }];
+}
+
+- (nullable id<FPTransportTask>)uploadData:(NSData *)payload toURL:(NSURL *)url compress:(BOOL)compress completionHandler:(void (^)(BOOL retry, NSTimeInterval retryAfter))completionHandler
+{
+    NSMutableURLRequest *request = self.requestFactory(url);
+    [request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+    [request setHTTPMethod:@"POST"];
+    if (compress) {
+        payload = [payload seg_gzippedData];
+        [request setValue:@"gzip" forHTTPHeaderField:@"Content-Encoding"];
+    }
 
-        // 5xx response codes. Retry.
-        FPLog(@"Server error with HTTP code %d.", code);
-        completionHandler(YES);
+    return [self.genericTransport sendRequest:request body:payload completionHandler:^(NSData *_Nullable data, NSHTTPURLResponse *_Nullable response, NSError *_Nullable error) {
+        [self classifyUploadResponse:response error:error completionHandler:completionHandler];
     }];
+}
+
+- (void)classifyUploadResponse:(NSURLResponse *)response error:(NSError *)error completionHandler:(void (^)(BOOL retry, NSTimeInterval retryAfter))completionHandler
+{
+    if (error) {
+        // Network error. Retry.
+        FPLog(@"Error uploading request %@.", error);
+        completionHandler(YES, 0);
+        return;
+    }
+
+    NSInteger code = ((NSHTTPURLResponse *)response).statusCode;
+    if (code < 300) {
+        // 2xx response codes. Don't retry.
+        completionHandler(NO, 0);
+        return;
+    }
+    if (code < 400) {
+        // 3xx response codes. Retry.
+        FPLog(@"Server responded with unexpected HTTP code %d.", code);
+        completionHandler(YES, 0);
+        return;
+    }
+    if (code == 429) {
+        // 429 response codes. Retry.
+        FPLog(@"Server limited client with response code %d.", code);
+        completionHandler(YES, [FPHTTPClient retryAfterFromResponse:(NSHTTPURLResponse *)response]);
+        return;
+    }
+    if (code < 500) {
+        // non-429 4xx response codes. Don't retry.
+        FPLog(@"Server rejected payload with HTTP code %d.", code);
+        completionHandler(NO, 0);
+        return;
+    }
+
+    // 5xx response codes. Retry.
+    FPLog(@"Server error with HTTP code %d.", code);
+    completionHandler(YES, code == 503 ? [FPHTTPClient retryAfterFromResponse:(NSHTTPURLResponse *)response] : 0);
+}
+
+#pragma mark - Background uploads
+
++ (NSString *)backgroundSessionIdentifierForWriteKey:(NSString *)writeKey
+{
+    return [kFPBackgroundSessionPrefix stringByAppendingString:writeKey];
+}
+
+- (NSURLSession *)backgroundSessionForWriteKey:(NSString *)writeKey
+{
+    static NSMutableDictionary<NSString *, NSURLSession *> *sessions;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sessions = [NSMutableDictionary dictionary];
+    });
+
+    NSString *identifier = [[self class] backgroundSessionIdentifierForWriteKey:writeKey];
+    @synchronized(sessions) {
+        NSURLSession *session = sessions[identifier];
+        if (!session) {
+            NSURLSessionConfiguration *config = [NSURLSessionConfiguration backgroundSessionConfigurationWithIdentifier:identifier];
+            config.HTTPAdditionalHeaders = @{
+                @"Accept-Encoding" : @"gzip",
+                @"Content-Encoding" : @"gzip",
+                @"Content-Type" : @"application/json",
+                @"Authorization" : [@"Basic " stringByAppendingString:[[self class] authorizationHeader:writeKey]],
+                @"User-Agent" : [NSString stringWithFormat:@"freshpaint-ios/%@", [FPAnalytics version]],
+            };
+            config.discretionary = NO;
+#if TARGET_OS_IPHONE
+            config.sessionSendsLaunchEvents = YES;
+#endif
+            session = [NSURLSession sessionWithConfiguration:config delegate:[[FPBackgroundUploadDelegate alloc] init] delegateQueue:nil];
+            sessions[identifier] = session;
+        }
+        // The most recent client gets the events.
+        ((FPBackgroundUploadDelegate *)session.delegate).client = self;
+        return session;
+    }
+}
+
+- (nullable NSURLSessionUploadTask *)uploadFile:(NSURL *)fileURL forWriteKey:(NSString *)writeKey
+{
+    NSURLSession *session = [self backgroundSessionForWriteKey:writeKey];
+
+    NSURL *url = [FRESHPAINT_API_BASE URLByAppendingPathComponent:@"/"];
+    NSMutableURLRequest *request = self.requestFactory(url);
+    [request addValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+    [request setHTTPMethod:@"POST"];
+
+    NSURLSessionUploadTask *task = [session uploadTaskWithRequest:request fromFile:fileURL];
+    // Paths change when the app is updated, so only the name identifies the batch on the next launch.
+    task.taskDescription = fileURL.lastPathComponent;
     [task resume];
     return task;
 }
 
+- (void)getBackgroundUploadsForWriteKey:(NSString *)writeKey completionHandler:(void (^)(NSSet<NSString *> *fileNames))completionHandler
+{
+    [[self backgroundSessionForWriteKey:writeKey] getAllTasksWithCompletionHandler:^(NSArray<__kindof NSURLSessionTask *> *tasks) {
+        NSMutableSet<NSString *> *fileNames = [NSMutableSet set];
+        for (NSURLSessionTask *task in tasks) {
+            if (task.taskDescription && task.state != NSURLSessionTaskStateCompleted) {
+                [fileNames addObject:task.taskDescription];
+            }
+        }
+        completionHandler(fileNames);
+    }];
+}
+
+- (BOOL)handleEventsForBackgroundURLSession:(NSString *)identifier completionHandler:(void (^)(void))completionHandler
+{
+    if (![identifier hasPrefix:kFPBackgroundSessionPrefix]) {
+        return NO;
+    }
+    NSString *writeKey = [identifier substringFromIndex:kFPBackgroundSessionPrefix.length];
+    NSURLSession *session = [self backgroundSessionForWriteKey:writeKey];
+    ((FPBackgroundUploadDelegate *)session.delegate).eventsCompletionHandler = completionHandler;
+    return YES;
+}
+
++ (NSTimeInterval)retryAfterFromResponse:(NSHTTPURLResponse *)response
+{
+    NSString *value = [response valueForHTTPHeaderField:@"Retry-After"];
+    if (value.length == 0) {
+        return 0;
+    }
+    // Either a number of seconds or an HTTP date.
+    NSScanner *scanner = [NSScanner scannerWithString:value];
+    NSInteger seconds = 0;
+    if ([scanner scanInteger:&seconds] && scanner.isAtEnd) {
+        return MAX(seconds, 0);
+    }
+    static NSDateFormatter *formatter;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        formatter = [[NSDateFormatter alloc] init];
+        formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+        formatter.timeZone = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+        formatter.dateFormat = @"EEE, dd MMM yyyy HH:mm:ss zzz";
+    });
+    NSDate *date = nil;
+    @synchronized(formatter) {
+        date = [formatter dateFromString:value];
+    }
+    return date ? MAX(date.timeIntervalSinceNow, 0) : 0;
+}
+
++ (NSDictionary<NSString *, NSString *> *)settingsValidatorsFromResponse:(NSHTTPURLResponse *)response
+{
+    NSMutableDictionary<NSString *, NSString *> *validators = [NSMutableDictionary dictionaryWithCapacity:2];
+    for (NSString *field in @[ @"ETag", @"Last-Modified" ]) {
+        NSString *value = [response valueForHTTPHeaderField:field];
+        if (value.length > 0) {
+            validators[field] = value;
+        }
+    }
+    return validators;
+}
+
 - (NSURLSessionDataTask *)settingsForWriteKey:(NSString *)writeKey completionHandler:(void (^)(BOOL success, JSON_DICT _Nullable settings))completionHandler
+{
+    return [self settingsForWriteKey:writeKey validators:nil completionHandler:^(BOOL success, BOOL notModified, JSON_DICT settings, NSDictionary<NSString *, NSString *> *validators) {
+        completionHandler(success, settings);
+    }];
+}
+
+- (NSURLSessionDataTask *)settingsForWriteKey:(NSString *)writeKey validators:(NSDictionary<NSString *, NSString *> *)validators completionHandler:(void (^)(BOOL success, BOOL notModified, JSON_DICT _Nullable settings, NSDictionary<NSString *, NSString *> *_Nullable validators))completionHandler
 {
     NSURLSession *session = self.genericSession;
 
     NSURL *url = [FRESHPAINT_CDN_BASE URLByAppendingPathComponent:[NSString stringWithFormat:@"/projects/%@/settings", writeKey]];
     NSMutableURLRequest *request = self.requestFactory(url);
     [request setHTTPMethod:@"GET"];
+    // The validators are handled here; a response cached by the URL loading system would hide the 304.
+    request.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+    if (validators[@"ETag"]) {
+        [request setValue:validators[@"ETag"] forHTTPHeaderField:@"If-None-Match"];
+    }
+    if (validators[@"Last-Modified"]) {
+        [request setValue:validators[@"Last-Modified"] forHTTPHeaderField:@"If-Modified-Since"];
+    }
 
     NSURLSessionDataTask *task = [session dataTaskWithRequest:request completionHandler:^(NSData *_Nullable data, NSURLResponse *_Nullable response, NSError *_Nullable error) {
         if (error != nil) {
             FPLog(@"Error fetching settings %@.", error);
-            completionHandler(NO, nil);
+            completionHandler(NO, NO, nil, nil);
             return;
         }
 
-        NSInteger code = ((NSHTTPURLResponse *)response).statusCode;
+        NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)response;
+        NSInteger code = httpResponse.statusCode;
+        if (code == 304) {
+            completionHandler(YES, YES, nil, validators);
+            return;
+        }
         if (code > 300) {
             FPLog(@"Server responded with unexpected HTTP code %d.", code);
-            completionHandler(NO, nil);
+            completionHandler(NO, NO, nil, nil);
             return;
         }
 
         NSError *jsonError = nil;
         id responseJson = [NSJSONSerialization JSONObjectWithData:data options:0 error:&jsonError];
-        if (jsonError != nil) {
+        if (jsonError != nil || ![responseJson isKindOfClass:[NSDictionary class]]) {
             FPLog(@"Error deserializing response body %@.", jsonError);
-            completionHandler(NO, nil);
+            completionHandler(NO, NO, nil, nil);
             return;
         }
 
-        completionHandler(YES, responseJson);
+        completionHandler(YES, NO, responseJson, [[self class] settingsValidatorsFromResponse:httpResponse]);
     }];
     [task resume];
     return task;
@@ -53,6 +53,10 @@ NS_SWIFT_NAME(Integration)
 // Flush is invoked when any queued events should be uploaded.
 - (void)flush;
 
+// Drain is invoked when queued events should be uploaded batch after batch until none are left.
+// The completion is called once, with the number of events delivered.
+- (void)drainWithCompletion:(void (^_Nullable)(NSUInteger deliveredCount))completion;
+
 // App Delegate Callbacks
 
 // Callbacks for notifications changes.
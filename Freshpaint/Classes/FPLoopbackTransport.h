@@ -0,0 +1,68 @@
+//
+//  FPLoopbackTransport.h
+//  Freshpaint
+//
+
+#import <Foundation/Foundation.h>
+#import "FPTransport.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * In-memory transport answering every request itself, for load tests and benchmarks of the upload pipeline that
+ * must not depend on a network.
+ *
+ * Each request is answered, in order of precedence:
+ *
+ * 1. by `responseHandler`, when set;
+ * 2. with the next status code or error queued by `enqueueStatusCodes:` or `enqueueError:`;
+ * 3. with a network error, for a share `failureRate` of the requests;
+ * 4. with `statusCode`.
+ *
+ * Failures are drawn from a generator seeded with `seed`, so the same settings fail the same requests on every run.
+ * Responses arrive after `latency` plus the time the body takes at `bytesPerSecond`, on a queue internal to the
+ * transport. Requests are answered concurrently; nothing limits how many are in flight.
+ */
+NS_SWIFT_NAME(LoopbackTransport)
+@interface FPLoopbackTransport : NSObject <FPTransport>
+
+/// Delay before every response, in seconds. `0` by default.
+@property (atomic, assign) NSTimeInterval latency;
+/// Simulated upload bandwidth; `0`, the default, for none.
+@property (atomic, assign) NSUInteger bytesPerSecond;
+/// Status code of the responses nothing else decided. `200` by default.
+@property (atomic, assign) NSInteger statusCode;
+/// Headers of every response, e.g. `Retry-After`. Empty by default.
+@property (atomic, copy) NSDictionary<NSString *, NSString *> *responseHeaders;
+/// Share of the requests, from 0 to 1, failing with `NSURLErrorNetworkConnectionLost`. `0` by default.
+@property (atomic, assign) double failureRate;
+/// Seed of the generator drawing the failures. Setting it restarts the sequence. `0` by default.
+@property (atomic, assign) uint64_t seed;
+
+/**
+ * Decides the response of every request: returns a status code, or sets `error` and returns anything.
+ * Called on a queue internal to the transport.
+ */
+@property (atomic, copy, nullable) NSInteger (^responseHandler)(NSURLRequest *request, NSData *_Nullable body, NSError *_Nullable *_Nonnull error);
+
+/// Requests received so far.
+@property (atomic, assign, readonly) NSUInteger requestCount;
+/// Bytes of request bodies received so far.
+@property (atomic, assign, readonly) uint64_t bodyBytesReceived;
+/// Requests answered with a 2xx status so far.
+@property (atomic, assign, readonly) NSUInteger successCount;
+/// Requests answered with another status or an error so far.
+@property (atomic, assign, readonly) NSUInteger failureCount;
+
+/// Answers the next requests with `statusCodes`, one each, before anything else applies.
+- (void)enqueueStatusCodes:(NSArray<NSNumber *> *)statusCodes;
+
+/// Answers the next request after those already queued with `error`.
+- (void)enqueueError:(NSError *)error;
+
+/// Clears the counters and the queued responses.
+- (void)reset;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,174 @@
+//
+//  FPLoopbackTransport.m
+//  Freshpaint
+//
+
+#import "FPLoopbackTransport.h"
+
+
+// A request answered by FPLoopbackTransport. Calls its completion handler once, when answered or cancelled.
+@interface FPLoopbackTask : NSObject <FPTransportTask>
+@property (nonatomic, copy) void (^completionHandler)(NSData *_Nullable, NSHTTPURLResponse *_Nullable, NSError *_Nullable);
+- (void)completeWithResponse:(NSHTTPURLResponse *)response error:(NSError *)error;
+@end
+
+@implementation FPLoopbackTask
+
+- (void)completeWithResponse:(NSHTTPURLResponse *)response error:(NSError *)error
+{
+    void (^completionHandler)(NSData *, NSHTTPURLResponse *, NSError *) = nil;
+    @synchronized(self) {
+        completionHandler = self.completionHandler;
+        self.completionHandler = nil;
+    }
+    if (completionHandler) {
+        completionHandler(error == nil ? [NSData data] : nil, error == nil ? response : nil, error);
+    }
+}
+
+- (void)cancel
+{
+    [self completeWithResponse:nil error:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]];
+}
+
+@end
+
+
+@interface FPLoopbackTransport ()
+@property (atomic, assign, readwrite) NSUInteger requestCount;
+@property (atomic, assign, readwrite) uint64_t bodyBytesReceived;
+@property (atomic, assign, readwrite) NSUInteger successCount;
+@property (atomic, assign, readwrite) NSUInteger failureCount;
+@property (nonatomic, strong) NSMutableArray *scriptedResponses;
+@property (nonatomic, strong) dispatch_queue_t responseQueue;
+@end
+
+@implementation FPLoopbackTransport {
+    uint64_t _generatorState;
+}
+
+@synthesize seed = _seed;
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        _statusCode = 200;
+        _responseHeaders = @{};
+        _scriptedResponses = [NSMutableArray array];
+        _responseQueue = dispatch_queue_create("io.freshpaint.analytics.loopback", DISPATCH_QUEUE_CONCURRENT);
+    }
+    return self;
+}
+
+- (uint64_t)seed
+{
+    @synchronized(self) {
+        return _seed;
+    }
+}
+
+- (void)setSeed:(uint64_t)seed
+{
+    @synchronized(self) {
+        _seed = seed;
+        _generatorState = seed;
+    }
+}
+
+- (void)enqueueStatusCodes:(NSArray<NSNumber *> *)statusCodes
+{
+    @synchronized(self) {
+        [self.scriptedResponses addObjectsFromArray:statusCodes];
+    }
+}
+
+- (void)enqueueError:(NSError *)error
+{
+    @synchronized(self) {
+        [self.scriptedResponses addObject:error];
+    }
+}
+
+- (void)reset
+{
+    @synchronized(self) {
+        [self.scriptedResponses removeAllObjects];
+        self.requestCount = 0;
+        self.bodyBytesReceived = 0;
+        self.successCount = 0;
+        self.failureCount = 0;
+    }
+}
+
+- (id<FPTransportTask>)sendRequest:(NSURLRequest *)request body:(NSData *)body completionHandler:(void (^)(NSData *_Nullable, NSHTTPURLResponse *_Nullable, NSError *_Nullable))completionHandler
+{
+    FPLoopbackTask *task = [[FPLoopbackTask alloc] init];
+    task.completionHandler = completionHandler;
+
+    NSTimeInterval delay = self.latency;
+    NSUInteger bytesPerSecond = self.bytesPerSecond;
+    if (bytesPerSecond > 0) {
+        delay += (NSTimeInterval)body.length / bytesPerSecond;
+    }
+
+    // Answers are decided in arrival order, whatever the delays, so scripted responses and failures stay reproducible.
+    NSError *error = nil;
+    NSInteger statusCode = [self statusCodeForRequest:request body:body error:&error];
+    NSHTTPURLResponse *response = nil;
+    if (error == nil) {
+        response = [[NSHTTPURLResponse alloc] initWithURL:request.URL statusCode:statusCode HTTPVersion:@"HTTP/1.1" headerFields:self.responseHeaders];
+    }
+    @synchronized(self) {
+        self.requestCount += 1;
+        self.bodyBytesReceived += body.length;
+        if (error == nil && statusCode >= 200 && statusCode < 300) {
+            self.successCount += 1;
+        } else {
+            self.failureCount += 1;
+        }
+    }
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), self.responseQueue, ^{
+        [task completeWithResponse:response error:error];
+    });
+    return task;
+}
+
+#pragma mark - Private
+
+- (NSInteger)statusCodeForRequest:(NSURLRequest *)request body:(NSData *)body error:(NSError **)error
+{
+    NSInteger (^responseHandler)(NSURLRequest *, NSData *, NSError **) = self.responseHandler;
+    if (responseHandler) {
+        return responseHandler(request, body, error);
+    }
+    @synchronized(self) {
+        id scripted = self.scriptedResponses.firstObject;
+        if (scripted != nil) {
+            [self.scriptedResponses removeObjectAtIndex:0];
+            if ([scripted isKindOfClass:[NSError class]]) {
+                *error = scripted;
+                return 0;
+            }
+            return [scripted integerValue];
+        }
+        if (self.failureRate > 0 && [self nextRandomFraction] < self.failureRate) {
+            *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil];
+            return 0;
+        }
+    }
+    return self.statusCode;
+}
+
+// SplitMix64; the next number of the sequence started by `seed`, as a fraction in [0, 1).
+- (double)nextRandomFraction
+{
+    _generatorState += 0x9E3779B97F4A7C15ull;
+    uint64_t z = _generatorState;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z = z ^ (z >> 31);
+    return (double)(z >> 11) / (double)(1ull << 53);
+}
+
+@end
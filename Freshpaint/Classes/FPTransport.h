@@ -0,0 +1,60 @@
+//
+//  FPTransport.h
+//  Freshpaint
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * A request sent through an FPTransport.
+ */
+NS_SWIFT_NAME(TransportTask)
+@protocol FPTransportTask <NSObject>
+
+/// Stops the request. Its completion handler is still called, with an `NSURLErrorCancelled` error unless it already finished.
+- (void)cancel;
+
+@end
+
+/**
+ * Carries the HTTP requests of FPHTTPClient: batch uploads and webhook deliveries. FPHTTPClient builds every
+ * request, headers included, compresses the body and reads the response; the transport only moves the bytes.
+ *
+ * The default transport is FPURLSessionTransport. Setting `FPAnalyticsConfiguration.transport` replaces it, for
+ * instance with FPLoopbackTransport to exercise the upload pipeline without a network. Background uploads and
+ * settings fetches always go through `NSURLSession`.
+ */
+NS_SWIFT_NAME(Transport)
+@protocol FPTransport <NSObject>
+
+/**
+ * Sends `request` with `body`, which replaces any body the request has, and starts it right away.
+ * `completionHandler` is called exactly once, on a queue internal to the transport, with either a response or an error.
+ */
+- (id<FPTransportTask>)sendRequest:(NSURLRequest *)request
+                              body:(NSData *_Nullable)body
+                 completionHandler:(void (^)(NSData *_Nullable data, NSHTTPURLResponse *_Nullable response, NSError *_Nullable error))completionHandler;
+
+@end
+
+
+/**
+ * Transport sending requests through an `NSURLSession`.
+ */
+NS_SWIFT_NAME(URLSessionTransport)
+@interface FPURLSessionTransport : NSObject <FPTransport>
+
+@property (nonatomic, strong, readonly) NSURLSession *session;
+
+- (instancetype)initWithSession:(NSURLSession *)session NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+
+@interface NSURLSessionTask (FPTransportTask) <FPTransportTask>
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,38 @@
+//
+//  FPTransport.m
+//  Freshpaint
+//
+
+#import "FPTransport.h"
+
+
+@implementation FPURLSessionTransport
+
+- (instancetype)initWithSession:(NSURLSession *)session
+{
+    if (self = [super init]) {
+        _session = session;
+    }
+    return self;
+}
+
+- (id<FPTransportTask>)sendRequest:(NSURLRequest *)request body:(NSData *)body completionHandler:(void (^)(NSData *_Nullable, NSHTTPURLResponse *_Nullable, NSError *_Nullable))completionHandler
+{
+    void (^handler)(NSData *, NSURLResponse *, NSError *) = ^(NSData *_Nullable data, NSURLResponse *_Nullable response, NSError *_Nullable error) {
+        completionHandler(data, error == nil ? (NSHTTPURLResponse *)response : nil, error);
+    };
+    NSURLSessionTask *task = nil;
+    if (body != nil) {
+        task = [self.session uploadTaskWithRequest:request fromData:body completionHandler:handler];
+    } else {
+        task = [self.session dataTaskWithRequest:request completionHandler:handler];
+    }
+    [task resume];
+    return task;
+}
+
+@end
+
+
+@implementation NSURLSessionTask (FPTransportTask)
+@end
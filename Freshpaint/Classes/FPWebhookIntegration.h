@@ -9,6 +9,13 @@ NS_SWIFT_NAME(WebhookIntegrationFactory)
 @property (nonatomic, copy) NSString *name;
 @property (nonatomic, copy) NSString *webhookUrl;
 
+/**
+ * Events sent in one request. Defaults to 1: every event is posted on its own as its JSON payload.
+ * Above 1, events are posted gzipped as `{"batch": [...], "sentAt": "..."}` once that many are queued or
+ * `flushInterval` elapses, so the receiver has to accept that format.
+ */
+@property (nonatomic, assign) NSUInteger batchSize;
+
 - (instancetype)initWithName:(NSString *)name webhookUrl:(NSString *)webhookUrl;
 
 @end
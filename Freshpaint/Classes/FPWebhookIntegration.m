@@ -4,6 +4,20 @@
 #import "FPState.h"
 #import "FPAnalyticsUtils.h"
 #import "FPUtils.h"
+#import "FPEventJournal.h"
+#import "FPEventQueue.h"
+#import "FPRetryScheduler.h"
+#import "FPGZIPBatchBuilder.h"
+#import "FPEncodedEventCache.h"
+#import "FPFileStorage.h"
+#import "FPDeliveryMetrics+FPRecording.h"
+#import "FPMacros.h"
+
+// Bytes of a batch body taken by everything but the events: `{"batch":[`, `],"sentAt":"..."}`.
+static const NSUInteger kFPWebhookBatchEnvelopeReserve = 64;
+
+// Equiv to UIBackgroundTaskInvalid.
+static const NSUInteger kFPWebhookBackgroundTaskInvalid = 0;
 
 NS_ASSUME_NONNULL_BEGIN
 @interface FPWebhookIntegration : NSObject <FPIntegration>
@@ -13,83 +27,296 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, strong) NSString *name;
 @property (nonatomic, strong) FPAnalytics *analytics;
 @property (nonatomic, strong) dispatch_queue_t serialQueue;
+@property (nonatomic, assign) NSUInteger batchSize;
+@property (nonatomic, strong) NSURL *folderURL;
+@property (nonatomic, strong) FPDeliveryMetrics *metrics;
+
+// Queued events, persisted in the journal until the webhook accepted or rejected them. Both are only
+// touched from the serial queue, and their sequence numbers follow each other.
+@property (nonatomic, strong) FPEventJournal *journal;
+@property (nonatomic, strong) FPEventQueue *queue;
+@property (nonatomic, strong) FPRetryScheduler *retryScheduler;
+@property (nonatomic, strong, nullable) FPGZIPBatchBuilder *batchBuilder;
+// Set while a request is in flight; it carries the events numbered below `sendingEndSequence`.
+@property (nonatomic, assign) BOOL sending;
+@property (nonatomic, assign) uint64_t sendingEndSequence;
+// Set while a flush is scheduled for a partial batch.
+@property (nonatomic, assign) BOOL flushScheduled;
+// Set while events are sent batch after batch in a background task.
+@property (nonatomic, assign) BOOL draining;
+@property (nonatomic, assign) NSUInteger backgroundTaskID;
 
 - (instancetype)initWithAnalytics:(FPAnalytics *)analytics httpClient:(FPHTTPClient *)client webhookUrl:(NSString *)webhookUrl name:(NSString *)name;
+- (instancetype)initWithAnalytics:(FPAnalytics *)analytics httpClient:(FPHTTPClient *)client webhookUrl:(NSString *)webhookUrl name:(NSString *)name folderURL:(NSURL *)folderURL batchSize:(NSUInteger)batchSize;
 
 @end
 
 NS_ASSUME_NONNULL_END
 
+@interface FPAnalytics ()
+@property (nonatomic, strong, readonly) FPAnalyticsConfiguration *oneTimeConfiguration;
+@end
+
 @implementation FPWebhookIntegration
 
++ (NSURL *)defaultFolderURLForName:(NSString *)name
+{
+    NSString *component = [name stringByAddingPercentEncodingWithAllowedCharacters:[NSCharacterSet alphanumericCharacterSet]] ?: @"";
+    NSString *key = [NSString stringWithFormat:@"freshpaintio.webhook.%@.journal", component];
+#if TARGET_OS_TV
+    return [[FPFileStorage cachesDirectoryURL] URLByAppendingPathComponent:key];
+#else
+    return [[FPFileStorage applicationSupportDirectoryURL] URLByAppendingPathComponent:key];
+#endif
+}
+
 - (instancetype)initWithAnalytics:(FPAnalytics *)analytics httpClient:(FPHTTPClient *)client webhookUrl:(NSString *)webhookUrl name:(NSString *)name {
+    return [self initWithAnalytics:analytics httpClient:client webhookUrl:webhookUrl name:name folderURL:[FPWebhookIntegration defaultFolderURLForName:name] batchSize:1];
+}
+
+- (instancetype)initWithAnalytics:(FPAnalytics *)analytics httpClient:(FPHTTPClient *)client webhookUrl:(NSString *)webhookUrl name:(NSString *)name folderURL:(NSURL *)folderURL batchSize:(NSUInteger)batchSize {
     if (self = [super init]) {
         _name = name;
         _analytics = analytics;
         _client = client;
         _webhookUrl = webhookUrl;
+        _folderURL = folderURL;
+        _batchSize = MAX(batchSize, 1u);
+        _metrics = [analytics.deliveryMetrics fp_metricsForDestination:[NSString stringWithFormat:@"webhook_%@", name]];
         _serialQueue = seg_dispatch_queue_create_specific("io.freshpaint.analytics.webhook", DISPATCH_QUEUE_SERIAL);
+        weakify(self);
+        _retryScheduler = [[FPRetryScheduler alloc] initWithQueue:_serialQueue retryHandler:^{
+            strongify(self);
+            [self sendBatch];
+        }];
+        // Events left over from the last launch go out as soon as the journal is read.
+        [self dispatchBackground:^{
+            [self sendNextBatchIfDue];
+        }];
     }
     return self;
 }
 
-- (void)sendPayloadToWebhook:(NSDictionary *)data {
-    NSURLSession *session = self.client.genericSession;
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%p:%@, %@>", self, self.class, self.name];
+}
 
-    NSURL *url = [NSURL URLWithString:self.webhookUrl];
-    NSMutableURLRequest *request = self.client.requestFactory(url);
+#pragma mark - Queue
 
-    // This is a workaround for an IOS 8.3 bug that causes Content-Type to be incorrectly set
-    [request addValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+- (FPEventJournal *)journal
+{
+    if (!_journal) {
+        _journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:self.analytics.oneTimeConfiguration.crypto];
+    }
+    return _journal;
+}
 
-    [request setHTTPMethod:@"POST"];
+- (FPEventQueue *)queue
+{
+    if (!_queue) {
+        // Only the journal index is read here; event bodies are paged in as batches are cut.
+        _queue = [[FPEventQueue alloc] initWithFirstSequence:self.journal.firstSequence capacity:self.journal.count];
+        weakify(self);
+        _queue.recordLoader = ^NSData *(uint64_t sequence) {
+            strongify(self);
+            return [self.journal recordAtSequence:sequence];
+        };
+        for (NSUInteger i = 0; i < self.journal.count; i++) {
+            [_queue pushPagedOutRecordInLane:FPEventLaneStandard];
+        }
+    }
+    return _queue;
+}
 
-    NSError *error = nil;
-    NSException *exception = nil;
-    NSData *payload = nil;
-    @try {
-        payload = [NSJSONSerialization dataWithJSONObject:data options:0 error:&error];
+- (void)queueRecord:(NSData *)record
+{
+    if (record.length > kFPMaxBatchSize - kFPWebhookBatchEnvelopeReserve) {
+        FPLog(@"%@ Dropping event larger than the %luKB batch limit.", self, (unsigned long)(kFPMaxBatchSize / 1000));
+        [self.metrics fp_recordOversizedEventsDropped:1];
+        return;
     }
-    @catch (NSException *exc) {
-        exception = exc;
+
+    NSUInteger maxQueueSize = MAX(self.analytics.oneTimeConfiguration.maxQueueSize, 1u);
+    while (self.queue.count >= maxQueueSize && [self.queue evictLowestPriorityEventInLane:NULL sequence:NULL]) {
+        FPLog(@"%@ Queue is at max capacity (%lu), evicting the oldest event.", self, (unsigned long)maxQueueSize);
+        [self.metrics fp_recordQueueOverflowEventsDropped:1];
     }
-    if (error || exception) {
-        FPLog(@"Error serializing JSON for upload to webhook %@", error);
+    // Evicted events at the head need no delivery; release them from the journal.
+    [self acknowledgeEventsBeforeSequence:self.queue.firstLiveSequence];
+
+    [self.queue pushRecord:record lane:FPEventLaneStandard];
+    [self.journal appendRecord:record];
+    [self sendNextBatchIfDue];
+}
+
+- (void)acknowledgeEventsBeforeSequence:(uint64_t)sequence
+{
+    if (sequence <= self.queue.headSequence) {
         return;
     }
+    [self.queue removeEventsBeforeSequence:sequence];
+    [self.journal acknowledgeRecordsBeforeSequence:self.queue.headSequence];
+}
 
-    NSURLSessionUploadTask *task = [session uploadTaskWithRequest:request fromData:payload completionHandler:^(NSData *_Nullable data, NSURLResponse *_Nullable response, NSError *_Nullable error) {
-        if (error) {
-            // Network error. Retry.
-            FPLog(@"Error uploading request %@.", error);
-            return;
+#pragma mark - Delivery
+
+// Sends a batch once enough events are queued, or schedules a flush for a partial one. Ends a drain
+// once there is nothing left it can send.
+- (void)sendNextBatchIfDue
+{
+    if (!self.sending) {
+        if (self.queue.count >= self.batchSize || (self.draining && self.queue.count > 0)) {
+            [self sendBatch];
+        } else if (self.queue.count > 0) {
+            [self scheduleFlush];
         }
+    }
+    if (self.draining && !self.sending) {
+        [self endDrain];
+    }
+}
 
-        NSInteger code = ((NSHTTPURLResponse *)response).statusCode;
-        if (code < 300) {
-            // 2xx response codes. Don't retry.
-            return;
+- (void)scheduleFlush
+{
+    NSTimeInterval interval = self.analytics.oneTimeConfiguration.flushInterval;
+    if (self.flushScheduled || interval <= 0) {
+        return;
+    }
+    self.flushScheduled = YES;
+    weakify(self);
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(interval * NSEC_PER_SEC)), self.serialQueue, ^{
+        strongify(self);
+        self.flushScheduled = NO;
+        [self sendBatch];
+    });
+}
+
+// Sends the oldest queued events, up to `batchSize` of them and the batch size limit.
+- (void)sendBatch
+{
+    if (self.sending || self.queue.count == 0 || ![self.retryScheduler canAttempt]) {
+        return;
+    }
+
+    NSURL *url = [NSURL URLWithString:self.webhookUrl];
+    if (url == nil) {
+        FPLog(@"%@ Invalid webhook URL %@.", self, self.webhookUrl);
+        return;
+    }
+
+    NSMutableArray<NSData *> *records = [NSMutableArray arrayWithCapacity:MIN(self.batchSize, self.queue.count)];
+    NSUInteger length = kFPWebhookBatchEnvelopeReserve;
+    uint64_t end = self.queue.headSequence;
+    while (records.count < self.batchSize && end < self.queue.endSequence) {
+        NSData *record = [self.queue recordAtSequence:end];
+        if (record != nil) {
+            if (records.count > 0 && length + record.length + 1 > kFPMaxBatchSize) {
+                break;
+            }
+            length += record.length + 1;
+            [records addObject:record];
         }
-        if (code < 400) {
-            // 3xx response codes. Retry.
-            FPLog(@"Server responded with unexpected HTTP code %zd.", code);
-            return;
+        end++;
+    }
+    if (records.count == 0) {
+        // Only unreadable events were left.
+        [self acknowledgeEventsBeforeSequence:end];
+        return;
+    }
+
+    NSData *body = records.firstObject;
+    BOOL batched = self.batchSize > 1;
+    if (batched) {
+        if (!self.batchBuilder) {
+            self.batchBuilder = [[FPGZIPBatchBuilder alloc] init];
+        }
+        for (NSData *record in records) {
+            [self.batchBuilder appendRecord:record];
         }
-        if (code == 429) {
-            // 429 response codes. Retry.
-            FPLog(@"Server limited client with response code %zd.", code);
+        body = [self.batchBuilder finishWithSentAt:iso8601FormattedString([NSDate date])];
+        if (body == nil) {
+            FPLog(@"%@ Error compressing batch for upload to webhook.", self);
             return;
         }
-        if (code < 500) {
-            // non-429 4xx response codes. Don't retry.
-            FPLog(@"Server rejected payload with HTTP code %zd.", code);
+    }
+
+    FPLog(@"%@ Sending %lu events to webhook.", self, (unsigned long)records.count);
+    self.sending = YES;
+    self.sendingEndSequence = end;
+    [self.client uploadData:body toURL:url compress:batched completionHandler:^(BOOL retry, NSTimeInterval retryAfter) {
+        [self dispatchBackground:^{
+            [self completeBatchWithRetry:retry retryAfter:retryAfter];
+        }];
+    }];
+}
+
+- (void)completeBatchWithRetry:(BOOL)retry retryAfter:(NSTimeInterval)retryAfter
+{
+    self.sending = NO;
+    if (retry) {
+        // The events stay queued; the retry scheduler sends them again once the backoff elapsed.
+        [self.retryScheduler recordFailureWithRetryAfter:retryAfter];
+        [self.metrics fp_recordUploadFailedWithConsecutiveFailures:self.retryScheduler.consecutiveFailures circuitBreakerOpen:self.retryScheduler.breakerOpen nextAttemptDate:self.retryScheduler.nextAttemptDate];
+        if (self.draining) {
+            [self endDrain];
+        }
+        return;
+    }
+
+    // Delivered, or rejected for good; either way the events are done with.
+    [self.retryScheduler recordSuccess];
+    [self.metrics fp_recordUploadSucceeded];
+    [self acknowledgeEventsBeforeSequence:self.sendingEndSequence];
+    [self sendNextBatchIfDue];
+}
+
+- (void)endDrain
+{
+    self.draining = NO;
+    if (self.backgroundTaskID != kFPWebhookBackgroundTaskInvalid) {
+        id<FPApplicationProtocol> application = self.analytics.oneTimeConfiguration.application;
+        if ([application respondsToSelector:@selector(seg_endBackgroundTask:)]) {
+            [application seg_endBackgroundTask:self.backgroundTaskID];
+        }
+        self.backgroundTaskID = kFPWebhookBackgroundTaskInvalid;
+    }
+}
+
+#pragma mark - FPIntegration
+
+- (void)flush
+{
+    [self dispatchBackground:^{
+        [self sendBatch];
+    }];
+}
+
+- (void)applicationDidEnterBackground
+{
+    [self dispatchBackground:^{
+        [self.journal synchronize];
+        if (self.draining || self.queue.count == 0) {
             return;
         }
+        id<FPApplicationProtocol> application = self.analytics.oneTimeConfiguration.application;
+        if ([application respondsToSelector:@selector(seg_beginBackgroundTaskWithName:expirationHandler:)]) {
+            self.backgroundTaskID = [application seg_beginBackgroundTaskWithName:@"Freshpaint.Webhook" expirationHandler:^{
+                [self dispatchBackgroundAndWait:^{
+                    [self endDrain];
+                }];
+            }];
+        }
+        self.draining = YES;
+        [self sendNextBatchIfDue];
+    }];
+}
 
-        // 5xx response codes. Retry.
-        FPLog(@"Server error with HTTP code %zd.", code);
+- (void)applicationWillTerminate
+{
+    [self dispatchBackgroundAndWait:^{
+        [self.journal synchronize];
     }];
-    [task resume];
 }
 
 // Merges user provided integration options with bundled integrations.
@@ -117,10 +344,16 @@ NS_ASSUME_NONNULL_END
     [payload setValue:[self integrationsDictionary:integrations] forKey:@"integrations"];
     [payload setValue:[context copy] forKey:@"context"];
 
+    // Every webhook gets the same event; the first one to get to it encodes it for the others.
+    NSData *record = [[FPEncodedEventCache sharedCache] recordForEvent:payload messageId:payload[@"messageId"]];
+    if (record == nil) {
+        FPLog(@"Error serializing JSON for upload to webhook %@", self.name);
+        return;
+    }
+
     [self dispatchBackground:^{
         FPLog(@"%@ Enqueueing payload %@ through %@", self, type, self.name);
-        NSDictionary *queuePayload = [payload copy];
-        [self sendPayloadToWebhook:queuePayload];
+        [self queueRecord:record];
     }];
 }
 
@@ -129,6 +362,11 @@ NS_ASSUME_NONNULL_END
     seg_dispatch_specific_async(_serialQueue, block);
 }
 
+- (void)dispatchBackgroundAndWait:(void (^)(void))block
+{
+    seg_dispatch_specific_sync(_serialQueue, block);
+}
+
 - (NSString *)userId
 {
     return [FPState sharedInstance].userInfo.userId;
@@ -195,13 +433,15 @@ NS_ASSUME_NONNULL_END
     if (self = [super init]) {
         _name = name;
         _webhookUrl = webhookUrl;
+        _batchSize = 1;
     }
     return self;
 }
 
 - (id <FPIntegration>)createWithSettings:(NSDictionary *)settings forAnalytics:(FPAnalytics *)analytics {
     FPHTTPClient *httpClient = [[FPHTTPClient alloc] initWithRequestFactory:nil];
-    return [[FPWebhookIntegration alloc] initWithAnalytics:analytics httpClient:httpClient webhookUrl:self.webhookUrl name:self.name];
+    httpClient.transport = analytics.oneTimeConfiguration.transport;
+    return [[FPWebhookIntegration alloc] initWithAnalytics:analytics httpClient:httpClient webhookUrl:self.webhookUrl name:self.name folderURL:[FPWebhookIntegration defaultFolderURLForName:self.name] batchSize:self.batchSize];
 }
 
 - (NSString *)key {
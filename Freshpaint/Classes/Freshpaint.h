@@ -22,3 +22,6 @@ FOUNDATION_EXPORT const unsigned char FreshpaintVersionString[];
 #import "FPScreenReporting.h"
 #import "FPAnalyticsUtils.h"
 #import "FPWebhookIntegration.h"
+#import "FPDeliveryMetrics.h"
+#import "FPTransport.h"
+#import "FPLoopbackTransport.h"
@@ -22,4 +22,15 @@ NS_SWIFT_NAME(AES256Crypto)
 
 + (NSData *_Nonnull)randomDataOfLength:(size_t)length;
 
+// Runs the full PBKDF2 derivation. Instances derive their key once and reuse it; exposed for benchmarks.
++ (NSData *_Nonnull)AESKeyForPassword:(NSString *_Nonnull)password salt:(NSData *_Nonnull)salt NS_SWIFT_NAME(deriveKey(password:salt:));
+
+- (BOOL)encryptFromStream:(NSInputStream *_Nonnull)input toStream:(NSOutputStream *_Nonnull)output NS_SWIFT_NAME(encrypt(from:to:));
+- (BOOL)decryptFromStream:(NSInputStream *_Nonnull)input toStream:(NSOutputStream *_Nonnull)output NS_SWIFT_NAME(decrypt(from:to:));
+
+// AES-256-CTR with a random nonce per record, authenticated with a truncated HMAC-SHA256 (encrypt-then-MAC).
+// Returns nil from openRecord: if the envelope has been tampered with or was sealed under another key.
+- (NSData *_Nullable)sealRecord:(NSData *_Nonnull)record;
+- (NSData *_Nullable)openRecord:(NSData *_Nonnull)envelope;
+
 @end
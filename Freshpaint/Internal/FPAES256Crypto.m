@@ -7,6 +7,7 @@
 
 
 #import <CommonCrypto/CommonCryptor.h>
+#import <CommonCrypto/CommonHMAC.h>
 #import <CommonCrypto/CommonKeyDerivation.h>
 #import "FPAES256Crypto.h"
 #import "FPUtils.h"
@@ -22,6 +23,33 @@ static const NSUInteger kAlgorithmIVSize = kCCBlockSizeAES128;
 static const NSUInteger kPBKDFSaltSize = 8;
 static const NSUInteger kPBKDFRounds = 10000; // ~80ms on an iPhone 4
 
+// Cryptor contexts kept around per operation for reuse.
+static const NSUInteger kCryptorPoolSize = 4;
+// Chunk size used by the streaming API.
+static const NSUInteger kStreamChunkSize = 16384;
+
+// Record envelope: version (1) | nonce (16) | AES-CTR cipher text | HMAC-SHA256 tag truncated to 16 bytes.
+static const uint8_t kRecordEnvelopeVersion = 1;
+static const NSUInteger kRecordNonceSize = kCCBlockSizeAES128;
+static const NSUInteger kRecordTagSize = 16;
+static const NSUInteger kRecordHeaderSize = 1 + kRecordNonceSize;
+
+// The derived key buffer holds the PBKDF2 key followed by the record encryption and MAC sub keys.
+static const NSUInteger kKeyBufferSize = kAlgorithmKeySize * 3;
+
+
+@interface FPAES256Crypto () {
+    // Derived once per instance, wiped on dealloc. Layout: AES key | record key | record MAC key.
+    uint8_t *_key;
+}
+
+@property (nonatomic, strong) NSMutableArray<NSValue *> *encryptors;
+@property (nonatomic, strong) NSMutableArray<NSValue *> *decryptors;
+// CTR cryptors under the record key; CTR is symmetric, so they both seal and open records.
+@property (nonatomic, strong) NSMutableArray<NSValue *> *recordCryptors;
+
+@end
+
 
 @implementation FPAES256Crypto
 
@@ -31,6 +59,9 @@ static const NSUInteger kPBKDFRounds = 10000; // ~80ms on an iPhone 4
         _password = password;
         _salt = salt;
         _iv = iv;
+        _encryptors = [NSMutableArray arrayWithCapacity:kCryptorPoolSize];
+        _decryptors = [NSMutableArray arrayWithCapacity:kCryptorPoolSize];
+        _recordCryptors = [NSMutableArray arrayWithCapacity:kCryptorPoolSize];
     }
     return self;
 }
@@ -42,69 +73,313 @@ static const NSUInteger kPBKDFRounds = 10000; // ~80ms on an iPhone 4
     return [self initWithPassword:password salt:salt iv:iv];
 }
 
-- (NSData *)aesKey
+- (void)dealloc
 {
-    return [[self class] AESKeyForPassword:self.password salt:self.salt];
+    for (NSValue *value in [[self.encryptors arrayByAddingObjectsFromArray:self.decryptors] arrayByAddingObjectsFromArray:self.recordCryptors]) {
+        CCCryptorRelease(value.pointerValue);
+    }
+    if (_key) {
+        memset_s(_key, kKeyBufferSize, 0, kKeyBufferSize);
+        free(_key);
+    }
+}
+
+// PBKDF2 is deliberately slow, so the key is derived on first use and then kept for the lifetime of the instance.
+- (const uint8_t *)aesKey
+{
+    @synchronized(self) {
+        if (_key == NULL) {
+            uint8_t *key = malloc(kKeyBufferSize);
+            if (![[self class] deriveKey:key forPassword:self.password salt:self.salt]) {
+                memset_s(key, kKeyBufferSize, 0, kKeyBufferSize);
+                free(key);
+                return NULL;
+            }
+            // Independent sub keys for the record envelope, so it never shares a key with the CBC blob format.
+            static const char kRecordKeyLabel[] = "freshpaint.record.key";
+            static const char kRecordMACKeyLabel[] = "freshpaint.record.mac";
+            CCHmac(kCCHmacAlgSHA256, key, kAlgorithmKeySize, kRecordKeyLabel, strlen(kRecordKeyLabel), key + kAlgorithmKeySize);
+            CCHmac(kCCHmacAlgSHA256, key, kAlgorithmKeySize, kRecordMACKeyLabel, strlen(kRecordMACKeyLabel), key + 2 * kAlgorithmKeySize);
+            _key = key;
+        }
+        return _key;
+    }
 }
 
 - (NSData *)encrypt:(NSData *)data
 {
-    size_t outLength;
-    NSMutableData *cipherData = [NSMutableData dataWithLength:data.length + kAlgorithmBlockSize];
-
-    CCCryptorStatus
-        result = CCCrypt(kCCEncrypt,              // operation
-                         kAlgorithm,              // Algorithm
-                         kCCOptionPKCS7Padding,   // options
-                         self.aesKey.bytes,       // key
-                         self.aesKey.length,      // keylength
-                         self.iv.bytes,           // iv
-                         data.bytes,              // dataIn
-                         data.length,             // dataInLength,
-                         cipherData.mutableBytes, // dataOut
-                         cipherData.length,       // dataOutAvailable
-                         &outLength);             // dataOutMoved
+    return [self crypt:data operation:kCCEncrypt];
+}
+
+- (NSData *)decrypt:(NSData *)data
+{
+    return [self crypt:data operation:kCCDecrypt];
+}
+
+- (BOOL)encryptFromStream:(NSInputStream *)input toStream:(NSOutputStream *)output
+{
+    return [self cryptFromStream:input toStream:output operation:kCCEncrypt];
+}
+
+- (BOOL)decryptFromStream:(NSInputStream *)input toStream:(NSOutputStream *)output
+{
+    return [self cryptFromStream:input toStream:output operation:kCCDecrypt];
+}
+
+- (NSData *)sealRecord:(NSData *)record
+{
+    const uint8_t *key = self.aesKey;
+    if (key == NULL) {
+        return nil;
+    }
+
+    NSMutableData *envelope = [NSMutableData dataWithLength:kRecordHeaderSize + record.length + kRecordTagSize];
+    uint8_t *bytes = envelope.mutableBytes;
+    bytes[0] = kRecordEnvelopeVersion;
+    if (SecRandomCopyBytes(kSecRandomDefault, kRecordNonceSize, bytes + 1) != errSecSuccess) {
+        FPLog(@"Unable to generate record nonce");
+        return nil;
+    }
+    if (![self ctrCrypt:record.bytes length:record.length nonce:bytes + 1 output:bytes + kRecordHeaderSize]) {
+        return nil;
+    }
+
+    uint8_t mac[CC_SHA256_DIGEST_LENGTH];
+    CCHmac(kCCHmacAlgSHA256, key + 2 * kAlgorithmKeySize, kAlgorithmKeySize, bytes, kRecordHeaderSize + record.length, mac);
+    memcpy(bytes + kRecordHeaderSize + record.length, mac, kRecordTagSize);
+    return envelope;
+}
+
+- (NSData *)openRecord:(NSData *)envelope
+{
+    if (envelope.length < kRecordHeaderSize + kRecordTagSize) {
+        return nil;
+    }
+    const uint8_t *bytes = envelope.bytes;
+    if (bytes[0] != kRecordEnvelopeVersion) {
+        FPLog(@"Unsupported record envelope version %d", bytes[0]);
+        return nil;
+    }
+    const uint8_t *key = self.aesKey;
+    if (key == NULL) {
+        return nil;
+    }
+
+    size_t length = envelope.length - kRecordHeaderSize - kRecordTagSize;
+    uint8_t mac[CC_SHA256_DIGEST_LENGTH];
+    CCHmac(kCCHmacAlgSHA256, key + 2 * kAlgorithmKeySize, kAlgorithmKeySize, bytes, kRecordHeaderSize + length, mac);
+    // Constant time comparison of the tag.
+    uint8_t difference = 0;
+    for (NSUInteger i = 0; i < kRecordTagSize; i++) {
+        difference |= mac[i] ^ bytes[kRecordHeaderSize + length + i];
+    }
+    if (difference != 0) {
+        FPLog(@"Record envelope failed authentication");
+        return nil;
+    }
+
+    NSMutableData *record = [NSMutableData dataWithLength:length];
+    if (![self ctrCrypt:bytes + kRecordHeaderSize length:length nonce:bytes + 1 output:record.mutableBytes]) {
+        return nil;
+    }
+    return record;
+}
 
+#pragma mark - Private
+
+// CTR mode is symmetric, so the same call both encrypts and decrypts record bodies.
+- (BOOL)ctrCrypt:(const void *)input length:(size_t)length nonce:(const uint8_t *)nonce output:(void *)output
+{
+    CCCryptorRef cryptor = [self checkoutRecordCryptorWithNonce:nonce];
+    if (cryptor == NULL) {
+        return NO;
+    }
+    size_t moved = 0;
+    CCCryptorStatus result = kCCSuccess;
+    if (length > 0) {
+        result = CCCryptorUpdate(cryptor, input, length, output, length, &moved);
+    }
+    if (result != kCCSuccess) {
+        CCCryptorRelease(cryptor);
+        FPLog(@"Unable to process record envelope: %d", result);
+        return NO;
+    }
+    [self checkinCryptor:cryptor pool:self.recordCryptors];
+    return YES;
+}
+
+- (NSData *)crypt:(NSData *)data operation:(CCOperation)operation
+{
+    CCCryptorRef cryptor = [self checkoutCryptor:operation];
+    if (cryptor == NULL) {
+        return nil;
+    }
+
+    NSMutableData *output = [NSMutableData dataWithLength:CCCryptorGetOutputLength(cryptor, data.length, true)];
+    size_t updateLength = 0;
+    size_t finalLength = 0;
+    CCCryptorStatus result = CCCryptorUpdate(cryptor, data.bytes, data.length, output.mutableBytes, output.length, &updateLength);
     if (result == kCCSuccess) {
-        cipherData.length = outLength;
-    } else {
+        result = CCCryptorFinal(cryptor, (uint8_t *)output.mutableBytes + updateLength, output.length - updateLength, &finalLength);
+    }
+    [self checkinCryptor:cryptor pool:[self poolForOperation:operation]];
+
+    if (result != kCCSuccess) {
         NSError *error = [NSError errorWithDomain:kRNCryptManagerErrorDomain
                                              code:result
                                          userInfo:nil];
-        FPLog(@"Unable to encrypt data", error);
+        FPLog(@"Unable to %@ data %@", operation == kCCEncrypt ? @"encrypt" : @"decrypt", error);
         return nil;
     }
-    return cipherData;
+    output.length = updateLength + finalLength;
+    return output;
 }
 
-- (NSData *)decrypt:(NSData *)data
+- (BOOL)cryptFromStream:(NSInputStream *)input toStream:(NSOutputStream *)output operation:(CCOperation)operation
 {
-    size_t outLength;
-    NSMutableData *decryptedData = [NSMutableData dataWithLength:data.length + kAlgorithmBlockSize];
-
-    CCCryptorStatus
-        result = CCCrypt(kCCDecrypt,                 // operation
-                         kAlgorithm,                 // Algorithm
-                         kCCOptionPKCS7Padding,      // options
-                         self.aesKey.bytes,          // key
-                         self.aesKey.length,         // keylength
-                         self.iv.bytes,              // iv
-                         data.bytes,                 // dataIn
-                         data.length,                // dataInLength,
-                         decryptedData.mutableBytes, // dataOut
-                         decryptedData.length,       // dataOutAvailable
-                         &outLength);                // dataOutMoved
+    CCCryptorRef cryptor = [self checkoutCryptor:operation];
+    if (cryptor == NULL) {
+        return NO;
+    }
 
-    if (result == kCCSuccess) {
-        decryptedData.length = outLength;
-    } else {
+    uint8_t inBuffer[kStreamChunkSize];
+    uint8_t outBuffer[kStreamChunkSize + kAlgorithmBlockSize];
+    size_t moved = 0;
+    CCCryptorStatus result = kCCSuccess;
+    BOOL success = YES;
+
+    [input open];
+    [output open];
+    while (success) {
+        NSInteger read = [input read:inBuffer maxLength:kStreamChunkSize];
+        if (read < 0) {
+            FPLog(@"Unable to read crypto input stream %@", input.streamError);
+            success = NO;
+            break;
+        }
+        if (read == 0) {
+            break;
+        }
+        result = CCCryptorUpdate(cryptor, inBuffer, (size_t)read, outBuffer, sizeof(outBuffer), &moved);
+        success = (result == kCCSuccess) && [self writeBytes:outBuffer length:moved toStream:output];
+    }
+    if (success) {
+        result = CCCryptorFinal(cryptor, outBuffer, sizeof(outBuffer), &moved);
+        success = (result == kCCSuccess) && [self writeBytes:outBuffer length:moved toStream:output];
+    }
+    [input close];
+    [output close];
+    memset_s(inBuffer, sizeof(inBuffer), 0, sizeof(inBuffer));
+    memset_s(outBuffer, sizeof(outBuffer), 0, sizeof(outBuffer));
+    [self checkinCryptor:cryptor pool:[self poolForOperation:operation]];
+
+    if (result != kCCSuccess) {
         NSError *error = [NSError errorWithDomain:kRNCryptManagerErrorDomain
                                              code:result
                                          userInfo:nil];
-        FPLog(@"Unable to decrypt data", error);
-        return nil;
+        FPLog(@"Unable to %@ stream %@", operation == kCCEncrypt ? @"encrypt" : @"decrypt", error);
+    }
+    return success;
+}
+
+- (BOOL)writeBytes:(const uint8_t *)bytes length:(size_t)length toStream:(NSOutputStream *)output
+{
+    size_t written = 0;
+    while (written < length) {
+        NSInteger result = [output write:bytes + written maxLength:length - written];
+        if (result <= 0) {
+            FPLog(@"Unable to write crypto output stream %@", output.streamError);
+            return NO;
+        }
+        written += (size_t)result;
     }
-    return decryptedData;
+    return YES;
+}
+
+- (NSMutableArray<NSValue *> *)poolForOperation:(CCOperation)operation
+{
+    return (operation == kCCEncrypt) ? self.encryptors : self.decryptors;
+}
+
+// Takes a cryptor out of `pool`, or NULL if it is empty.
+- (CCCryptorRef)takeCryptorFromPool:(NSMutableArray<NSValue *> *)pool
+{
+    CCCryptorRef cryptor = NULL;
+    @synchronized(pool) {
+        cryptor = pool.lastObject.pointerValue;
+        if (cryptor) {
+            [pool removeLastObject];
+        }
+    }
+    return cryptor;
+}
+
+// Hands out a cryptor reset to the configured IV, creating one if the pool is empty.
+- (CCCryptorRef)checkoutCryptor:(CCOperation)operation
+{
+    CCCryptorRef cryptor = [self takeCryptorFromPool:[self poolForOperation:operation]];
+    if (cryptor) {
+        if (CCCryptorReset(cryptor, self.iv.bytes) == kCCSuccess) {
+            return cryptor;
+        }
+        CCCryptorRelease(cryptor);
+    }
+
+    const uint8_t *key = self.aesKey;
+    if (key == NULL) {
+        return NULL;
+    }
+    cryptor = NULL;
+    CCCryptorStatus result = CCCryptorCreate(operation,             // operation
+                                             kAlgorithm,            // Algorithm
+                                             kCCOptionPKCS7Padding, // options
+                                             key,                   // key
+                                             kAlgorithmKeySize,     // keylength
+                                             self.iv.bytes,         // iv
+                                             &cryptor);             // cryptorRef
+    if (result != kCCSuccess) {
+        FPLog(@"Unable to create cryptor: %d", result);
+        return NULL;
+    }
+    return cryptor;
+}
+
+// Hands out a CTR cryptor under the record key with its counter set to `nonce`, creating one if the pool is empty.
+- (CCCryptorRef)checkoutRecordCryptorWithNonce:(const uint8_t *)nonce
+{
+    CCCryptorRef cryptor = [self takeCryptorFromPool:self.recordCryptors];
+    if (cryptor) {
+        // Resetting also drops the unused key stream left over from the last record.
+        if (CCCryptorReset(cryptor, nonce) == kCCSuccess) {
+            return cryptor;
+        }
+        CCCryptorRelease(cryptor);
+    }
+
+    const uint8_t *key = self.aesKey;
+    if (key == NULL) {
+        return NULL;
+    }
+    cryptor = NULL;
+    CCCryptorStatus result = CCCryptorCreateWithMode(kCCEncrypt, kCCModeCTR, kAlgorithm, ccNoPadding,
+                                                     nonce, key + kAlgorithmKeySize, kAlgorithmKeySize,
+                                                     NULL, 0, 0, kCCModeOptionCTR_BE, &cryptor);
+    if (result != kCCSuccess) {
+        FPLog(@"Unable to create record cryptor: %d", result);
+        return NULL;
+    }
+    return cryptor;
+}
+
+- (void)checkinCryptor:(CCCryptorRef)cryptor pool:(NSMutableArray<NSValue *> *)pool
+{
+    @synchronized(pool) {
+        if (pool.count < kCryptorPoolSize) {
+            [pool addObject:[NSValue valueWithPointer:cryptor]];
+            return;
+        }
+    }
+    CCCryptorRelease(cryptor);
 }
 
 + (NSData *)randomDataOfLength:(size_t)length
@@ -121,12 +396,17 @@ static const NSUInteger kPBKDFRounds = 10000; // ~80ms on an iPhone 4
     return data;
 }
 
-// Replace this with a 10,000 hash calls if you don't have CCKeyDerivationPBKDF
 + (NSData *)AESKeyForPassword:(NSString *)password
                          salt:(NSData *)salt
 {
     NSMutableData *derivedKey = [NSMutableData dataWithLength:kAlgorithmKeySize];
+    [self deriveKey:derivedKey.mutableBytes forPassword:password salt:salt];
+    return derivedKey;
+}
 
+// Replace this with a 10,000 hash calls if you don't have CCKeyDerivationPBKDF
++ (BOOL)deriveKey:(uint8_t *)derivedKey forPassword:(NSString *)password salt:(NSData *)salt
+{
     int result = CCKeyDerivationPBKDF(kCCPBKDF2,                                                  // algorithm
                                       password.UTF8String,                                        // password
                                       [password lengthOfBytesUsingEncoding:NSUTF8StringEncoding], // passwordLength
@@ -134,15 +414,15 @@ static const NSUInteger kPBKDFRounds = 10000; // ~80ms on an iPhone 4
                                       salt.length,                                                // saltLen
                                       kCCPRFHmacAlgSHA1,                                          // PRF
                                       kPBKDFRounds,                                               // rounds
-                                      derivedKey.mutableBytes,                                    // derivedKey
-                                      derivedKey.length);                                         // derivedKeyLen
+                                      derivedKey,                                                 // derivedKey
+                                      kAlgorithmKeySize);                                         // derivedKeyLen
 
     // Do not log password here
     if (result != kCCSuccess) {
         FPLog(@"Unable to create AES key for password: %d", result);
+        return NO;
     }
-
-    return derivedKey;
+    return YES;
 }
 
 @end
@@ -0,0 +1,41 @@
+//
+//  FPCompactBatchCodec.h
+//  Freshpaint
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Content type of a batch body in the compact encoding.
+extern NSString *const kFPCompactBatchContentType;
+
+/**
+ * Encodes a batch upload in MessagePack instead of JSON.
+ *
+ * The body is a map of three entries, always in this order:
+ *
+ * - `"keys"`: array of every map key used by the events, each stored once.
+ * - `"batch"`: array of the events. Their maps, at every depth, are keyed by the index of the
+ *   key in `"keys"` rather than by the key itself.
+ * - `"sentAt"`: timestamp of the upload.
+ *
+ * String values holding a timestamp in one of the formats the SDK writes, with 3 or 9 fractional
+ * digits, are encoded as integers: ext type 1 holds the milliseconds since 1970 as an int64,
+ * ext type 2 the seconds since 1970 as an int64 followed by the 9 fractional digits as a uint32.
+ * Decoding gives back the exact same string. Everything else maps to its natural MessagePack type.
+ *
+ * The records are the UTF-8 JSON encodings of the events, as queued.
+ */
+@interface FPCompactBatchCodec : NSObject
+
+/// Returns the encoded batch, or nil if a record is not a JSON object.
++ (NSData *_Nullable)encodeRecords:(NSArray<NSData *> *)records sentAt:(NSString *)sentAt;
+
+/// Returns the batch as `{"batch": [...], "sentAt": "..."}` with the same values JSON would give, or nil if
+/// `data` is not a valid compact batch.
++ (NSDictionary *_Nullable)decodeBatch:(NSData *)data;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,566 @@
+//
+//  FPCompactBatchCodec.m
+//  Freshpaint
+//
+
+#import "FPCompactBatchCodec.h"
+
+NSString *const kFPCompactBatchContentType = @"application/vnd.freshpaint.batch+msgpack";
+
+static const int8_t kFPMillisecondTimestampExtType = 1;
+static const int8_t kFPNanosecondTimestampExtType = 2;
+static const NSUInteger kFPMaxDecodingDepth = 64;
+
+
+#pragma mark - Timestamps
+
+// Days since 1970-01-01 of a proleptic Gregorian date, and back.
+static int64_t FPDaysFromCivil(int64_t year, unsigned month, unsigned day)
+{
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yearOfEra = (unsigned)(year - era * 400);
+    unsigned shiftedMonth = month > 2 ? month - 3 : month + 9;
+    unsigned dayOfYear = (153 * shiftedMonth + 2) / 5 + day - 1;
+    unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + (int64_t)dayOfEra - 719468;
+}
+
+static void FPCivilFromDays(int64_t days, int64_t *year, unsigned *month, unsigned *day)
+{
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    unsigned dayOfEra = (unsigned)(days - era * 146097);
+    unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    unsigned shiftedMonth = (5 * dayOfYear + 2) / 153;
+    *day = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+    *month = shiftedMonth < 10 ? shiftedMonth + 3 : shiftedMonth - 9;
+    *year = (int64_t)yearOfEra + era * 400 + (*month <= 2);
+}
+
+// Formats yyyy-MM-ddTHH:mm:ss.<fraction>Z into `buffer`, which holds 32 bytes. Returns the length, or 0 when
+// the year does not take 4 digits.
+static int FPFormatTimestamp(char *buffer, int64_t seconds, uint32_t fraction, int digits)
+{
+    int64_t days = seconds >= 0 ? seconds / 86400 : -((-seconds + 86399) / 86400);
+    int64_t secondOfDay = seconds - days * 86400;
+    int64_t year;
+    unsigned month, day;
+    FPCivilFromDays(days, &year, &month, &day);
+    if (year < 0 || year > 9999) {
+        return 0;
+    }
+    return snprintf(buffer, 32, "%04lld-%02u-%02uT%02u:%02u:%02u.%0*uZ", (long long)year, month, day,
+                    (unsigned)(secondOfDay / 3600), (unsigned)(secondOfDay % 3600 / 60), (unsigned)(secondOfDay % 60),
+                    digits, fraction);
+}
+
+static BOOL FPReadDigits(const char *string, int count, uint32_t *value)
+{
+    uint32_t result = 0;
+    for (int i = 0; i < count; i++) {
+        if (string[i] < '0' || string[i] > '9') {
+            return NO;
+        }
+        result = result * 10 + (uint32_t)(string[i] - '0');
+    }
+    *value = result;
+    return YES;
+}
+
+// Parses the timestamps written by iso8601FormattedString and iso8601NanoFormattedString.
+static BOOL FPParseTimestamp(const char *string, size_t length, int64_t *seconds, uint32_t *fraction, int *digits)
+{
+    if (length != 24 && length != 30) {
+        return NO;
+    }
+    if (string[4] != '-' || string[7] != '-' || string[10] != 'T' || string[13] != ':' || string[16] != ':' || string[19] != '.' || string[length - 1] != 'Z') {
+        return NO;
+    }
+    int count = (int)length - 21;
+    uint32_t year, month, day, hour, minute, second;
+    if (!FPReadDigits(string, 4, &year) || !FPReadDigits(string + 5, 2, &month) || !FPReadDigits(string + 8, 2, &day) ||
+        !FPReadDigits(string + 11, 2, &hour) || !FPReadDigits(string + 14, 2, &minute) || !FPReadDigits(string + 17, 2, &second) ||
+        !FPReadDigits(string + 20, count, fraction)) {
+        return NO;
+    }
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 59) {
+        return NO;
+    }
+    *seconds = FPDaysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    *digits = count;
+    // Only dates that format back to the very same string, so February 30th stays a string.
+    char formatted[32];
+    return FPFormatTimestamp(formatted, *seconds, *fraction, count) == (int)length && memcmp(formatted, string, length) == 0;
+}
+
+
+#pragma mark - Encoding
+
+static inline void FPWriteByte(NSMutableData *output, uint8_t byte)
+{
+    [output appendBytes:&byte length:1];
+}
+
+// Writes the low `width` bytes of `value`, big-endian.
+static void FPWriteBigEndian(NSMutableData *output, uint64_t value, int width)
+{
+    uint8_t bytes[8];
+    for (int i = 0; i < width; i++) {
+        bytes[i] = (uint8_t)(value >> (8 * (width - 1 - i)));
+    }
+    [output appendBytes:bytes length:(NSUInteger)width];
+}
+
+static void FPWriteMarker(NSMutableData *output, uint8_t marker, uint64_t value, int width)
+{
+    FPWriteByte(output, marker);
+    FPWriteBigEndian(output, value, width);
+}
+
+static void FPWriteUnsigned(NSMutableData *output, uint64_t value)
+{
+    if (value < 0x80) {
+        FPWriteByte(output, (uint8_t)value);
+    } else if (value <= UINT8_MAX) {
+        FPWriteMarker(output, 0xcc, value, 1);
+    } else if (value <= UINT16_MAX) {
+        FPWriteMarker(output, 0xcd, value, 2);
+    } else if (value <= UINT32_MAX) {
+        FPWriteMarker(output, 0xce, value, 4);
+    } else {
+        FPWriteMarker(output, 0xcf, value, 8);
+    }
+}
+
+static void FPWriteSigned(NSMutableData *output, int64_t value)
+{
+    if (value >= 0) {
+        FPWriteUnsigned(output, (uint64_t)value);
+    } else if (value >= -32) {
+        FPWriteByte(output, (uint8_t)(int8_t)value);
+    } else if (value >= INT8_MIN) {
+        FPWriteMarker(output, 0xd0, (uint64_t)value, 1);
+    } else if (value >= INT16_MIN) {
+        FPWriteMarker(output, 0xd1, (uint64_t)value, 2);
+    } else if (value >= INT32_MIN) {
+        FPWriteMarker(output, 0xd2, (uint64_t)value, 4);
+    } else {
+        FPWriteMarker(output, 0xd3, (uint64_t)value, 8);
+    }
+}
+
+static void FPWriteContainerHeader(NSMutableData *output, uint8_t fixMarker, uint8_t marker16, NSUInteger count)
+{
+    if (count < 16) {
+        FPWriteByte(output, (uint8_t)(fixMarker | count));
+    } else if (count <= UINT16_MAX) {
+        FPWriteMarker(output, marker16, count, 2);
+    } else {
+        FPWriteMarker(output, marker16 + 1, count, 4);
+    }
+}
+
+
+@interface FPCompactBatchEncoder : NSObject
+@property (nonatomic, strong) NSMutableData *output;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSNumber *> *keyIndexes;
+@property (nonatomic, strong) NSMutableArray<NSString *> *keys;
+@end
+
+@implementation FPCompactBatchEncoder
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        _output = [NSMutableData dataWithCapacity:16384];
+        _keyIndexes = [NSMutableDictionary dictionary];
+        _keys = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)writeString:(NSString *)string detectingTimestamps:(BOOL)detectTimestamps
+{
+    if (detectTimestamps && (string.length == 24 || string.length == 30) && [self writeTimestamp:string]) {
+        return;
+    }
+    NSUInteger length = [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    if (length < 32) {
+        FPWriteByte(self.output, (uint8_t)(0xa0 | length));
+    } else if (length <= UINT8_MAX) {
+        FPWriteMarker(self.output, 0xd9, length, 1);
+    } else if (length <= UINT16_MAX) {
+        FPWriteMarker(self.output, 0xda, length, 2);
+    } else {
+        FPWriteMarker(self.output, 0xdb, length, 4);
+    }
+    // Convert straight into the output rather than through an intermediate buffer.
+    NSUInteger offset = self.output.length;
+    self.output.length += length;
+    [string getBytes:(uint8_t *)self.output.mutableBytes + offset maxLength:length usedLength:NULL encoding:NSUTF8StringEncoding options:0 range:NSMakeRange(0, string.length) remainingRange:NULL];
+}
+
+- (BOOL)writeTimestamp:(NSString *)string
+{
+    char buffer[32];
+    if (![string getCString:buffer maxLength:sizeof(buffer) encoding:NSASCIIStringEncoding]) {
+        return NO;
+    }
+    int64_t seconds;
+    uint32_t fraction;
+    int digits;
+    if (!FPParseTimestamp(buffer, string.length, &seconds, &fraction, &digits)) {
+        return NO;
+    }
+    if (digits == 3) {
+        // fixext 8
+        FPWriteMarker(self.output, 0xd7, (uint8_t)kFPMillisecondTimestampExtType, 1);
+        FPWriteBigEndian(self.output, (uint64_t)(seconds * 1000 + fraction), 8);
+    } else {
+        // ext 8 of 12 bytes
+        FPWriteMarker(self.output, 0xc7, 12, 1);
+        FPWriteByte(self.output, (uint8_t)kFPNanosecondTimestampExtType);
+        FPWriteBigEndian(self.output, (uint64_t)seconds, 8);
+        FPWriteBigEndian(self.output, fraction, 4);
+    }
+    return YES;
+}
+
+- (void)writeNumber:(NSNumber *)number
+{
+    if (CFGetTypeID((__bridge CFTypeRef)number) == CFBooleanGetTypeID()) {
+        FPWriteByte(self.output, number.boolValue ? 0xc3 : 0xc2);
+        return;
+    }
+    char type = number.objCType[0];
+    if (type == 'f' || type == 'd') {
+        double value = number.doubleValue;
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        FPWriteMarker(self.output, 0xcb, bits, 8);
+    } else if (type == 'Q') {
+        FPWriteUnsigned(self.output, number.unsignedLongLongValue);
+    } else {
+        FPWriteSigned(self.output, number.longLongValue);
+    }
+}
+
+- (BOOL)writeObject:(id)object
+{
+    if ([object isKindOfClass:[NSString class]]) {
+        [self writeString:object detectingTimestamps:YES];
+    } else if ([object isKindOfClass:[NSNumber class]]) {
+        [self writeNumber:object];
+    } else if ([object isKindOfClass:[NSNull class]]) {
+        FPWriteByte(self.output, 0xc0);
+    } else if ([object isKindOfClass:[NSArray class]]) {
+        FPWriteContainerHeader(self.output, 0x90, 0xdc, [object count]);
+        for (id element in object) {
+            if (![self writeObject:element]) {
+                return NO;
+            }
+        }
+    } else if ([object isKindOfClass:[NSDictionary class]]) {
+        FPWriteContainerHeader(self.output, 0x80, 0xde, [object count]);
+        for (NSString *key in object) {
+            NSNumber *index = self.keyIndexes[key];
+            if (index == nil) {
+                index = @(self.keys.count);
+                self.keyIndexes[key] = index;
+                [self.keys addObject:key];
+            }
+            FPWriteUnsigned(self.output, index.unsignedLongLongValue);
+            if (![self writeObject:[object objectForKey:key]]) {
+                return NO;
+            }
+        }
+    } else {
+        return NO;
+    }
+    return YES;
+}
+
+@end
+
+
+#pragma mark - Decoding
+
+@interface FPCompactBatchDecoder : NSObject {
+    const uint8_t *_bytes;
+    NSUInteger _length;
+    NSUInteger _offset;
+}
+@property (nonatomic, copy) NSArray<NSString *> *keys;
+@end
+
+@implementation FPCompactBatchDecoder
+
+- (instancetype)initWithData:(NSData *)data
+{
+    if (self = [super init]) {
+        _bytes = data.bytes;
+        _length = data.length;
+    }
+    return self;
+}
+
+- (BOOL)isAtEnd
+{
+    return _offset == _length;
+}
+
+- (BOOL)readByte:(uint8_t *)byte
+{
+    if (_offset >= _length) {
+        return NO;
+    }
+    *byte = _bytes[_offset++];
+    return YES;
+}
+
+- (BOOL)readBigEndian:(int)width value:(uint64_t *)value
+{
+    if (_length - _offset < (NSUInteger)width) {
+        return NO;
+    }
+    uint64_t result = 0;
+    for (int i = 0; i < width; i++) {
+        result = (result << 8) | _bytes[_offset++];
+    }
+    *value = result;
+    return YES;
+}
+
+- (NSString *)readStringOfLength:(uint64_t)length
+{
+    if (_length - _offset < length) {
+        return nil;
+    }
+    NSString *string = [[NSString alloc] initWithBytes:_bytes + _offset length:(NSUInteger)length encoding:NSUTF8StringEncoding];
+    _offset += (NSUInteger)length;
+    return string;
+}
+
+- (NSString *)readTimestampOfType:(int8_t)type length:(uint64_t)length
+{
+    uint64_t first, second = 0;
+    char buffer[32];
+    int formatted = 0;
+    if (type == kFPMillisecondTimestampExtType && length == 8 && [self readBigEndian:8 value:&first]) {
+        int64_t milliseconds = (int64_t)first;
+        int64_t seconds = milliseconds >= 0 ? milliseconds / 1000 : -((-milliseconds + 999) / 1000);
+        formatted = FPFormatTimestamp(buffer, seconds, (uint32_t)(milliseconds - seconds * 1000), 3);
+    } else if (type == kFPNanosecondTimestampExtType && length == 12 && [self readBigEndian:8 value:&first] && [self readBigEndian:4 value:&second]) {
+        formatted = second <= 999999999 ? FPFormatTimestamp(buffer, (int64_t)first, (uint32_t)second, 9) : 0;
+    }
+    return formatted > 0 ? [[NSString alloc] initWithBytes:buffer length:(NSUInteger)formatted encoding:NSASCIIStringEncoding] : nil;
+}
+
+- (NSArray *)readArrayOfCount:(uint64_t)count depth:(NSUInteger)depth
+{
+    // Every element takes at least a byte, which bounds the capacity by the data left.
+    if (count > _length - _offset) {
+        return nil;
+    }
+    NSMutableArray *array = [NSMutableArray arrayWithCapacity:(NSUInteger)count];
+    for (uint64_t i = 0; i < count; i++) {
+        id element = [self readObjectAtDepth:depth + 1];
+        if (element == nil) {
+            return nil;
+        }
+        [array addObject:element];
+    }
+    return array;
+}
+
+- (NSDictionary *)readMapOfCount:(uint64_t)count depth:(NSUInteger)depth
+{
+    if (count > _length - _offset) {
+        return nil;
+    }
+    NSMutableDictionary *map = [NSMutableDictionary dictionaryWithCapacity:(NSUInteger)count];
+    for (uint64_t i = 0; i < count; i++) {
+        id key = [self readObjectAtDepth:depth + 1];
+        if ([key isKindOfClass:[NSNumber class]]) {
+            uint64_t index = [key unsignedLongLongValue];
+            key = index < self.keys.count ? self.keys[(NSUInteger)index] : nil;
+        }
+        if (![key isKindOfClass:[NSString class]]) {
+            return nil;
+        }
+        id value = [self readObjectAtDepth:depth + 1];
+        if (value == nil) {
+            return nil;
+        }
+        map[key] = value;
+    }
+    return map;
+}
+
+// Returns nil on malformed input; MessagePack nil reads as NSNull.
+- (id)readObjectAtDepth:(NSUInteger)depth
+{
+    uint8_t marker;
+    if (depth > kFPMaxDecodingDepth || ![self readByte:&marker]) {
+        return nil;
+    }
+    if (marker <= 0x7f) {
+        return @(marker);
+    }
+    if (marker >= 0xe0) {
+        return @((int8_t)marker);
+    }
+    if ((marker & 0xe0) == 0xa0) {
+        return [self readStringOfLength:marker & 0x1f];
+    }
+    if ((marker & 0xf0) == 0x90) {
+        return [self readArrayOfCount:marker & 0x0f depth:depth];
+    }
+    if ((marker & 0xf0) == 0x80) {
+        return [self readMapOfCount:marker & 0x0f depth:depth];
+    }
+
+    uint64_t value = 0;
+    switch (marker) {
+        case 0xc0:
+            return [NSNull null];
+        case 0xc2:
+            return @NO;
+        case 0xc3:
+            return @YES;
+        case 0xcc:
+        case 0xcd:
+        case 0xce:
+        case 0xcf: {
+            int width = 1 << (marker - 0xcc);
+            return [self readBigEndian:width value:&value] ? @(value) : nil;
+        }
+        case 0xd0:
+        case 0xd1:
+        case 0xd2:
+        case 0xd3: {
+            int width = 1 << (marker - 0xd0);
+            if (![self readBigEndian:width value:&value]) {
+                return nil;
+            }
+            int shift = 64 - 8 * width;
+            return @((int64_t)(value << shift) >> shift);
+        }
+        case 0xca: {
+            if (![self readBigEndian:4 value:&value]) {
+                return nil;
+            }
+            uint32_t bits = (uint32_t)value;
+            float number;
+            memcpy(&number, &bits, sizeof(number));
+            return @((double)number);
+        }
+        case 0xcb: {
+            if (![self readBigEndian:8 value:&value]) {
+                return nil;
+            }
+            double number;
+            memcpy(&number, &value, sizeof(number));
+            return @(number);
+        }
+        case 0xd9:
+        case 0xda:
+        case 0xdb: {
+            int width = 1 << (marker - 0xd9);
+            return [self readBigEndian:width value:&value] ? [self readStringOfLength:value] : nil;
+        }
+        case 0xdc:
+        case 0xdd:
+            return [self readBigEndian:(marker == 0xdc ? 2 : 4) value:&value] ? [self readArrayOfCount:value depth:depth] : nil;
+        case 0xde:
+        case 0xdf:
+            return [self readBigEndian:(marker == 0xde ? 2 : 4) value:&value] ? [self readMapOfCount:value depth:depth] : nil;
+        case 0xd7: {
+            uint8_t type;
+            return [self readByte:&type] ? [self readTimestampOfType:(int8_t)type length:8] : nil;
+        }
+        case 0xc7: {
+            uint8_t length, type;
+            return [self readByte:&length] && [self readByte:&type] ? [self readTimestampOfType:(int8_t)type length:length] : nil;
+        }
+        default:
+            return nil;
+    }
+}
+
+@end
+
+
+@implementation FPCompactBatchCodec
+
++ (NSData *)encodeRecords:(NSArray<NSData *> *)records sentAt:(NSString *)sentAt
+{
+    FPCompactBatchEncoder *encoder = [[FPCompactBatchEncoder alloc] init];
+    for (NSData *record in records) {
+        id event = [NSJSONSerialization JSONObjectWithData:record options:0 error:nil];
+        if (![event isKindOfClass:[NSDictionary class]] || ![encoder writeObject:event]) {
+            return nil;
+        }
+    }
+
+    // The key table goes first so that a decoder can resolve the events as it reads them.
+    NSMutableData *events = encoder.output;
+    NSMutableData *body = [NSMutableData dataWithCapacity:events.length + encoder.keys.count * 16 + 64];
+    encoder.output = body;
+    FPWriteByte(body, 0x83);
+    [encoder writeString:@"keys" detectingTimestamps:NO];
+    FPWriteContainerHeader(body, 0x90, 0xdc, encoder.keys.count);
+    for (NSString *key in encoder.keys) {
+        [encoder writeString:key detectingTimestamps:NO];
+    }
+    [encoder writeString:@"batch" detectingTimestamps:NO];
+    FPWriteContainerHeader(body, 0x90, 0xdc, records.count);
+    [body appendData:events];
+    [encoder writeString:@"sentAt" detectingTimestamps:NO];
+    [encoder writeString:sentAt detectingTimestamps:YES];
+    return body;
+}
+
++ (NSDictionary *)decodeBatch:(NSData *)data
+{
+    FPCompactBatchDecoder *decoder = [[FPCompactBatchDecoder alloc] initWithData:data];
+    uint8_t marker;
+    if (![decoder readByte:&marker] || marker != 0x83) {
+        return nil;
+    }
+    NSMutableDictionary *batch = [NSMutableDictionary dictionaryWithCapacity:2];
+    for (NSUInteger i = 0; i < 3; i++) {
+        NSString *name = [decoder readObjectAtDepth:0];
+        if ([name isEqual:@"keys"]) {
+            NSArray *keys = [decoder readObjectAtDepth:0];
+            if (![keys isKindOfClass:[NSArray class]]) {
+                return nil;
+            }
+            for (id key in keys) {
+                if (![key isKindOfClass:[NSString class]]) {
+                    return nil;
+                }
+            }
+            decoder.keys = keys;
+        } else if ([name isEqual:@"batch"] && decoder.keys != nil) {
+            id events = [decoder readObjectAtDepth:0];
+            if (![events isKindOfClass:[NSArray class]]) {
+                return nil;
+            }
+            batch[@"batch"] = events;
+        } else if ([name isEqual:@"sentAt"]) {
+            id sentAt = [decoder readObjectAtDepth:0];
+            if (![sentAt isKindOfClass:[NSString class]]) {
+                return nil;
+            }
+            batch[@"sentAt"] = sentAt;
+        } else {
+            return nil;
+        }
+    }
+    return batch.count == 2 && [decoder isAtEnd] ? batch : nil;
+}
+
+@end
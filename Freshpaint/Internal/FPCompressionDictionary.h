@@ -0,0 +1,34 @@
+//
+//  FPCompressionDictionary.h
+//  Freshpaint
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// `Content-Encoding` of a batch body deflated with the preset dictionary.
+extern NSString *const kFPCompressionDictionaryContentEncoding;
+/// Header naming the version of the dictionary a body was deflated with.
+extern NSString *const kFPCompressionDictionaryHeader;
+/// Version of the dictionary returned by `+dictionaryData`.
+extern NSString *const kFPCompressionDictionaryVersion;
+
+/**
+ * Preset dictionary for deflating batch bodies, built from the payload the SDK sends: the batch envelope, the keys
+ * of every event type, the `context` field names and the values that never change, such as the library name.
+ *
+ * Small batches give deflate too little input to find those repeats on its own. With the dictionary, even the first
+ * event of a batch is mostly back-references. Bodies are zlib streams (RFC 1950) whose header carries the Adler-32
+ * of the dictionary, which the server can check against the version it was told.
+ *
+ * The contents of a version never change; the server keeps every version it accepts. Any change to the dictionary
+ * gets a new version.
+ */
+@interface FPCompressionDictionary : NSObject
+
++ (NSData *)dictionaryData;
+
+@end
+
+NS_ASSUME_NONNULL_END
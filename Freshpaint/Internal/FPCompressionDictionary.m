@@ -0,0 +1,52 @@
+//
+//  FPCompressionDictionary.m
+//  Freshpaint
+//
+
+#import "FPCompressionDictionary.h"
+
+NSString *const kFPCompressionDictionaryContentEncoding = @"x-freshpaint-deflate";
+NSString *const kFPCompressionDictionaryHeader = @"X-Freshpaint-Dictionary";
+NSString *const kFPCompressionDictionaryVersion = @"1";
+
+// Version 1. Deflate finds short distances cheaper, so the strings every event repeats come last.
+static const char kFPCompressionDictionaryV1[] =
+    "\"type\":\"alias\",\"previousId\":\""
+    "\"type\":\"group\",\"groupId\":\""
+    "\"referrer\":{\"type\":\"iad\",\"url\":\""
+    "\"apple_ads_token\":\"\",\"persistent_device_id\":\""
+    "\"event\":\"Application Installed\",\"properties\":{\"build\":\"\",\"version\":\""
+    "\"event\":\"Application Updated\",\"properties\":{\"previous_build\":\"\",\"previous_version\":\""
+    "\"event\":\"Application Opened\",\"properties\":{\"from_background\":false,\"referring_application\":\"\",\"url\":\""
+    "\"event\":\"Application Backgrounded\""
+    "\"traits\":{\"email\":\"\",\"name\":\"\",\"plan\":\"\",\"created_at\":\""
+    "\"type\":\"identify\",\"userId\":\""
+    "\"type\":\"screen\",\"name\":\""
+    "\"device\":{\"adTrackingEnabled\":false,\"advertisingId\":\"00000000-0000-0000-0000-000000000000\",\"token\":\""
+    "\"network\":{\"bluetooth\":false,\"carrier\":\"\",\"cellular\":true,\"wifi\":false},"
+    "\"context\":{\"app\":{\"build\":\"\",\"name\":\"\",\"namespace\":\"\",\"version\":\"\"},"
+    "\"device\":{\"id\":\"\",\"idfv\":\"\",\"manufacturer\":\"Apple\",\"model\":\"iPhone\",\"name\":\"iPhone\",\"type\":\"ios\"},"
+    "\"library\":{\"name\":\"analytics-ios\",\"version\":\"\"},\"locale\":\"en-US\",\"network\":{\"cellular\":false,\"wifi\":true},"
+    "\"os\":{\"name\":\"iOS\",\"version\":\"\"},\"screen\":{\"height\":,\"width\":},\"timezone\":\"America/\","
+    "\"userAgent\":\" (iPhone; iOS \"},"
+    "\"integrations\":{},\"properties\":{\"$is_first_event_in_session\":false,\"$session_id\":\""
+    "\"messageId\":\"\",\"timestamp\":\"20\",\"type\":\"track\",\"event\":\""
+    "],\"sentAt\":\"20"
+    "{\"batch\":[{\"anonymousId\":\""
+    "},{\"anonymousId\":\"";
+
+
+@implementation FPCompressionDictionary
+
++ (NSData *)dictionaryData
+{
+    static NSData *data;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        // Without the terminating NUL.
+        data = [NSData dataWithBytes:kFPCompressionDictionaryV1 length:sizeof(kFPCompressionDictionaryV1) - 1];
+    });
+    return data;
+}
+
+@end
@@ -0,0 +1,31 @@
+//
+//  FPDeliveryMetrics+FPRecording.h
+//  Freshpaint
+//
+//  Internal-only category. Lets the delivery pipeline update the public
+//  counters. Do NOT import from public-facing files.
+//
+
+#import "FPDeliveryMetrics.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@interface FPDeliveryMetrics (FPRecording)
+
+- (void)fp_recordOversizedEventsDropped:(NSUInteger)count;
+- (void)fp_recordOversizedEventsTruncated:(NSUInteger)count;
+- (void)fp_recordQueueOverflowEventsDropped:(NSUInteger)count;
+- (void)fp_recordQueueOverflowCriticalEventsDropped:(NSUInteger)count;
+- (void)fp_recordUploadSucceeded;
+- (void)fp_recordUploadFailedWithConsecutiveFailures:(NSUInteger)consecutiveFailures circuitBreakerOpen:(BOOL)circuitBreakerOpen nextAttemptDate:(NSDate *_Nullable)nextAttemptDate;
+- (void)fp_recordUploadWithConnectionSetupDuration:(NSTimeInterval)connectionSetupDuration transferDuration:(NSTimeInterval)transferDuration reusedConnection:(BOOL)reusedConnection;
+
+- (void)fp_recordDispatchWithLag:(NSTimeInterval)lag;
+- (void)fp_recordDispatchDropped;
+
+/// Counters of the destination `key`, created on first use.
+- (FPDeliveryMetrics *)fp_metricsForDestination:(NSString *)key;
+
+@end
+
+NS_ASSUME_NONNULL_END
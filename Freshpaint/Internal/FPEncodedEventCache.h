@@ -0,0 +1,42 @@
+//
+//  FPEncodedEventCache.h
+//  Freshpaint
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Encodes the events sent to webhook destinations once, however many destinations get them.
+ *
+ * An event is cached by `messageId`, as its top level members along with the JSON encoding of each of them. The
+ * destinations asking for the same event get the same bytes back. A destination whose copy differs, e.g. after its
+ * destination middleware ran, only has the members that differ encoded; the cached bytes of the other members are
+ * reused and the record is put together from the pieces. Members are compared by identity, then with `isEqual:`.
+ *
+ * Each destination runs on its own queue, and they fall behind one another by only a few events when none is stalled.
+ * Only the `capacity` most recent events are kept; a destination further behind encodes its events itself.
+ *
+ * Thread safe.
+ */
+@interface FPEncodedEventCache : NSObject
+
+@property (nonatomic, assign, readonly) NSUInteger capacity;
+/// Top level members encoded so far.
+@property (atomic, assign, readonly) NSUInteger encodedMemberCount;
+
+/// The cache shared by the webhook destinations.
++ (instancetype)sharedCache;
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+/// JSON encoding of `event`, or nil if it cannot be encoded. Events without a `messageId` are not cached.
+- (NSData *_Nullable)recordForEvent:(NSDictionary *)event messageId:(NSString *_Nullable)messageId;
+
+- (void)removeAllEvents;
+
+@end
+
+NS_ASSUME_NONNULL_END
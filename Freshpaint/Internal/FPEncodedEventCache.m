@@ -0,0 +1,160 @@
+//
+//  FPEncodedEventCache.m
+//  Freshpaint
+//
+
+#import "FPEncodedEventCache.h"
+#import "FPUtils.h"
+
+// Events the destinations of a fan out can still ask for while the slower ones catch up.
+static const NSUInteger kFPEncodedEventCacheDefaultCapacity = 256;
+
+
+@interface FPEncodedEvent : NSObject
+@property (nonatomic, copy) NSDictionary *members;
+// `"key":value` of every member.
+@property (nonatomic, copy) NSDictionary<NSString *, NSData *> *fragments;
+@property (nonatomic, strong) NSData *record;
+@end
+
+@implementation FPEncodedEvent
+@end
+
+
+@interface FPEncodedEventCache ()
+@property (nonatomic, assign, readwrite) NSUInteger capacity;
+@property (atomic, assign, readwrite) NSUInteger encodedMemberCount;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, FPEncodedEvent *> *events;
+// Message ids, oldest first.
+@property (nonatomic, strong) NSMutableArray<NSString *> *messageIds;
+@end
+
+
+@implementation FPEncodedEventCache
+
++ (instancetype)sharedCache
+{
+    static FPEncodedEventCache *cache;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        cache = [[FPEncodedEventCache alloc] initWithCapacity:kFPEncodedEventCacheDefaultCapacity];
+    });
+    return cache;
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity
+{
+    if (self = [super init]) {
+        _capacity = MAX(capacity, 1u);
+        _events = [NSMutableDictionary dictionaryWithCapacity:_capacity];
+        _messageIds = [NSMutableArray arrayWithCapacity:_capacity];
+    }
+    return self;
+}
+
+- (NSData *)recordForEvent:(NSDictionary *)event messageId:(NSString *)messageId
+{
+    FPEncodedEvent *cached = nil;
+    if (messageId != nil) {
+        @synchronized(self) {
+            cached = self.events[messageId];
+        }
+    }
+
+    NSMutableDictionary<NSString *, NSData *> *fragments = [NSMutableDictionary dictionaryWithCapacity:event.count];
+    __block BOOL unchanged = cached != nil && cached.members.count == event.count;
+    __block BOOL failed = NO;
+    [event enumerateKeysAndObjectsUsingBlock:^(NSString *key, id value, BOOL *stop) {
+        id cachedValue = cached.members[key];
+        NSData *fragment = nil;
+        if (cachedValue != nil && (cachedValue == value || [cachedValue isEqual:value])) {
+            fragment = cached.fragments[key];
+        } else {
+            fragment = [self fragmentForKey:key value:value];
+            unchanged = NO;
+        }
+        if (fragment == nil) {
+            failed = YES;
+            *stop = YES;
+            return;
+        }
+        fragments[key] = fragment;
+    }];
+    if (failed) {
+        return nil;
+    }
+    if (unchanged) {
+        return cached.record;
+    }
+
+    NSMutableData *body = [NSMutableData dataWithCapacity:cached.record.length ?: 1024];
+    [body appendBytes:"{" length:1];
+    __block BOOL first = YES;
+    [fragments enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSData *fragment, BOOL *stop) {
+        if (!first) {
+            [body appendBytes:"," length:1];
+        }
+        first = NO;
+        [body appendData:fragment];
+    }];
+    [body appendBytes:"}" length:1];
+    NSData *record = [body copy];
+
+    // The first copy asked for is the one the others are compared with.
+    if (messageId != nil && cached == nil) {
+        FPEncodedEvent *encoded = [[FPEncodedEvent alloc] init];
+        encoded.members = event;
+        encoded.fragments = fragments;
+        encoded.record = record;
+        [self cacheEvent:encoded messageId:messageId];
+    }
+    return record;
+}
+
+- (void)removeAllEvents
+{
+    @synchronized(self) {
+        [self.events removeAllObjects];
+        [self.messageIds removeAllObjects];
+    }
+}
+
+#pragma mark - Private
+
+- (void)cacheEvent:(FPEncodedEvent *)event messageId:(NSString *)messageId
+{
+    @synchronized(self) {
+        if (self.events[messageId] == nil) {
+            [self.messageIds addObject:messageId];
+        }
+        self.events[messageId] = event;
+        while (self.messageIds.count > self.capacity) {
+            [self.events removeObjectForKey:self.messageIds.firstObject];
+            [self.messageIds removeObjectAtIndex:0];
+        }
+    }
+}
+
+// `"key":value`, cut out of the encoding of a single member object.
+- (NSData *)fragmentForKey:(NSString *)key value:(id)value
+{
+    NSError *error = nil;
+    NSData *data = nil;
+    @try {
+        data = [NSJSONSerialization dataWithJSONObject:@{ key : value } options:0 error:&error];
+    }
+    @catch (NSException *exception) {
+        FPLog(@"Error serializing JSON member %@: %@", key, exception);
+        return nil;
+    }
+    if (data.length < 2) {
+        FPLog(@"Error serializing JSON member %@: %@", key, error);
+        return nil;
+    }
+    @synchronized(self) {
+        self.encodedMemberCount += 1;
+    }
+    return [data subdataWithRange:NSMakeRange(1, data.length - 2)];
+}
+
+@end
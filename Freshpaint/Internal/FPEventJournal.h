@@ -0,0 +1,99 @@
+//
+//  FPEventJournal.h
+//  Freshpaint
+//
+
+#import <Foundation/Foundation.h>
+#import "FPCrypto.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Append-only, segmented on-disk log backing the event queue.
+ *
+ * Each enqueue appends a single length-prefixed record to the active segment file
+ * instead of rewriting the whole queue. Acknowledging records advances a small
+ * persisted cursor; segments that fall entirely behind the cursor are deleted by a
+ * compaction pass that runs on a low priority queue, off the enqueue path.
+ *
+ * With a crypto configured every record is encrypted on its own, through the record
+ * envelope of FPCrypto when implemented, so the cost tracks the records touched.
+ *
+ * Layout of the journal folder:
+ *   <segment id>.seg  - records, each a 4 byte big-endian length followed by the payload. The top
+ *                       byte of the length carries the record flags, and marks removed records.
+ *   <segment id>.idx  - offsets and lengths of the records of a sealed segment, written when it is
+ *                       rolled, so that opening the journal does not have to scan it.
+ *   cursor            - segment id, byte offset and sequence number of the oldest unacknowledged record.
+ *
+ * Opening the journal only reads the indexes, the cursor and the active segment. Records can be read
+ * one at a time with `recordAtSequence:`, which decrypts only the record asked for.
+ *
+ * Every record is numbered in append order. Sequence numbers keep increasing across launches
+ * and are never reused, even after `removeAllRecords`. A record removed ahead of the cursor, with
+ * `removeRecordAtSequence:`, keeps its number; its prefix is rewritten in place to mark it.
+ *
+ * The journal is not thread safe; callers are expected to serialize access
+ * (FPFreshpaintIntegration only touches it from its serial queue).
+ */
+NS_SWIFT_NAME(EventJournal)
+@interface FPEventJournal : NSObject
+
+@property (nonatomic, strong, readonly) NSURL *folderURL;
+@property (nonatomic, strong, readonly, nullable) id<FPCrypto> crypto;
+
+/// Number of records that have been appended but not yet acknowledged.
+@property (nonatomic, assign, readonly) NSUInteger count;
+
+/// Sequence number of the oldest unacknowledged record; the next record appended gets `firstSequence + count`.
+@property (nonatomic, assign, readonly) uint64_t firstSequence;
+
+- (instancetype)initWithFolder:(NSURL *)folderURL crypto:(id<FPCrypto> _Nullable)crypto;
+
+/// Creation time of the segment holding the oldest unacknowledged record, nil when there is none.
+@property (nonatomic, strong, readonly, nullable) NSDate *oldestRecordDate;
+
+/// When YES, appended records are kept in memory until `commit`, which writes them all at once; they can be read
+/// back meanwhile. When NO, the default, every record is written to the active segment as it is appended.
+@property (nonatomic, assign) BOOL buffersWrites;
+
+/// Appends a single record to the end of the journal.
+- (BOOL)appendRecord:(NSData *)record;
+
+/// Appends a record along with 6 bits of flags kept in the index, readable without decoding the record.
+- (BOOL)appendRecord:(NSData *)record flags:(uint8_t)flags;
+
+/// Reads and decodes a single pending record. Returns nil if it is not pending or cannot be read.
+- (NSData *_Nullable)recordAtSequence:(uint64_t)sequence;
+
+/// Flags the pending record was appended with. Returns NO for records written before flags existed.
+- (BOOL)getFlags:(uint8_t *)flags ofRecordAtSequence:(uint64_t)sequence;
+
+/// Marks a pending record removed, on disk too, without acknowledging the records before it. It is not
+/// read again, here or after a relaunch, and is acknowledged along with its neighbours.
+- (void)removeRecordAtSequence:(uint64_t)sequence;
+
+/// Whether the pending record was removed with `removeRecordAtSequence:`.
+- (BOOL)isRecordRemovedAtSequence:(uint64_t)sequence;
+
+/// Returns all unacknowledged records that were not removed, oldest first.
+- (NSArray<NSData *> *)pendingRecords;
+
+/// Marks the `count` oldest records as acknowledged and advances the persisted cursor.
+- (void)acknowledgeRecords:(NSUInteger)count;
+
+/// Marks every record numbered below `sequence` as acknowledged.
+- (void)acknowledgeRecordsBeforeSequence:(uint64_t)sequence;
+
+/// Drops every record and deletes all segment files.
+- (void)removeAllRecords;
+
+/// Writes the records buffered by `buffersWrites` to the active segment.
+- (void)commit;
+
+/// Commits, then flushes the writes of the active segment to stable storage.
+- (void)synchronize;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,753 @@
+//
+//  FPEventJournal.m
+//  Freshpaint
+//
+
+#import "FPEventJournal.h"
+#import "FPUtils.h"
+
+static NSString *const kFPJournalSegmentExtension = @"seg";
+static NSString *const kFPJournalIndexExtension = @"idx";
+static NSString *const kFPJournalCursorFilename = @"cursor";
+
+// Segments are rolled once they grow past this size so that acknowledged data
+// can be reclaimed by deleting whole files.
+static const uint64_t kFPJournalSegmentMaxSize = 256 * 1024;
+static const NSUInteger kFPJournalLengthPrefixSize = sizeof(uint32_t);
+
+// The top byte of a length prefix carries the record flags, marked by its high bit. Records
+// written before flags existed have a zero top byte.
+static const uint32_t kFPJournalFlagsPresent = 0x80000000;
+static const uint32_t kFPJournalLengthMask = 0x00FFFFFF;
+// Set in the prefix of a record removed ahead of the cursor. It keeps its sequence number but is never read again.
+static const uint32_t kFPJournalRecordRemoved = 0x40000000;
+static const uint8_t kFPJournalCallerFlagsMask = 0x3F;
+
+// Index of a sealed segment: magic, record count and creation time in milliseconds, followed by
+// the offset and length prefix of every record. All values big-endian.
+static const uint32_t kFPJournalIndexMagic = 0x46504A58; // "FPJX"
+static const NSUInteger kFPJournalIndexHeaderSize = 2 * sizeof(uint32_t) + sizeof(uint64_t);
+static const NSUInteger kFPJournalIndexEntrySize = 2 * sizeof(uint32_t);
+
+typedef struct {
+    uint64_t segment;
+    uint64_t offset; // offset of the length prefix within the segment
+    uint32_t length; // length of the payload following the prefix
+    uint32_t entry;  // position of the record in the index of its segment
+    uint8_t tag;     // top byte of the length prefix
+} FPJournalLocation;
+
+static uint32_t FPJournalLengthOfPrefix(uint32_t prefix)
+{
+    return (prefix & kFPJournalFlagsPresent) ? (prefix & kFPJournalLengthMask) : prefix;
+}
+
+
+@interface FPEventJournal ()
+
+@property (nonatomic, strong, readwrite) NSURL *folderURL;
+@property (nonatomic, strong, readwrite, nullable) id<FPCrypto> crypto;
+// Packed array of FPJournalLocation for every record at or after `headIndex`.
+@property (nonatomic, strong) NSMutableData *locations;
+@property (nonatomic, assign) NSUInteger headIndex;
+@property (nonatomic, assign, readwrite) uint64_t firstSequence;
+@property (nonatomic, assign) uint64_t oldestSegment;
+@property (nonatomic, assign) uint64_t activeSegment;
+// Size of the active segment, buffered records included.
+@property (nonatomic, assign) uint64_t activeSize;
+@property (nonatomic, strong, nullable) NSFileHandle *activeHandle;
+// Frames appended to the active segment that are not written yet, see `buffersWrites`.
+@property (nonatomic, strong) NSMutableData *bufferedFrames;
+// Offset and length prefix of every record of the active segment, written out as its index when it is rolled.
+@property (nonatomic, strong) NSMutableData *activeEntries;
+// Creation time of the segments, as far as known.
+@property (nonatomic, strong) NSMutableDictionary<NSNumber *, NSDate *> *segmentDates;
+// Segment currently open for lazy reads.
+@property (nonatomic, strong, nullable) NSFileHandle *readHandle;
+@property (nonatomic, assign) uint64_t readSegment;
+// Sealed segment, and its index, the last removed record was marked in. Removals come in runs from the same segment.
+@property (nonatomic, strong, nullable) NSFileHandle *removalHandle;
+@property (nonatomic, strong, nullable) NSFileHandle *removalIndexHandle;
+@property (nonatomic, assign) uint64_t removalSegment;
+@property (nonatomic, strong) dispatch_queue_t compactionQueue;
+
+@end
+
+
+@implementation FPEventJournal
+
+- (instancetype)initWithFolder:(NSURL *)folderURL crypto:(id<FPCrypto>)crypto
+{
+    if (self = [super init]) {
+        _folderURL = folderURL;
+        _crypto = crypto;
+        _locations = [NSMutableData data];
+        _activeEntries = [NSMutableData data];
+        _bufferedFrames = [NSMutableData data];
+        _segmentDates = [NSMutableDictionary dictionary];
+        _compactionQueue = dispatch_queue_create("io.freshpaint.analytics.journal.compaction",
+                                                 dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0));
+        [self createFolderIfNeeded];
+        [self load];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self commit];
+    [self closeActiveSegment];
+    [self.readHandle closeFile];
+    [self closeRemovalHandles];
+}
+
+- (NSUInteger)count
+{
+    return self.locations.length / sizeof(FPJournalLocation) - self.headIndex;
+}
+
+#pragma mark - Writing
+
+- (BOOL)appendRecord:(NSData *)record
+{
+    return [self appendRecord:record flags:0];
+}
+
+- (BOOL)appendRecord:(NSData *)record flags:(uint8_t)flags
+{
+    NSData *payload = [self encodeRecord:record];
+    if (payload == nil) {
+        FPLog(@"Unable to encrypt journal record, dropping it.");
+        return NO;
+    }
+    if (payload.length > kFPJournalLengthMask) {
+        FPLog(@"Journal record of %lu bytes is too large, dropping it.", (unsigned long)payload.length);
+        return NO;
+    }
+
+    if (self.activeSize >= kFPJournalSegmentMaxSize) {
+        [self rollSegment];
+    }
+    NSFileHandle *handle = [self openActiveSegment];
+    if (handle == nil) {
+        return NO;
+    }
+
+    uint32_t prefix = kFPJournalFlagsPresent | ((uint32_t)(flags & kFPJournalCallerFlagsMask) << 24) | (uint32_t)payload.length;
+    uint32_t bigEndianPrefix = CFSwapInt32HostToBig(prefix);
+    NSMutableData *frame = [NSMutableData dataWithCapacity:kFPJournalLengthPrefixSize + payload.length];
+    [frame appendBytes:&bigEndianPrefix length:kFPJournalLengthPrefixSize];
+    [frame appendData:payload];
+
+    if (self.buffersWrites) {
+        [self.bufferedFrames appendData:frame];
+    } else {
+        @try {
+            [handle writeData:frame];
+        } @catch (NSException *exception) {
+            FPLog(@"Unable to append to journal segment %llu: %@", self.activeSegment, exception);
+            [self closeActiveSegment];
+            return NO;
+        }
+    }
+
+    if (self.activeSize == 0) {
+        self.segmentDates[@(self.activeSegment)] = [NSDate date];
+    }
+    FPJournalLocation location = {self.activeSegment, self.activeSize, (uint32_t)payload.length, [self activeEntryCount], (uint8_t)(prefix >> 24)};
+    [self.locations appendBytes:&location length:sizeof(location)];
+    [self appendActiveEntryWithOffset:self.activeSize prefix:prefix];
+    self.activeSize += frame.length;
+    return YES;
+}
+
+- (void)removeRecordAtSequence:(uint64_t)sequence
+{
+    if (sequence < self.firstSequence || sequence - self.firstSequence >= self.count) {
+        return;
+    }
+    NSUInteger index = self.headIndex + (NSUInteger)(sequence - self.firstSequence);
+    FPJournalLocation *location = (FPJournalLocation *)self.locations.mutableBytes + index;
+    if (location->tag & (kFPJournalRecordRemoved >> 24)) {
+        return;
+    }
+    uint32_t prefix = kFPJournalFlagsPresent | kFPJournalRecordRemoved | ((uint32_t)location->tag << 24) | location->length;
+    location->tag = (uint8_t)(prefix >> 24);
+    uint32_t bigEndianPrefix = CFSwapInt32HostToBig(prefix);
+    NSData *prefixData = [NSData dataWithBytes:&bigEndianPrefix length:sizeof(bigEndianPrefix)];
+
+    // The prefix is rewritten wherever the record is described: the segment, and the index of the segment.
+    if (location->segment == self.activeSegment) {
+        NSRange entry = NSMakeRange(location->entry * kFPJournalIndexEntrySize + sizeof(uint32_t), sizeof(uint32_t));
+        if (NSMaxRange(entry) <= self.activeEntries.length) {
+            [self.activeEntries replaceBytesInRange:entry withBytes:&bigEndianPrefix];
+        }
+        uint64_t bufferStart = self.activeSize - self.bufferedFrames.length;
+        if (location->offset >= bufferStart) {
+            [self.bufferedFrames replaceBytesInRange:NSMakeRange((NSUInteger)(location->offset - bufferStart), kFPJournalLengthPrefixSize) withBytes:&bigEndianPrefix];
+            return;
+        }
+        NSFileHandle *handle = [NSFileHandle fileHandleForUpdatingURL:[self urlForSegment:location->segment] error:nil];
+        [self writeData:prefixData atOffset:location->offset toHandle:handle segment:location->segment];
+        [handle closeFile];
+        return;
+    }
+
+    if (self.removalHandle == nil || self.removalSegment != location->segment) {
+        [self closeRemovalHandles];
+        self.removalHandle = [NSFileHandle fileHandleForUpdatingURL:[self urlForSegment:location->segment] error:nil];
+        self.removalIndexHandle = [NSFileHandle fileHandleForUpdatingURL:[self indexURLForSegment:location->segment] error:nil];
+        self.removalSegment = location->segment;
+    }
+    [self writeData:prefixData atOffset:location->offset toHandle:self.removalHandle segment:location->segment];
+    [self writeData:prefixData atOffset:kFPJournalIndexHeaderSize + location->entry * kFPJournalIndexEntrySize + sizeof(uint32_t) toHandle:self.removalIndexHandle segment:location->segment];
+}
+
+- (void)acknowledgeRecords:(NSUInteger)count
+{
+    count = MIN(count, self.count);
+    if (count == 0) {
+        return;
+    }
+    self.headIndex += count;
+    self.firstSequence += count;
+
+    uint64_t cursorSegment = self.activeSegment;
+    uint64_t cursorOffset = self.activeSize;
+    if (self.count > 0) {
+        FPJournalLocation head = [self locationAtIndex:0];
+        cursorSegment = head.segment;
+        cursorOffset = head.offset;
+    }
+    [self writeCursorSegment:cursorSegment offset:cursorOffset];
+
+    // Reclaim the front of the index once it makes up most of the buffer.
+    NSUInteger total = self.locations.length / sizeof(FPJournalLocation);
+    if (self.headIndex > 256 && self.headIndex * 2 > total) {
+        [self.locations replaceBytesInRange:NSMakeRange(0, self.headIndex * sizeof(FPJournalLocation)) withBytes:NULL length:0];
+        self.headIndex = 0;
+    }
+
+    [self compactSegmentsBefore:cursorSegment];
+}
+
+- (void)acknowledgeRecordsBeforeSequence:(uint64_t)sequence
+{
+    if (sequence > self.firstSequence) {
+        [self acknowledgeRecords:(NSUInteger)MIN(sequence - self.firstSequence, (uint64_t)NSUIntegerMax)];
+    }
+}
+
+- (void)removeAllRecords
+{
+    [self.bufferedFrames setLength:0];
+    [self closeActiveSegment];
+    [self.readHandle closeFile];
+    self.readHandle = nil;
+    [self closeRemovalHandles];
+    for (NSNumber *segment in [self segmentsOnDisk]) {
+        [[NSFileManager defaultManager] removeItemAtURL:[self urlForSegment:segment.unsignedLongLongValue] error:nil];
+        [[NSFileManager defaultManager] removeItemAtURL:[self indexURLForSegment:segment.unsignedLongLongValue] error:nil];
+    }
+    [self.activeEntries setLength:0];
+    [self.segmentDates removeAllObjects];
+    self.firstSequence += self.count;
+    self.locations = [NSMutableData data];
+    self.headIndex = 0;
+    // Never reuse segment ids; a compaction pass may still be pending for the old ones.
+    self.activeSegment += 1;
+    self.activeSize = 0;
+    self.oldestSegment = self.activeSegment;
+    [self writeCursorSegment:self.activeSegment offset:0];
+}
+
+- (void)commit
+{
+    if (self.bufferedFrames.length == 0) {
+        return;
+    }
+    NSFileHandle *handle = [self openActiveSegment];
+    if (handle == nil) {
+        return;
+    }
+    @try {
+        [handle writeData:self.bufferedFrames];
+        [self.bufferedFrames setLength:0];
+    } @catch (NSException *exception) {
+        // Kept for the next commit; a partial write is cut off as a torn record on the next load.
+        FPLog(@"Unable to commit to journal segment %llu: %@", self.activeSegment, exception);
+        [self closeActiveSegment];
+    }
+}
+
+- (void)synchronize
+{
+    [self commit];
+    @try {
+        [self.activeHandle synchronizeFile];
+    } @catch (NSException *exception) {
+        FPLog(@"Unable to synchronize journal segment %llu: %@", self.activeSegment, exception);
+    }
+}
+
+#pragma mark - Reading
+
+- (NSData *)recordAtSequence:(uint64_t)sequence
+{
+    if (sequence < self.firstSequence || sequence - self.firstSequence >= self.count) {
+        return nil;
+    }
+    FPJournalLocation location = [self locationAtIndex:(NSUInteger)(sequence - self.firstSequence)];
+    if (location.tag & (kFPJournalRecordRemoved >> 24)) {
+        return nil;
+    }
+    uint64_t bufferStart = self.activeSize - self.bufferedFrames.length;
+    if (location.segment == self.activeSegment && location.offset >= bufferStart) {
+        NSRange range = NSMakeRange((NSUInteger)(location.offset - bufferStart) + kFPJournalLengthPrefixSize, location.length);
+        return [self decodeRecord:[self.bufferedFrames subdataWithRange:range]];
+    }
+    if (self.readHandle == nil || self.readSegment != location.segment) {
+        [self.readHandle closeFile];
+        self.readHandle = [NSFileHandle fileHandleForReadingFromURL:[self urlForSegment:location.segment] error:nil];
+        self.readSegment = location.segment;
+    }
+
+    NSData *payload = nil;
+    @try {
+        [self.readHandle seekToFileOffset:location.offset + kFPJournalLengthPrefixSize];
+        payload = [self.readHandle readDataOfLength:location.length];
+    } @catch (NSException *exception) {
+        FPLog(@"Unable to read journal segment %llu: %@", location.segment, exception);
+    }
+    NSData *record = payload.length == location.length ? [self decodeRecord:payload] : nil;
+    if (record == nil) {
+        FPLog(@"Journal record %llu is unreadable.", sequence);
+    }
+    return record;
+}
+
+- (BOOL)getFlags:(uint8_t *)flags ofRecordAtSequence:(uint64_t)sequence
+{
+    if (sequence < self.firstSequence || sequence - self.firstSequence >= self.count) {
+        return NO;
+    }
+    uint8_t tag = [self locationAtIndex:(NSUInteger)(sequence - self.firstSequence)].tag;
+    if (!(tag & 0x80)) {
+        return NO;
+    }
+    if (flags) {
+        *flags = tag & kFPJournalCallerFlagsMask;
+    }
+    return YES;
+}
+
+- (BOOL)isRecordRemovedAtSequence:(uint64_t)sequence
+{
+    if (sequence < self.firstSequence || sequence - self.firstSequence >= self.count) {
+        return NO;
+    }
+    return ([self locationAtIndex:(NSUInteger)(sequence - self.firstSequence)].tag & (kFPJournalRecordRemoved >> 24)) != 0;
+}
+
+- (NSDate *)oldestRecordDate
+{
+    if (self.count == 0) {
+        return nil;
+    }
+    uint64_t segment = [self locationAtIndex:0].segment;
+    NSDate *date = self.segmentDates[@(segment)];
+    if (date == nil) {
+        // Segments written by older versions, or the active one after a relaunch.
+        date = [[NSFileManager defaultManager] attributesOfItemAtPath:[self urlForSegment:segment].path error:nil].fileCreationDate;
+        self.segmentDates[@(segment)] = date;
+    }
+    return date;
+}
+
+- (NSArray<NSData *> *)pendingRecords
+{
+    [self commit];
+    NSUInteger count = self.count;
+    NSMutableArray<NSData *> *records = [NSMutableArray arrayWithCapacity:count];
+    NSMutableDictionary<NSNumber *, NSData *> *segments = [NSMutableDictionary dictionary];
+    BOOL corrupted = NO;
+
+    NSUInteger removed = 0;
+    for (NSUInteger i = 0; i < count; i++) {
+        FPJournalLocation location = [self locationAtIndex:i];
+        if (location.tag & (kFPJournalRecordRemoved >> 24)) {
+            removed++;
+            continue;
+        }
+        NSData *segmentData = segments[@(location.segment)];
+        if (segmentData == nil) {
+            segmentData = [NSData dataWithContentsOfURL:[self urlForSegment:location.segment]
+                                                options:NSDataReadingMappedIfSafe
+                                                  error:nil] ?: [NSData data];
+            segments[@(location.segment)] = segmentData;
+        }
+
+        NSData *record = nil;
+        NSRange range = NSMakeRange((NSUInteger)location.offset + kFPJournalLengthPrefixSize, location.length);
+        if (NSMaxRange(range) <= segmentData.length) {
+            record = [self decodeRecord:[segmentData subdataWithRange:range]];
+        }
+        if (record == nil) {
+            corrupted = YES;
+            continue;
+        }
+        [records addObject:record];
+    }
+
+    if (corrupted) {
+        // Keep the journal aligned with what callers see by rewriting it without the unreadable records.
+        FPLog(@"Dropping %lu unreadable journal records.", (unsigned long)(count - removed - records.count));
+        [self removeAllRecords];
+        for (NSData *record in records) {
+            [self appendRecord:record];
+        }
+    }
+    return records;
+}
+
+#pragma mark - Private
+
+// Records are sealed individually so appends and acknowledgements never touch other records. Crypto
+// implementations without a record envelope fall back to running encrypt:/decrypt: on each record.
+- (NSData *)encodeRecord:(NSData *)record
+{
+    if (self.crypto == nil) {
+        return record;
+    }
+    if ([self.crypto respondsToSelector:@selector(sealRecord:)]) {
+        return [self.crypto sealRecord:record];
+    }
+    return [self.crypto encrypt:record];
+}
+
+- (NSData *)decodeRecord:(NSData *)payload
+{
+    if (self.crypto == nil) {
+        return payload;
+    }
+    if ([self.crypto respondsToSelector:@selector(openRecord:)]) {
+        return [self.crypto openRecord:payload];
+    }
+    return [self.crypto decrypt:payload];
+}
+
+- (FPJournalLocation)locationAtIndex:(NSUInteger)index
+{
+    const FPJournalLocation *locations = (const FPJournalLocation *)self.locations.bytes;
+    return locations[self.headIndex + index];
+}
+
+- (void)load
+{
+    uint64_t cursorSegment = 0;
+    uint64_t cursorOffset = 0;
+    uint64_t cursorSequence = 0;
+    BOOL hasCursor = [self readCursorSegment:&cursorSegment offset:&cursorOffset sequence:&cursorSequence];
+
+    NSArray<NSNumber *> *segments = [self segmentsOnDisk];
+    if (!hasCursor) {
+        cursorSegment = segments.firstObject.unsignedLongLongValue;
+    }
+
+    self.firstSequence = cursorSequence;
+    self.oldestSegment = cursorSegment;
+    self.activeSegment = cursorSegment;
+    self.activeSize = 0;
+
+    for (NSNumber *number in segments) {
+        uint64_t segment = number.unsignedLongLongValue;
+        NSURL *url = [self urlForSegment:segment];
+        if (segment < cursorSegment) {
+            // Fully acknowledged before the last compaction got to run.
+            [[NSFileManager defaultManager] removeItemAtURL:url error:nil];
+            [[NSFileManager defaultManager] removeItemAtURL:[self indexURLForSegment:segment] error:nil];
+            continue;
+        }
+
+        uint64_t offset = (segment == cursorSegment) ? cursorOffset : 0;
+        // Sealed segments are read through their index alone; only the active one is scanned.
+        BOOL sealed = segment != segments.lastObject.unsignedLongLongValue;
+        if (sealed && [self loadIndexOfSegment:segment fromOffset:offset]) {
+            continue;
+        }
+
+        [self.activeEntries setLength:0];
+        NSData *data = [NSData dataWithContentsOfURL:url options:NSDataReadingMappedIfSafe error:nil];
+        const uint8_t *bytes = data.bytes;
+        while (offset + kFPJournalLengthPrefixSize <= data.length) {
+            uint32_t prefix = 0;
+            memcpy(&prefix, bytes + offset, kFPJournalLengthPrefixSize);
+            prefix = CFSwapInt32BigToHost(prefix);
+            uint32_t length = FPJournalLengthOfPrefix(prefix);
+            if (offset + kFPJournalLengthPrefixSize + length > data.length) {
+                break;
+            }
+            FPJournalLocation location = {segment, offset, length, [self activeEntryCount], (uint8_t)(prefix >> 24)};
+            [self.locations appendBytes:&location length:sizeof(location)];
+            [self appendActiveEntryWithOffset:offset prefix:prefix];
+            offset += kFPJournalLengthPrefixSize + length;
+        }
+
+        uint64_t validLength = MIN(offset, (uint64_t)data.length);
+        if (validLength < data.length) {
+            // A record was torn by a crash mid-append; cut it off so later appends stay aligned.
+            FPLog(@"Truncating torn record at the end of journal segment %llu.", segment);
+            NSFileHandle *handle = [NSFileHandle fileHandleForWritingToURL:url error:nil];
+            @try {
+                [handle truncateFileAtOffset:validLength];
+            } @catch (NSException *exception) {
+                FPLog(@"Unable to truncate journal segment %llu: %@", segment, exception);
+            }
+            [handle closeFile];
+        }
+
+        self.activeSegment = segment;
+        self.activeSize = validLength;
+        if (sealed) {
+            // Written by a version without indexes, or the index was lost; the next launch can skip the scan.
+            [self writeIndexForActiveSegment];
+        }
+    }
+
+    if (hasCursor && self.count == 0 && (cursorSegment != self.activeSegment || cursorOffset != self.activeSize)) {
+        // The cursor was moved past records that never reached the disk. Bring it back to the end of the
+        // journal, or the records appended from here on would sit behind it.
+        [self writeCursorSegment:self.activeSegment offset:self.activeSize];
+    }
+}
+
+- (NSFileHandle *)openActiveSegment
+{
+    if (self.activeHandle) {
+        return self.activeHandle;
+    }
+
+    [self createFolderIfNeeded];
+    NSURL *url = [self urlForSegment:self.activeSegment];
+    if (![[NSFileManager defaultManager] fileExistsAtPath:url.path]) {
+        [[NSFileManager defaultManager] createFileAtPath:url.path contents:nil attributes:nil];
+    }
+
+    NSError *error = nil;
+    NSFileHandle *handle = [NSFileHandle fileHandleForWritingToURL:url error:&error];
+    if (handle == nil) {
+        FPLog(@"Unable to open journal segment %@: %@", url, error);
+        return nil;
+    }
+    self.activeSize = [handle seekToEndOfFile] + self.bufferedFrames.length;
+    self.activeHandle = handle;
+    return handle;
+}
+
+- (void)closeActiveSegment
+{
+    [self.activeHandle closeFile];
+    self.activeHandle = nil;
+}
+
+- (void)rollSegment
+{
+    [self commit];
+    if (self.bufferedFrames.length > 0) {
+        // The records cannot move to the next segment, their locations point into this one.
+        FPLog(@"Dropping %lu bytes of uncommitted journal records.", (unsigned long)self.bufferedFrames.length);
+        [self.bufferedFrames setLength:0];
+    }
+    [self closeActiveSegment];
+    [self writeIndexForActiveSegment];
+    [self.activeEntries setLength:0];
+    self.activeSegment += 1;
+    self.activeSize = 0;
+}
+
+- (uint32_t)activeEntryCount
+{
+    return (uint32_t)(self.activeEntries.length / kFPJournalIndexEntrySize);
+}
+
+- (void)appendActiveEntryWithOffset:(uint64_t)offset prefix:(uint32_t)prefix
+{
+    uint32_t entry[2] = {CFSwapInt32HostToBig((uint32_t)offset), CFSwapInt32HostToBig(prefix)};
+    [self.activeEntries appendBytes:entry length:sizeof(entry)];
+}
+
+// Entries may start past the beginning of the segment when it was scanned from the cursor; the
+// records before the cursor are acknowledged, so a later load never needs them.
+- (void)writeIndexForActiveSegment
+{
+    NSUInteger count = self.activeEntries.length / kFPJournalIndexEntrySize;
+    if (count == 0) {
+        return;
+    }
+    NSDate *date = self.segmentDates[@(self.activeSegment)];
+    uint32_t header32[2] = {CFSwapInt32HostToBig(kFPJournalIndexMagic), CFSwapInt32HostToBig((uint32_t)count)};
+    uint64_t createdAt = CFSwapInt64HostToBig((uint64_t)(MAX(date.timeIntervalSince1970, 0) * 1000));
+    NSMutableData *index = [NSMutableData dataWithCapacity:kFPJournalIndexHeaderSize + self.activeEntries.length];
+    [index appendBytes:header32 length:sizeof(header32)];
+    [index appendBytes:&createdAt length:sizeof(createdAt)];
+    [index appendData:self.activeEntries];
+    if (![index writeToURL:[self indexURLForSegment:self.activeSegment] atomically:YES]) {
+        FPLog(@"Unable to write the index of journal segment %llu.", self.activeSegment);
+    }
+}
+
+// Adds the records of a sealed segment from its index. Returns NO when the index is missing or
+// does not match the segment, in which case the segment is scanned instead.
+- (BOOL)loadIndexOfSegment:(uint64_t)segment fromOffset:(uint64_t)startOffset
+{
+    NSData *index = [NSData dataWithContentsOfURL:[self indexURLForSegment:segment]];
+    if (index.length < kFPJournalIndexHeaderSize) {
+        return NO;
+    }
+    const uint8_t *bytes = index.bytes;
+    uint32_t header32[2];
+    uint64_t createdAt;
+    memcpy(header32, bytes, sizeof(header32));
+    memcpy(&createdAt, bytes + sizeof(header32), sizeof(createdAt));
+    NSUInteger count = CFSwapInt32BigToHost(header32[1]);
+    if (CFSwapInt32BigToHost(header32[0]) != kFPJournalIndexMagic || index.length != kFPJournalIndexHeaderSize + count * kFPJournalIndexEntrySize || count == 0) {
+        return NO;
+    }
+
+    // The last record must end exactly where the segment does.
+    uint32_t last[2];
+    memcpy(last, bytes + kFPJournalIndexHeaderSize + (count - 1) * kFPJournalIndexEntrySize, sizeof(last));
+    uint64_t end = CFSwapInt32BigToHost(last[0]) + kFPJournalLengthPrefixSize + FPJournalLengthOfPrefix(CFSwapInt32BigToHost(last[1]));
+    NSNumber *size = [[NSFileManager defaultManager] attributesOfItemAtPath:[self urlForSegment:segment].path error:nil][NSFileSize];
+    if (size == nil || size.unsignedLongLongValue != end) {
+        return NO;
+    }
+
+    for (NSUInteger i = 0; i < count; i++) {
+        uint32_t entry[2];
+        memcpy(entry, bytes + kFPJournalIndexHeaderSize + i * kFPJournalIndexEntrySize, sizeof(entry));
+        uint64_t offset = CFSwapInt32BigToHost(entry[0]);
+        if (offset < startOffset) {
+            continue;
+        }
+        uint32_t prefix = CFSwapInt32BigToHost(entry[1]);
+        FPJournalLocation location = {segment, offset, FPJournalLengthOfPrefix(prefix), (uint32_t)i, (uint8_t)(prefix >> 24)};
+        [self.locations appendBytes:&location length:sizeof(location)];
+    }
+    createdAt = CFSwapInt64BigToHost(createdAt);
+    if (createdAt > 0) {
+        self.segmentDates[@(segment)] = [NSDate dateWithTimeIntervalSince1970:createdAt / 1000.0];
+    }
+    return YES;
+}
+
+- (void)compactSegmentsBefore:(uint64_t)segment
+{
+    uint64_t oldest = self.oldestSegment;
+    if (segment <= oldest) {
+        return;
+    }
+    self.oldestSegment = segment;
+    if (self.removalHandle != nil && self.removalSegment < segment) {
+        [self closeRemovalHandles];
+    }
+
+    NSMutableArray<NSURL *> *urls = [NSMutableArray array];
+    for (uint64_t s = oldest; s < segment; s++) {
+        [urls addObject:[self urlForSegment:s]];
+        [urls addObject:[self indexURLForSegment:s]];
+        [self.segmentDates removeObjectForKey:@(s)];
+    }
+    dispatch_async(self.compactionQueue, ^{
+        NSFileManager *fileManager = [NSFileManager defaultManager];
+        for (NSURL *url in urls) {
+            [fileManager removeItemAtURL:url error:nil];
+        }
+    });
+}
+
+- (void)writeData:(NSData *)data atOffset:(uint64_t)offset toHandle:(NSFileHandle *)handle segment:(uint64_t)segment
+{
+    @try {
+        [handle seekToFileOffset:offset];
+        [handle writeData:data];
+    } @catch (NSException *exception) {
+        FPLog(@"Unable to mark a record of journal segment %llu removed: %@", segment, exception);
+    }
+}
+
+- (void)closeRemovalHandles
+{
+    [self.removalHandle closeFile];
+    [self.removalIndexHandle closeFile];
+    self.removalHandle = nil;
+    self.removalIndexHandle = nil;
+}
+
+- (NSArray<NSNumber *> *)segmentsOnDisk
+{
+    NSArray<NSURL *> *contents = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:self.folderURL
+                                                               includingPropertiesForKeys:nil
+                                                                                  options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                                    error:nil];
+    NSMutableArray<NSNumber *> *segments = [NSMutableArray array];
+    for (NSURL *url in contents) {
+        if ([url.pathExtension isEqualToString:kFPJournalSegmentExtension]) {
+            NSString *name = url.lastPathComponent.stringByDeletingPathExtension;
+            [segments addObject:@(strtoull(name.UTF8String, NULL, 10))];
+        }
+    }
+    return [segments sortedArrayUsingSelector:@selector(compare:)];
+}
+
+- (NSURL *)urlForSegment:(uint64_t)segment
+{
+    NSString *name = [NSString stringWithFormat:@"%020llu.%@", segment, kFPJournalSegmentExtension];
+    return [self.folderURL URLByAppendingPathComponent:name];
+}
+
+- (NSURL *)indexURLForSegment:(uint64_t)segment
+{
+    NSString *name = [NSString stringWithFormat:@"%020llu.%@", segment, kFPJournalIndexExtension];
+    return [self.folderURL URLByAppendingPathComponent:name];
+}
+
+- (BOOL)readCursorSegment:(uint64_t *)segment offset:(uint64_t *)offset sequence:(uint64_t *)sequence
+{
+    NSData *data = [NSData dataWithContentsOfURL:[self.folderURL URLByAppendingPathComponent:kFPJournalCursorFilename]];
+    // Cursors written before records were numbered hold no sequence; numbering then starts at 0.
+    if (data.length != sizeof(uint64_t) * 2 && data.length != sizeof(uint64_t) * 3) {
+        return NO;
+    }
+    uint64_t values[3] = {0, 0, 0};
+    memcpy(values, data.bytes, data.length);
+    *segment = CFSwapInt64BigToHost(values[0]);
+    *offset = CFSwapInt64BigToHost(values[1]);
+    *sequence = CFSwapInt64BigToHost(values[2]);
+    return YES;
+}
+
+- (void)writeCursorSegment:(uint64_t)segment offset:(uint64_t)offset
+{
+    uint64_t values[3] = {CFSwapInt64HostToBig(segment), CFSwapInt64HostToBig(offset), CFSwapInt64HostToBig(self.firstSequence)};
+    NSData *data = [NSData dataWithBytes:values length:sizeof(values)];
+    [data writeToURL:[self.folderURL URLByAppendingPathComponent:kFPJournalCursorFilename] atomically:YES];
+}
+
+- (void)createFolderIfNeeded
+{
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    if ([fileManager fileExistsAtPath:self.folderURL.path]) {
+        return;
+    }
+    NSError *error = nil;
+    if (![fileManager createDirectoryAtURL:self.folderURL withIntermediateDirectories:YES attributes:nil error:&error]) {
+        FPLog(@"Unable to create journal folder %@: %@", self.folderURL, error);
+        return;
+    }
+    if (![self.folderURL setResourceValue:@YES forKey:NSURLIsExcludedFromBackupKey error:&error]) {
+        FPLog(@"Error excluding %@ from backup %@", self.folderURL.lastPathComponent, error);
+    }
+}
+
+@end
@@ -0,0 +1,94 @@
+//
+//  FPEventQueue.h
+//  Freshpaint
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/// Eviction priority of a queued event. Lower lanes are evicted first when the queue overflows.
+typedef NS_ENUM(NSUInteger, FPEventLane) {
+    /// Track and screen events.
+    FPEventLaneStandard = 0,
+    /// Identify, alias, group and the track events listed in `criticalTrackEvents`.
+    FPEventLaneCritical,
+    FPEventLaneCount,
+};
+
+/**
+ * In-memory event queue backed by a ring buffer.
+ *
+ * Events are numbered in push order and addressed by sequence number. Pushing, removing from the
+ * head and evicting all take constant time. Evicting an event from the middle leaves a hole that
+ * keeps its sequence number until the head moves past it, so the numbers of the other events
+ * never shift. `span` counts those holes along with the live events.
+ *
+ * Every lane keeps the sequence numbers of its events in order. Eviction takes the oldest event
+ * of the lowest non-empty lane, or the oldest event of a lane within a range of sequence numbers;
+ * the latter costs a search and a shift of the events of the lane ahead of the range.
+ *
+ * Events restored at launch can be pushed paged out, with only their lane known. Their bytes are
+ * read through `recordLoader` the first time they are asked for, and kept from then on.
+ *
+ * Not thread safe; FPFreshpaintIntegration and FPWebhookIntegration only use it from their serial queues.
+ */
+@interface FPEventQueue : NSObject
+
+/// Number of live events.
+@property (nonatomic, assign, readonly) NSUInteger count;
+/// Sequence number of the oldest slot, live or evicted.
+@property (nonatomic, assign, readonly) uint64_t headSequence;
+/// Sequence number the next pushed event gets.
+@property (nonatomic, assign, readonly) uint64_t endSequence;
+/// Number of slots between the head and the end, evicted ones included.
+@property (nonatomic, assign, readonly) NSUInteger span;
+
+- (instancetype)initWithFirstSequence:(uint64_t)sequence capacity:(NSUInteger)capacity NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+/// Reads the bytes of a paged out event. Returning nil turns the event into a hole.
+@property (nonatomic, copy, nullable) NSData *_Nullable (^recordLoader)(uint64_t sequence);
+
+/// Appends an event and returns its sequence number. The buffer grows when full.
+- (uint64_t)pushRecord:(NSData *)record lane:(FPEventLane)lane;
+
+/// Appends an event whose bytes are read through `recordLoader` when first needed.
+- (uint64_t)pushPagedOutRecordInLane:(FPEventLane)lane;
+
+/// Appends the hole of an event evicted before it was pushed, e.g. during an earlier launch.
+- (uint64_t)pushHole;
+
+/// The event numbered `sequence`, or nil if it was evicted or is not in the queue. Pages the event in if needed.
+- (NSData *_Nullable)recordAtSequence:(uint64_t)sequence;
+
+/// YES when the event numbered `sequence` has not been read yet.
+- (BOOL)isRecordPagedOutAtSequence:(uint64_t)sequence;
+
+/// Live events numbered from `start` up to, but not including, `end`.
+- (NSArray<NSData *> *)recordsFromSequence:(uint64_t)start toSequence:(uint64_t)end;
+
+/// Number of live events numbered from `start` up to, but not including, `end`. Does not page anything in.
+- (NSUInteger)countFromSequence:(uint64_t)start toSequence:(uint64_t)end;
+
+/// Number of live events in `lane`.
+- (NSUInteger)countInLane:(FPEventLane)lane;
+
+/// Sequence number of the oldest live event, `endSequence` when there is none.
+- (uint64_t)firstLiveSequence;
+
+/// Evicts the oldest event of the lowest non-empty lane. Returns NO when the queue is empty.
+- (BOOL)evictLowestPriorityEventInLane:(FPEventLane *_Nullable)lane sequence:(uint64_t *_Nullable)sequence;
+
+/// Evicts the oldest event of `lane` numbered from `start` up to, but not including, `end`. Returns NO when there is none.
+- (BOOL)evictEventInLane:(FPEventLane)lane fromSequence:(uint64_t)start toSequence:(uint64_t)end sequence:(uint64_t *_Nullable)sequence;
+
+/// Calls `block` with every live event, oldest first, paging them all in.
+- (void)enumerateRecordsUsingBlock:(void (^)(NSData *record, FPEventLane lane, uint64_t sequence))block;
+
+/// Removes every slot numbered below `sequence` and returns the number of live events removed.
+- (NSUInteger)removeEventsBeforeSequence:(uint64_t)sequence;
+
+@end
+
+NS_ASSUME_NONNULL_END
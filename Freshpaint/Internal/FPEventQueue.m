@@ -0,0 +1,366 @@
+//
+//  FPEventQueue.m
+//  Freshpaint
+//
+
+#import "FPEventQueue.h"
+
+// Ring of sequence numbers; one per lane, oldest first.
+typedef struct {
+    uint64_t *values;
+    NSUInteger capacity;
+    NSUInteger head;
+    NSUInteger count;
+} FPSequenceRing;
+
+static void FPSequenceRingPush(FPSequenceRing *ring, uint64_t value)
+{
+    if (ring->count == ring->capacity) {
+        NSUInteger capacity = MAX(ring->capacity * 2, 16u);
+        uint64_t *values = malloc(capacity * sizeof(uint64_t));
+        for (NSUInteger i = 0; i < ring->count; i++) {
+            values[i] = ring->values[(ring->head + i) % ring->capacity];
+        }
+        free(ring->values);
+        ring->values = values;
+        ring->capacity = capacity;
+        ring->head = 0;
+    }
+    ring->values[(ring->head + ring->count) % ring->capacity] = value;
+    ring->count++;
+}
+
+static uint64_t FPSequenceRingPop(FPSequenceRing *ring)
+{
+    uint64_t value = ring->values[ring->head];
+    ring->head = (ring->head + 1) % ring->capacity;
+    ring->count--;
+    return value;
+}
+
+// Position of the first value not below `value`.
+static NSUInteger FPSequenceRingLowerBound(FPSequenceRing *ring, uint64_t value)
+{
+    NSUInteger low = 0;
+    NSUInteger high = ring->count;
+    while (low < high) {
+        NSUInteger middle = low + (high - low) / 2;
+        if (ring->values[(ring->head + middle) % ring->capacity] < value) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Removes the value at `position`, shifting whichever side of it is shorter.
+static void FPSequenceRingRemove(FPSequenceRing *ring, NSUInteger position)
+{
+    if (position < ring->count / 2) {
+        for (NSUInteger i = position; i > 0; i--) {
+            ring->values[(ring->head + i) % ring->capacity] = ring->values[(ring->head + i - 1) % ring->capacity];
+        }
+        ring->head = (ring->head + 1) % ring->capacity;
+    } else {
+        for (NSUInteger i = position; i + 1 < ring->count; i++) {
+            ring->values[(ring->head + i) % ring->capacity] = ring->values[(ring->head + i + 1) % ring->capacity];
+        }
+    }
+    ring->count--;
+}
+
+
+// Marks a slot whose event has not been paged in yet.
+static id FPEventQueuePagedOutSlot(void)
+{
+    static id slot;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        slot = [[NSObject alloc] init];
+    });
+    return slot;
+}
+
+
+@interface FPEventQueue () {
+    // Slot storage; NSNull marks an evicted event.
+    NSMutableArray *_slots;
+    uint8_t *_lanes;
+    NSUInteger _capacity;
+    NSUInteger _headIndex;
+    // May still hold events that turned out unreadable; those are skipped when they reach the front.
+    FPSequenceRing _laneSequences[FPEventLaneCount];
+    NSUInteger _laneCounts[FPEventLaneCount];
+}
+
+@property (nonatomic, assign, readwrite) NSUInteger count;
+@property (nonatomic, assign, readwrite) uint64_t headSequence;
+@property (nonatomic, assign, readwrite) NSUInteger span;
+
+@end
+
+
+@implementation FPEventQueue
+
+- (instancetype)initWithFirstSequence:(uint64_t)sequence capacity:(NSUInteger)capacity
+{
+    if (self = [super init]) {
+        _headSequence = sequence;
+        _capacity = MAX(capacity, 16u);
+        _slots = [NSMutableArray arrayWithCapacity:_capacity];
+        for (NSUInteger i = 0; i < _capacity; i++) {
+            [_slots addObject:[NSNull null]];
+        }
+        _lanes = calloc(_capacity, sizeof(uint8_t));
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(_lanes);
+    for (NSUInteger lane = 0; lane < FPEventLaneCount; lane++) {
+        free(_laneSequences[lane].values);
+    }
+}
+
+- (uint64_t)endSequence
+{
+    return self.headSequence + self.span;
+}
+
+- (uint64_t)pushRecord:(NSData *)record lane:(FPEventLane)lane
+{
+    return [self pushSlot:record lane:lane];
+}
+
+- (uint64_t)pushPagedOutRecordInLane:(FPEventLane)lane
+{
+    return [self pushSlot:FPEventQueuePagedOutSlot() lane:lane];
+}
+
+- (uint64_t)pushHole
+{
+    if (self.span == _capacity) {
+        [self grow];
+    }
+    uint64_t sequence = self.endSequence;
+    _slots[(_headIndex + self.span) % _capacity] = [NSNull null];
+    self.span += 1;
+    return sequence;
+}
+
+- (NSData *)recordAtSequence:(uint64_t)sequence
+{
+    if (sequence < self.headSequence || sequence >= self.endSequence) {
+        return nil;
+    }
+    NSUInteger index = [self indexOfSequence:sequence];
+    id slot = _slots[index];
+    if (slot == FPEventQueuePagedOutSlot()) {
+        slot = self.recordLoader ? self.recordLoader(sequence) : nil;
+        if (slot == nil) {
+            // Unreadable; it becomes a hole like an evicted event.
+            slot = [NSNull null];
+            _laneCounts[_lanes[index]] -= 1;
+            self.count -= 1;
+        }
+        _slots[index] = slot;
+    }
+    return slot == [NSNull null] ? nil : slot;
+}
+
+- (BOOL)isRecordPagedOutAtSequence:(uint64_t)sequence
+{
+    if (sequence < self.headSequence || sequence >= self.endSequence) {
+        return NO;
+    }
+    return _slots[[self indexOfSequence:sequence]] == FPEventQueuePagedOutSlot();
+}
+
+- (NSArray<NSData *> *)recordsFromSequence:(uint64_t)start toSequence:(uint64_t)end
+{
+    start = MAX(start, self.headSequence);
+    end = MIN(end, self.endSequence);
+    NSMutableArray<NSData *> *records = [NSMutableArray arrayWithCapacity:end > start ? (NSUInteger)(end - start) : 0];
+    for (uint64_t sequence = start; sequence < end; sequence++) {
+        NSData *record = [self recordAtSequence:sequence];
+        if (record != nil) {
+            [records addObject:record];
+        }
+    }
+    return records;
+}
+
+- (NSUInteger)countFromSequence:(uint64_t)start toSequence:(uint64_t)end
+{
+    start = MAX(start, self.headSequence);
+    end = MIN(end, self.endSequence);
+    NSUInteger count = 0;
+    for (uint64_t sequence = start; sequence < end; sequence++) {
+        count += _slots[[self indexOfSequence:sequence]] != [NSNull null] ? 1 : 0;
+    }
+    return count;
+}
+
+- (NSUInteger)countInLane:(FPEventLane)lane
+{
+    return lane < FPEventLaneCount ? _laneCounts[lane] : 0;
+}
+
+- (uint64_t)firstLiveSequence
+{
+    uint64_t oldest = self.endSequence;
+    for (NSUInteger lane = 0; lane < FPEventLaneCount; lane++) {
+        FPSequenceRing *ring = [self prunedRingOfLane:lane];
+        if (ring->count > 0) {
+            oldest = MIN(oldest, ring->values[ring->head]);
+        }
+    }
+    return oldest;
+}
+
+- (BOOL)evictLowestPriorityEventInLane:(FPEventLane *)lane sequence:(uint64_t *)sequence
+{
+    for (NSUInteger candidate = 0; candidate < FPEventLaneCount; candidate++) {
+        if ([self prunedRingOfLane:candidate]->count > 0) {
+            [self evictHeadOfLane:candidate sequence:sequence];
+            if (lane) {
+                *lane = candidate;
+            }
+            return YES;
+        }
+    }
+    return NO;
+}
+
+- (BOOL)evictEventInLane:(FPEventLane)lane fromSequence:(uint64_t)start toSequence:(uint64_t)end sequence:(uint64_t *)sequence
+{
+    if (lane >= FPEventLaneCount) {
+        return NO;
+    }
+    FPSequenceRing *ring = [self prunedRingOfLane:lane];
+    NSUInteger position = FPSequenceRingLowerBound(ring, start);
+    while (position < ring->count) {
+        uint64_t candidate = ring->values[(ring->head + position) % ring->capacity];
+        if (candidate >= end) {
+            return NO;
+        }
+        NSUInteger index = [self indexOfSequence:candidate];
+        BOOL live = _slots[index] != [NSNull null];
+        FPSequenceRingRemove(ring, position);
+        if (live) {
+            _slots[index] = [NSNull null];
+            _laneCounts[lane] -= 1;
+            self.count -= 1;
+            if (sequence) {
+                *sequence = candidate;
+            }
+            return YES;
+        }
+    }
+    return NO;
+}
+
+- (void)enumerateRecordsUsingBlock:(void (^)(NSData *, FPEventLane, uint64_t))block
+{
+    for (NSUInteger i = 0; i < self.span; i++) {
+        uint64_t sequence = self.headSequence + i;
+        NSData *record = [self recordAtSequence:sequence];
+        if (record != nil) {
+            block(record, _lanes[[self indexOfSequence:sequence]], sequence);
+        }
+    }
+}
+
+- (NSUInteger)removeEventsBeforeSequence:(uint64_t)sequence
+{
+    NSUInteger removed = 0;
+    while (self.span > 0 && self.headSequence < sequence) {
+        if (_slots[_headIndex] != [NSNull null]) {
+            _laneCounts[_lanes[_headIndex]] -= 1;
+            _slots[_headIndex] = [NSNull null];
+            self.count -= 1;
+            removed++;
+        }
+        _headIndex = (_headIndex + 1) % _capacity;
+        self.headSequence += 1;
+        self.span -= 1;
+    }
+    for (NSUInteger lane = 0; lane < FPEventLaneCount; lane++) {
+        [self prunedRingOfLane:lane];
+    }
+    return removed;
+}
+
+#pragma mark - Private
+
+- (uint64_t)pushSlot:(id)slot lane:(FPEventLane)lane
+{
+    lane = MIN(lane, FPEventLaneCount - 1);
+    if (self.span == _capacity) {
+        [self grow];
+    }
+    NSUInteger index = (_headIndex + self.span) % _capacity;
+    uint64_t sequence = self.endSequence;
+    _slots[index] = slot;
+    _lanes[index] = (uint8_t)lane;
+    FPSequenceRingPush(&_laneSequences[lane], sequence);
+    _laneCounts[lane] += 1;
+    self.span += 1;
+    self.count += 1;
+    return sequence;
+}
+
+// Drops the sequence numbers at the front of a lane that no longer name a live event.
+- (FPSequenceRing *)prunedRingOfLane:(NSUInteger)lane
+{
+    FPSequenceRing *ring = &_laneSequences[lane];
+    while (ring->count > 0) {
+        uint64_t sequence = ring->values[ring->head];
+        if (sequence >= self.headSequence && _slots[[self indexOfSequence:sequence]] != [NSNull null]) {
+            break;
+        }
+        FPSequenceRingPop(ring);
+    }
+    return ring;
+}
+
+- (NSUInteger)indexOfSequence:(uint64_t)sequence
+{
+    return (_headIndex + (NSUInteger)(sequence - self.headSequence)) % _capacity;
+}
+
+- (void)evictHeadOfLane:(NSUInteger)lane sequence:(uint64_t *)sequence
+{
+    uint64_t evicted = FPSequenceRingPop(&_laneSequences[lane]);
+    _slots[[self indexOfSequence:evicted]] = [NSNull null];
+    _laneCounts[lane] -= 1;
+    self.count -= 1;
+    if (sequence) {
+        *sequence = evicted;
+    }
+}
+
+- (void)grow
+{
+    NSUInteger capacity = _capacity * 2;
+    NSMutableArray *slots = [NSMutableArray arrayWithCapacity:capacity];
+    uint8_t *lanes = calloc(capacity, sizeof(uint8_t));
+    for (NSUInteger i = 0; i < self.span; i++) {
+        NSUInteger index = (_headIndex + i) % _capacity;
+        [slots addObject:_slots[index]];
+        lanes[i] = _lanes[index];
+    }
+    for (NSUInteger i = self.span; i < capacity; i++) {
+        [slots addObject:[NSNull null]];
+    }
+    free(_lanes);
+    _slots = slots;
+    _lanes = lanes;
+    _capacity = capacity;
+    _headIndex = 0;
+}
+
+@end
@@ -59,8 +59,12 @@
     }
     
     if (self.crypto) {
-        NSData *encryptedData = [self.crypto encrypt:data];
-        [encryptedData writeToURL:url atomically:YES];
+        if ([self.crypto respondsToSelector:@selector(encryptFromStream:toStream:)]) {
+            [self writeEncryptedData:data toURL:url];
+        } else {
+            NSData *encryptedData = [self.crypto encrypt:data];
+            [encryptedData writeToURL:url atomically:YES];
+        }
     } else {
         [data writeToURL:url atomically:YES];
     }
@@ -76,6 +80,9 @@
 - (NSData *)dataForKey:(NSString *)key
 {
     NSURL *url = [self urlForKey:key];
+    if (self.crypto && [self.crypto respondsToSelector:@selector(decryptFromStream:toStream:)]) {
+        return [self readEncryptedDataFromURL:url forKey:key];
+    }
     NSData *data = [NSData dataWithContentsOfURL:url];
     if (!data) {
         FPLog(@"WARNING: No data file for key %@", key);
@@ -178,6 +185,33 @@
 
 #pragma mark - Helpers
 
+// Streams the cipher text straight to a temporary file and swaps it in, instead of building it in memory first.
+- (void)writeEncryptedData:(NSData *)data toURL:(NSURL *)url
+{
+    NSURL *tempURL = [url URLByAppendingPathExtension:@"tmp"];
+    NSInputStream *input = [NSInputStream inputStreamWithData:data];
+    NSOutputStream *output = [NSOutputStream outputStreamWithURL:tempURL append:NO];
+    if (![self.crypto encryptFromStream:input toStream:output] ||
+        rename(tempURL.fileSystemRepresentation, url.fileSystemRepresentation) != 0) {
+        FPLog(@"Unable to write encrypted data to %@", url.lastPathComponent);
+        [[NSFileManager defaultManager] removeItemAtURL:tempURL error:nil];
+    }
+}
+
+- (NSData *_Nullable)readEncryptedDataFromURL:(NSURL *)url forKey:(NSString *)key
+{
+    if (![[NSFileManager defaultManager] fileExistsAtPath:url.path]) {
+        FPLog(@"WARNING: No data file for key %@", key);
+        return nil;
+    }
+    NSInputStream *input = [NSInputStream inputStreamWithURL:url];
+    NSOutputStream *output = [NSOutputStream outputStreamToMemory];
+    if (![self.crypto decryptFromStream:input toStream:output]) {
+        return nil;
+    }
+    return [output propertyForKey:NSStreamDataWrittenToMemoryStreamKey];
+}
+
 - (id _Nullable)jsonForKey:(NSString *)key
 {
     id result = nil;
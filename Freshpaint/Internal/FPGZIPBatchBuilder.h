@@ -0,0 +1,44 @@
+//
+//  FPGZIPBatchBuilder.h
+//  Freshpaint
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Builds the gzipped body of a batch upload one event at a time.
+ *
+ * Each appended record goes through a long-lived deflate stream straight away. When the
+ * batch is flushed, only the trailing `sentAt` and the final deflate block are left to
+ * write. Finishing a batch resets the stream instead of reallocating it, so the builder is
+ * ready for the next batch.
+ *
+ * The body has the shape `{"batch":[<record>,...],"sentAt":"<timestamp>"}`.
+ *
+ * Not thread safe; FPFreshpaintIntegration only uses it from its serial queue.
+ */
+@interface FPGZIPBatchBuilder : NSObject
+
+/// Number of records in the batch being built.
+@property (nonatomic, assign, readonly) NSUInteger count;
+/// Size of the uncompressed JSON fed into the stream so far.
+@property (nonatomic, assign, readonly) NSUInteger uncompressedLength;
+
+- (instancetype)init;
+- (instancetype)initWithCompressionLevel:(float)level NS_DESIGNATED_INITIALIZER;
+
+/// Appends a record holding the JSON encoding of a single event.
+- (BOOL)appendRecord:(NSData *)record;
+
+/// Completes the batch with `sentAt` and returns the gzipped body, leaving the builder empty.
+/// Returns nil if compression failed at any point since the last reset.
+- (NSData *_Nullable)finishWithSentAt:(NSString *)sentAt;
+
+/// Discards the batch being built.
+- (void)reset;
+
+@end
+
+NS_ASSUME_NONNULL_END
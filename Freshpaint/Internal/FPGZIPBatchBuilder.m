@@ -0,0 +1,154 @@
+//
+//  FPGZIPBatchBuilder.m
+//  Freshpaint
+//
+
+#import "FPGZIPBatchBuilder.h"
+#import "NSData+FPGZIP.h"
+#import "FPUtils.h"
+#import <zlib.h>
+#import <dlfcn.h>
+
+
+#pragma clang diagnostic ignored "-Wcast-qual"
+
+static const NSUInteger kFPBatchBuilderChunkSize = 16384;
+static const char kFPBatchPrefix[] = "{\"batch\":[";
+
+typedef int (*FPDeflateInit2Function)(z_streamp, int, int, int, int, int, const char *, int);
+typedef int (*FPDeflateFunction)(z_streamp, int);
+typedef int (*FPDeflateStreamFunction)(z_streamp);
+
+
+@interface FPGZIPBatchBuilder () {
+    z_stream _stream;
+    BOOL _streamReady;
+    BOOL _failed;
+    FPDeflateFunction _deflate;
+    FPDeflateStreamFunction _deflateReset;
+    FPDeflateStreamFunction _deflateEnd;
+}
+
+@property (nonatomic, strong) NSMutableData *output;
+@property (nonatomic, assign, readwrite) NSUInteger count;
+@property (nonatomic, assign, readwrite) NSUInteger uncompressedLength;
+
+@end
+
+
+@implementation FPGZIPBatchBuilder
+
+- (instancetype)init
+{
+    return [self initWithCompressionLevel:-1.0f];
+}
+
+- (instancetype)initWithCompressionLevel:(float)level
+{
+    if (self = [super init]) {
+        _output = [NSMutableData dataWithCapacity:kFPBatchBuilderChunkSize];
+
+        void *libz = seg_libzOpen();
+        FPDeflateInit2Function deflateInit2_ = libz ? (FPDeflateInit2Function)dlsym(libz, "deflateInit2_") : NULL;
+        _deflate = libz ? (FPDeflateFunction)dlsym(libz, "deflate") : NULL;
+        _deflateReset = libz ? (FPDeflateStreamFunction)dlsym(libz, "deflateReset") : NULL;
+        _deflateEnd = libz ? (FPDeflateStreamFunction)dlsym(libz, "deflateEnd") : NULL;
+
+        memset(&_stream, 0, sizeof(_stream));
+        int compression = (level < 0.0f) ? Z_DEFAULT_COMPRESSION : (int)(roundf(level * 9));
+        if (deflateInit2_ && _deflate && _deflateReset && _deflateEnd) {
+            _streamReady = deflateInit2(&_stream, compression, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        }
+        if (!_streamReady) {
+            FPLog(@"Unable to set up deflate stream for batch uploads.");
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (_streamReady) {
+        _deflateEnd(&_stream);
+    }
+}
+
+- (BOOL)appendRecord:(NSData *)record
+{
+    if (self.count == 0) {
+        [self feedBytes:kFPBatchPrefix length:strlen(kFPBatchPrefix) flush:Z_NO_FLUSH];
+    } else {
+        [self feedBytes:"," length:1 flush:Z_NO_FLUSH];
+    }
+    [self feedBytes:record.bytes length:record.length flush:Z_NO_FLUSH];
+    self.count += 1;
+    return !_failed;
+}
+
+- (NSData *)finishWithSentAt:(NSString *)sentAt
+{
+    if (self.count == 0) {
+        [self feedBytes:kFPBatchPrefix length:strlen(kFPBatchPrefix) flush:Z_NO_FLUSH];
+    }
+    NSData *suffix = [[NSString stringWithFormat:@"],\"sentAt\":\"%@\"}", sentAt] dataUsingEncoding:NSUTF8StringEncoding];
+    [self feedBytes:suffix.bytes length:suffix.length flush:Z_FINISH];
+
+    NSData *body = nil;
+    if (!_failed) {
+        // Hand the buffer over instead of copying it; the next batch starts a fresh one.
+        self.output.length = (NSUInteger)_stream.total_out;
+        body = self.output;
+        self.output = [NSMutableData dataWithCapacity:kFPBatchBuilderChunkSize];
+    }
+    [self reset];
+    return body;
+}
+
+- (void)reset
+{
+    if (_streamReady) {
+        _deflateReset(&_stream);
+    }
+    self.output.length = 0;
+    self.count = 0;
+    self.uncompressedLength = 0;
+    _failed = !_streamReady;
+}
+
+#pragma mark - Private
+
+- (void)feedBytes:(const void *)bytes length:(NSUInteger)length flush:(int)flush
+{
+    if (_failed || !_streamReady) {
+        _failed = YES;
+        return;
+    }
+    self.uncompressedLength += length;
+    _stream.next_in = (Bytef *)bytes;
+    _stream.avail_in = (uInt)length;
+
+    for (;;) {
+        if (_stream.total_out >= self.output.length) {
+            self.output.length += kFPBatchBuilderChunkSize;
+        }
+        _stream.next_out = (Bytef *)self.output.mutableBytes + _stream.total_out;
+        _stream.avail_out = (uInt)(self.output.length - _stream.total_out);
+
+        int status = _deflate(&_stream, flush);
+        if (status == Z_STREAM_END) {
+            break;
+        }
+        if ((status != Z_OK && status != Z_BUF_ERROR) || (status == Z_BUF_ERROR && flush == Z_FINISH && _stream.avail_out > 0)) {
+            FPLog(@"Unable to compress batch: %d", status);
+            _failed = YES;
+            break;
+        }
+        // Without Z_FINISH, deflate is done once it has taken all input and left output space unused.
+        if (flush != Z_FINISH && _stream.avail_in == 0 && _stream.avail_out > 0) {
+            break;
+        }
+    }
+    _stream.next_in = Z_NULL;
+}
+
+@end
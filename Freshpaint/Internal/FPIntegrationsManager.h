@@ -14,6 +14,7 @@
  */
 extern NSString *_Nonnull const kFPAnonymousIdFilename;
 extern NSString *_Nonnull const kFPCachedSettingsFilename;
+extern NSString *_Nonnull const kFPCachedSettingsMetadataFilename;
 
 /**
  * NSNotification name, that is posted after integrations are loaded.
@@ -28,6 +29,7 @@ NS_SWIFT_NAME(IntegrationsManager)
 // Exposed for testing.
 + (BOOL)isIntegration:(NSString *_Nonnull)key enabledInOptions:(NSDictionary *_Nonnull)options;
 + (BOOL)isTrackEvent:(NSString *_Nonnull)event enabledForIntegration:(NSString *_Nonnull)key inPlan:(NSDictionary *_Nonnull)plan;
++ (BOOL)isSettingsCacheFetchedAt:(NSDate *_Nullable)fetchedAt expiredForTTL:(NSTimeInterval)ttl;
 
 // @Deprecated - Exposing for backward API compat reasons only
 @property (nonatomic, readonly) NSMutableDictionary *_Nonnull registeredIntegrations;
@@ -37,6 +39,10 @@ NS_SWIFT_NAME(IntegrationsManager)
 // @Deprecated - Exposing for backward API compat reasons only
 - (NSString *_Nonnull)getAnonymousId;
 
+- (void)drainWithCompletion:(void (^_Nullable)(NSUInteger deliveredCount))completion;
+
+- (BOOL)handleEventsForBackgroundURLSession:(NSString *_Nonnull)identifier completionHandler:(void (^_Nonnull)(void))completionHandler;
+
 @end
 
 
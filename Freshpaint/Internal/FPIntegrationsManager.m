@@ -28,11 +28,15 @@
 #import "FPAliasPayload.h"
 #import "FPUtils.h"
 #import "FPState.h"
+#import "FPDeliveryMetrics+FPRecording.h"
+#import "FPTrackingPlan.h"
 
 NSString *FPAnalyticsIntegrationDidStart = @"io.freshpaint.analytics.integration.did.start";
 NSString *const FPAnonymousIdKey = @"FPAnonymousId";
 NSString *const kFPAnonymousIdFilename = @"freshpaint.anonymousId";
 NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
+// When the cached settings were fetched and the validators to check them for changes with.
+NSString *const kFPCachedSettingsMetadataFilename = @"freshpaint.settings.v2.meta.plist";
 
 
 @interface FPIdentifyPayload (AnonymousId)
@@ -60,10 +64,104 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
 @end
 
 
-@interface FPIntegrationsManager ()
+// Serial queue an integration is called on, so that a slow integration only holds up its own events.
+@interface FPIntegrationInbox : NSObject
+@property (nonatomic, strong) dispatch_queue_t queue;
+// Events waiting past which new ones are dropped.
+@property (nonatomic, assign) NSUInteger capacity;
+@property (nonatomic, assign) NSUInteger pendingCount;
+@property (nonatomic, strong) FPDeliveryMetrics *metrics;
+@end
+
+@implementation FPIntegrationInbox
+
+// Runs `block` on the queue, unless `capacity` events are already waiting for it.
+- (void)deliverEvent:(dispatch_block_t)block
+{
+    @synchronized(self) {
+        if (self.pendingCount >= self.capacity) {
+            [self.metrics fp_recordDispatchDropped];
+            return;
+        }
+        self.pendingCount += 1;
+    }
+    CFAbsoluteTime queuedAt = CFAbsoluteTimeGetCurrent();
+    seg_dispatch_specific_async(self.queue, ^{
+        [self.metrics fp_recordDispatchWithLag:CFAbsoluteTimeGetCurrent() - queuedAt];
+        block();
+        @synchronized(self) {
+            self.pendingCount -= 1;
+        }
+    });
+}
+
+// Runs `block` on the queue after the events already waiting. Calls other than events are never dropped.
+- (void)deliverCall:(dispatch_block_t)block
+{
+    seg_dispatch_specific_async(self.queue, block);
+}
+
+@end
+
+
+// Integration method taking a payload, e.g. `track:`.
+typedef void (*FPPayloadIMP)(id, SEL, FPPayload *);
+
+// An integration that takes the events of one type, resolved once when the integrations start.
+@interface FPIntegrationDispatchTarget : NSObject
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic, strong) id<FPIntegration> integration;
+@property (nonatomic, assign) SEL selector;
+@property (nonatomic, copy) NSString *selectorName;
+@property (nonatomic, assign) FPPayloadIMP imp;
+@property (nonatomic, strong) FPIntegrationInbox *inbox;
+// Nil when no destination middleware is set for the integration.
+@property (nonatomic, strong) FPMiddlewareRunner *runner;
+@end
+
+@implementation FPIntegrationDispatchTarget
+@end
+
+// Integration method taking the payloads of `eventType`, NULL for the event types without a payload.
+static SEL FPPayloadSelectorForEventType(FPEventType eventType)
+{
+    switch (eventType) {
+        case FPEventTypeIdentify:
+            return @selector(identify:);
+        case FPEventTypeTrack:
+            return @selector(track:);
+        case FPEventTypeScreen:
+            return @selector(screen:);
+        case FPEventTypeGroup:
+            return @selector(group:);
+        case FPEventTypeAlias:
+            return @selector(alias:);
+        default:
+            return NULL;
+    }
+}
+
+static FPEventType FPPayloadEventTypeForSelector(SEL selector)
+{
+    for (FPEventType eventType = FPEventTypeIdentify; eventType <= FPEventTypeAlias; eventType++) {
+        if (sel_isEqual(selector, FPPayloadSelectorForEventType(eventType))) {
+            return eventType;
+        }
+    }
+    return FPEventTypeUndefined;
+}
+
+
+@interface FPIntegrationsManager () {
+    // Integrations taking each payload event type, built by `buildDispatchTable` and only used on the serial queue.
+    NSArray<FPIntegrationDispatchTarget *> *_dispatchTable[FPEventTypeAlias + 1];
+}
 
 @property (nonatomic, strong) FPAnalytics *analytics;
 @property (nonatomic, strong) NSDictionary *cachedSettings;
+@property (nonatomic, strong) NSDictionary *cachedSettingsMetadata;
+// Compiled from the `plan` of `cachedSettings` when first needed, dropped when they change.
+@property (nonatomic, strong) FPTrackingPlan *trackingPlan;
 @property (nonatomic, strong) FPAnalyticsConfiguration *configuration;
 @property (nonatomic, strong) dispatch_queue_t serialQueue;
 @property (nonatomic, strong) NSMutableArray *messageQueue;
@@ -71,6 +169,7 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
 @property (nonatomic, strong) NSMutableDictionary *integrations;
 @property (nonatomic, strong) NSMutableDictionary *registeredIntegrations;
 @property (nonatomic, strong) NSMutableDictionary *integrationMiddleware;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, FPIntegrationInbox *> *integrationInboxes;
 @property (nonatomic) volatile BOOL initialized;
 @property (nonatomic, copy) NSString *cachedAnonymousId;
 @property (nonatomic, strong) FPHTTPClient *httpClient;
@@ -89,6 +188,7 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
 
 @dynamic cachedAnonymousId;
 @synthesize cachedSettings = _cachedSettings;
+@synthesize cachedSettingsMetadata = _cachedSettingsMetadata;
 
 - (instancetype _Nonnull)initWithAnalytics:(FPAnalytics *_Nonnull)analytics
 {
@@ -101,6 +201,7 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
         self.serialQueue = seg_dispatch_queue_create_specific("io.freshpaint.analytics", DISPATCH_QUEUE_SERIAL);
         self.messageQueue = [[NSMutableArray alloc] init];
         self.httpClient = [[FPHTTPClient alloc] initWithRequestFactory:configuration.requestFactory];
+        self.httpClient.transport = configuration.transport;
         
         self.userDefaultsStorage = [[FPUserDefaultsStorage alloc] initWithDefaults:[NSUserDefaults standardUserDefaults] namespacePrefix:nil crypto:configuration.crypto];
         #if TARGET_OS_TV
@@ -116,6 +217,7 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
         self.integrations = [NSMutableDictionary dictionaryWithCapacity:factories.count];
         self.registeredIntegrations = [NSMutableDictionary dictionaryWithCapacity:factories.count];
         self.integrationMiddleware = [NSMutableDictionary dictionaryWithCapacity:factories.count];
+        self.integrationInboxes = [NSMutableDictionary dictionaryWithCapacity:factories.count];
 
         // Update settings on each integration immediately
         [self refreshSettings];
@@ -221,10 +323,7 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
         [self saveAnonymousId:anonymousId];
     }
 
-    [self callIntegrationsWithSelector:NSSelectorFromString(@"identify:")
-                             arguments:@[ payload ]
-                               options:payload.options
-                                  sync:false];
+    [self callIntegrationsWithPayload:payload eventType:FPEventTypeIdentify];
 }
 
 #pragma mark - Track
@@ -233,10 +332,7 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
 {
     NSCAssert1(payload.event.length > 0, @"event (%@) must not be empty.", payload.event);
 
-    [self callIntegrationsWithSelector:NSSelectorFromString(@"track:")
-                             arguments:@[ payload ]
-                               options:payload.options
-                                  sync:false];
+    [self callIntegrationsWithPayload:payload eventType:FPEventTypeTrack];
 }
 
 #pragma mark - Screen
@@ -245,30 +341,21 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
 {
     NSCAssert1(payload.name.length > 0, @"screen name (%@) must not be empty.", payload.name);
 
-    [self callIntegrationsWithSelector:NSSelectorFromString(@"screen:")
-                             arguments:@[ payload ]
-                               options:payload.options
-                                  sync:false];
+    [self callIntegrationsWithPayload:payload eventType:FPEventTypeScreen];
 }
 
 #pragma mark - Group
 
 - (void)group:(FPGroupPayload *)payload
 {
-    [self callIntegrationsWithSelector:NSSelectorFromString(@"group:")
-                             arguments:@[ payload ]
-                               options:payload.options
-                                  sync:false];
+    [self callIntegrationsWithPayload:payload eventType:FPEventTypeGroup];
 }
 
 #pragma mark - Alias
 
 - (void)alias:(FPAliasPayload *)payload
 {
-    [self callIntegrationsWithSelector:NSSelectorFromString(@"alias:")
-                             arguments:@[ payload ]
-                               options:payload.options
-                                  sync:false];
+    [self callIntegrationsWithPayload:payload eventType:FPEventTypeAlias];
 }
 
 - (void)receivedRemoteNotification:(NSDictionary *)userInfo
@@ -358,6 +445,18 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
     [self callIntegrationsWithSelector:_cmd arguments:nil options:nil sync:false];
 }
 
+- (void)drainWithCompletion:(void (^)(NSUInteger))completion
+{
+    // Only the Freshpaint integration keeps a queue, so the completion is called once.
+    [self callIntegrationsWithSelector:_cmd arguments:@[ [completion copy] ?: [NSNull null] ] options:nil sync:false];
+}
+
+- (BOOL)handleEventsForBackgroundURLSession:(NSString *)identifier completionHandler:(void (^)(void))completionHandler
+{
+    // The session is recreated here if need be; the Freshpaint integration picks up its results through the HTTP client.
+    return [self.httpClient handleEventsForBackgroundURLSession:identifier completionHandler:completionHandler];
+}
+
 #pragma mark - Analytics Settings
 
 - (NSDictionary *)cachedSettings
@@ -375,7 +474,13 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
 
 - (void)setCachedSettings:(NSDictionary *)settings
 {
+    if (settings && [settings isEqualToDictionary:self.cachedSettings]) {
+        // Nothing to write; integrations that have not started yet still need them.
+        [self updateIntegrationsWithSettings:settings[@"integrations"]];
+        return;
+    }
     _cachedSettings = [settings copy];
+    self.trackingPlan = nil;
     if (!_cachedSettings) {
         // [@{} writeToURL:settingsURL atomically:YES];
         return;
@@ -390,6 +495,46 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
     [self updateIntegrationsWithSettings:settings[@"integrations"]];
 }
 
+- (FPTrackingPlan *)trackingPlan
+{
+    if (!_trackingPlan) {
+        _trackingPlan = [[FPTrackingPlan alloc] initWithPlan:self.cachedSettings[@"plan"]];
+    }
+    return _trackingPlan;
+}
+
+- (NSDictionary *)cachedSettingsMetadata
+{
+    if (!_cachedSettingsMetadata) {
+#if TARGET_OS_TV
+        _cachedSettingsMetadata = [self.userDefaultsStorage dictionaryForKey:kFPCachedSettingsMetadataFilename] ?: @{};
+#else
+        _cachedSettingsMetadata = [self.fileStorage dictionaryForKey:kFPCachedSettingsMetadataFilename] ?: @{};
+#endif
+    }
+    return _cachedSettingsMetadata;
+}
+
+- (void)setCachedSettingsMetadata:(NSDictionary *)metadata
+{
+    _cachedSettingsMetadata = [metadata copy];
+#if TARGET_OS_TV
+    [self.userDefaultsStorage setDictionary:_cachedSettingsMetadata forKey:kFPCachedSettingsMetadataFilename];
+#else
+    [self.fileStorage setDictionary:_cachedSettingsMetadata forKey:kFPCachedSettingsMetadataFilename];
+#endif
+}
+
++ (BOOL)isSettingsCacheFetchedAt:(NSDate *)fetchedAt expiredForTTL:(NSTimeInterval)ttl
+{
+    if (fetchedAt == nil) {
+        return YES;
+    }
+    NSTimeInterval age = -fetchedAt.timeIntervalSinceNow;
+    // A clock set back makes the age negative; refetch rather than trust the cache for longer than the TTL.
+    return age < 0 || age >= ttl;
+}
+
 - (nonnull NSArray<id<FPMiddleware>> *)middlewareForIntegrationKey:(NSString *)key
 {
     NSMutableArray *result = [[NSMutableArray alloc] init];
@@ -428,6 +573,7 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
                 FPLog(@"No settings for %@. Skipping.", key);
             }
         }
+        [self buildDispatchTable];
         [self flushMessageQueue];
         self.initialized = true;
     });
@@ -465,23 +611,64 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
     return result;
 }
 
+- (NSDictionary *)settingsWithFreshpaintSettings:(NSDictionary *)settings
+{
+    NSMutableDictionary *newSettings = [settings serializableMutableDeepCopy];
+    NSMutableDictionary *integrations = newSettings[@"integrations"];
+    if ([integrations isKindOfClass:[NSDictionary class]]) {
+        integrations[@"Freshpaint.io"] = [self freshpaintSettings];
+    } else {
+        newSettings[@"integrations"] = @{@"Freshpaint.io": [self freshpaintSettings]};
+    }
+    return newSettings;
+}
+
+- (NSDictionary *)localSettings
+{
+    if (self.configuration.defaultSettings != nil) {
+        NSDictionary *newSettings = [self settingsWithFreshpaintSettings:self.configuration.defaultSettings];
+        NSLog(@"Hit default configured: %@", newSettings);
+        return newSettings;
+    }
+    NSLog(@"Hit default: %@", [self defaultSettings]);
+    return [self defaultSettings];
+}
+
 - (void)refreshSettings
 {
     seg_dispatch_specific_async(_serialQueue, ^{
-        if (self.configuration.defaultSettings != nil) {
-            NSMutableDictionary *newSettings = [self.configuration.defaultSettings serializableMutableDeepCopy];
-            NSMutableDictionary *integrations = newSettings[@"integrations"];
-            if (integrations != nil) {
-                integrations[@"Freshpaint.io"] = [self freshpaintSettings];
-            } else {
-                newSettings[@"integrations"] = @{@"Freshpaint.io": [self freshpaintSettings]};
-            }
-            NSLog(@"Hit default configured: %@", newSettings);
-            [self setCachedSettings:newSettings];
-        } else {
-            NSLog(@"Hit default: %@", [self defaultSettings]);
-            [self setCachedSettings:[self defaultSettings]];
+        if (!self.configuration.shouldFetchSettings) {
+            [self setCachedSettings:[self localSettings]];
+            return;
+        }
+        // Integrations start right away from the last fetched settings, and from the defaults until a fetch succeeds.
+        if (!self.initialized) {
+            NSDictionary *cachedSettings = self.cachedSettings;
+            [self setCachedSettings:cachedSettings.count > 0 ? cachedSettings : [self localSettings]];
+        }
+
+        NSNumber *fetchedAt = self.cachedSettingsMetadata[@"fetchedAt"];
+        NSDate *fetchDate = fetchedAt ? [NSDate dateWithTimeIntervalSince1970:fetchedAt.doubleValue] : nil;
+        if (self.settingsRequest != nil || ![[self class] isSettingsCacheFetchedAt:fetchDate expiredForTTL:self.configuration.settingsTTL]) {
+            return;
         }
+        NSDictionary *validators = self.cachedSettingsMetadata[@"validators"];
+        self.settingsRequest = [self.httpClient settingsForWriteKey:self.configuration.writeKey validators:validators completionHandler:^(BOOL success, BOOL notModified, JSON_DICT settings, NSDictionary<NSString *, NSString *> *newValidators) {
+            seg_dispatch_specific_async(self.serialQueue, ^{
+                self.settingsRequest = nil;
+                if (!success) {
+                    // Keep using the cache; the next launch or foreground tries again.
+                    return;
+                }
+                if (!notModified) {
+                    [self setCachedSettings:[self settingsWithFreshpaintSettings:settings]];
+                }
+                self.cachedSettingsMetadata = @{
+                    @"fetchedAt" : @([NSDate date].timeIntervalSince1970),
+                    @"validators" : newValidators ?: @{},
+                };
+            });
+        }];
     });
 }
 
@@ -519,26 +706,98 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
 
 + (BOOL)isTrackEvent:(NSString *)event enabledForIntegration:(NSString *)key inPlan:(NSDictionary *)plan
 {
-    // Whether the event is enabled or disabled, it should always be sent to api.freshpaint.io.
-    if ([key isEqualToString:@"Freshpaint.io"]) {
-        return YES;
-    }
+    // Events go through the plan compiled from the settings; this compiles `plan` for a single decision.
+    return [[[FPTrackingPlan alloc] initWithPlan:plan capacity:1] isTrackEvent:event enabledForIntegration:key];
+}
 
-    if (plan[@"track"][event]) {
-        if ([plan[@"track"][event][@"enabled"] boolValue]) {
-            return [self isIntegration:key enabledInOptions:plan[@"track"][event][@"integrations"]];
-        } else {
-            return NO;
+- (FPIntegrationInbox *)inboxForIntegrationKey:(NSString *)key
+{
+    BOOL latencyCritical = [self.configuration.latencyCriticalIntegrations containsObject:key];
+    dispatch_queue_attr_t attributes = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, latencyCritical ? QOS_CLASS_USER_INITIATED : QOS_CLASS_UTILITY, 0);
+    NSString *label = [NSString stringWithFormat:@"io.freshpaint.analytics.integration.%@", key];
+    FPIntegrationInbox *inbox = [[FPIntegrationInbox alloc] init];
+    inbox.queue = seg_dispatch_queue_create_specific(label.UTF8String, attributes);
+    // Events bound for the queue of the SDK itself are never dropped here; that queue handles its own overflow.
+    inbox.capacity = [key isEqualToString:@"Freshpaint.io"] ? NSUIntegerMax : MAX(self.configuration.integrationInboxCapacity, 1u);
+    inbox.metrics = [self.analytics.deliveryMetrics fp_metricsForDestination:key];
+    return inbox;
+}
+
+// Resolves, once for every event to come, the integrations taking each payload type and the methods to call.
+// Also gives every integration its inbox.
+- (void)buildDispatchTable
+{
+    [self.integrations enumerateKeysAndObjectsUsingBlock:^(NSString *key, id<FPIntegration> integration, BOOL *stop) {
+        if (self.integrationInboxes[key] == nil) {
+            self.integrationInboxes[key] = [self inboxForIntegrationKey:key];
         }
-    } else if (plan[@"track"][@"__default"]) {
-        return [plan[@"track"][@"__default"][@"enabled"] boolValue];
+    }];
+    for (FPEventType eventType = FPEventTypeIdentify; eventType <= FPEventTypeAlias; eventType++) {
+        SEL selector = FPPayloadSelectorForEventType(eventType);
+        NSMutableArray<FPIntegrationDispatchTarget *> *targets = [NSMutableArray arrayWithCapacity:self.integrations.count];
+        [self.integrations enumerateKeysAndObjectsUsingBlock:^(NSString *key, id<FPIntegration> integration, BOOL *stop) {
+            if (![integration respondsToSelector:selector]) {
+                FPLog(@"Not sending %@ calls to %@ because it doesn't respond to them.", NSStringFromSelector(selector), key);
+                return;
+            }
+            FPIntegrationDispatchTarget *target = [[FPIntegrationDispatchTarget alloc] init];
+            target.key = key;
+            target.integration = integration;
+            target.selector = selector;
+            target.selectorName = NSStringFromSelector(selector);
+            // Forwarded methods resolve to the forwarding trampoline, which still delivers the call.
+            target.imp = (FPPayloadIMP)class_getMethodImplementation(object_getClass(integration), selector);
+            FPMiddlewareRunner *runner = self.integrationMiddleware[key];
+            target.runner = runner.middlewares.count > 0 ? runner : nil;
+            target.inbox = self.integrationInboxes[key];
+            [targets addObject:target];
+        }];
+        _dispatchTable[eventType] = [targets copy];
     }
+}
 
-    return YES;
+// Delivers a payload through the dispatch table, with a direct call to every integration taking it on its own queue.
+- (void)forwardPayload:(FPPayload *)payload eventType:(FPEventType)eventType options:(NSDictionary *)options
+{
+    NSDictionary *integrationOptions = options[@"integrations"];
+    FPTrackingPlan *plan = eventType == FPEventTypeTrack ? self.trackingPlan : nil;
+    for (FPIntegrationDispatchTarget *target in _dispatchTable[eventType]) {
+        if (![[self class] isIntegration:target.key enabledInOptions:integrationOptions]) {
+            FPLog(@"Not sending call to %@ because it is disabled in options.", target.key);
+            continue;
+        }
+        if (plan != nil && ![plan isTrackEvent:((FPTrackPayload *)payload).event enabledForIntegration:target.key]) {
+            FPLog(@"Not sending call to %@ because it is disabled in plan.", target.key);
+            continue;
+        }
+
+        [target.inbox deliverEvent:^{
+            FPPayload *delivered = payload;
+            if (target.runner) {
+                FPContext *context = [[[FPContext alloc] initWithAnalytics:self.analytics] modify:^(id<FPMutableContext> _Nonnull ctx) {
+                    ctx.eventType = eventType;
+                    ctx.payload = payload;
+                }];
+                delivered = [target.runner run:context callback:nil].payload;
+                if (delivered == nil) {
+                    return;
+                }
+            }
+
+            FPLog(@"Running: %@ with arguments %@ on integration: %@", target.selectorName, delivered, target.key);
+            target.imp(target.integration, target.selector, delivered);
+        }];
+    }
 }
 
 - (void)forwardSelector:(SEL)selector arguments:(NSArray *)arguments options:(NSDictionary *)options
 {
+    FPEventType eventType = FPPayloadEventTypeForSelector(selector);
+    if (eventType != FPEventTypeUndefined && arguments.count == 1) {
+        [self forwardPayload:arguments[0] eventType:eventType options:options];
+        return;
+    }
+
     [self.integrations enumerateKeysAndObjectsUsingBlock:^(NSString *key, id<FPIntegration> integration, BOOL *stop) {
         [self invokeIntegration:integration key:key selector:selector arguments:arguments options:options];
     }];
@@ -602,7 +861,7 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
     FPEventType eventType = [self eventTypeFromSelector:selector];
     if (eventType == FPEventTypeTrack) {
         FPTrackPayload *eventPayload = arguments[0];
-        BOOL enabled = [[self class] isTrackEvent:eventPayload.event enabledForIntegration:key inPlan:self.cachedSettings[@"plan"]];
+        BOOL enabled = [self.trackingPlan isTrackEvent:eventPayload.event enabledForIntegration:key];
         if (!enabled) {
             FPLog(@"Not sending call to %@ because it is disabled in plan.", key);
             return;
@@ -634,7 +893,16 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
     
     FPLog(@"Running: %@ with arguments %@ on integration: %@", NSStringFromSelector(selector), newArguments, key);
     NSInvocation *invocation = [self invocationForSelector:selector arguments:newArguments];
-    [invocation invokeWithTarget:integration];
+    FPIntegrationInbox *inbox = self.integrationInboxes[key];
+    if (inbox == nil) {
+        [invocation invokeWithTarget:integration];
+        return;
+    }
+    // Runs after the events already waiting for the integration, e.g. a flush after the track calls before it.
+    [invocation retainArguments];
+    [inbox deliverCall:^{
+        [invocation invokeWithTarget:integration];
+    }];
 }
 
 - (NSInvocation *)invocationForSelector:(SEL)selector arguments:(NSArray *)arguments
@@ -668,6 +936,19 @@ NSString *const kFPCachedSettingsFilename = @"freshpaint.settings.v2.plist";
     }
 }
 
+- (void)callIntegrationsWithPayload:(FPPayload *)payload eventType:(FPEventType)eventType
+{
+    NSDictionary *options = payload.options;
+    seg_dispatch_specific_async(_serialQueue, ^{
+        if (self.initialized) {
+            [self flushMessageQueue];
+            [self forwardPayload:payload eventType:eventType options:options];
+        } else {
+            [self queueSelector:FPPayloadSelectorForEventType(eventType) arguments:@[ payload ] options:options];
+        }
+    });
+}
+
 - (void)callIntegrationsWithSelector:(SEL)selector arguments:(NSArray *)arguments options:(NSDictionary *)options sync:(BOOL)sync
 {
     // TODO: Currently we ignore the `sync` argument and queue the event asynchronously.
@@ -0,0 +1,69 @@
+//
+//  FPRetryScheduler.h
+//  Freshpaint
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Decides when uploads may be attempted again after they failed.
+ *
+ * Every failure pushes the next attempt back by an exponentially growing delay with equal
+ * jitter, i.e. a random delay between half and all of `baseDelay * 2^(failures - 1)`, capped
+ * at `maxDelay`. A `Retry-After` delay requested by the server is never undercut, up to the
+ * larger of `maxDelay` and `breakerCooldown`.
+ *
+ * After `failureThreshold` consecutive failures the circuit breaker opens and uploads pause
+ * for `breakerCooldown`. Once that elapses a single probe is let through; its failure opens
+ * the breaker again, its success closes it.
+ *
+ * Uploads running side by side fail together in an outage. An upload notes `failureCount`
+ * when it starts, and its failure is only counted if no other failure was counted since, so
+ * that a wave of concurrent uploads moves the backoff by a single step.
+ *
+ * When the delay elapses the retry handler is called on the queue given at creation, so the
+ * owner can flush again without waiting for its regular flush triggers.
+ *
+ * Not thread safe; FPFreshpaintIntegration and FPWebhookIntegration only use it from their serial queues.
+ */
+@interface FPRetryScheduler : NSObject
+
+/// Delay after the first failure. Defaults to 1 second.
+@property (nonatomic, assign) NSTimeInterval baseDelay;
+/// Upper bound of the backoff delay. Defaults to 5 minutes.
+@property (nonatomic, assign) NSTimeInterval maxDelay;
+/// Consecutive failures that open the circuit breaker. Defaults to 5.
+@property (nonatomic, assign) NSUInteger failureThreshold;
+/// How long uploads pause once the circuit breaker is open. Defaults to 10 minutes.
+@property (nonatomic, assign) NSTimeInterval breakerCooldown;
+
+@property (nonatomic, assign, readonly) NSUInteger consecutiveFailures;
+/// Failures counted so far, never reset.
+@property (nonatomic, assign, readonly) NSUInteger failureCount;
+@property (nonatomic, assign, readonly, getter=isBreakerOpen) BOOL breakerOpen;
+/// Earliest time the next upload may start, or nil when uploads are not held back.
+@property (nonatomic, strong, readonly, nullable) NSDate *nextAttemptDate;
+
+- (instancetype)initWithQueue:(dispatch_queue_t)queue retryHandler:(void (^)(void))retryHandler NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+/// Whether an upload may start now.
+- (BOOL)canAttempt;
+
+/// Records a failed upload and schedules the retry handler. `retryAfter` is the delay requested
+/// by the server, 0 if none. Returns the delay until the next attempt.
+- (NSTimeInterval)recordFailureWithRetryAfter:(NSTimeInterval)retryAfter;
+
+/// Records the failure of an upload started when `failureCount` was `startFailureCount`. If another
+/// failure was counted since, this one is not: the retry already scheduled stands, pushed back only by a
+/// longer `retryAfter`. Returns the delay until the next attempt.
+- (NSTimeInterval)recordFailureWithRetryAfter:(NSTimeInterval)retryAfter startFailureCount:(NSUInteger)startFailureCount;
+
+/// Records a successful upload, closing the breaker and cancelling the pending retry.
+- (void)recordSuccess;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,112 @@
+//
+//  FPRetryScheduler.m
+//  Freshpaint
+//
+
+#import "FPRetryScheduler.h"
+#import "FPUtils.h"
+
+
+@interface FPRetryScheduler ()
+
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, copy) void (^retryHandler)(void);
+@property (nonatomic, assign, readwrite) NSUInteger consecutiveFailures;
+@property (nonatomic, assign, readwrite) NSUInteger failureCount;
+@property (nonatomic, assign, readwrite) BOOL breakerOpen;
+@property (nonatomic, strong, readwrite, nullable) NSDate *nextAttemptDate;
+// Bumped whenever the pending retry is superseded, so stale timers do nothing when they fire.
+@property (nonatomic, assign) NSUInteger generation;
+
+@end
+
+
+@implementation FPRetryScheduler
+
+- (instancetype)initWithQueue:(dispatch_queue_t)queue retryHandler:(void (^)(void))retryHandler
+{
+    if (self = [super init]) {
+        _queue = queue;
+        _retryHandler = [retryHandler copy];
+        _baseDelay = 1;
+        _maxDelay = 5 * 60;
+        _failureThreshold = 5;
+        _breakerCooldown = 10 * 60;
+    }
+    return self;
+}
+
+- (BOOL)canAttempt
+{
+    return self.nextAttemptDate == nil || self.nextAttemptDate.timeIntervalSinceNow <= 0;
+}
+
+- (NSTimeInterval)recordFailureWithRetryAfter:(NSTimeInterval)retryAfter
+{
+    return [self recordFailureWithRetryAfter:retryAfter startFailureCount:self.failureCount];
+}
+
+- (NSTimeInterval)recordFailureWithRetryAfter:(NSTimeInterval)retryAfter startFailureCount:(NSUInteger)startFailureCount
+{
+    // A bogus or hostile Retry-After must not hold uploads back for the rest of the process lifetime.
+    retryAfter = MIN(retryAfter, MAX(self.maxDelay, self.breakerCooldown));
+    if (startFailureCount < self.failureCount) {
+        // Part of the wave whose failure was already counted.
+        NSTimeInterval remaining = MAX(self.nextAttemptDate.timeIntervalSinceNow, 0);
+        if (retryAfter <= remaining) {
+            return remaining;
+        }
+        self.nextAttemptDate = [NSDate dateWithTimeIntervalSinceNow:retryAfter];
+        [self scheduleRetryAfter:retryAfter];
+        return retryAfter;
+    }
+
+    self.failureCount += 1;
+    self.consecutiveFailures += 1;
+
+    NSTimeInterval delay;
+    if (self.consecutiveFailures >= MAX(self.failureThreshold, 1u)) {
+        if (!self.breakerOpen) {
+            FPLog(@"%@ %lu uploads failed in a row, pausing uploads for %.0fs.", self, (unsigned long)self.consecutiveFailures, self.breakerCooldown);
+        }
+        self.breakerOpen = YES;
+        delay = self.breakerCooldown;
+    } else {
+        // 2^(failures - 1), without overflowing on long outages.
+        double backoff = MIN(self.baseDelay * pow(2, MIN(self.consecutiveFailures - 1, 32u)), self.maxDelay);
+        delay = backoff / 2 + backoff / 2 * ((double)arc4random() / UINT32_MAX);
+    }
+    delay = MAX(delay, retryAfter);
+
+    self.nextAttemptDate = [NSDate dateWithTimeIntervalSinceNow:delay];
+    [self scheduleRetryAfter:delay];
+    return delay;
+}
+
+- (void)recordSuccess
+{
+    if (self.breakerOpen) {
+        FPLog(@"%@ Upload succeeded, resuming uploads.", self);
+    }
+    self.consecutiveFailures = 0;
+    self.breakerOpen = NO;
+    self.nextAttemptDate = nil;
+    self.generation += 1;
+}
+
+#pragma mark - Private
+
+- (void)scheduleRetryAfter:(NSTimeInterval)delay
+{
+    NSUInteger generation = ++self.generation;
+    __weak typeof(self) weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), self.queue, ^{
+        __strong typeof(weakSelf) strongSelf = weakSelf;
+        if (strongSelf == nil || strongSelf.generation != generation) {
+            return;
+        }
+        strongSelf.retryHandler();
+    });
+}
+
+@end
@@ -0,0 +1,37 @@
+//
+//  FPTrackingPlan.h
+//  Freshpaint
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * The `plan` of the project settings, compiled to decide which integrations get a track event.
+ *
+ * The rules of `plan.track` are read once into a table keyed by event name, along with the `__default` rule.
+ * Every decision is then kept by event name and integration key, so a track event costs a lookup per integration
+ * however many events the plan lists. Decisions of only the `capacity` most recently seen event names are kept,
+ * in a list ordered by when each name was last seen, so finding, refreshing and evicting one take constant time.
+ *
+ * A plan never changes; new settings get a new plan, which drops the decisions of the old one.
+ *
+ * Not thread safe; FPIntegrationsManager only uses it from its serial queue.
+ */
+@interface FPTrackingPlan : NSObject
+
+@property (nonatomic, assign, readonly) NSUInteger capacity;
+/// Event names whose decisions are kept.
+@property (nonatomic, assign, readonly) NSUInteger cachedEventCount;
+
+- (instancetype)initWithPlan:(NSDictionary *_Nullable)plan capacity:(NSUInteger)capacity NS_DESIGNATED_INITIALIZER;
+- (instancetype)initWithPlan:(NSDictionary *_Nullable)plan;
+- (instancetype)init NS_UNAVAILABLE;
+
+/// Whether the track event `event` goes to the integration `key`. Always YES for Freshpaint.io.
+- (BOOL)isTrackEvent:(NSString *)event enabledForIntegration:(NSString *)key;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,164 @@
+//
+//  FPTrackingPlan.m
+//  Freshpaint
+//
+
+#import "FPTrackingPlan.h"
+#import "FPIntegrationsManager.h"
+
+// Event names whose decisions are kept by default.
+static const NSUInteger kFPTrackingPlanDefaultCapacity = 1000;
+
+
+// A rule of `plan.track`: whether the event is sent at all, and to which integrations.
+@interface FPTrackingPlanRule : NSObject
+@property (nonatomic, assign) BOOL enabled;
+@property (nonatomic, copy) NSDictionary *integrations;
+@end
+
+@implementation FPTrackingPlanRule
+@end
+
+
+// The decisions about an event name, linked in the order event names were last seen.
+@interface FPTrackingPlanEntry : NSObject
+@property (nonatomic, copy) NSString *event;
+// Decisions by integration key.
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSNumber *> *decisions;
+// Held by the plan through the entry before it, so it never outlives it.
+@property (nonatomic, unsafe_unretained) FPTrackingPlanEntry *previous;
+@property (nonatomic, strong) FPTrackingPlanEntry *next;
+@end
+
+@implementation FPTrackingPlanEntry
+@end
+
+
+@interface FPTrackingPlan ()
+@property (nonatomic, assign, readwrite) NSUInteger capacity;
+@property (nonatomic, copy) NSDictionary<NSString *, FPTrackingPlanRule *> *rules;
+// Nil when the plan has no `__default` rule.
+@property (nonatomic, strong) NSNumber *defaultEnabled;
+// Decisions by event name.
+@property (nonatomic, strong) NSMutableDictionary<NSString *, FPTrackingPlanEntry *> *entries;
+// Ends of the list of `entries`, from the least to the most recently seen.
+@property (nonatomic, strong) FPTrackingPlanEntry *oldest;
+@property (nonatomic, strong) FPTrackingPlanEntry *newest;
+@end
+
+
+@implementation FPTrackingPlan
+
+- (instancetype)initWithPlan:(NSDictionary *)plan
+{
+    return [self initWithPlan:plan capacity:kFPTrackingPlanDefaultCapacity];
+}
+
+- (instancetype)initWithPlan:(NSDictionary *)plan capacity:(NSUInteger)capacity
+{
+    if (self = [super init]) {
+        _capacity = MAX(capacity, 1u);
+        _entries = [NSMutableDictionary dictionary];
+
+        NSDictionary *track = [plan isKindOfClass:[NSDictionary class]] ? plan[@"track"] : nil;
+        if (![track isKindOfClass:[NSDictionary class]]) {
+            track = @{};
+        }
+        NSMutableDictionary<NSString *, FPTrackingPlanRule *> *rules = [NSMutableDictionary dictionaryWithCapacity:track.count];
+        [track enumerateKeysAndObjectsUsingBlock:^(NSString *event, NSDictionary *entry, BOOL *stop) {
+            if (![entry isKindOfClass:[NSDictionary class]]) {
+                return;
+            }
+            if ([event isEqualToString:@"__default"]) {
+                self.defaultEnabled = @([entry[@"enabled"] boolValue]);
+            }
+            FPTrackingPlanRule *rule = [[FPTrackingPlanRule alloc] init];
+            rule.enabled = [entry[@"enabled"] boolValue];
+            rule.integrations = [entry[@"integrations"] isKindOfClass:[NSDictionary class]] ? entry[@"integrations"] : @{};
+            rules[event] = rule;
+        }];
+        _rules = [rules copy];
+    }
+    return self;
+}
+
+- (NSUInteger)cachedEventCount
+{
+    return self.entries.count;
+}
+
+- (BOOL)isTrackEvent:(NSString *)event enabledForIntegration:(NSString *)key
+{
+    // Whether the event is enabled or disabled, it should always be sent to api.freshpaint.io.
+    if ([key isEqualToString:@"Freshpaint.io"]) {
+        return YES;
+    }
+
+    FPTrackingPlanEntry *entry = self.entries[event];
+    if (entry == nil) {
+        entry = [[FPTrackingPlanEntry alloc] init];
+        entry.event = event;
+        entry.decisions = [NSMutableDictionary dictionary];
+        self.entries[event] = entry;
+        [self appendEntry:entry];
+        if (self.entries.count > self.capacity) {
+            FPTrackingPlanEntry *oldest = self.oldest;
+            [self unlinkEntry:oldest];
+            [self.entries removeObjectForKey:oldest.event];
+        }
+    } else if (entry != self.newest) {
+        [self unlinkEntry:entry];
+        [self appendEntry:entry];
+    }
+
+    NSNumber *decision = entry.decisions[key];
+    if (decision != nil) {
+        return decision.boolValue;
+    }
+    BOOL enabled = [self decideTrackEvent:event enabledForIntegration:key];
+    entry.decisions[key] = @(enabled);
+    return enabled;
+}
+
+#pragma mark - Private
+
+- (void)appendEntry:(FPTrackingPlanEntry *)entry
+{
+    entry.previous = self.newest;
+    if (self.newest != nil) {
+        self.newest.next = entry;
+    } else {
+        self.oldest = entry;
+    }
+    self.newest = entry;
+}
+
+- (void)unlinkEntry:(FPTrackingPlanEntry *)entry
+{
+    if (entry.previous != nil) {
+        entry.previous.next = entry.next;
+    } else {
+        self.oldest = entry.next;
+    }
+    if (entry.next != nil) {
+        entry.next.previous = entry.previous;
+    } else {
+        self.newest = entry.previous;
+    }
+    entry.previous = nil;
+    entry.next = nil;
+}
+
+- (BOOL)decideTrackEvent:(NSString *)event enabledForIntegration:(NSString *)key
+{
+    FPTrackingPlanRule *rule = self.rules[event];
+    if (rule != nil) {
+        return rule.enabled && [FPIntegrationsManager isIntegration:key enabledInOptions:rule.integrations];
+    }
+    if (self.defaultEnabled != nil) {
+        return self.defaultEnabled.boolValue;
+    }
+    return YES;
+}
+
+@end
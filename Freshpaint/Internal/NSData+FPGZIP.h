@@ -41,4 +41,9 @@ extern void *_Nullable seg_libzOpen(void);
 - (nullable NSData *)seg_gzippedData;
 - (BOOL)seg_isGzippedData;
 
+/// Deflates the data into a zlib stream primed with a preset dictionary. Returns nil if the stream cannot be set up.
+- (nullable NSData *)seg_deflatedDataWithDictionary:(nonnull NSData *)dictionary;
+/// Inflates a zlib stream made by seg_deflatedDataWithDictionary:, or nil if it is invalid or needs another dictionary.
+- (nullable NSData *)seg_inflatedDataWithDictionary:(nonnull NSData *)dictionary;
+
 @end
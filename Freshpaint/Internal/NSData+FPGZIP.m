@@ -104,4 +104,90 @@ void *_Nullable seg_libzOpen()
     return (self.length >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b);
 }
 
+- (NSData *)seg_deflatedDataWithDictionary:(NSData *)dictionary
+{
+    void *libz = seg_libzOpen();
+    int (*deflateInit2_)(z_streamp, int, int, int, int, int, const char *, int) =
+        (int (*)(z_streamp, int, int, int, int, int, const char *, int))dlsym(libz, "deflateInit2_");
+    int (*deflateSetDictionary)(z_streamp, const Bytef *, uInt) = (int (*)(z_streamp, const Bytef *, uInt))dlsym(libz, "deflateSetDictionary");
+    int (*deflate)(z_streamp, int) = (int (*)(z_streamp, int))dlsym(libz, "deflate");
+    int (*deflateEnd)(z_streamp) = (int (*)(z_streamp))dlsym(libz, "deflateEnd");
+
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    stream.avail_in = (uint)self.length;
+    stream.next_in = (Bytef *)(void *)self.bytes;
+    stream.total_out = 0;
+    stream.avail_out = 0;
+
+    static const NSUInteger ChunkSize = 16384;
+
+    NSMutableData *output = nil;
+    // A window of 15 bits without the gzip flag of 16 gives a zlib stream; gzip has no room for a dictionary id.
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+        if (deflateSetDictionary(&stream, dictionary.bytes, (uInt)dictionary.length) == Z_OK) {
+            output = [NSMutableData dataWithLength:ChunkSize];
+            while (stream.avail_out == 0) {
+                if (stream.total_out >= output.length) {
+                    output.length += ChunkSize;
+                }
+                stream.next_out = (uint8_t *)output.mutableBytes + stream.total_out;
+                stream.avail_out = (uInt)(output.length - stream.total_out);
+                deflate(&stream, Z_FINISH);
+            }
+            output.length = stream.total_out;
+        }
+        deflateEnd(&stream);
+    }
+
+    return output;
+}
+
+- (NSData *)seg_inflatedDataWithDictionary:(NSData *)dictionary
+{
+    void *libz = seg_libzOpen();
+    int (*inflateInit2_)(z_streamp, int, const char *, int) =
+        (int (*)(z_streamp, int, const char *, int))dlsym(libz, "inflateInit2_");
+    int (*inflateSetDictionary)(z_streamp, const Bytef *, uInt) = (int (*)(z_streamp, const Bytef *, uInt))dlsym(libz, "inflateSetDictionary");
+    int (*inflate)(z_streamp, int) = (int (*)(z_streamp, int))dlsym(libz, "inflate");
+    int (*inflateEnd)(z_streamp) = (int (*)(z_streamp))dlsym(libz, "inflateEnd");
+
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    stream.avail_in = (uint)self.length;
+    stream.next_in = (Bytef *)(void *)self.bytes;
+    stream.total_out = 0;
+    stream.avail_out = 0;
+
+    static const NSUInteger ChunkSize = 16384;
+
+    if (inflateInit2(&stream, 15) != Z_OK) {
+        return nil;
+    }
+    NSMutableData *output = [NSMutableData dataWithLength:ChunkSize];
+    int status = Z_OK;
+    while (status == Z_OK) {
+        if (stream.total_out >= output.length) {
+            output.length += ChunkSize;
+        }
+        stream.next_out = (uint8_t *)output.mutableBytes + stream.total_out;
+        stream.avail_out = (uInt)(output.length - stream.total_out);
+        status = inflate(&stream, Z_NO_FLUSH);
+        if (status == Z_NEED_DICT) {
+            // Fails with Z_DATA_ERROR when the stream names another dictionary.
+            status = inflateSetDictionary(&stream, dictionary.bytes, (uInt)dictionary.length);
+        }
+    }
+    inflateEnd(&stream);
+    if (status != Z_STREAM_END) {
+        return nil;
+    }
+    output.length = stream.total_out;
+    return output;
+}
+
 @end
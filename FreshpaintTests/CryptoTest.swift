@@ -58,4 +58,80 @@ class CryptoTest : XCTestCase {
         let strOut = String(data: dataOut!, encoding: String.Encoding.utf8)
         XCTAssertNotEqual(strOut ?? "", strIn, "Out and In strings should not match")
     }
+    
+    func testStreamingMatchesOneShot() {
+        let dataIn = Data(repeating: 0x2A, count: 100_000)
+        let encryptedData = crypto.encrypt(dataIn)
+        
+        let encryptOut = OutputStream.toMemory()
+        XCTAssertTrue(crypto.encrypt(from: InputStream(data: dataIn), to: encryptOut))
+        let streamed = encryptOut.property(forKey: .dataWrittenToMemoryStreamKey) as? Data
+        XCTAssertEqual(streamed, encryptedData, "Streamed and one shot cipher text should match")
+        
+        let decryptOut = OutputStream.toMemory()
+        XCTAssertTrue(crypto.decrypt(from: InputStream(data: streamed!), to: decryptOut))
+        XCTAssertEqual(decryptOut.property(forKey: .dataWrittenToMemoryStreamKey) as? Data, dataIn)
+    }
+    
+    func testRepeatedUseReusesCryptors() {
+        for i in 0..<20 {
+            let dataIn = "event \(i)".data(using: String.Encoding.utf8)!
+            XCTAssertEqual(crypto.decrypt(crypto.encrypt(dataIn)!), dataIn)
+        }
+    }
+    
+    // Per-persist cost as it used to be: two PBKDF2 derivations per encrypt.
+    func testPersistCostDerivingKeyEachTime() {
+        let payload = Data(repeating: 0x2A, count: 4096)
+        measure {
+            for _ in 0..<10 {
+                _ = AES256Crypto.deriveKey(password: crypto.password, salt: crypto.salt)
+                _ = AES256Crypto.deriveKey(password: crypto.password, salt: crypto.salt)
+                _ = crypto.encrypt(payload)
+            }
+        }
+    }
+    
+    // Per-persist cost with the cached key and pooled cryptors.
+    func testPersistCostWithCachedKey() {
+        let payload = Data(repeating: 0x2A, count: 4096)
+        _ = crypto.encrypt(payload)
+        measure {
+            for _ in 0..<10 {
+                _ = crypto.decrypt(crypto.encrypt(payload)!)
+            }
+        }
+    }
+    
+    func testRecordEnvelopeRoundTrip() {
+        let dataIn = "segment".data(using: String.Encoding.utf8)!
+        let sealed = crypto.sealRecord(dataIn)
+        XCTAssertNotNil(sealed, "Sealed record should not be nil")
+        XCTAssertNotEqual(sealed, crypto.sealRecord(dataIn), "Each record should get its own nonce")
+        XCTAssertEqual(crypto.openRecord(sealed!), dataIn)
+        
+        let empty = crypto.sealRecord(Data())
+        XCTAssertEqual(crypto.openRecord(empty!), Data())
+    }
+    
+    func testRecordEnvelopesReuseCryptors() {
+        // Lengths off the block size leave unused key stream behind in a reused cryptor.
+        let records = (0..<20).map { Data(repeating: UInt8($0), count: 7 * $0 + 3) }
+        let sealed = records.map { crypto.sealRecord($0)! }
+        let fresh = AES256Crypto(password: crypto.password, salt: crypto.salt, iv: crypto.iv)
+        for (record, envelope) in zip(records, sealed).reversed() {
+            XCTAssertEqual(fresh.openRecord(envelope), record)
+            XCTAssertEqual(crypto.openRecord(envelope), record)
+        }
+    }
+    
+    func testRecordEnvelopeRejectsTampering() {
+        var sealed = crypto.sealRecord("segment".data(using: String.Encoding.utf8)!)!
+        sealed[20] ^= 0x01
+        XCTAssertNil(crypto.openRecord(sealed), "Tampered record should fail authentication")
+        
+        let crypto2 = AES256Crypto(password: "wolf", salt: crypto.salt, iv: crypto.iv)
+        let other = crypto2.sealRecord("segment".data(using: String.Encoding.utf8)!)!
+        XCTAssertNil(crypto.openRecord(other), "Record sealed with another password should not open")
+    }
 }
@@ -0,0 +1,735 @@
+//
+//  FPBatchPackingTests.m
+//  FreshpaintTests
+//
+
+#import <XCTest/XCTest.h>
+#import "FPAnalytics.h"
+#import "FPAnalyticsConfiguration.h"
+#import "FPDeliveryMetrics.h"
+#import "FPEventQueue.h"
+#import "FPFreshpaintIntegration.h"
+#import "FPFileStorage.h"
+#import "FPUserDefaultsStorage.h"
+#import "FPHTTPClient.h"
+#import "FPCompactBatchCodec.h"
+#import "NSData+FPGZIP.h"
+#import "NSData+FPGUNZIPP.h"
+
+@interface FPFreshpaintIntegration (Testing)
+- (void)dispatchBackgroundAndWait:(void (^)(void))block;
+- (void)queueRecord:(NSData *)record lane:(FPEventLane)lane;
+- (void)compactQueue;
+- (uint64_t)batchEndFromSequence:(uint64_t)start maxCount:(NSUInteger)maxCount count:(NSUInteger *)count;
+- (NSData *)recordFittingBatchFromPayload:(NSDictionary *)payload;
+- (void)flushWithMaxSize:(NSUInteger)maxBatchSize;
+- (void)drainWithCompletion:(void (^)(NSUInteger))completion;
+- (void)applicationDidEnterBackground;
+- (NSTimeInterval)nextFlushInterval;
+@end
+
+// Holds on to uploads instead of sending them so tests decide when and how each one completes.
+@interface FPRecordingHTTPClient : FPHTTPClient
+@property (nonatomic, strong) NSMutableArray<NSData *> *bodies;
+@property (nonatomic, strong) NSMutableArray<NSData *> *compactBodies;
+@property (nonatomic, strong) NSMutableArray<void (^)(BOOL, NSTimeInterval)> *completions;
+@property (nonatomic, strong) NSMutableArray<NSURL *> *uploadedFiles;
+// What the background session reports as still running.
+@property (nonatomic, copy) NSSet<NSString *> *runningBackgroundUploads;
+@property (nonatomic, strong) NSMutableArray<NSString *> *prewarmedWriteKeys;
+@end
+
+@implementation FPRecordingHTTPClient
+
+- (id<FPTransportTask>)uploadData:(NSData *)body forWriteKey:(NSString *)writeKey completionHandler:(void (^)(BOOL, NSTimeInterval))completionHandler
+{
+    [self.bodies addObject:body];
+    [self.completions addObject:completionHandler];
+    return nil;
+}
+
+- (id<FPTransportTask>)uploadCompactData:(NSData *)body forWriteKey:(NSString *)writeKey completionHandler:(void (^)(BOOL, NSTimeInterval))completionHandler
+{
+    [self.compactBodies addObject:body];
+    [self.completions addObject:completionHandler];
+    return nil;
+}
+
+- (NSURLSessionUploadTask *)uploadFile:(NSURL *)fileURL forWriteKey:(NSString *)writeKey
+{
+    [self.uploadedFiles addObject:fileURL];
+    return nil;
+}
+
+- (void)getBackgroundUploadsForWriteKey:(NSString *)writeKey completionHandler:(void (^)(NSSet<NSString *> *))completionHandler
+{
+    completionHandler(self.runningBackgroundUploads ?: [NSSet set]);
+}
+
+- (void)prewarmSessionForWriteKey:(NSString *)writeKey
+{
+    [self.prewarmedWriteKeys addObject:writeKey];
+}
+
+@end
+
+@interface FPBatchPackingTests : XCTestCase
+@property (nonatomic, strong) FPAnalyticsConfiguration *configuration;
+@property (nonatomic, strong) FPAnalytics *analytics;
+@property (nonatomic, strong) NSURL *folderURL;
+@end
+
+@implementation FPBatchPackingTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.configuration = [FPAnalyticsConfiguration configurationWithWriteKey:@"TEST_WRITE_KEY"];
+    // Only flush when a test asks for it.
+    self.configuration.flushAt = 10000;
+    self.analytics = [[FPAnalytics alloc] initWithConfiguration:self.configuration];
+    self.folderURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[NSUUID UUID].UUIDString];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtURL:self.folderURL error:nil];
+    self.analytics = nil;
+    self.configuration = nil;
+    [super tearDown];
+}
+
+- (FPFreshpaintIntegration *)makeIntegration
+{
+    return [self makeIntegrationWithHTTPClient:[[FPHTTPClient alloc] initWithRequestFactory:nil]];
+}
+
+- (FPFreshpaintIntegration *)makeIntegrationWithHTTPClient:(FPHTTPClient *)httpClient
+{
+    FPFileStorage *fileStorage = [[FPFileStorage alloc] initWithFolder:self.folderURL crypto:nil];
+    FPUserDefaultsStorage *defaultsStorage = [[FPUserDefaultsStorage alloc] initWithDefaults:[NSUserDefaults standardUserDefaults] namespacePrefix:nil crypto:nil];
+    return [[FPFreshpaintIntegration alloc] initWithAnalytics:self.analytics
+                                                   httpClient:httpClient
+                                                  fileStorage:fileStorage
+                                          userDefaultsStorage:defaultsStorage];
+}
+
+- (NSDictionary *)payloadWithBlobOfLength:(NSUInteger)length
+{
+    NSString *blob = [@"" stringByPaddingToLength:length withString:@"x" startingAtIndex:0];
+    return @{ @"type" : @"track", @"event" : @"Big", @"properties" : @{ @"blob" : blob, @"small" : @"keep" } };
+}
+
+- (void)testBatchesArePackedByByteSize
+{
+    FPFreshpaintIntegration *integration = [self makeIntegration];
+    NSData *record = [NSJSONSerialization dataWithJSONObject:[self payloadWithBlobOfLength:150000] options:0 error:nil];
+
+    __block NSUInteger count = 0;
+    [integration dispatchBackgroundAndWait:^{
+        for (NSUInteger i = 0; i < 5; i++) {
+            [integration queueRecord:record lane:FPEventLaneStandard];
+        }
+        [integration batchEndFromSequence:0 maxCount:100 count:&count];
+    }];
+    XCTAssertEqual(count, 3u);
+}
+
+- (void)testBatchesStillRespectTheCountLimit
+{
+    FPFreshpaintIntegration *integration = [self makeIntegration];
+    NSData *record = [NSJSONSerialization dataWithJSONObject:@{ @"type" : @"track", @"event" : @"Small" } options:0 error:nil];
+
+    __block NSUInteger count = 0;
+    [integration dispatchBackgroundAndWait:^{
+        for (NSUInteger i = 0; i < 5; i++) {
+            [integration queueRecord:record lane:FPEventLaneStandard];
+        }
+        [integration batchEndFromSequence:0 maxCount:2 count:&count];
+    }];
+    XCTAssertEqual(count, 2u);
+}
+
+- (void)testOversizedEventIsTruncated
+{
+    FPFreshpaintIntegration *integration = [self makeIntegration];
+    NSData *record = [integration recordFittingBatchFromPayload:[self payloadWithBlobOfLength:600000]];
+
+    XCTAssertNotNil(record);
+    XCTAssertLessThan(record.length, kFPMaxBatchSize);
+    NSDictionary *event = [NSJSONSerialization JSONObjectWithData:record options:0 error:nil];
+    XCTAssertNil(event[@"properties"][@"blob"]);
+    XCTAssertEqualObjects(event[@"properties"][@"small"], @"keep");
+    XCTAssertEqual(self.analytics.deliveryMetrics.oversizedEventsTruncated, 1u);
+    XCTAssertEqual(self.analytics.deliveryMetrics.oversizedEventsDropped, 0u);
+}
+
+- (void)testOversizedEventWithManyPropertiesKeepsTheSmallestOnes
+{
+    FPFreshpaintIntegration *integration = [self makeIntegration];
+    NSMutableDictionary *properties = [NSMutableDictionary dictionaryWithObject:@"keep" forKey:@"small"];
+    for (NSUInteger i = 0; i < 40; i++) {
+        properties[[NSString stringWithFormat:@"medium%lu", (unsigned long)i]] = [@"" stringByPaddingToLength:20000 + i withString:@"x" startingAtIndex:0];
+    }
+    NSData *record = [integration recordFittingBatchFromPayload:@{ @"type" : @"track", @"event" : @"Big", @"properties" : properties }];
+
+    XCTAssertNotNil(record);
+    XCTAssertLessThan(record.length, kFPMaxBatchSize);
+    NSDictionary *event = [NSJSONSerialization JSONObjectWithData:record options:0 error:nil];
+    XCTAssertEqualObjects(event[@"properties"][@"small"], @"keep");
+    XCTAssertNil(event[@"properties"][@"medium39"], @"the largest values go first");
+    XCTAssertNotNil(event[@"properties"][@"medium0"]);
+    XCTAssertEqual(self.analytics.deliveryMetrics.oversizedEventsTruncated, 1u);
+}
+
+- (void)testOversizedEventIsDroppedWithDropPolicy
+{
+    self.configuration.oversizedEventPolicy = FPOversizedEventPolicyDrop;
+    FPFreshpaintIntegration *integration = [self makeIntegration];
+
+    XCTAssertNil([integration recordFittingBatchFromPayload:[self payloadWithBlobOfLength:600000]]);
+    XCTAssertEqual(self.analytics.deliveryMetrics.oversizedEventsDropped, 1u);
+}
+
+- (FPRecordingHTTPClient *)makeRecordingClient
+{
+    FPRecordingHTTPClient *client = [[FPRecordingHTTPClient alloc] initWithRequestFactory:nil];
+    client.bodies = [NSMutableArray array];
+    client.compactBodies = [NSMutableArray array];
+    client.completions = [NSMutableArray array];
+    client.uploadedFiles = [NSMutableArray array];
+    client.prewarmedWriteKeys = [NSMutableArray array];
+    return client;
+}
+
+- (NSArray<NSDictionary *> *)eventsInBody:(NSData *)body
+{
+    NSData *json = [body seg_isGzippedData] ? [body seg_gunzippedData] : body;
+    return [NSJSONSerialization JSONObjectWithData:json options:0 error:nil][@"batch"];
+}
+
+- (NSUInteger)eventCountInBody:(NSData *)body
+{
+    return [self eventsInBody:body].count;
+}
+
+- (NSUInteger)queueCountOfIntegration:(FPFreshpaintIntegration *)integration
+{
+    __block NSUInteger count = 0;
+    [integration dispatchBackgroundAndWait:^{
+        count = [[integration valueForKey:@"queue"] count];
+    }];
+    return count;
+}
+
+- (void)complete:(FPRecordingHTTPClient *)client upload:(NSUInteger)index retry:(BOOL)retry integration:(FPFreshpaintIntegration *)integration
+{
+    [self complete:client upload:index retry:retry retryAfter:0 integration:integration];
+}
+
+- (void)complete:(FPRecordingHTTPClient *)client upload:(NSUInteger)index retry:(BOOL)retry retryAfter:(NSTimeInterval)retryAfter integration:(FPFreshpaintIntegration *)integration
+{
+    client.completions[index](retry, retryAfter);
+    // Completions hop onto the integration queue; wait for them to land.
+    [integration dispatchBackgroundAndWait:^{}];
+}
+
+- (void)queueSmallRecords:(NSUInteger)count integration:(FPFreshpaintIntegration *)integration
+{
+    NSData *record = [NSJSONSerialization dataWithJSONObject:@{ @"type" : @"track", @"event" : @"Small" } options:0 error:nil];
+    [integration dispatchBackgroundAndWait:^{
+        for (NSUInteger i = 0; i < count; i++) {
+            [integration queueRecord:record lane:FPEventLaneStandard];
+        }
+    }];
+}
+
+- (void)testSeveralBatchesAreUploadedConcurrently
+{
+    self.configuration.maxInFlightBatches = 3;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:350 integration:integration];
+
+    [integration flushWithMaxSize:100];
+    [integration dispatchBackgroundAndWait:^{}];
+
+    XCTAssertEqual(client.bodies.count, 3u);
+    XCTAssertEqual([self eventCountInBody:client.bodies[0]], 100u);
+    XCTAssertEqual([self eventCountInBody:client.bodies[2]], 100u);
+}
+
+- (void)testRequestNotificationsCarryTheEvents
+{
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:2 integration:integration];
+
+    XCTNSNotificationExpectation *sent = [[XCTNSNotificationExpectation alloc] initWithName:FPFreshpaintDidSendRequest];
+    sent.handler = ^BOOL(NSNotification *notification) {
+        NSArray *batch = notification.object;
+        return batch.count == 2 && [batch[0] isKindOfClass:[NSDictionary class]] && [batch[1][@"event"] isEqualToString:@"Small"];
+    };
+    [integration flushWithMaxSize:100];
+    [self waitForExpectations:@[ sent ] timeout:2];
+}
+
+- (void)testOutOfOrderResponsesAreAcknowledgedInOrder
+{
+    self.configuration.maxInFlightBatches = 3;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:250 integration:integration];
+
+    [integration flushWithMaxSize:100];
+    [integration dispatchBackgroundAndWait:^{}];
+    XCTAssertEqual(client.completions.count, 3u);
+
+    [self complete:client upload:2 retry:NO integration:integration];
+    XCTAssertEqual([self queueCountOfIntegration:integration], 250u, @"The last batch waits for the ones before it");
+
+    [self complete:client upload:0 retry:NO integration:integration];
+    XCTAssertEqual([self queueCountOfIntegration:integration], 150u);
+
+    [self complete:client upload:1 retry:NO integration:integration];
+    XCTAssertEqual([self queueCountOfIntegration:integration], 0u);
+}
+
+- (void)testTrimmingWhileInFlightSparesTheUploadingBatch
+{
+    self.configuration.maxQueueSize = 150;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:100 integration:integration];
+
+    [integration flushWithMaxSize:100];
+    [integration dispatchBackgroundAndWait:^{}];
+    // The new events make room for each other rather than evicting the uploading ones.
+    [self queueSmallRecords:100 integration:integration];
+    XCTAssertEqual([self queueCountOfIntegration:integration], 150u);
+    XCTAssertEqual(self.analytics.deliveryMetrics.queueOverflowEventsDropped, 50u);
+
+    [self complete:client upload:0 retry:NO integration:integration];
+    XCTAssertEqual([self queueCountOfIntegration:integration], 50u);
+}
+
+- (void)testCriticalEventsOutliveQueueOverflow
+{
+    self.configuration.maxQueueSize = 10;
+    self.configuration.criticalTrackEvents = [NSSet setWithObject:@"Order Completed"];
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    NSData *identify = [NSJSONSerialization dataWithJSONObject:@{ @"type" : @"identify", @"userId" : @"sloth" } options:0 error:nil];
+    NSData *order = [NSJSONSerialization dataWithJSONObject:@{ @"type" : @"track", @"event" : @"Order Completed" } options:0 error:nil];
+    [integration dispatchBackgroundAndWait:^{
+        [integration queueRecord:identify lane:FPEventLaneCritical];
+        [integration queueRecord:order lane:FPEventLaneCritical];
+    }];
+    // Leaves the queue mostly holes, behind the critical events pinning its head.
+    [self queueSmallRecords:100 integration:integration];
+    [integration dispatchBackgroundAndWait:^{
+        XCTAssertGreaterThan([[integration valueForKey:@"queue"] span], 100u, @"Enqueueing does not compact the queue itself");
+        [integration compactQueue];
+        XCTAssertEqual([[integration valueForKey:@"queue"] span], 10u);
+    }];
+
+    XCTAssertEqual([self queueCountOfIntegration:integration], 10u);
+    XCTAssertEqual(self.analytics.deliveryMetrics.queueOverflowEventsDropped, 92u);
+    XCTAssertEqual(self.analytics.deliveryMetrics.queueOverflowCriticalEventsDropped, 0u);
+
+    [integration flushWithMaxSize:100];
+    [integration dispatchBackgroundAndWait:^{}];
+    NSArray<NSDictionary *> *batch = [self eventsInBody:client.bodies[0]];
+    XCTAssertEqual(batch.count, 10u);
+    XCTAssertEqualObjects(batch[0][@"type"], @"identify");
+    XCTAssertEqualObjects(batch[1][@"event"], @"Order Completed");
+}
+
+- (void)testCompactionKeepsDeliveredBatchesWaitingOnAFailedOne
+{
+    self.configuration.maxQueueSize = 10;
+    self.configuration.maxInFlightBatches = 2;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    NSData *identify = [NSJSONSerialization dataWithJSONObject:@{ @"type" : @"identify", @"userId" : @"sloth" } options:0 error:nil];
+    NSData *small = [NSJSONSerialization dataWithJSONObject:@{ @"type" : @"track", @"event" : @"Small" } options:0 error:nil];
+    [integration dispatchBackgroundAndWait:^{
+        [integration queueRecord:identify lane:FPEventLaneCritical];
+        for (NSUInteger i = 0; i < 4; i++) {
+            [integration queueRecord:small lane:FPEventLaneStandard];
+        }
+        for (NSUInteger i = 0; i < 5; i++) {
+            [integration queueRecord:identify lane:FPEventLaneCritical];
+        }
+    }];
+    [integration flushWithMaxSize:5];
+    [integration dispatchBackgroundAndWait:^{}];
+    XCTAssertEqual(client.bodies.count, 2u);
+    [self complete:client upload:0 retry:YES integration:integration];
+    [self complete:client upload:1 retry:NO integration:integration];
+
+    // Evicts a track event of the failed batch, then the new events in turn, leaving holes for the compaction to reclaim.
+    [self queueSmallRecords:20 integration:integration];
+    [integration dispatchBackgroundAndWait:^{
+        [integration compactQueue];
+    }];
+    XCTAssertEqual([self queueCountOfIntegration:integration], 10u);
+
+    [integration flushWithMaxSize:5];
+    [integration dispatchBackgroundAndWait:^{}];
+    XCTAssertEqual(client.bodies.count, 4u);
+    XCTAssertEqual([self eventCountInBody:client.bodies[2]], 4u, @"The failed batch, less its evicted event");
+    XCTAssertEqual([self eventCountInBody:client.bodies[3]], 1u, @"The delivered batch is not sent again");
+
+    [self complete:client upload:2 retry:NO integration:integration];
+    XCTAssertEqual([self queueCountOfIntegration:integration], 1u);
+}
+
+- (void)testFailedBatchIsResentBeforeNewOnes
+{
+    self.configuration.maxInFlightBatches = 2;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:300 integration:integration];
+
+    [integration flushWithMaxSize:100];
+    [integration dispatchBackgroundAndWait:^{}];
+    [self complete:client upload:0 retry:YES integration:integration];
+    [self complete:client upload:1 retry:NO integration:integration];
+    XCTAssertEqual([self queueCountOfIntegration:integration], 300u);
+
+    [integration flushWithMaxSize:100];
+    [integration dispatchBackgroundAndWait:^{}];
+    XCTAssertEqual(client.bodies.count, 4u, @"The failed batch and one new batch");
+    XCTAssertEqual([self eventCountInBody:client.bodies[2]], 100u);
+
+    [self complete:client upload:2 retry:NO integration:integration];
+    XCTAssertEqual([self queueCountOfIntegration:integration], 100u);
+}
+
+- (void)testConcurrentFailuresMoveTheBackoffOnce
+{
+    self.configuration.maxInFlightBatches = 2;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:200 integration:integration];
+
+    [integration flushWithMaxSize:100];
+    [integration dispatchBackgroundAndWait:^{}];
+    XCTAssertEqual(client.bodies.count, 2u);
+    [self complete:client upload:0 retry:YES integration:integration];
+    [self complete:client upload:1 retry:YES integration:integration];
+
+    XCTAssertEqualObjects([integration valueForKeyPath:@"retryScheduler.consecutiveFailures"], @1, @"Both requests failed in the same outage");
+}
+
+- (void)testDrainChainsBatchesUntilTheQueueIsEmpty
+{
+    self.configuration.maxInFlightBatches = 1;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:250 integration:integration];
+
+    XCTestExpectation *drained = [self expectationWithDescription:@"drained"];
+    [integration drainWithCompletion:^(NSUInteger deliveredCount) {
+        XCTAssertEqual(deliveredCount, 250u);
+        [drained fulfill];
+    }];
+    [integration dispatchBackgroundAndWait:^{}];
+
+    for (NSUInteger i = 0; i < 3; i++) {
+        XCTAssertEqual(client.completions.count, i + 1, @"The next batch starts as soon as the previous one is delivered");
+        [self complete:client upload:i retry:NO integration:integration];
+    }
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    XCTAssertEqual([self queueCountOfIntegration:integration], 0u);
+}
+
+- (void)testDrainStopsOnFailure
+{
+    self.configuration.maxInFlightBatches = 1;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:250 integration:integration];
+
+    XCTestExpectation *drained = [self expectationWithDescription:@"drained"];
+    [integration drainWithCompletion:^(NSUInteger deliveredCount) {
+        XCTAssertEqual(deliveredCount, 100u);
+        [drained fulfill];
+    }];
+    [integration dispatchBackgroundAndWait:^{}];
+    [self complete:client upload:0 retry:NO integration:integration];
+    [self complete:client upload:1 retry:YES integration:integration];
+
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    XCTAssertEqual(client.completions.count, 2u);
+    XCTAssertEqual([self queueCountOfIntegration:integration], 150u);
+}
+
+- (void)testFlushBacksOffAfterFailedUpload
+{
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:50 integration:integration];
+
+    [integration flushWithMaxSize:100];
+    [integration dispatchBackgroundAndWait:^{}];
+    [self complete:client upload:0 retry:YES integration:integration];
+
+    [integration flushWithMaxSize:100];
+    [integration dispatchBackgroundAndWait:^{}];
+    XCTAssertEqual(client.bodies.count, 1u, @"The retry waits for the backoff delay");
+    XCTAssertEqual(self.analytics.deliveryMetrics.uploadsFailed, 1u);
+    XCTAssertEqual(self.analytics.deliveryMetrics.consecutiveUploadFailures, 1u);
+    XCTAssertNotNil(self.analytics.deliveryMetrics.nextUploadAttemptDate);
+}
+
+- (void)testRetryAfterPostponesTheRetry
+{
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:50 integration:integration];
+
+    [integration flushWithMaxSize:100];
+    [integration dispatchBackgroundAndWait:^{}];
+    [self complete:client upload:0 retry:YES retryAfter:120 integration:integration];
+
+    XCTAssertGreaterThan(self.analytics.deliveryMetrics.nextUploadAttemptDate.timeIntervalSinceNow, 100);
+}
+
+- (void)testSuccessfulUploadClearsTheBackoff
+{
+    self.configuration.maxInFlightBatches = 2;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:200 integration:integration];
+
+    [integration flushWithMaxSize:100];
+    [integration dispatchBackgroundAndWait:^{}];
+    [self complete:client upload:0 retry:YES integration:integration];
+    [self complete:client upload:1 retry:NO integration:integration];
+
+    XCTAssertEqual(self.analytics.deliveryMetrics.uploadsSucceeded, 1u);
+    XCTAssertEqual(self.analytics.deliveryMetrics.consecutiveUploadFailures, 0u);
+    XCTAssertNil(self.analytics.deliveryMetrics.nextUploadAttemptDate);
+}
+
+- (void)testCompactBatchRejectedByTheServerIsResentAsJSON
+{
+    self.configuration.shouldUseCompactEncoding = YES;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:5 integration:integration];
+
+    [integration flushWithMaxSize:100];
+    [integration dispatchBackgroundAndWait:^{}];
+    XCTAssertEqual(client.bodies.count, 0u);
+    XCTAssertEqual(client.compactBodies.count, 1u);
+    XCTAssertEqual([[FPCompactBatchCodec decodeBatch:client.compactBodies[0]][@"batch"] count], 5u);
+
+    // What the client does on a 415 response.
+    [client setValue:@YES forKey:@"compactEncodingRejected"];
+    [self complete:client upload:0 retry:YES integration:integration];
+    XCTAssertEqual(client.bodies.count, 1u);
+    XCTAssertEqual([self eventCountInBody:client.bodies[0]], 5u);
+    XCTAssertEqual(self.analytics.deliveryMetrics.uploadsFailed, 0u, @"Falling back is not a failed upload");
+
+    [self complete:client upload:1 retry:NO integration:integration];
+    XCTAssertEqual([self queueCountOfIntegration:integration], 0u);
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Background uploads
+// ---------------------------------------------------------------------------
+
+- (void)completeBackgroundUpload:(NSURL *)fileURL client:(FPRecordingHTTPClient *)client integration:(FPFreshpaintIntegration *)integration
+{
+    client.backgroundUploadCompletionHandler(fileURL.lastPathComponent, NO, 0);
+    [integration dispatchBackgroundAndWait:^{}];
+}
+
+- (void)testBackgroundUploadsAreWrittenToFiles
+{
+    self.configuration.shouldUseBackgroundUploads = YES;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:250 integration:integration];
+
+    [integration applicationDidEnterBackground];
+    [integration dispatchBackgroundAndWait:^{}];
+
+    XCTAssertEqual(client.bodies.count, 0u, @"Nothing is uploaded from memory");
+    XCTAssertEqual(client.uploadedFiles.count, 3u, @"Every queued event is handed over, not only maxInFlightBatches batches");
+    XCTAssertEqual([self eventCountInBody:[NSData dataWithContentsOfURL:client.uploadedFiles[0]]], 100u);
+
+    for (NSURL *fileURL in [client.uploadedFiles copy]) {
+        [self completeBackgroundUpload:fileURL client:client integration:integration];
+        XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:fileURL.path]);
+    }
+    XCTAssertEqual([self queueCountOfIntegration:integration], 0u);
+}
+
+- (void)testBackgroundUploadsAreReconciledOnRelaunch
+{
+    self.configuration.shouldUseBackgroundUploads = YES;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:150 integration:integration];
+    [integration applicationDidEnterBackground];
+    [integration dispatchBackgroundAndWait:^{}];
+    XCTAssertEqual(client.uploadedFiles.count, 2u);
+
+    // Relaunch: the session still runs the first upload and lost the second.
+    FPRecordingHTTPClient *relaunchedClient = [self makeRecordingClient];
+    relaunchedClient.runningBackgroundUploads = [NSSet setWithObject:client.uploadedFiles[0].lastPathComponent];
+    FPFreshpaintIntegration *relaunched = [self makeIntegrationWithHTTPClient:relaunchedClient];
+    [relaunched dispatchBackgroundAndWait:^{}];
+
+    [relaunched flushWithMaxSize:100];
+    [relaunched dispatchBackgroundAndWait:^{}];
+    XCTAssertEqual(relaunchedClient.bodies.count, 1u, @"Only the lost batch is sent again");
+    XCTAssertEqual([self eventCountInBody:relaunchedClient.bodies[0]], 50u);
+
+    [self completeBackgroundUpload:client.uploadedFiles[0] client:relaunchedClient integration:relaunched];
+    XCTAssertEqual([self queueCountOfIntegration:relaunched], 50u);
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Flush timer
+// ---------------------------------------------------------------------------
+
+- (NSTimeInterval)flushTimerIntervalOfIntegration:(FPFreshpaintIntegration *)integration
+{
+    __block NSTimeInterval interval = 0;
+    [integration dispatchBackgroundAndWait:^{
+        interval = [[integration valueForKey:@"flushTimerInterval"] doubleValue];
+    }];
+    return interval;
+}
+
+- (void)testFlushTimerOnlyRunsWhileEventsAreQueued
+{
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    XCTAssertEqual([self flushTimerIntervalOfIntegration:integration], 0);
+
+    [self queueSmallRecords:1 integration:integration];
+    XCTAssertEqualWithAccuracy([self flushTimerIntervalOfIntegration:integration], 30, 0.01);
+
+    [integration flushWithMaxSize:100];
+    [integration dispatchBackgroundAndWait:^{}];
+    [self complete:client upload:0 retry:NO integration:integration];
+    XCTAssertEqual([self flushTimerIntervalOfIntegration:integration], 0, @"Parked once the queue is empty");
+}
+
+- (void)testFlushIntervalAdaptsToDepthAndFailures
+{
+    self.configuration.flushAt = 10;
+    self.configuration.maxFlushInterval = 45;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:5 integration:integration];
+
+    __block NSTimeInterval interval = 0;
+    [integration dispatchBackgroundAndWait:^{
+        interval = [integration nextFlushInterval];
+    }];
+    XCTAssertEqualWithAccuracy(interval, 22.5, 0.01, @"Halfway to flushAt");
+
+    [integration flushWithMaxSize:100];
+    [integration dispatchBackgroundAndWait:^{}];
+    [self complete:client upload:0 retry:YES integration:integration];
+    [integration dispatchBackgroundAndWait:^{
+        interval = [integration nextFlushInterval];
+    }];
+    XCTAssertEqualWithAccuracy(interval, 45, 0.01, @"Doubled after a failure, then capped");
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Durability
+// ---------------------------------------------------------------------------
+
+- (unsigned long long)journalBytesOnDisk
+{
+    NSURL *journalURL = [self.folderURL URLByAppendingPathComponent:kFPQueueJournalFilename];
+    unsigned long long size = 0;
+    for (NSURL *url in [[NSFileManager defaultManager] contentsOfDirectoryAtURL:journalURL includingPropertiesForKeys:nil options:0 error:nil]) {
+        if ([url.pathExtension isEqualToString:@"seg"]) {
+            size += [[NSFileManager defaultManager] attributesOfItemAtPath:url.path error:nil].fileSize;
+        }
+    }
+    return size;
+}
+
+- (void)testPerEventDurabilityWritesEveryEvent
+{
+    XCTAssertEqual(self.configuration.durabilityMode, FPDurabilityModePerEvent, @"every event is durable unless the app opts out");
+    FPFreshpaintIntegration *integration = [self makeIntegration];
+    [self queueSmallRecords:1 integration:integration];
+
+    XCTAssertGreaterThan([self journalBytesOnDisk], 0u);
+}
+
+- (void)testGroupCommitWritesEventsTogether
+{
+    self.configuration.durabilityMode = FPDurabilityModeGroupCommit;
+    self.configuration.groupCommitInterval = 0.1;
+    FPFreshpaintIntegration *integration = [self makeIntegration];
+    [self queueSmallRecords:5 integration:integration];
+    XCTAssertEqual([self journalBytesOnDisk], 0u);
+
+    XCTestExpectation *committed = [self expectationWithDescription:@"committed"];
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.3 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [integration dispatchBackgroundAndWait:^{}];
+        XCTAssertGreaterThan([self journalBytesOnDisk], 0u);
+        [committed fulfill];
+    });
+    [self waitForExpectationsWithTimeout:2 handler:nil];
+}
+
+- (void)testMemoryOnlyDurabilityWritesOnBackground
+{
+    self.configuration.durabilityMode = FPDurabilityModeMemoryOnly;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [self queueSmallRecords:5 integration:integration];
+    XCTAssertEqual([self journalBytesOnDisk], 0u);
+
+    [integration applicationDidEnterBackground];
+    [integration dispatchBackgroundAndWait:^{}];
+    XCTAssertGreaterThan([self journalBytesOnDisk], 0u);
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Connection
+// ---------------------------------------------------------------------------
+
+- (void)testUploadConnectionIsPrewarmedAtSetupAndOnForeground
+{
+    self.configuration.maxInFlightBatches = 4;
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithHTTPClient:client];
+    [integration dispatchBackgroundAndWait:^{}];
+    XCTAssertEqualObjects(client.prewarmedWriteKeys, @[ @"TEST_WRITE_KEY" ]);
+    XCTAssertEqual(client.maximumConnectionsPerHost, 4);
+
+    [integration applicationWillEnterForeground];
+    [integration dispatchBackgroundAndWait:^{}];
+    XCTAssertEqual(client.prewarmedWriteKeys.count, 2u);
+}
+
+- (void)testUploadTimingIsRecorded
+{
+    FPRecordingHTTPClient *client = [self makeRecordingClient];
+    [self makeIntegrationWithHTTPClient:client];
+    client.uploadMetricsHandler(0.25, 0.5, NO);
+    client.uploadMetricsHandler(0, 0.25, YES);
+
+    FPDeliveryMetrics *metrics = self.analytics.deliveryMetrics;
+    XCTAssertEqual(metrics.measuredUploads, 2u);
+    XCTAssertEqual(metrics.reusedConnectionUploads, 1u);
+    XCTAssertEqualWithAccuracy(metrics.uploadConnectionSetupDuration, 0.25, 0.0001);
+    XCTAssertEqualWithAccuracy(metrics.uploadTransferDuration, 0.75, 0.0001);
+}
+
+@end
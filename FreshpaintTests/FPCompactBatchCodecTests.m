@@ -0,0 +1,238 @@
+//
+//  FPCompactBatchCodecTests.m
+//  FreshpaintTests
+//
+
+#import <XCTest/XCTest.h>
+#import "FPCompactBatchCodec.h"
+#import "FPGZIPBatchBuilder.h"
+#import "NSData+FPGZIP.h"
+
+static NSString *const kFPTestSentAt = @"2024-03-14T09:26:53.589Z";
+
+
+@interface FPCompactBatchCodecTests : XCTestCase
+@end
+
+@implementation FPCompactBatchCodecTests
+
+// Events shaped like the ones the SDK queues, with the static context, session properties and timestamps it adds.
+// Identifiers and timestamps change from one event to the next as they do in a real batch.
+- (NSArray<NSData *> *)sampleBatchOfCount:(NSUInteger)count
+{
+    NSString *context = @"{\"app\":{\"build\":\"412\",\"name\":\"Sample\",\"namespace\":\"io.freshpaint.sample\",\"version\":\"2.8.1\"},"
+                         "\"device\":{\"id\":\"4B1E6A0C-5F7D-4C3A-9C1E-2D8B7F6A5E40\",\"idfv\":\"4B1E6A0C-5F7D-4C3A-9C1E-2D8B7F6A5E40\",\"manufacturer\":\"Apple\",\"model\":\"iPhone15,4\",\"name\":\"iPhone\",\"type\":\"ios\"},"
+                         "\"library\":{\"name\":\"analytics-ios\",\"version\":\"0.9.4\"},\"locale\":\"en-US\",\"network\":{\"cellular\":false,\"wifi\":true},"
+                         "\"os\":{\"name\":\"iOS\",\"version\":\"17.4\"},\"screen\":{\"height\":852,\"width\":393},\"timezone\":\"America/Los_Angeles\","
+                         "\"userAgent\":\"Sample/2.8.1 (iPhone; iOS 17.4)\"}";
+    NSMutableArray<NSData *> *records = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        NSString *messageId = [NSUUID UUID].UUIDString;
+        NSString *timestamp = [NSString stringWithFormat:@"2024-03-14T09:%02lu:%02lu.%03luZ", (unsigned long)(i / 60 % 60), (unsigned long)(i % 60), (unsigned long)(i * 37 % 1000)];
+        NSString *event = nil;
+        switch (i % 3) {
+            case 0:
+                event = [NSString stringWithFormat:@"{\"anonymousId\":\"9D2F4C71-0B8E-4E55-A1F3-6C07E2B9D814\",\"context\":%@,\"event\":\"Product Viewed\",\"integrations\":{},"
+                                                    "\"messageId\":\"%@\",\"properties\":{\"$is_first_event_in_session\":false,\"$session_id\":\"1710408413589\","
+                                                    "\"category\":\"Shoes\",\"price\":89.99,\"product_id\":\"sku-%lu\",\"quantity\":1},\"timestamp\":\"%@\",\"type\":\"track\"}",
+                                                   context, messageId, (unsigned long)(20000 + i), timestamp];
+                break;
+            case 1:
+                event = [NSString stringWithFormat:@"{\"anonymousId\":\"9D2F4C71-0B8E-4E55-A1F3-6C07E2B9D814\",\"context\":%@,\"integrations\":{},"
+                                                    "\"messageId\":\"%@\",\"name\":\"Checkout\",\"properties\":{\"$is_first_event_in_session\":false,\"$session_id\":\"1710408413589\"},"
+                                                    "\"timestamp\":\"%@\",\"type\":\"screen\"}",
+                                                   context, messageId, [timestamp stringByReplacingOccurrencesOfString:@"Z" withString:@"116000Z"]];
+                break;
+            default:
+                event = [NSString stringWithFormat:@"{\"anonymousId\":\"9D2F4C71-0B8E-4E55-A1F3-6C07E2B9D814\",\"context\":%@,\"integrations\":{},"
+                                                    "\"messageId\":\"%@\",\"properties\":{\"$is_first_event_in_session\":false,\"$session_id\":\"1710408413589\"},"
+                                                    "\"timestamp\":\"%@\",\"traits\":{\"email\":\"jane@example.com\",\"plan\":\"pro\",\"signup_date\":\"2023-11-02T17:45:09.000Z\"},"
+                                                    "\"type\":\"identify\",\"userId\":\"user-48213\"}",
+                                                   context, messageId, timestamp];
+                break;
+        }
+        [records addObject:[event dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    return records;
+}
+
+// JSON may parse decimals as NSDecimalNumber; compare every non-integer number as a double.
+- (id)normalizedObject:(id)object
+{
+    if ([object isKindOfClass:[NSDictionary class]]) {
+        NSMutableDictionary *result = [NSMutableDictionary dictionary];
+        [object enumerateKeysAndObjectsUsingBlock:^(id key, id value, BOOL *stop) {
+            result[key] = [self normalizedObject:value];
+        }];
+        return result;
+    }
+    if ([object isKindOfClass:[NSArray class]]) {
+        NSMutableArray *result = [NSMutableArray array];
+        for (id value in object) {
+            [result addObject:[self normalizedObject:value]];
+        }
+        return result;
+    }
+    if ([object isKindOfClass:[NSNumber class]] && (strcmp([object objCType], "d") == 0 || strcmp([object objCType], "f") == 0)) {
+        return @([object doubleValue]);
+    }
+    return object;
+}
+
+- (NSDictionary *)jsonBatchWithRecords:(NSArray<NSData *> *)records
+{
+    NSMutableArray *events = [NSMutableArray array];
+    for (NSData *record in records) {
+        [events addObject:[NSJSONSerialization JSONObjectWithData:record options:0 error:nil]];
+    }
+    return @{ @"batch" : events, @"sentAt" : kFPTestSentAt };
+}
+
+- (void)assertRoundTrip:(NSArray<NSData *> *)records
+{
+    NSData *encoded = [FPCompactBatchCodec encodeRecords:records sentAt:kFPTestSentAt];
+    XCTAssertNotNil(encoded);
+    XCTAssertEqualObjects([self normalizedObject:[FPCompactBatchCodec decodeBatch:encoded]], [self normalizedObject:[self jsonBatchWithRecords:records]]);
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Round trip
+// ---------------------------------------------------------------------------
+
+- (void)testSampleEventsRoundTrip
+{
+    [self assertRoundTrip:[self sampleBatchOfCount:100]];
+}
+
+- (void)testEmptyBatchRoundTrips
+{
+    [self assertRoundTrip:@[]];
+}
+
+- (void)testScalarsRoundTrip
+{
+    NSDictionary *event = @{
+        @"small" : @7,
+        @"negative" : @-5,
+        @"int8" : @-100,
+        @"int16" : @-30000,
+        @"int32" : @-2000000000,
+        @"int64" : @-9000000000000000000,
+        @"uint8" : @200,
+        @"uint16" : @60000,
+        @"uint32" : @4000000000,
+        @"uint64" : @5000000000,
+        @"double" : @-1234.5678,
+        @"true" : @YES,
+        @"false" : @NO,
+        @"null" : [NSNull null],
+        @"unicode" : @"Crème brûlée 🍮",
+        @"long" : [@"" stringByPaddingToLength:70000 withString:@"abc" startingAtIndex:0],
+        @"nested" : @[ @[ @1, @{ @"deep" : @[] } ], @{} ],
+    };
+    [self assertRoundTrip:@[ [NSJSONSerialization dataWithJSONObject:event options:0 error:nil] ]];
+}
+
+- (void)testLargeContainersRoundTrip
+{
+    NSMutableDictionary *properties = [NSMutableDictionary dictionary];
+    NSMutableArray *values = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 300; i++) {
+        properties[[NSString stringWithFormat:@"property_%lu", (unsigned long)i]] = @(i);
+        [values addObject:@(i * 1000)];
+    }
+    NSDictionary *event = @{ @"properties" : properties, @"values" : values };
+    [self assertRoundTrip:@[ [NSJSONSerialization dataWithJSONObject:event options:0 error:nil] ]];
+}
+
+- (void)testOnlyExactTimestampsAreEncodedAsIntegers
+{
+    NSDictionary *event = @{
+        @"millis" : @"1969-12-31T23:59:59.999Z",
+        @"nanos" : @"2024-02-29T23:59:59.000123000Z",
+        @"invalidDay" : @"2023-02-30T10:00:00.000Z",
+        @"noFraction" : @"2024-03-14T09:26:53Z",
+        @"offset" : @"2024-03-14T09:26:53.589+01:00",
+        @"lookalike" : @"abcd-ef-ghTij:kl:mn.opqZ",
+    };
+    NSArray<NSData *> *records = @[ [NSJSONSerialization dataWithJSONObject:event options:0 error:nil] ];
+    [self assertRoundTrip:records];
+
+    // Two timestamps as ext types, the sentAt one included, and nothing else.
+    NSData *encoded = [FPCompactBatchCodec encodeRecords:records sentAt:kFPTestSentAt];
+    const uint8_t *bytes = encoded.bytes;
+    NSUInteger millis = 0;
+    for (NSUInteger i = 0; i + 1 < encoded.length; i++) {
+        millis += bytes[i] == 0xd7 && bytes[i + 1] == 0x01 ? 1 : 0;
+    }
+    XCTAssertEqual(millis, 2u);
+    NSData *invalidDay = [@"2023-02-30T10:00:00.000Z" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertNotEqual([encoded rangeOfData:invalidDay options:0 range:NSMakeRange(0, encoded.length)].location, NSNotFound);
+}
+
+- (void)testRecordsThatAreNotObjectsAreRejected
+{
+    XCTAssertNil([FPCompactBatchCodec encodeRecords:@[ [@"[1,2]" dataUsingEncoding:NSUTF8StringEncoding] ] sentAt:kFPTestSentAt]);
+    XCTAssertNil([FPCompactBatchCodec encodeRecords:@[ [@"{\"a\":" dataUsingEncoding:NSUTF8StringEncoding] ] sentAt:kFPTestSentAt]);
+}
+
+- (void)testMalformedInputIsRejected
+{
+    NSData *encoded = [FPCompactBatchCodec encodeRecords:[self sampleBatchOfCount:3] sentAt:kFPTestSentAt];
+    for (NSUInteger length = 0; length < encoded.length; length += 7) {
+        XCTAssertNil([FPCompactBatchCodec decodeBatch:[encoded subdataWithRange:NSMakeRange(0, length)]]);
+    }
+    NSMutableData *trailing = [encoded mutableCopy];
+    [trailing appendBytes:"\x00" length:1];
+    XCTAssertNil([FPCompactBatchCodec decodeBatch:trailing]);
+    XCTAssertNil([FPCompactBatchCodec decodeBatch:[@"{\"batch\":[]}" dataUsingEncoding:NSUTF8StringEncoding]]);
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Size and CPU against JSON + gzip
+// ---------------------------------------------------------------------------
+
+- (NSData *)jsonGzipBodyWithRecords:(NSArray<NSData *> *)records
+{
+    FPGZIPBatchBuilder *builder = [[FPGZIPBatchBuilder alloc] init];
+    for (NSData *record in records) {
+        [builder appendRecord:record];
+    }
+    return [builder finishWithSentAt:kFPTestSentAt];
+}
+
+- (void)testCompactBodiesAreSmaller
+{
+    NSArray<NSData *> *records = [self sampleBatchOfCount:100];
+    NSData *json = [NSJSONSerialization dataWithJSONObject:[self jsonBatchWithRecords:records] options:0 error:nil];
+    NSData *compact = [FPCompactBatchCodec encodeRecords:records sentAt:kFPTestSentAt];
+    NSData *jsonGzip = [self jsonGzipBodyWithRecords:records];
+    NSData *compactGzip = [compact seg_gzippedData];
+    NSLog(@"100 events: JSON %lu bytes, %lu gzipped; compact %lu bytes, %lu gzipped.",
+          (unsigned long)json.length, (unsigned long)jsonGzip.length, (unsigned long)compact.length, (unsigned long)compactGzip.length);
+
+    XCTAssertLessThan(compact.length, json.length * 3 / 4);
+    XCTAssertLessThan(compactGzip.length, jsonGzip.length);
+}
+
+- (void)testJSONGzipEncodingPerformance
+{
+    NSArray<NSData *> *records = [self sampleBatchOfCount:100];
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 10; i++) {
+            [self jsonGzipBodyWithRecords:records];
+        }
+    }];
+}
+
+- (void)testCompactGzipEncodingPerformance
+{
+    NSArray<NSData *> *records = [self sampleBatchOfCount:100];
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 10; i++) {
+            [[FPCompactBatchCodec encodeRecords:records sentAt:kFPTestSentAt] seg_gzippedData];
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,141 @@
+//
+//  FPCompressionDictionaryTests.m
+//  FreshpaintTests
+//
+
+#import <XCTest/XCTest.h>
+#import <zlib.h>
+#import <dlfcn.h>
+#import "FPCompressionDictionary.h"
+#import "NSData+FPGZIP.h"
+
+static NSString *const kFPTestSentAt = @"2024-03-14T09:26:53.589Z";
+
+
+@interface FPCompressionDictionaryTests : XCTestCase
+@end
+
+@implementation FPCompressionDictionaryTests
+
+// A batch body shaped like the ones the SDK uploads, with identifiers and timestamps changing from one event to the next.
+- (NSData *)sampleBodyOfCount:(NSUInteger)count
+{
+    NSString *context = @"{\"app\":{\"build\":\"87\",\"name\":\"Groceries\",\"namespace\":\"com.example.groceries\",\"version\":\"4.2.0\"},"
+                         "\"device\":{\"id\":\"0C6E2B7D-93A4-4F1B-8E2D-5A7C91B3D604\",\"idfv\":\"0C6E2B7D-93A4-4F1B-8E2D-5A7C91B3D604\",\"manufacturer\":\"Apple\",\"model\":\"iPhone14,5\",\"name\":\"iPhone\",\"type\":\"ios\"},"
+                         "\"library\":{\"name\":\"analytics-ios\",\"version\":\"0.9.4\"},\"locale\":\"en-GB\",\"network\":{\"cellular\":true,\"wifi\":false},"
+                         "\"os\":{\"name\":\"iOS\",\"version\":\"17.2.1\"},\"screen\":{\"height\":844,\"width\":390},\"timezone\":\"Europe/London\","
+                         "\"userAgent\":\"Groceries/4.2.0 (iPhone; iOS 17.2.1)\"}";
+    NSMutableArray<NSString *> *events = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        NSString *timestamp = [NSString stringWithFormat:@"2024-03-14T09:%02lu:%02lu.%03luZ", (unsigned long)(i / 60 % 60), (unsigned long)(i % 60), (unsigned long)(i * 53 % 1000)];
+        NSString *type = i % 4 == 3 ? @"\"name\":\"Basket\",\"type\":\"screen\"" : [NSString stringWithFormat:@"\"event\":\"Item Added\",\"type\":\"track\",\"item\":\"%lu\"", (unsigned long)(7000 + i * 13)];
+        [events addObject:[NSString stringWithFormat:@"{\"anonymousId\":\"E1A7C3F0-2B44-4D9E-B6A1-73F0C2D8E915\",\"context\":%@,\"integrations\":{},"
+                                                      "\"messageId\":\"%@\",\"properties\":{\"$is_first_event_in_session\":false,\"$session_id\":\"1710408001337\"},"
+                                                      "\"timestamp\":\"%@\",%@}",
+                                                     context, [NSUUID UUID].UUIDString, timestamp, type]];
+    }
+    NSString *body = [NSString stringWithFormat:@"{\"batch\":[%@],\"sentAt\":\"%@\"}", [events componentsJoinedByString:@","], kFPTestSentAt];
+    return [body dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+- (void)testBodiesRoundTrip
+{
+    NSData *dictionary = [FPCompressionDictionary dictionaryData];
+    for (NSNumber *count in @[ @1, @5, @20, @100, @1000 ]) {
+        NSData *body = [self sampleBodyOfCount:count.unsignedIntegerValue];
+        NSData *deflated = [body seg_deflatedDataWithDictionary:dictionary];
+        XCTAssertNotNil(deflated);
+        XCTAssertEqualObjects([deflated seg_inflatedDataWithDictionary:dictionary], body);
+    }
+}
+
+- (void)testStreamNamesItsDictionary
+{
+    NSData *dictionary = [FPCompressionDictionary dictionaryData];
+    NSData *deflated = [[self sampleBodyOfCount:5] seg_deflatedDataWithDictionary:dictionary];
+    const uint8_t *bytes = deflated.bytes;
+    XCTAssertFalse([deflated seg_isGzippedData]);
+    XCTAssertEqual((bytes[0] << 8 | bytes[1]) % 31, 0);
+    XCTAssertTrue(bytes[1] & 0x20, @"FDICT flag");
+
+    uLong (*adler32)(uLong, const Bytef *, uInt) = (uLong(*)(uLong, const Bytef *, uInt))dlsym(seg_libzOpen(), "adler32");
+    uLong expected = adler32(adler32(0, NULL, 0), dictionary.bytes, (uInt)dictionary.length);
+    uLong dictionaryId = (uLong)bytes[2] << 24 | (uLong)bytes[3] << 16 | (uLong)bytes[4] << 8 | bytes[5];
+    XCTAssertEqual(dictionaryId, expected);
+}
+
+- (void)testOtherDictionaryIsRefused
+{
+    NSData *deflated = [[self sampleBodyOfCount:5] seg_deflatedDataWithDictionary:[FPCompressionDictionary dictionaryData]];
+    XCTAssertNil([deflated seg_inflatedDataWithDictionary:[@"{\"batch\":[" dataUsingEncoding:NSUTF8StringEncoding]]);
+    XCTAssertNil([[deflated subdataWithRange:NSMakeRange(0, deflated.length / 2)] seg_inflatedDataWithDictionary:[FPCompressionDictionary dictionaryData]]);
+}
+
+- (void)testDictionaryVersionIsStable
+{
+    // Bump kFPCompressionDictionaryVersion, and update this length, whenever the dictionary changes.
+    XCTAssertEqualObjects(kFPCompressionDictionaryVersion, @"1");
+    XCTAssertEqual([FPCompressionDictionary dictionaryData].length, 1055u);
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Bytes and CPU against gzip
+// ---------------------------------------------------------------------------
+
+- (void)testSmallBatchesAreSmaller
+{
+    NSData *dictionary = [FPCompressionDictionary dictionaryData];
+    for (NSNumber *count in @[ @5, @20, @100 ]) {
+        NSData *body = [self sampleBodyOfCount:count.unsignedIntegerValue];
+        NSData *gzipped = [body seg_gzippedData];
+        NSData *deflated = [body seg_deflatedDataWithDictionary:dictionary];
+        NSLog(@"%@ events: JSON %lu bytes, gzip %lu, dictionary %lu.",
+              count, (unsigned long)body.length, (unsigned long)gzipped.length, (unsigned long)deflated.length);
+        XCTAssertLessThan(deflated.length, gzipped.length);
+        if (count.unsignedIntegerValue <= 20) {
+            XCTAssertLessThan(deflated.length, gzipped.length * 9 / 10);
+        }
+    }
+}
+
+- (void)measureCompression:(NSData * (^)(NSData *body))compress count:(NSUInteger)count
+{
+    NSData *body = [self sampleBodyOfCount:count];
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 200; i++) {
+            compress(body);
+        }
+    }];
+}
+
+- (void)testGzipPerformanceWith5Events
+{
+    [self measureCompression:^(NSData *body) { return [body seg_gzippedData]; } count:5];
+}
+
+- (void)testDictionaryPerformanceWith5Events
+{
+    [self measureCompression:^(NSData *body) { return [body seg_deflatedDataWithDictionary:[FPCompressionDictionary dictionaryData]]; } count:5];
+}
+
+- (void)testGzipPerformanceWith20Events
+{
+    [self measureCompression:^(NSData *body) { return [body seg_gzippedData]; } count:20];
+}
+
+- (void)testDictionaryPerformanceWith20Events
+{
+    [self measureCompression:^(NSData *body) { return [body seg_deflatedDataWithDictionary:[FPCompressionDictionary dictionaryData]]; } count:20];
+}
+
+- (void)testGzipPerformanceWith100Events
+{
+    [self measureCompression:^(NSData *body) { return [body seg_gzippedData]; } count:100];
+}
+
+- (void)testDictionaryPerformanceWith100Events
+{
+    [self measureCompression:^(NSData *body) { return [body seg_deflatedDataWithDictionary:[FPCompressionDictionary dictionaryData]]; } count:100];
+}
+
+@end
@@ -0,0 +1,122 @@
+//
+//  FPEncodedEventCacheTests.m
+//  FreshpaintTests
+//
+
+#import <XCTest/XCTest.h>
+#import "FPEncodedEventCache.h"
+
+
+@interface FPEncodedEventCacheTests : XCTestCase
+@property (nonatomic, strong) FPEncodedEventCache *cache;
+@end
+
+@implementation FPEncodedEventCacheTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.cache = [[FPEncodedEventCache alloc] initWithCapacity:4];
+}
+
+- (NSDictionary *)eventWithMessageId:(NSString *)messageId
+{
+    return @{
+        @"type" : @"track",
+        @"event" : @"Purchased",
+        @"messageId" : messageId,
+        @"properties" : @{ @"price" : @9.99, @"items" : @[ @"a", @"b" ] },
+        @"context" : @{ @"library" : @{ @"name" : @"analytics-ios" } },
+        @"integrations" : @{ @"Amplitude" : @NO },
+    };
+}
+
+- (NSDictionary *)decode:(NSData *)record
+{
+    return [NSJSONSerialization JSONObjectWithData:record options:0 error:nil];
+}
+
+- (void)testEncodesEachEventOnce
+{
+    NSDictionary *event = [self eventWithMessageId:@"m1"];
+    NSData *first = [self.cache recordForEvent:event messageId:@"m1"];
+    XCTAssertEqualObjects([self decode:first], event);
+    XCTAssertEqual(self.cache.encodedMemberCount, event.count);
+
+    // Another destination builds its own, equal copy of the event.
+    NSDictionary *copy = [[NSDictionary alloc] initWithDictionary:event copyItems:YES];
+    NSData *second = [self.cache recordForEvent:copy messageId:@"m1"];
+    XCTAssertEqual(second, first, @"the cached bytes are handed out again");
+    XCTAssertEqual(self.cache.encodedMemberCount, event.count, @"nothing is encoded again");
+}
+
+- (void)testEncodesOnlyTheMembersThatDiffer
+{
+    NSDictionary *event = [self eventWithMessageId:@"m1"];
+    [self.cache recordForEvent:event messageId:@"m1"];
+
+    NSMutableDictionary *overlay = [event mutableCopy];
+    overlay[@"properties"] = @{ @"price" : @19.99 };
+    overlay[@"destination"] = @"webhook";
+    NSData *record = [self.cache recordForEvent:overlay messageId:@"m1"];
+    XCTAssertEqualObjects([self decode:record], overlay);
+    XCTAssertEqual(self.cache.encodedMemberCount, event.count + 2);
+
+    NSMutableDictionary *removed = [event mutableCopy];
+    [removed removeObjectForKey:@"integrations"];
+    XCTAssertEqualObjects([self decode:[self.cache recordForEvent:removed messageId:@"m1"]], removed);
+    XCTAssertEqual(self.cache.encodedMemberCount, event.count + 2);
+
+    // The first copy stays the reference.
+    XCTAssertEqualObjects([self decode:[self.cache recordForEvent:event messageId:@"m1"]], event);
+    XCTAssertEqual(self.cache.encodedMemberCount, event.count + 2);
+}
+
+- (void)testDoesNotCacheEventsWithoutMessageId
+{
+    NSDictionary *event = @{ @"type" : @"track", @"event" : @"Opened" };
+    [self.cache recordForEvent:event messageId:nil];
+    [self.cache recordForEvent:event messageId:nil];
+    XCTAssertEqual(self.cache.encodedMemberCount, 2 * event.count);
+}
+
+- (void)testKeepsOnlyTheMostRecentEvents
+{
+    for (NSUInteger i = 0; i < 5; i++) {
+        NSString *messageId = [NSString stringWithFormat:@"m%lu", (unsigned long)i];
+        [self.cache recordForEvent:[self eventWithMessageId:messageId] messageId:messageId];
+    }
+    NSUInteger encoded = self.cache.encodedMemberCount;
+
+    [self.cache recordForEvent:[self eventWithMessageId:@"m4"] messageId:@"m4"];
+    XCTAssertEqual(self.cache.encodedMemberCount, encoded);
+
+    NSDictionary *evicted = [self eventWithMessageId:@"m0"];
+    [self.cache recordForEvent:evicted messageId:@"m0"];
+    XCTAssertEqual(self.cache.encodedMemberCount, encoded + evicted.count);
+}
+
+- (void)testReturnsNilForEventsThatCannotBeEncoded
+{
+    NSDictionary *event = @{ @"type" : @"track", @"properties" : @{ @"date" : [NSDate date] } };
+    XCTAssertNil([self.cache recordForEvent:event messageId:@"m1"]);
+    XCTAssertNotNil([self.cache recordForEvent:@{ @"type" : @"track" } messageId:@"m1"], @"a failed event is not cached");
+}
+
+- (void)testFanOutPerformance
+{
+    NSDictionary *event = [self eventWithMessageId:@"m1"];
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 1000; i++) {
+            NSString *messageId = [NSString stringWithFormat:@"p%lu", (unsigned long)i];
+            NSMutableDictionary *copy = [event mutableCopy];
+            copy[@"messageId"] = messageId;
+            // Five webhook destinations.
+            for (NSUInteger destination = 0; destination < 5; destination++) {
+                [self.cache recordForEvent:copy messageId:messageId];
+            }
+        }
+    }];
+}
+
+@end
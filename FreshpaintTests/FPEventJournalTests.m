@@ -0,0 +1,422 @@
+//
+//  FPEventJournalTests.m
+//  FreshpaintTests
+//
+
+#import <XCTest/XCTest.h>
+#import "FPEventJournal.h"
+#import "FPAES256Crypto.h"
+
+// Whole-blob crypto without a record envelope, exercising the compatibility path.
+@interface FPXORTestCrypto : NSObject <FPCrypto>
+@end
+
+@implementation FPXORTestCrypto
+
+- (NSData *)encrypt:(NSData *)data
+{
+    NSMutableData *output = [data mutableCopy];
+    uint8_t *bytes = output.mutableBytes;
+    for (NSUInteger i = 0; i < output.length; i++) {
+        bytes[i] ^= 0x5A;
+    }
+    return output;
+}
+
+- (NSData *)decrypt:(NSData *)data
+{
+    return [self encrypt:data];
+}
+
+@end
+
+
+@interface FPEventJournalTests : XCTestCase
+@property (nonatomic, strong) NSURL *folderURL;
+@end
+
+@implementation FPEventJournalTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.folderURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[NSUUID UUID].UUIDString];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtURL:self.folderURL error:nil];
+    [super tearDown];
+}
+
+- (NSData *)recordWithIndex:(NSUInteger)index
+{
+    return [[NSString stringWithFormat:@"{\"event\":\"Event %lu\"}", (unsigned long)index] dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+- (NSArray<NSURL *> *)segmentURLs
+{
+    NSArray<NSURL *> *contents = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:self.folderURL includingPropertiesForKeys:nil options:0 error:nil];
+    return [contents filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"pathExtension == 'seg'"]];
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Append / read
+// ---------------------------------------------------------------------------
+
+- (void)testAppendedRecordsAreReadBackInOrder
+{
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    for (NSUInteger i = 0; i < 5; i++) {
+        XCTAssertTrue([journal appendRecord:[self recordWithIndex:i]]);
+    }
+
+    XCTAssertEqual(journal.count, 5u);
+    NSArray<NSData *> *records = [journal pendingRecords];
+    XCTAssertEqual(records.count, 5u);
+    for (NSUInteger i = 0; i < 5; i++) {
+        XCTAssertEqualObjects(records[i], [self recordWithIndex:i]);
+    }
+}
+
+- (void)testRecordsSurviveReopening
+{
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    for (NSUInteger i = 0; i < 3; i++) {
+        [journal appendRecord:[self recordWithIndex:i]];
+    }
+    journal = nil;
+
+    FPEventJournal *reopened = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    XCTAssertEqual(reopened.count, 3u);
+    XCTAssertEqualObjects([reopened pendingRecords].lastObject, [self recordWithIndex:2]);
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Acknowledgement
+// ---------------------------------------------------------------------------
+
+- (void)testAcknowledgedRecordsStayAcknowledgedAfterReopening
+{
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    for (NSUInteger i = 0; i < 10; i++) {
+        [journal appendRecord:[self recordWithIndex:i]];
+    }
+    [journal acknowledgeRecords:4];
+    XCTAssertEqual(journal.count, 6u);
+    journal = nil;
+
+    FPEventJournal *reopened = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    NSArray<NSData *> *records = [reopened pendingRecords];
+    XCTAssertEqual(records.count, 6u);
+    XCTAssertEqualObjects(records.firstObject, [self recordWithIndex:4]);
+}
+
+- (void)testSequenceNumbersSurviveReopening
+{
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    for (NSUInteger i = 0; i < 10; i++) {
+        [journal appendRecord:[self recordWithIndex:i]];
+    }
+    [journal acknowledgeRecordsBeforeSequence:7];
+    XCTAssertEqual(journal.firstSequence, 7u);
+    XCTAssertEqual(journal.count, 3u);
+    journal = nil;
+
+    FPEventJournal *reopened = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    XCTAssertEqual(reopened.firstSequence, 7u);
+    XCTAssertEqualObjects([reopened pendingRecords].firstObject, [self recordWithIndex:7]);
+
+    [reopened acknowledgeRecordsBeforeSequence:5];
+    XCTAssertEqual(reopened.count, 3u, @"Sequences already acknowledged are ignored");
+
+    [reopened removeAllRecords];
+    XCTAssertEqual(reopened.firstSequence, 10u, @"Sequence numbers are never reused");
+}
+
+- (void)testAcknowledgingMoreThanPendingIsClamped
+{
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    [journal appendRecord:[self recordWithIndex:0]];
+    [journal acknowledgeRecords:10];
+    XCTAssertEqual(journal.count, 0u);
+
+    [journal appendRecord:[self recordWithIndex:1]];
+    XCTAssertEqualObjects([journal pendingRecords], @[ [self recordWithIndex:1] ]);
+}
+
+- (void)testFullyAcknowledgedSegmentsAreDeleted
+{
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    NSMutableData *large = [NSMutableData dataWithLength:64 * 1024];
+    for (NSUInteger i = 0; i < 12; i++) {
+        [journal appendRecord:large];
+    }
+    XCTAssertGreaterThan([self segmentURLs].count, 1u);
+
+    [journal acknowledgeRecords:12];
+    [journal appendRecord:[self recordWithIndex:0]];
+    [journal acknowledgeRecords:1];
+
+    XCTestExpectation *compacted = [self expectationWithDescription:@"old segments removed"];
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        XCTAssertEqual([self segmentURLs].count, 1u);
+        [compacted fulfill];
+    });
+    [self waitForExpectationsWithTimeout:2 handler:nil];
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Index
+// ---------------------------------------------------------------------------
+
+- (void)testSealedSegmentsAreIndexed
+{
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    NSMutableData *large = [NSMutableData dataWithLength:64 * 1024];
+    for (NSUInteger i = 0; i < 12; i++) {
+        [journal appendRecord:large flags:(uint8_t)(i % 2)];
+    }
+    [journal appendRecord:[self recordWithIndex:12] flags:1];
+    journal = nil;
+
+    NSArray<NSURL *> *contents = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:self.folderURL includingPropertiesForKeys:nil options:0 error:nil];
+    NSArray<NSURL *> *indexes = [contents filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"pathExtension == 'idx'"]];
+    XCTAssertEqual(indexes.count, [self segmentURLs].count - 1, @"Every segment but the active one has an index");
+
+    FPEventJournal *reopened = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    XCTAssertEqual(reopened.count, 13u);
+    XCTAssertNotNil(reopened.oldestRecordDate);
+    uint8_t flags = 0;
+    XCTAssertTrue([reopened getFlags:&flags ofRecordAtSequence:3]);
+    XCTAssertEqual(flags, 1);
+    XCTAssertEqualObjects([reopened recordAtSequence:12], [self recordWithIndex:12]);
+    XCTAssertEqualObjects([reopened recordAtSequence:0], large);
+    XCTAssertNil([reopened recordAtSequence:13]);
+}
+
+- (void)testMissingIndexFallsBackToScanning
+{
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    NSMutableData *large = [NSMutableData dataWithLength:64 * 1024];
+    for (NSUInteger i = 0; i < 12; i++) {
+        [journal appendRecord:large flags:1];
+    }
+    journal = nil;
+    NSArray<NSURL *> *contents = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:self.folderURL includingPropertiesForKeys:nil options:0 error:nil];
+    for (NSURL *url in contents) {
+        if ([url.pathExtension isEqualToString:@"idx"]) {
+            [[NSFileManager defaultManager] removeItemAtURL:url error:nil];
+        }
+    }
+
+    FPEventJournal *reopened = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    XCTAssertEqual(reopened.count, 12u);
+    uint8_t flags = 0;
+    XCTAssertTrue([reopened getFlags:&flags ofRecordAtSequence:0]);
+    XCTAssertEqual(flags, 1);
+}
+
+- (void)testRemovedRecordsStayRemovedAfterReopening
+{
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    NSMutableData *large = [NSMutableData dataWithLength:64 * 1024];
+    for (NSUInteger i = 0; i < 8; i++) {
+        [journal appendRecord:large flags:1];
+    }
+    // One record of a sealed segment, one of the active segment, which is sealed before reopening.
+    [journal removeRecordAtSequence:1];
+    [journal removeRecordAtSequence:7];
+    XCTAssertNil([journal recordAtSequence:1]);
+    XCTAssertEqual(journal.count, 8u, @"Removed records keep their sequence numbers");
+    for (NSUInteger i = 0; i < 4; i++) {
+        [journal appendRecord:large flags:1];
+    }
+    journal = nil;
+
+    FPEventJournal *reopened = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    XCTAssertEqual(reopened.count, 12u);
+    XCTAssertTrue([reopened isRecordRemovedAtSequence:1]);
+    XCTAssertTrue([reopened isRecordRemovedAtSequence:7]);
+    XCTAssertFalse([reopened isRecordRemovedAtSequence:2]);
+    uint8_t flags = 0;
+    XCTAssertTrue([reopened getFlags:&flags ofRecordAtSequence:1]);
+    XCTAssertEqual(flags, 1);
+    XCTAssertNil([reopened recordAtSequence:7]);
+    XCTAssertEqualObjects([reopened recordAtSequence:8], large);
+    XCTAssertEqual([reopened pendingRecords].count, 10u);
+}
+
+- (void)testRemovingABufferedRecord
+{
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    journal.buffersWrites = YES;
+    for (NSUInteger i = 0; i < 3; i++) {
+        [journal appendRecord:[self recordWithIndex:i] flags:0];
+    }
+    [journal removeRecordAtSequence:1];
+    [journal synchronize];
+    journal = nil;
+
+    FPEventJournal *reopened = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    XCTAssertEqualObjects([reopened pendingRecords], (@[ [self recordWithIndex:0], [self recordWithIndex:2] ]));
+}
+
+- (void)testSingleRecordsAreReadAfterAcknowledgement
+{
+    FPAES256Crypto *crypto = [[FPAES256Crypto alloc] initWithPassword:@"slothysloth"];
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:crypto];
+    for (NSUInteger i = 0; i < 4; i++) {
+        [journal appendRecord:[self recordWithIndex:i]];
+    }
+    [journal acknowledgeRecords:2];
+
+    XCTAssertNil([journal recordAtSequence:1]);
+    XCTAssertEqualObjects([journal recordAtSequence:3], [self recordWithIndex:3]);
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Buffered writes
+// ---------------------------------------------------------------------------
+
+- (unsigned long long)bytesOnDisk
+{
+    unsigned long long size = 0;
+    for (NSURL *url in [self segmentURLs]) {
+        size += [[NSFileManager defaultManager] attributesOfItemAtPath:url.path error:nil].fileSize;
+    }
+    return size;
+}
+
+- (void)testBufferedRecordsAreReadableBeforeTheyAreCommitted
+{
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    journal.buffersWrites = YES;
+    [journal appendRecord:[self recordWithIndex:0]];
+    [journal appendRecord:[self recordWithIndex:1]];
+
+    XCTAssertEqual([self bytesOnDisk], 0u);
+    XCTAssertEqualObjects([journal recordAtSequence:1], [self recordWithIndex:1]);
+
+    [journal commit];
+    XCTAssertGreaterThan([self bytesOnDisk], 0u);
+    FPEventJournal *reopened = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    XCTAssertEqual(reopened.count, 2u);
+}
+
+- (void)testRecordsAppendedAfterLosingUncommittedOnesSurvive
+{
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    journal.buffersWrites = YES;
+    [journal appendRecord:[self recordWithIndex:0]];
+    [journal appendRecord:[self recordWithIndex:1]];
+    [journal acknowledgeRecords:2];
+    // Crash before the commit: the cursor is past records that never reached the disk.
+    [journal setValue:[NSMutableData data] forKey:@"bufferedFrames"];
+    journal = nil;
+
+    FPEventJournal *reopened = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    XCTAssertEqual(reopened.count, 0u);
+    [reopened appendRecord:[self recordWithIndex:2]];
+    reopened = nil;
+
+    FPEventJournal *again = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    XCTAssertEqualObjects([again pendingRecords], @[ [self recordWithIndex:2] ]);
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Crash recovery
+// ---------------------------------------------------------------------------
+
+- (void)testTornTrailingRecordIsDiscarded
+{
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    [journal appendRecord:[self recordWithIndex:0]];
+    [journal appendRecord:[self recordWithIndex:1]];
+    journal = nil;
+
+    // Simulate a crash halfway through writing a third record.
+    NSURL *segmentURL = [self segmentURLs].firstObject;
+    NSFileHandle *handle = [NSFileHandle fileHandleForWritingToURL:segmentURL error:nil];
+    [handle seekToEndOfFile];
+    uint32_t length = CFSwapInt32HostToBig(100);
+    [handle writeData:[NSData dataWithBytes:&length length:sizeof(length)]];
+    [handle writeData:[@"{\"ev" dataUsingEncoding:NSUTF8StringEncoding]];
+    [handle closeFile];
+
+    FPEventJournal *reopened = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    XCTAssertEqual(reopened.count, 2u);
+    [reopened appendRecord:[self recordWithIndex:2]];
+    reopened = nil;
+
+    FPEventJournal *again = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:nil];
+    NSArray<NSData *> *records = [again pendingRecords];
+    XCTAssertEqual(records.count, 3u);
+    XCTAssertEqualObjects(records.lastObject, [self recordWithIndex:2]);
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Crypto
+// ---------------------------------------------------------------------------
+
+- (void)testRecordsAreEncryptedAtRest
+{
+    FPAES256Crypto *crypto = [[FPAES256Crypto alloc] initWithPassword:@"slothysloth"];
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:crypto];
+    [journal appendRecord:[self recordWithIndex:0]];
+
+    NSData *segment = [NSData dataWithContentsOfURL:[self segmentURLs].firstObject];
+    NSRange plaintext = [segment rangeOfData:[@"Event 0" dataUsingEncoding:NSUTF8StringEncoding] options:0 range:NSMakeRange(0, segment.length)];
+    XCTAssertEqual(plaintext.location, NSNotFound);
+
+    FPEventJournal *reopened = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:crypto];
+    XCTAssertEqualObjects([reopened pendingRecords], @[ [self recordWithIndex:0] ]);
+}
+
+- (void)testIdenticalRecordsAreSealedWithDistinctNonces
+{
+    FPAES256Crypto *crypto = [[FPAES256Crypto alloc] initWithPassword:@"slothysloth"];
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:crypto];
+    [journal appendRecord:[self recordWithIndex:0]];
+    [journal appendRecord:[self recordWithIndex:0]];
+
+    NSData *segment = [NSData dataWithContentsOfURL:[self segmentURLs].firstObject];
+    NSUInteger half = segment.length / 2;
+    XCTAssertNotEqualObjects([segment subdataWithRange:NSMakeRange(0, half)], [segment subdataWithRange:NSMakeRange(half, half)]);
+    XCTAssertEqual([journal pendingRecords].count, 2u);
+}
+
+- (void)testTamperedRecordIsDropped
+{
+    FPAES256Crypto *crypto = [[FPAES256Crypto alloc] initWithPassword:@"slothysloth"];
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:crypto];
+    [journal appendRecord:[self recordWithIndex:0]];
+    [journal appendRecord:[self recordWithIndex:1]];
+    journal = nil;
+
+    // Flip a bit inside the cipher text of the first record.
+    NSURL *segmentURL = [self segmentURLs].firstObject;
+    NSMutableData *segment = [NSMutableData dataWithContentsOfURL:segmentURL];
+    ((uint8_t *)segment.mutableBytes)[24] ^= 0x01;
+    [segment writeToURL:segmentURL atomically:YES];
+
+    FPEventJournal *reopened = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:crypto];
+    XCTAssertEqualObjects([reopened pendingRecords], @[ [self recordWithIndex:1] ]);
+}
+
+- (void)testWholeBlobCryptoStillWorksPerRecord
+{
+    FPXORTestCrypto *crypto = [[FPXORTestCrypto alloc] init];
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:crypto];
+    for (NSUInteger i = 0; i < 3; i++) {
+        [journal appendRecord:[self recordWithIndex:i]];
+    }
+    [journal acknowledgeRecords:1];
+    journal = nil;
+
+    FPEventJournal *reopened = [[FPEventJournal alloc] initWithFolder:self.folderURL crypto:crypto];
+    NSArray *expected = @[ [self recordWithIndex:1], [self recordWithIndex:2] ];
+    XCTAssertEqualObjects([reopened pendingRecords], expected);
+}
+
+@end
@@ -0,0 +1,122 @@
+//
+//  FPEventQueueTests.m
+//  FreshpaintTests
+//
+
+#import <XCTest/XCTest.h>
+#import "FPEventQueue.h"
+
+
+@interface FPEventQueueTests : XCTestCase
+@end
+
+@implementation FPEventQueueTests
+
+- (NSData *)recordWithIndex:(NSUInteger)index
+{
+    return [[NSString stringWithFormat:@"{\"event\":\"Event %lu\"}", (unsigned long)index] dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+- (void)testEventsAreNumberedFromTheFirstSequence
+{
+    FPEventQueue *queue = [[FPEventQueue alloc] initWithFirstSequence:42 capacity:4];
+    XCTAssertEqual([queue pushRecord:[self recordWithIndex:0] lane:FPEventLaneStandard], 42u);
+    XCTAssertEqual([queue pushRecord:[self recordWithIndex:1] lane:FPEventLaneStandard], 43u);
+
+    XCTAssertEqualObjects([queue recordAtSequence:43], [self recordWithIndex:1]);
+    XCTAssertNil([queue recordAtSequence:44]);
+    XCTAssertEqual(queue.endSequence, 44u);
+}
+
+- (void)testQueueGrowsAndWrapsAround
+{
+    FPEventQueue *queue = [[FPEventQueue alloc] initWithFirstSequence:0 capacity:16];
+    for (NSUInteger i = 0; i < 12; i++) {
+        [queue pushRecord:[self recordWithIndex:i] lane:FPEventLaneStandard];
+    }
+    XCTAssertEqual([queue removeEventsBeforeSequence:10], 10u);
+    for (NSUInteger i = 12; i < 40; i++) {
+        [queue pushRecord:[self recordWithIndex:i] lane:FPEventLaneStandard];
+    }
+
+    XCTAssertEqual(queue.count, 30u);
+    NSArray<NSData *> *records = [queue recordsFromSequence:10 toSequence:40];
+    XCTAssertEqual(records.count, 30u);
+    XCTAssertEqualObjects(records.firstObject, [self recordWithIndex:10]);
+    XCTAssertEqualObjects(records.lastObject, [self recordWithIndex:39]);
+}
+
+- (void)testLowestLaneIsEvictedFirst
+{
+    FPEventQueue *queue = [[FPEventQueue alloc] initWithFirstSequence:0 capacity:16];
+    [queue pushRecord:[self recordWithIndex:0] lane:FPEventLaneCritical];
+    [queue pushRecord:[self recordWithIndex:1] lane:FPEventLaneStandard];
+    [queue pushRecord:[self recordWithIndex:2] lane:FPEventLaneStandard];
+
+    FPEventLane lane;
+    uint64_t sequence;
+    XCTAssertTrue([queue evictLowestPriorityEventInLane:&lane sequence:&sequence]);
+    XCTAssertEqual(lane, FPEventLaneStandard);
+    XCTAssertEqual(sequence, 1u);
+    XCTAssertNil([queue recordAtSequence:1]);
+    XCTAssertEqual(queue.span, 3u, @"The hole keeps its place");
+
+    [queue evictLowestPriorityEventInLane:NULL sequence:NULL];
+    XCTAssertTrue([queue evictLowestPriorityEventInLane:&lane sequence:&sequence]);
+    XCTAssertEqual(lane, FPEventLaneCritical);
+    XCTAssertEqual(queue.count, 0u);
+    XCTAssertFalse([queue evictLowestPriorityEventInLane:NULL sequence:NULL]);
+}
+
+- (void)testEvictsTheOldestEventOfALaneWithinARange
+{
+    FPEventQueue *queue = [[FPEventQueue alloc] initWithFirstSequence:0 capacity:16];
+    for (NSUInteger i = 0; i < 6; i++) {
+        [queue pushRecord:[self recordWithIndex:i] lane:i == 3 ? FPEventLaneCritical : FPEventLaneStandard];
+    }
+
+    uint64_t sequence;
+    XCTAssertTrue([queue evictEventInLane:FPEventLaneStandard fromSequence:2 toSequence:6 sequence:&sequence]);
+    XCTAssertEqual(sequence, 2u);
+    XCTAssertTrue([queue evictEventInLane:FPEventLaneStandard fromSequence:2 toSequence:6 sequence:&sequence]);
+    XCTAssertEqual(sequence, 4u, @"events of other lanes are left alone");
+    XCTAssertFalse([queue evictEventInLane:FPEventLaneStandard fromSequence:2 toSequence:5 sequence:NULL]);
+    XCTAssertEqual(queue.count, 4u);
+
+    XCTAssertTrue([queue evictLowestPriorityEventInLane:NULL sequence:&sequence]);
+    XCTAssertEqual(sequence, 0u, @"the lane keeps its order around the evicted events");
+    XCTAssertTrue([queue evictLowestPriorityEventInLane:NULL sequence:&sequence]);
+    XCTAssertEqual(sequence, 1u);
+    XCTAssertTrue([queue evictLowestPriorityEventInLane:NULL sequence:&sequence]);
+    XCTAssertEqual(sequence, 5u);
+}
+
+- (void)testRemovingTheHeadSkipsHoles
+{
+    FPEventQueue *queue = [[FPEventQueue alloc] initWithFirstSequence:0 capacity:16];
+    [queue pushRecord:[self recordWithIndex:0] lane:FPEventLaneStandard];
+    [queue pushRecord:[self recordWithIndex:1] lane:FPEventLaneCritical];
+    [queue pushRecord:[self recordWithIndex:2] lane:FPEventLaneStandard];
+    [queue evictLowestPriorityEventInLane:NULL sequence:NULL];
+
+    XCTAssertEqual(queue.firstLiveSequence, 1u);
+    XCTAssertEqual([queue removeEventsBeforeSequence:2], 1u);
+    XCTAssertEqual([queue countInLane:FPEventLaneCritical], 0u);
+    XCTAssertEqual([queue countInLane:FPEventLaneStandard], 1u);
+    XCTAssertEqual(queue.headSequence, 2u);
+}
+
+- (void)testPushedHolesOnlyTakeASequenceNumber
+{
+    FPEventQueue *queue = [[FPEventQueue alloc] initWithFirstSequence:0 capacity:16];
+    [queue pushHole];
+    [queue pushRecord:[self recordWithIndex:1] lane:FPEventLaneStandard];
+
+    XCTAssertEqual(queue.count, 1u);
+    XCTAssertEqual(queue.span, 2u);
+    XCTAssertEqual(queue.firstLiveSequence, 1u);
+    XCTAssertNil([queue recordAtSequence:0]);
+    XCTAssertEqual([queue removeEventsBeforeSequence:1], 0u);
+}
+
+@end
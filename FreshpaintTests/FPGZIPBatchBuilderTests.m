@@ -0,0 +1,111 @@
+//
+//  FPGZIPBatchBuilderTests.m
+//  FreshpaintTests
+//
+
+#import <XCTest/XCTest.h>
+#import "FPGZIPBatchBuilder.h"
+#import "NSData+FPGZIP.h"
+#import "NSData+FPGUNZIPP.h"
+
+@interface FPGZIPBatchBuilderTests : XCTestCase
+@end
+
+@implementation FPGZIPBatchBuilderTests
+
+- (NSData *)recordWithIndex:(NSUInteger)index
+{
+    NSDictionary *event = @{ @"type" : @"track", @"event" : [NSString stringWithFormat:@"Event %lu", (unsigned long)index] };
+    return [NSJSONSerialization dataWithJSONObject:event options:0 error:nil];
+}
+
+- (NSDictionary *)decodeBody:(NSData *)body
+{
+    XCTAssertTrue([body seg_isGzippedData]);
+    return [NSJSONSerialization JSONObjectWithData:[body seg_gunzippedData] options:0 error:nil];
+}
+
+- (void)testBuildsGzippedBatchBody
+{
+    FPGZIPBatchBuilder *builder = [[FPGZIPBatchBuilder alloc] init];
+    for (NSUInteger i = 0; i < 3; i++) {
+        XCTAssertTrue([builder appendRecord:[self recordWithIndex:i]]);
+    }
+    XCTAssertEqual(builder.count, 3u);
+
+    NSDictionary *batch = [self decodeBody:[builder finishWithSentAt:@"2016-07-19T19:25:06.000Z"]];
+    XCTAssertEqual([batch[@"batch"] count], 3u);
+    XCTAssertEqualObjects(batch[@"batch"][2][@"event"], @"Event 2");
+    XCTAssertEqualObjects(batch[@"sentAt"], @"2016-07-19T19:25:06.000Z");
+    XCTAssertEqual(builder.count, 0u);
+}
+
+- (void)testBuilderIsReusableAfterFinishAndReset
+{
+    FPGZIPBatchBuilder *builder = [[FPGZIPBatchBuilder alloc] init];
+    [builder appendRecord:[self recordWithIndex:0]];
+    [builder finishWithSentAt:@"2016-07-19T19:25:06.000Z"];
+
+    [builder appendRecord:[self recordWithIndex:1]];
+    [builder reset];
+    [builder appendRecord:[self recordWithIndex:2]];
+
+    NSDictionary *batch = [self decodeBody:[builder finishWithSentAt:@"2016-07-19T19:25:07.000Z"]];
+    XCTAssertEqualObjects(batch[@"batch"], @[ [NSJSONSerialization JSONObjectWithData:[self recordWithIndex:2] options:0 error:nil] ]);
+}
+
+- (void)testEmptyBatch
+{
+    FPGZIPBatchBuilder *builder = [[FPGZIPBatchBuilder alloc] init];
+    NSDictionary *batch = [self decodeBody:[builder finishWithSentAt:@"2016-07-19T19:25:06.000Z"]];
+    XCTAssertEqualObjects(batch[@"batch"], @[]);
+}
+
+- (void)testLargeBatchSpanningSeveralChunks
+{
+    FPGZIPBatchBuilder *builder = [[FPGZIPBatchBuilder alloc] init];
+    NSMutableData *raw = [NSMutableData data];
+    for (NSUInteger i = 0; i < 2000; i++) {
+        NSData *record = [self recordWithIndex:i];
+        [raw appendData:record];
+        [builder appendRecord:record];
+    }
+    XCTAssertGreaterThan(builder.uncompressedLength, raw.length);
+
+    NSDictionary *batch = [self decodeBody:[builder finishWithSentAt:@"2016-07-19T19:25:06.000Z"]];
+    XCTAssertEqual([batch[@"batch"] count], 2000u);
+    XCTAssertEqualObjects(batch[@"batch"][1999][@"event"], @"Event 1999");
+}
+
+// Flush-time cost: compressing the whole batch in one shot versus finishing a stream fed at enqueue.
+- (void)testFlushCostOneShot
+{
+    NSMutableArray<NSData *> *records = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 100; i++) {
+        [records addObject:[self recordWithIndex:i]];
+    }
+    [self measureBlock:^{
+        NSMutableData *body = [NSMutableData dataWithData:[@"{\"batch\":[" dataUsingEncoding:NSUTF8StringEncoding]];
+        for (NSData *record in records) {
+            [body appendData:record];
+            [body appendBytes:"," length:1];
+        }
+        [body appendData:[@"],\"sentAt\":\"2016-07-19T19:25:06.000Z\"}" dataUsingEncoding:NSUTF8StringEncoding]];
+        [body seg_gzippedData];
+    }];
+}
+
+- (void)testFlushCostStreaming
+{
+    FPGZIPBatchBuilder *builder = [[FPGZIPBatchBuilder alloc] init];
+    [self measureMetrics:[[self class] defaultPerformanceMetrics] automaticallyStartMeasuring:NO forBlock:^{
+        for (NSUInteger i = 0; i < 100; i++) {
+            [builder appendRecord:[self recordWithIndex:i]];
+        }
+        [self startMeasuring];
+        [builder finishWithSentAt:@"2016-07-19T19:25:06.000Z"];
+        [self stopMeasuring];
+    }];
+}
+
+@end
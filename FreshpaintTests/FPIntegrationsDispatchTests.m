@@ -0,0 +1,315 @@
+//
+//  FPIntegrationsDispatchTests.m
+//  FreshpaintTests
+//
+
+#import <XCTest/XCTest.h>
+#import "FPAnalytics.h"
+#import "FPAnalyticsConfiguration.h"
+#import "FPIntegration.h"
+#import "FPIntegrationsManager.h"
+#import "FPTrackPayload.h"
+#import "FPIdentifyPayload.h"
+#import "FPDeliveryMetrics.h"
+#import "FPUtils.h"
+
+@interface FPIntegrationsManager (Testing)
+@property (nonatomic, strong) dispatch_queue_t serialQueue;
+@property (nonatomic, strong) NSMutableDictionary *integrations;
+@property (nonatomic, strong) NSMutableDictionary *integrationMiddleware;
+@property (nonatomic, strong) NSMutableDictionary *integrationInboxes;
+@property (nonatomic, strong) NSDictionary *cachedSettings;
+- (void)buildDispatchTable;
+- (void)forwardSelector:(SEL)selector arguments:(NSArray *)arguments options:(NSDictionary *)options;
+@end
+
+
+// Counts the events it gets; only implements track and identify.
+@interface FPCountingIntegration : NSObject <FPIntegration>
+@property (nonatomic, assign) NSUInteger trackCount;
+@property (nonatomic, assign) NSUInteger identifyCount;
+@property (nonatomic, strong) FPPayload *lastPayload;
+@end
+
+@implementation FPCountingIntegration
+
+- (void)track:(FPTrackPayload *)payload
+{
+    self.trackCount += 1;
+    self.lastPayload = payload;
+}
+
+- (void)identify:(FPIdentifyPayload *)payload
+{
+    self.identifyCount += 1;
+    self.lastPayload = payload;
+}
+
+@end
+
+
+// Holds every track call until released.
+@interface FPBlockingIntegration : NSObject <FPIntegration>
+@property (nonatomic, strong) dispatch_semaphore_t released;
+@end
+
+@implementation FPBlockingIntegration
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        _released = dispatch_semaphore_create(0);
+    }
+    return self;
+}
+
+- (void)track:(FPTrackPayload *)payload
+{
+    dispatch_semaphore_wait(self.released, DISPATCH_TIME_FOREVER);
+    dispatch_semaphore_signal(self.released);
+}
+
+@end
+
+
+@interface FPIntegrationsDispatchTests : XCTestCase
+@property (nonatomic, strong) FPAnalyticsConfiguration *configuration;
+@property (nonatomic, strong) FPAnalytics *analytics;
+@property (nonatomic, strong) FPIntegrationsManager *manager;
+@property (nonatomic, strong) NSArray<FPCountingIntegration *> *counters;
+@end
+
+@implementation FPIntegrationsDispatchTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.configuration = [FPAnalyticsConfiguration configurationWithWriteKey:@"TEST_WRITE_KEY"];
+    self.analytics = [[FPAnalytics alloc] initWithConfiguration:self.configuration];
+    self.manager = [[FPIntegrationsManager alloc] initWithAnalytics:self.analytics];
+}
+
+- (void)tearDown
+{
+    self.counters = nil;
+    self.manager = nil;
+    self.analytics = nil;
+    self.configuration = nil;
+    [super tearDown];
+}
+
+// Replaces the integrations of the manager with `count` counting ones, the way they are registered at start.
+- (void)useIntegrations:(NSUInteger)count middleware:(NSDictionary *)middleware plan:(NSDictionary *)plan
+{
+    NSMutableDictionary *integrations = [NSMutableDictionary dictionaryWithCapacity:count];
+    NSMutableArray *counters = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        FPCountingIntegration *counter = [[FPCountingIntegration alloc] init];
+        integrations[[NSString stringWithFormat:@"Counter %lu", (unsigned long)i]] = counter;
+        [counters addObject:counter];
+    }
+    [self installIntegrations:integrations middleware:middleware plan:plan];
+    self.counters = counters;
+}
+
+- (void)installIntegrations:(NSDictionary *)integrations middleware:(NSDictionary *)middleware plan:(NSDictionary *)plan
+{
+    seg_dispatch_specific_sync(self.manager.serialQueue, ^{
+        // Set first, so that applying the settings below does not start the configured integrations.
+        [self.manager setValue:@YES forKey:@"initialized"];
+        self.manager.integrations = [integrations mutableCopy];
+        self.manager.integrationMiddleware = [middleware mutableCopy] ?: [NSMutableDictionary dictionary];
+        self.manager.integrationInboxes = [NSMutableDictionary dictionary];
+        self.manager.cachedSettings = @{ @"plan" : plan ?: @{} };
+        [self.manager buildDispatchTable];
+    });
+}
+
+// Forwards a payload `times` times and waits until every integration got it.
+- (void)forward:(SEL)selector payload:(FPPayload *)payload times:(NSUInteger)times
+{
+    [self forwardWithoutWaiting:selector payload:payload times:times];
+    [self waitForIntegrationKeys:self.manager.integrationInboxes.allKeys];
+}
+
+- (void)forwardWithoutWaiting:(SEL)selector payload:(FPPayload *)payload times:(NSUInteger)times
+{
+    NSDictionary *options = @{ @"context" : payload.context ?: @{}, @"integrations" : payload.integrations ?: @{} };
+    NSArray *arguments = @[ payload ];
+    seg_dispatch_specific_sync(self.manager.serialQueue, ^{
+        for (NSUInteger i = 0; i < times; i++) {
+            [self.manager forwardSelector:selector arguments:arguments options:options];
+        }
+    });
+}
+
+- (void)waitForIntegrationKeys:(NSArray<NSString *> *)keys
+{
+    for (NSString *key in keys) {
+        seg_dispatch_specific_sync([self.manager.integrationInboxes[key] valueForKey:@"queue"], ^{
+        });
+    }
+}
+
+- (FPDeliveryMetrics *)metricsForKey:(NSString *)key
+{
+    return self.analytics.deliveryMetrics.destinationMetrics[key];
+}
+
+- (FPTrackPayload *)trackPayload:(NSString *)event integrations:(NSDictionary *)integrations
+{
+    return [[FPTrackPayload alloc] initWithEvent:event properties:@{ @"price" : @1 } context:@{} integrations:integrations ?: @{}];
+}
+
+- (void)testDeliversEachPayloadToTheIntegrationsTakingIt
+{
+    [self useIntegrations:3 middleware:nil plan:nil];
+    FPTrackPayload *track = [self trackPayload:@"Purchased" integrations:nil];
+    [self forward:@selector(track:) payload:track times:2];
+    FPIdentifyPayload *identify = [[FPIdentifyPayload alloc] initWithUserId:@"user" anonymousId:nil traits:@{} context:@{} integrations:@{}];
+    [self forward:@selector(identify:) payload:identify times:1];
+    // No integration takes screen calls; they are dropped without a lookup.
+    [self forward:@selector(screen:) payload:track times:1];
+
+    for (FPCountingIntegration *counter in self.counters) {
+        XCTAssertEqual(counter.trackCount, 2u);
+        XCTAssertEqual(counter.identifyCount, 1u);
+        XCTAssertEqual(counter.lastPayload, identify);
+    }
+}
+
+- (void)testSkipsIntegrationsDisabledInOptionsAndPlan
+{
+    NSDictionary *plan = @{ @"track" : @{ @"Purchased" : @{ @"enabled" : @YES, @"integrations" : @{ @"Counter 1" : @NO } } } };
+    [self useIntegrations:3 middleware:nil plan:plan];
+    [self forward:@selector(track:) payload:[self trackPayload:@"Purchased" integrations:@{ @"Counter 0" : @NO }] times:1];
+
+    XCTAssertEqual(self.counters[0].trackCount, 0u, @"disabled in options");
+    XCTAssertEqual(self.counters[1].trackCount, 0u, @"disabled in plan");
+    XCTAssertEqual(self.counters[2].trackCount, 1u);
+}
+
+- (void)testAppliesNewPlanWhenSettingsChange
+{
+    NSDictionary *plan = @{ @"track" : @{ @"Purchased" : @{ @"enabled" : @NO } } };
+    [self useIntegrations:1 middleware:nil plan:plan];
+    FPTrackPayload *track = [self trackPayload:@"Purchased" integrations:nil];
+    [self forward:@selector(track:) payload:track times:1];
+    XCTAssertEqual(self.counters[0].trackCount, 0u);
+
+    seg_dispatch_specific_sync(self.manager.serialQueue, ^{
+        self.manager.cachedSettings = @{ @"plan" : @{ @"track" : @{ @"Purchased" : @{ @"enabled" : @YES } } } };
+    });
+    [self forward:@selector(track:) payload:track times:1];
+    XCTAssertEqual(self.counters[0].trackCount, 1u, @"the decision cached for the old plan is dropped");
+}
+
+- (void)testRunsDestinationMiddleware
+{
+    FPTrackPayload *modified = [self trackPayload:@"Modified" integrations:nil];
+    FPBlockMiddleware *middleware = [[FPBlockMiddleware alloc] initWithBlock:^(FPContext *_Nonnull context, FPMiddlewareNext _Nonnull next) {
+        next([context modify:^(id<FPMutableContext> _Nonnull ctx) {
+            ctx.payload = modified;
+        }]);
+    }];
+    FPMiddlewareRunner *runner = [[FPMiddlewareRunner alloc] initWithMiddleware:@[ middleware ]];
+    [self useIntegrations:2 middleware:@{ @"Counter 0" : runner } plan:nil];
+    FPTrackPayload *track = [self trackPayload:@"Purchased" integrations:nil];
+    [self forward:@selector(track:) payload:track times:1];
+
+    XCTAssertEqual(self.counters[0].lastPayload, modified);
+    XCTAssertEqual(self.counters[1].lastPayload, track);
+}
+
+- (void)testSlowIntegrationDoesNotHoldUpTheOthers
+{
+    FPBlockingIntegration *blocking = [[FPBlockingIntegration alloc] init];
+    FPCountingIntegration *counter = [[FPCountingIntegration alloc] init];
+    [self installIntegrations:@{ @"Blocking" : blocking, @"Counter" : counter } middleware:nil plan:nil];
+
+    [self forwardWithoutWaiting:@selector(track:) payload:[self trackPayload:@"Purchased" integrations:nil] times:5];
+    [self waitForIntegrationKeys:@[ @"Counter" ]];
+    XCTAssertEqual(counter.trackCount, 5u, @"delivered while the other integration is stuck");
+
+    dispatch_semaphore_signal(blocking.released);
+    [self waitForIntegrationKeys:@[ @"Blocking" ]];
+    XCTAssertEqual([self metricsForKey:@"Blocking"].dispatchedEvents, 5u);
+    XCTAssertGreaterThanOrEqual([self metricsForKey:@"Blocking"].maxDispatchLag, [self metricsForKey:@"Counter"].maxDispatchLag);
+}
+
+- (void)testDropsEventsPastInboxCapacity
+{
+    self.configuration.integrationInboxCapacity = 3;
+    FPBlockingIntegration *blocking = [[FPBlockingIntegration alloc] init];
+    FPCountingIntegration *counter = [[FPCountingIntegration alloc] init];
+    [self installIntegrations:@{ @"Blocking" : blocking, @"Counter" : counter } middleware:nil plan:nil];
+
+    // The first event blocks the integration and still takes a place in its inbox; two more fill it, the last two are dropped.
+    [self forwardWithoutWaiting:@selector(track:) payload:[self trackPayload:@"Purchased" integrations:nil] times:5];
+    dispatch_semaphore_signal(blocking.released);
+    [self waitForIntegrationKeys:@[ @"Blocking", @"Counter" ]];
+
+    XCTAssertEqual([self metricsForKey:@"Blocking"].dispatchedEvents, 3u);
+    XCTAssertEqual([self metricsForKey:@"Blocking"].dispatchDroppedEvents, 2u);
+    XCTAssertEqual(counter.trackCount, 5u);
+    XCTAssertEqual([self metricsForKey:@"Counter"].dispatchDroppedEvents, 0u);
+}
+
+- (void)testNeverDropsEventsBoundForFreshpaint
+{
+    self.configuration.integrationInboxCapacity = 3;
+    FPBlockingIntegration *blocking = [[FPBlockingIntegration alloc] init];
+    [self installIntegrations:@{ @"Freshpaint.io" : blocking } middleware:nil plan:nil];
+
+    [self forwardWithoutWaiting:@selector(track:) payload:[self trackPayload:@"Purchased" integrations:nil] times:5];
+    dispatch_semaphore_signal(blocking.released);
+    [self waitForIntegrationKeys:@[ @"Freshpaint.io" ]];
+
+    XCTAssertEqual([self metricsForKey:@"Freshpaint.io"].dispatchedEvents, 5u);
+    XCTAssertEqual([self metricsForKey:@"Freshpaint.io"].dispatchDroppedEvents, 0u);
+}
+
+- (void)testRunsLatencyCriticalIntegrationsAtHigherQoS
+{
+    self.configuration.latencyCriticalIntegrations = [NSSet setWithObject:@"Counter 0"];
+    [self useIntegrations:2 middleware:nil plan:nil];
+
+    dispatch_queue_t critical = [self.manager.integrationInboxes[@"Counter 0"] valueForKey:@"queue"];
+    dispatch_queue_t standard = [self.manager.integrationInboxes[@"Counter 1"] valueForKey:@"queue"];
+    XCTAssertEqual(dispatch_queue_get_qos_class(critical, NULL), QOS_CLASS_USER_INITIATED);
+    XCTAssertEqual(dispatch_queue_get_qos_class(standard, NULL), QOS_CLASS_UTILITY);
+}
+
+// Events per second through forwardSelector: until every integration was called, logged for each integration count.
+- (void)measureForwardingToIntegrations:(NSUInteger)count
+{
+    const NSUInteger events = 10000;
+    // Nothing is dropped, so every event is delivered.
+    self.configuration.integrationInboxCapacity = events;
+    [self useIntegrations:count middleware:nil plan:nil];
+    FPTrackPayload *track = [self trackPayload:@"Purchased" integrations:nil];
+    [self measureBlock:^{
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        [self forward:@selector(track:) payload:track times:events];
+        CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+        NSLog(@"%lu integrations: %.0f events/sec", (unsigned long)count, events / MAX(elapsed, 1e-9));
+    }];
+    XCTAssertGreaterThanOrEqual(self.counters.firstObject.trackCount, events);
+}
+
+- (void)testForwardingPerformanceWith1Integration
+{
+    [self measureForwardingToIntegrations:1];
+}
+
+- (void)testForwardingPerformanceWith5Integrations
+{
+    [self measureForwardingToIntegrations:5];
+}
+
+- (void)testForwardingPerformanceWith20Integrations
+{
+    [self measureForwardingToIntegrations:20];
+}
+
+@end
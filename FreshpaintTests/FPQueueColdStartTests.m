@@ -0,0 +1,181 @@
+//
+//  FPQueueColdStartTests.m
+//  FreshpaintTests
+//
+
+#import <XCTest/XCTest.h>
+#import "FPAnalytics.h"
+#import "FPAnalyticsConfiguration.h"
+#import "FPDeliveryMetrics.h"
+#import "FPEventJournal.h"
+#import "FPEventQueue.h"
+#import "FPFreshpaintIntegration.h"
+#import "FPFileStorage.h"
+#import "FPUserDefaultsStorage.h"
+#import "FPHTTPClient.h"
+
+@interface FPFreshpaintIntegration (ColdStartTesting)
+@property (nonatomic, strong) FPEventQueue *queue;
+- (void)dispatchBackgroundAndWait:(void (^)(void))block;
+- (void)queueRecord:(NSData *)record lane:(FPEventLane)lane;
+- (uint64_t)batchEndFromSequence:(uint64_t)start maxCount:(NSUInteger)maxCount count:(NSUInteger *)count;
+- (void)applicationWillTerminate;
+@end
+
+// Counts how many records get decrypted.
+@interface FPCountingTestCrypto : NSObject <FPCrypto>
+@property (atomic, assign) NSUInteger decryptCount;
+@end
+
+@implementation FPCountingTestCrypto
+
+- (NSData *)encrypt:(NSData *)data
+{
+    NSMutableData *output = [data mutableCopy];
+    uint8_t *bytes = output.mutableBytes;
+    for (NSUInteger i = 0; i < output.length; i++) {
+        bytes[i] ^= 0x3C;
+    }
+    return output;
+}
+
+- (NSData *)decrypt:(NSData *)data
+{
+    self.decryptCount += 1;
+    return [self encrypt:data];
+}
+
+@end
+
+
+@interface FPQueueColdStartTests : XCTestCase
+@property (nonatomic, strong) FPAnalyticsConfiguration *configuration;
+@property (nonatomic, strong) FPAnalytics *analytics;
+@property (nonatomic, strong) FPCountingTestCrypto *crypto;
+@property (nonatomic, strong) NSURL *folderURL;
+@end
+
+@implementation FPQueueColdStartTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.configuration = [FPAnalyticsConfiguration configurationWithWriteKey:@"TEST_WRITE_KEY"];
+    self.configuration.flushAt = 10000;
+    self.analytics = [[FPAnalytics alloc] initWithConfiguration:self.configuration];
+    self.crypto = [[FPCountingTestCrypto alloc] init];
+    self.folderURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[NSUUID UUID].UUIDString];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtURL:self.folderURL error:nil];
+    self.analytics = nil;
+    self.configuration = nil;
+    [super tearDown];
+}
+
+- (NSData *)recordWithIndex:(NSUInteger)index
+{
+    NSDictionary *payload = @{ @"type" : @"track", @"event" : [NSString stringWithFormat:@"Event %lu", (unsigned long)index], @"properties" : @{ @"index" : @(index) } };
+    return [NSJSONSerialization dataWithJSONObject:payload options:0 error:nil];
+}
+
+- (FPFileStorage *)fileStorage
+{
+    return [[FPFileStorage alloc] initWithFolder:self.folderURL crypto:self.crypto];
+}
+
+// Leaves `count` events in the journal, as a previous launch that never got to upload them would.
+- (void)persistEvents:(NSUInteger)count
+{
+    FPEventJournal *journal = [[FPEventJournal alloc] initWithFolder:[[self fileStorage] urlForKey:kFPQueueJournalFilename] crypto:self.crypto];
+    for (NSUInteger i = 0; i < count; i++) {
+        [journal appendRecord:[self recordWithIndex:i] flags:FPEventLaneStandard];
+    }
+    [journal synchronize];
+}
+
+- (FPFreshpaintIntegration *)makeIntegration
+{
+    FPUserDefaultsStorage *defaultsStorage = [[FPUserDefaultsStorage alloc] initWithDefaults:[NSUserDefaults standardUserDefaults] namespacePrefix:nil crypto:nil];
+    return [[FPFreshpaintIntegration alloc] initWithAnalytics:self.analytics
+                                                   httpClient:[[FPHTTPClient alloc] initWithRequestFactory:nil]
+                                                  fileStorage:[self fileStorage]
+                                          userDefaultsStorage:defaultsStorage];
+}
+
+- (void)testFirstEnqueueDoesNotDecryptPersistedEvents
+{
+    [self persistEvents:500];
+    FPFreshpaintIntegration *integration = [self makeIntegration];
+    self.crypto.decryptCount = 0;
+
+    __block NSUInteger queued = 0;
+    [integration dispatchBackgroundAndWait:^{
+        [integration queueRecord:[self recordWithIndex:500] lane:FPEventLaneStandard];
+        queued = integration.queue.count;
+    }];
+    XCTAssertEqual(queued, 501u);
+    XCTAssertEqual(self.crypto.decryptCount, 0u);
+}
+
+- (void)testPersistedEventsArePagedInWhenABatchIsCut
+{
+    [self persistEvents:500];
+    FPFreshpaintIntegration *integration = [self makeIntegration];
+    self.crypto.decryptCount = 0;
+
+    __block NSData *first = nil;
+    [integration dispatchBackgroundAndWait:^{
+        uint64_t head = integration.queue.headSequence;
+        NSUInteger count = 0;
+        [integration batchEndFromSequence:head maxCount:100 count:&count];
+        XCTAssertEqual(count, 100u);
+        first = [integration.queue recordAtSequence:head];
+    }];
+    XCTAssertEqual(self.crypto.decryptCount, 100u, @"Only the events of the batch are read");
+    XCTAssertEqualObjects(first, [self recordWithIndex:0]);
+}
+
+- (void)testEvictedEventsStayEvictedAfterARelaunch
+{
+    self.configuration.maxQueueSize = 5;
+    FPFreshpaintIntegration *integration = [self makeIntegration];
+    NSData *identify = [NSJSONSerialization dataWithJSONObject:@{ @"type" : @"identify", @"userId" : @"sloth" } options:0 error:nil];
+    [integration dispatchBackgroundAndWait:^{
+        // Pins the head of the queue, so the evicted events are holes behind it rather than acknowledged.
+        [integration queueRecord:identify lane:FPEventLaneCritical];
+        for (NSUInteger i = 0; i < 8; i++) {
+            [integration queueRecord:[self recordWithIndex:i] lane:FPEventLaneStandard];
+        }
+    }];
+    [integration applicationWillTerminate];
+    XCTAssertEqual(self.analytics.deliveryMetrics.queueOverflowEventsDropped, 4u);
+
+    FPFreshpaintIntegration *relaunched = [self makeIntegration];
+    __block NSArray<NSData *> *records = nil;
+    [relaunched dispatchBackgroundAndWait:^{
+        FPEventQueue *queue = relaunched.queue;
+        XCTAssertEqual(queue.count, 5u);
+        records = [queue recordsFromSequence:queue.headSequence toSequence:queue.endSequence];
+    }];
+    XCTAssertEqualObjects(records, (@[ identify, [self recordWithIndex:4], [self recordWithIndex:5], [self recordWithIndex:6], [self recordWithIndex:7] ]));
+}
+
+// Launch cost: opening the queue with 1000 events left over and enqueueing the first new one.
+- (void)testTimeToFirstEnqueueWith1000PersistedEvents
+{
+    [self persistEvents:1000];
+    NSData *record = [self recordWithIndex:1000];
+    [self measureMetrics:[[self class] defaultPerformanceMetrics] automaticallyStartMeasuring:NO forBlock:^{
+        [self startMeasuring];
+        FPFreshpaintIntegration *integration = [self makeIntegration];
+        [integration dispatchBackgroundAndWait:^{
+            [integration queueRecord:record lane:FPEventLaneStandard];
+        }];
+        [self stopMeasuring];
+    }];
+}
+
+@end
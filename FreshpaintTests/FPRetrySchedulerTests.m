@@ -0,0 +1,192 @@
+//
+//  FPRetrySchedulerTests.m
+//  FreshpaintTests
+//
+
+#import <XCTest/XCTest.h>
+#import "FPRetryScheduler.h"
+#import "FPHTTPClient.h"
+
+
+@interface FPRetrySchedulerTests : XCTestCase
+@property (nonatomic, strong) dispatch_queue_t queue;
+@end
+
+@implementation FPRetrySchedulerTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.queue = dispatch_queue_create("io.freshpaint.test.retry", DISPATCH_QUEUE_SERIAL);
+}
+
+- (FPRetryScheduler *)makeScheduler
+{
+    return [[FPRetryScheduler alloc] initWithQueue:self.queue retryHandler:^{}];
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Backoff
+// ---------------------------------------------------------------------------
+
+- (void)testDelayGrowsExponentiallyWithJitter
+{
+    FPRetryScheduler *scheduler = [self makeScheduler];
+    scheduler.failureThreshold = 100;
+    for (NSUInteger failure = 1; failure <= 6; failure++) {
+        NSTimeInterval backoff = pow(2, failure - 1);
+        NSTimeInterval delay = [scheduler recordFailureWithRetryAfter:0];
+        XCTAssertGreaterThanOrEqual(delay, backoff / 2);
+        XCTAssertLessThanOrEqual(delay, backoff);
+    }
+    XCTAssertFalse([scheduler canAttempt]);
+}
+
+- (void)testDelayIsCapped
+{
+    FPRetryScheduler *scheduler = [self makeScheduler];
+    scheduler.failureThreshold = 100;
+    scheduler.maxDelay = 10;
+    NSTimeInterval delay = 0;
+    for (NSUInteger failure = 0; failure < 50; failure++) {
+        delay = [scheduler recordFailureWithRetryAfter:0];
+    }
+    XCTAssertLessThanOrEqual(delay, 10);
+}
+
+- (void)testRetryAfterIsHonored
+{
+    FPRetryScheduler *scheduler = [self makeScheduler];
+    XCTAssertEqualWithAccuracy([scheduler recordFailureWithRetryAfter:45], 45, 0.001);
+    XCTAssertGreaterThan(scheduler.nextAttemptDate.timeIntervalSinceNow, 40);
+}
+
+- (void)testSuccessResetsTheBackoff
+{
+    FPRetryScheduler *scheduler = [self makeScheduler];
+    [scheduler recordFailureWithRetryAfter:0];
+    [scheduler recordSuccess];
+
+    XCTAssertTrue([scheduler canAttempt]);
+    XCTAssertEqual(scheduler.consecutiveFailures, 0u);
+    XCTAssertNil(scheduler.nextAttemptDate);
+}
+
+- (void)testRetryAfterIsBounded
+{
+    FPRetryScheduler *scheduler = [self makeScheduler];
+    XCTAssertEqualWithAccuracy([scheduler recordFailureWithRetryAfter:99999999], 600, 0.001);
+}
+
+- (void)testFailuresOfConcurrentUploadsCountOnce
+{
+    FPRetryScheduler *scheduler = [self makeScheduler];
+    NSUInteger start = scheduler.failureCount;
+    NSTimeInterval delay = [scheduler recordFailureWithRetryAfter:0 startFailureCount:start];
+    XCTAssertEqualWithAccuracy([scheduler recordFailureWithRetryAfter:0 startFailureCount:start], delay, 0.1, @"The retry already scheduled stands");
+    XCTAssertEqual(scheduler.consecutiveFailures, 1u);
+
+    XCTAssertEqualWithAccuracy([scheduler recordFailureWithRetryAfter:30 startFailureCount:start], 30, 0.001, @"A longer Retry-After is still honored");
+    XCTAssertEqual(scheduler.consecutiveFailures, 1u);
+
+    [scheduler recordFailureWithRetryAfter:0 startFailureCount:scheduler.failureCount];
+    XCTAssertEqual(scheduler.consecutiveFailures, 2u, @"An upload started after the failure counts again");
+}
+
+- (void)testRetryHandlerRunsWhenTheDelayElapses
+{
+    XCTestExpectation *retried = [self expectationWithDescription:@"retried"];
+    FPRetryScheduler *scheduler = [[FPRetryScheduler alloc] initWithQueue:self.queue retryHandler:^{
+        [retried fulfill];
+    }];
+    scheduler.baseDelay = 0.05;
+    [scheduler recordFailureWithRetryAfter:0];
+
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+    XCTAssertTrue([scheduler canAttempt]);
+}
+
+- (void)testSuccessCancelsThePendingRetry
+{
+    XCTestExpectation *retried = [self expectationWithDescription:@"retried"];
+    retried.inverted = YES;
+    FPRetryScheduler *scheduler = [[FPRetryScheduler alloc] initWithQueue:self.queue retryHandler:^{
+        [retried fulfill];
+    }];
+    scheduler.baseDelay = 0.05;
+    dispatch_sync(self.queue, ^{
+        [scheduler recordFailureWithRetryAfter:0];
+        [scheduler recordSuccess];
+    });
+
+    [self waitForExpectationsWithTimeout:0.3 handler:nil];
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Circuit breaker
+// ---------------------------------------------------------------------------
+
+- (void)testBreakerOpensAfterRepeatedFailures
+{
+    FPRetryScheduler *scheduler = [self makeScheduler];
+    scheduler.failureThreshold = 3;
+    scheduler.breakerCooldown = 600;
+
+    [scheduler recordFailureWithRetryAfter:0];
+    [scheduler recordFailureWithRetryAfter:0];
+    XCTAssertFalse(scheduler.breakerOpen);
+
+    XCTAssertEqual([scheduler recordFailureWithRetryAfter:0], 600);
+    XCTAssertTrue(scheduler.breakerOpen);
+    XCTAssertFalse([scheduler canAttempt]);
+
+    [scheduler recordSuccess];
+    XCTAssertFalse(scheduler.breakerOpen);
+}
+
+- (void)testFailedProbeReopensTheBreaker
+{
+    FPRetryScheduler *scheduler = [self makeScheduler];
+    scheduler.failureThreshold = 1;
+    scheduler.breakerCooldown = 0;
+    [scheduler recordFailureWithRetryAfter:0];
+    XCTAssertTrue([scheduler canAttempt], @"The cooldown elapsed, a probe may go out");
+
+    scheduler.breakerCooldown = 600;
+    [scheduler recordFailureWithRetryAfter:0];
+    XCTAssertTrue(scheduler.breakerOpen);
+    XCTAssertFalse([scheduler canAttempt]);
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Retry-After
+// ---------------------------------------------------------------------------
+
+- (NSHTTPURLResponse *)responseWithRetryAfter:(NSString *)value
+{
+    return [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:@"https://api.freshpaint.io/import"]
+                                       statusCode:429
+                                      HTTPVersion:@"HTTP/1.1"
+                                     headerFields:value ? @{ @"Retry-After" : value } : @{}];
+}
+
+- (void)testRetryAfterSecondsAreParsed
+{
+    XCTAssertEqual([FPHTTPClient retryAfterFromResponse:[self responseWithRetryAfter:@"120"]], 120);
+    XCTAssertEqual([FPHTTPClient retryAfterFromResponse:[self responseWithRetryAfter:nil]], 0);
+    XCTAssertEqual([FPHTTPClient retryAfterFromResponse:[self responseWithRetryAfter:@"soon"]], 0);
+}
+
+- (void)testRetryAfterDateIsParsed
+{
+    NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
+    formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+    formatter.timeZone = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+    formatter.dateFormat = @"EEE, dd MMM yyyy HH:mm:ss 'GMT'";
+    NSString *value = [formatter stringFromDate:[NSDate dateWithTimeIntervalSinceNow:300]];
+
+    XCTAssertEqualWithAccuracy([FPHTTPClient retryAfterFromResponse:[self responseWithRetryAfter:value]], 300, 5);
+    XCTAssertEqual([FPHTTPClient retryAfterFromResponse:[self responseWithRetryAfter:@"Wed, 21 Oct 2015 07:28:00 GMT"]], 0);
+}
+
+@end
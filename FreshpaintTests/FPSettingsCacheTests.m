@@ -0,0 +1,43 @@
+//
+//  FPSettingsCacheTests.m
+//  FreshpaintTests
+//
+
+#import <XCTest/XCTest.h>
+#import "FPHTTPClient.h"
+#import "FPIntegrationsManager.h"
+
+
+@interface FPSettingsCacheTests : XCTestCase
+@end
+
+@implementation FPSettingsCacheTests
+
+- (void)testValidatorsAreReadFromTheResponse
+{
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:@"https://cdn-settings.segment.com/v1/projects/foo/settings"]
+                                                              statusCode:200
+                                                             HTTPVersion:@"HTTP/1.1"
+                                                            headerFields:@{ @"ETag" : @"\"abc\"", @"Last-Modified" : @"Wed, 21 Oct 2015 07:28:00 GMT", @"Content-Type" : @"application/json" }];
+    NSDictionary *validators = [FPHTTPClient settingsValidatorsFromResponse:response];
+    XCTAssertEqualObjects(validators, (@{ @"ETag" : @"\"abc\"", @"Last-Modified" : @"Wed, 21 Oct 2015 07:28:00 GMT" }));
+}
+
+- (void)testResponseWithoutValidators
+{
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:@"https://cdn-settings.segment.com/v1/projects/foo/settings"]
+                                                              statusCode:200
+                                                             HTTPVersion:@"HTTP/1.1"
+                                                            headerFields:@{}];
+    XCTAssertEqual([FPHTTPClient settingsValidatorsFromResponse:response].count, 0u);
+}
+
+- (void)testCacheExpiresAfterTheTTL
+{
+    XCTAssertTrue([FPIntegrationsManager isSettingsCacheFetchedAt:nil expiredForTTL:3600], @"Never fetched");
+    XCTAssertFalse([FPIntegrationsManager isSettingsCacheFetchedAt:[NSDate dateWithTimeIntervalSinceNow:-60] expiredForTTL:3600]);
+    XCTAssertTrue([FPIntegrationsManager isSettingsCacheFetchedAt:[NSDate dateWithTimeIntervalSinceNow:-3601] expiredForTTL:3600]);
+    XCTAssertTrue([FPIntegrationsManager isSettingsCacheFetchedAt:[NSDate dateWithTimeIntervalSinceNow:600] expiredForTTL:3600], @"The clock was set back");
+}
+
+@end
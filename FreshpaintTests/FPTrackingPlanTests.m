@@ -0,0 +1,108 @@
+//
+//  FPTrackingPlanTests.m
+//  FreshpaintTests
+//
+
+#import <XCTest/XCTest.h>
+#import "FPTrackingPlan.h"
+
+
+@interface FPTrackingPlanTests : XCTestCase
+@end
+
+@implementation FPTrackingPlanTests
+
+- (NSDictionary *)plan
+{
+    return @{
+        @"track" : @{
+            @"Enabled" : @{ @"enabled" : @YES },
+            @"Disabled" : @{ @"enabled" : @NO },
+            @"Amplitude Only" : @{ @"enabled" : @YES, @"integrations" : @{ @"All" : @NO, @"Amplitude" : @YES } },
+            @"Not Mixpanel" : @{ @"enabled" : @YES, @"integrations" : @{ @"Mixpanel" : @NO } },
+        }
+    };
+}
+
+- (void)testFollowsTheEventRules
+{
+    FPTrackingPlan *plan = [[FPTrackingPlan alloc] initWithPlan:[self plan]];
+    XCTAssertTrue([plan isTrackEvent:@"Enabled" enabledForIntegration:@"Mixpanel"]);
+    XCTAssertFalse([plan isTrackEvent:@"Disabled" enabledForIntegration:@"Mixpanel"]);
+    XCTAssertTrue([plan isTrackEvent:@"Amplitude Only" enabledForIntegration:@"Amplitude"]);
+    XCTAssertFalse([plan isTrackEvent:@"Amplitude Only" enabledForIntegration:@"Mixpanel"]);
+    XCTAssertFalse([plan isTrackEvent:@"Not Mixpanel" enabledForIntegration:@"Mixpanel"]);
+    XCTAssertTrue([plan isTrackEvent:@"Not Mixpanel" enabledForIntegration:@"Amplitude"]);
+    XCTAssertTrue([plan isTrackEvent:@"Unplanned" enabledForIntegration:@"Mixpanel"], @"events outside the plan go through without a default");
+}
+
+- (void)testAlwaysSendsToFreshpaint
+{
+    FPTrackingPlan *plan = [[FPTrackingPlan alloc] initWithPlan:[self plan]];
+    XCTAssertTrue([plan isTrackEvent:@"Disabled" enabledForIntegration:@"Freshpaint.io"]);
+}
+
+- (void)testAppliesTheDefaultRuleToUnplannedEvents
+{
+    NSMutableDictionary *track = [[self plan][@"track"] mutableCopy];
+    track[@"__default"] = @{ @"enabled" : @NO };
+    FPTrackingPlan *plan = [[FPTrackingPlan alloc] initWithPlan:@{ @"track" : track }];
+    XCTAssertFalse([plan isTrackEvent:@"Unplanned" enabledForIntegration:@"Mixpanel"]);
+    XCTAssertTrue([plan isTrackEvent:@"Enabled" enabledForIntegration:@"Mixpanel"], @"planned events keep their rule");
+}
+
+- (void)testIgnoresMalformedPlans
+{
+    XCTAssertTrue([[[FPTrackingPlan alloc] initWithPlan:nil] isTrackEvent:@"Any" enabledForIntegration:@"Mixpanel"]);
+    XCTAssertTrue([[[FPTrackingPlan alloc] initWithPlan:@{ @"track" : @"none" }] isTrackEvent:@"Any" enabledForIntegration:@"Mixpanel"]);
+    FPTrackingPlan *plan = [[FPTrackingPlan alloc] initWithPlan:@{ @"track" : @{ @"Broken" : @YES } }];
+    XCTAssertTrue([plan isTrackEvent:@"Broken" enabledForIntegration:@"Mixpanel"]);
+}
+
+- (void)testKeepsTheDecisionsOfRecentEventsOnly
+{
+    FPTrackingPlan *plan = [[FPTrackingPlan alloc] initWithPlan:[self plan] capacity:2];
+    XCTAssertFalse([plan isTrackEvent:@"Disabled" enabledForIntegration:@"Mixpanel"]);
+    XCTAssertTrue([plan isTrackEvent:@"Enabled" enabledForIntegration:@"Mixpanel"]);
+    XCTAssertTrue([plan isTrackEvent:@"Enabled" enabledForIntegration:@"Amplitude"]);
+    XCTAssertEqual(plan.cachedEventCount, 2u);
+
+    XCTAssertFalse([plan isTrackEvent:@"Not Mixpanel" enabledForIntegration:@"Mixpanel"]);
+    XCTAssertEqual(plan.cachedEventCount, 2u);
+    XCTAssertFalse([plan isTrackEvent:@"Disabled" enabledForIntegration:@"Mixpanel"], @"an evicted event is decided again");
+}
+
+- (void)testKeepsTheDecisionsOfEventsSeenAgain
+{
+    FPTrackingPlan *plan = [[FPTrackingPlan alloc] initWithPlan:[self plan] capacity:2];
+    [plan isTrackEvent:@"Enabled" enabledForIntegration:@"Mixpanel"];
+    [plan isTrackEvent:@"Disabled" enabledForIntegration:@"Mixpanel"];
+    [plan isTrackEvent:@"Enabled" enabledForIntegration:@"Mixpanel"];
+    [plan isTrackEvent:@"Not Mixpanel" enabledForIntegration:@"Mixpanel"];
+
+    NSDictionary *entries = [plan valueForKey:@"entries"];
+    XCTAssertNotNil(entries[@"Enabled"], @"seen since the other one");
+    XCTAssertNil(entries[@"Disabled"]);
+}
+
+- (void)testLargePlanPerformance
+{
+    NSMutableDictionary *track = [NSMutableDictionary dictionaryWithCapacity:5000];
+    for (NSUInteger i = 0; i < 5000; i++) {
+        track[[NSString stringWithFormat:@"Event %lu", (unsigned long)i]] = @{ @"enabled" : @YES, @"integrations" : @{ @"Mixpanel" : @(i % 2 == 0) } };
+    }
+    FPTrackingPlan *plan = [[FPTrackingPlan alloc] initWithPlan:@{ @"track" : track }];
+    NSArray<NSString *> *events = @[ @"Event 10", @"Event 2501", @"Event 4999", @"Unplanned" ];
+    NSArray<NSString *> *keys = @[ @"Mixpanel", @"Amplitude", @"webhook_a", @"webhook_b", @"Freshpaint.io" ];
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 20000; i++) {
+            for (NSString *key in keys) {
+                [plan isTrackEvent:events[i % events.count] enabledForIntegration:key];
+            }
+        }
+    }];
+    XCTAssertTrue([plan isTrackEvent:@"Event 10" enabledForIntegration:@"Mixpanel"]);
+    XCTAssertFalse([plan isTrackEvent:@"Event 2501" enabledForIntegration:@"Mixpanel"]);
+}
+
+@end
@@ -0,0 +1,301 @@
+//
+//  FPTransportTests.m
+//  FreshpaintTests
+//
+
+#import <XCTest/XCTest.h>
+#import "FPAnalytics.h"
+#import "FPAnalyticsConfiguration.h"
+#import "FPEventQueue.h"
+#import "FPFreshpaintIntegration.h"
+#import "FPFileStorage.h"
+#import "FPUserDefaultsStorage.h"
+#import "FPHTTPClient.h"
+#import "FPLoopbackTransport.h"
+#import "NSData+FPGZIP.h"
+
+@interface FPFreshpaintIntegration (Testing)
+- (void)dispatchBackgroundAndWait:(void (^)(void))block;
+- (void)queueRecord:(NSData *)record lane:(FPEventLane)lane;
+- (void)drainWithCompletion:(void (^)(NSUInteger))completion;
+@end
+
+
+@interface FPTransportTests : XCTestCase
+@property (nonatomic, strong) FPAnalyticsConfiguration *configuration;
+@property (nonatomic, strong) FPAnalytics *analytics;
+@property (nonatomic, strong) NSURL *folderURL;
+@property (nonatomic, strong) FPLoopbackTransport *transport;
+@end
+
+@implementation FPTransportTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.configuration = [FPAnalyticsConfiguration configurationWithWriteKey:@"TEST_WRITE_KEY"];
+    // Only flush when a test asks for it.
+    self.configuration.flushAt = 10000;
+    self.analytics = [[FPAnalytics alloc] initWithConfiguration:self.configuration];
+    self.folderURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    self.transport = [[FPLoopbackTransport alloc] init];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtURL:self.folderURL error:nil];
+    self.analytics = nil;
+    self.configuration = nil;
+    self.transport = nil;
+    [super tearDown];
+}
+
+- (FPHTTPClient *)makeClient
+{
+    FPHTTPClient *client = [[FPHTTPClient alloc] initWithRequestFactory:nil];
+    client.transport = self.transport;
+    return client;
+}
+
+- (FPFreshpaintIntegration *)makeIntegrationWithEvents:(NSUInteger)count
+{
+    FPFileStorage *fileStorage = [[FPFileStorage alloc] initWithFolder:self.folderURL crypto:nil];
+    FPUserDefaultsStorage *defaultsStorage = [[FPUserDefaultsStorage alloc] initWithDefaults:[NSUserDefaults standardUserDefaults] namespacePrefix:nil crypto:nil];
+    FPFreshpaintIntegration *integration = [[FPFreshpaintIntegration alloc] initWithAnalytics:self.analytics
+                                                                                   httpClient:[self makeClient]
+                                                                                  fileStorage:fileStorage
+                                                                          userDefaultsStorage:defaultsStorage];
+    NSData *record = [NSJSONSerialization dataWithJSONObject:@{ @"type" : @"track", @"event" : @"Small" } options:0 error:nil];
+    [integration dispatchBackgroundAndWait:^{
+        for (NSUInteger i = 0; i < count; i++) {
+            [integration queueRecord:record lane:FPEventLaneStandard];
+        }
+    }];
+    return integration;
+}
+
+- (NSUInteger)drain:(FPFreshpaintIntegration *)integration
+{
+    __block NSUInteger delivered = 0;
+    XCTestExpectation *drained = [self expectationWithDescription:@"drained"];
+    [integration drainWithCompletion:^(NSUInteger deliveredCount) {
+        delivered = deliveredCount;
+        [drained fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    return delivered;
+}
+
+// Uploads `body` and returns what the client made of the response.
+- (void)upload:(NSData *)body retry:(BOOL *)retry retryAfter:(NSTimeInterval *)retryAfter
+{
+    XCTestExpectation *completed = [self expectationWithDescription:@"completed"];
+    [[self makeClient] uploadData:body forWriteKey:@"TEST_WRITE_KEY" completionHandler:^(BOOL shouldRetry, NSTimeInterval delay) {
+        *retry = shouldRetry;
+        *retryAfter = delay;
+        [completed fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:1 handler:nil];
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Loopback transport
+// ---------------------------------------------------------------------------
+
+- (void)testScriptedResponsesComeFirstAndInOrder
+{
+    NSError *lost = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil];
+    [self.transport enqueueStatusCodes:@[ @500, @429 ]];
+    [self.transport enqueueError:lost];
+
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"https://example.com/"]];
+    NSMutableArray *results = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 4; i++) {
+        XCTestExpectation *answered = [self expectationWithDescription:@"answered"];
+        [self.transport sendRequest:request body:[NSData dataWithBytes:"body" length:4] completionHandler:^(NSData *data, NSHTTPURLResponse *response, NSError *error) {
+            [results addObject:error ?: @(response.statusCode)];
+            [answered fulfill];
+        }];
+        [self waitForExpectationsWithTimeout:1 handler:nil];
+    }
+
+    XCTAssertEqualObjects(results, (@[ @500, @429, lost, @200 ]));
+    XCTAssertEqual(self.transport.requestCount, 4u);
+    XCTAssertEqual(self.transport.bodyBytesReceived, 16u);
+    XCTAssertEqual(self.transport.successCount, 1u);
+    XCTAssertEqual(self.transport.failureCount, 3u);
+}
+
+- (void)testInjectedFailuresAreReproducible
+{
+    NSMutableArray<NSNumber *> *(^failures)(void) = ^{
+        FPLoopbackTransport *transport = [[FPLoopbackTransport alloc] init];
+        transport.failureRate = 0.25;
+        transport.seed = 42;
+        NSMutableArray<NSNumber *> *failed = [NSMutableArray array];
+        NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"https://example.com/"]];
+        dispatch_group_t group = dispatch_group_create();
+        for (NSUInteger i = 0; i < 400; i++) {
+            dispatch_group_enter(group);
+            [transport sendRequest:request body:nil completionHandler:^(NSData *data, NSHTTPURLResponse *response, NSError *error) {
+                if (error != nil) {
+                    @synchronized(failed) {
+                        [failed addObject:@(i)];
+                    }
+                }
+                dispatch_group_leave(group);
+            }];
+        }
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+        [failed sortUsingSelector:@selector(compare:)];
+        return failed;
+    };
+
+    NSArray<NSNumber *> *first = failures();
+    XCTAssertEqualObjects(first, failures());
+    XCTAssertGreaterThan(first.count, 60u);
+    XCTAssertLessThan(first.count, 140u);
+}
+
+- (void)testLatencyDelaysResponses
+{
+    self.transport.latency = 0.2;
+    NSDate *start = [NSDate date];
+    XCTestExpectation *answered = [self expectationWithDescription:@"answered"];
+    [self.transport sendRequest:[NSURLRequest requestWithURL:[NSURL URLWithString:@"https://example.com/"]] body:nil completionHandler:^(NSData *data, NSHTTPURLResponse *response, NSError *error) {
+        [answered fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:2 handler:nil];
+    XCTAssertGreaterThanOrEqual(-start.timeIntervalSinceNow, 0.2);
+}
+
+- (void)testCancelledRequestCompletesOnce
+{
+    self.transport.latency = 0.2;
+    __block NSUInteger calls = 0;
+    __block NSError *cancelError = nil;
+    id<FPTransportTask> task = [self.transport sendRequest:[NSURLRequest requestWithURL:[NSURL URLWithString:@"https://example.com/"]] body:nil completionHandler:^(NSData *data, NSHTTPURLResponse *response, NSError *error) {
+        calls++;
+        cancelError = error;
+    }];
+    [task cancel];
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.4]];
+    XCTAssertEqual(calls, 1u);
+    XCTAssertEqual(cancelError.code, NSURLErrorCancelled);
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - HTTP client over a transport
+// ---------------------------------------------------------------------------
+
+- (void)testUploadsCarryTheirHeadersAndGzippedBody
+{
+    __block NSURLRequest *sentRequest = nil;
+    __block NSData *sentBody = nil;
+    self.transport.responseHandler = ^NSInteger(NSURLRequest *request, NSData *body, NSError **error) {
+        sentRequest = request;
+        sentBody = body;
+        return 200;
+    };
+    NSData *body = [@"{\"batch\":[],\"sentAt\":\"2024-03-14T09:26:53.589Z\"}" dataUsingEncoding:NSUTF8StringEncoding];
+    BOOL retry = YES;
+    NSTimeInterval retryAfter = 0;
+    [self upload:body retry:&retry retryAfter:&retryAfter];
+
+    XCTAssertFalse(retry);
+    XCTAssertEqualObjects(sentRequest.HTTPMethod, @"POST");
+    XCTAssertEqualObjects([sentRequest valueForHTTPHeaderField:@"Content-Encoding"], @"gzip");
+    XCTAssertEqualObjects([sentRequest valueForHTTPHeaderField:@"Content-Type"], @"application/json");
+    XCTAssertEqualObjects([sentRequest valueForHTTPHeaderField:@"Authorization"], [@"Basic " stringByAppendingString:[FPHTTPClient authorizationHeader:@"TEST_WRITE_KEY"]]);
+    XCTAssertTrue([sentBody seg_isGzippedData]);
+}
+
+- (void)testResponsesAreClassifiedForRetry
+{
+    BOOL retry = NO;
+    NSTimeInterval retryAfter = 0;
+    NSData *body = [@"{}" dataUsingEncoding:NSUTF8StringEncoding];
+
+    [self.transport enqueueStatusCodes:@[ @500 ]];
+    [self upload:body retry:&retry retryAfter:&retryAfter];
+    XCTAssertTrue(retry);
+
+    [self.transport enqueueStatusCodes:@[ @400 ]];
+    [self upload:body retry:&retry retryAfter:&retryAfter];
+    XCTAssertFalse(retry);
+
+    [self.transport enqueueError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorTimedOut userInfo:nil]];
+    [self upload:body retry:&retry retryAfter:&retryAfter];
+    XCTAssertTrue(retry);
+
+    self.transport.responseHeaders = @{ @"Retry-After" : @"7" };
+    [self.transport enqueueStatusCodes:@[ @429 ]];
+    [self upload:body retry:&retry retryAfter:&retryAfter];
+    XCTAssertTrue(retry);
+    XCTAssertEqual(retryAfter, 7.0);
+}
+
+// ---------------------------------------------------------------------------
+#pragma mark - Upload pipeline over the loopback transport
+// ---------------------------------------------------------------------------
+
+- (void)testDrainDeliversEverythingOverTheTransport
+{
+    self.transport.latency = 0.005;
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithEvents:1000];
+
+    XCTAssertEqual([self drain:integration], 1000u);
+    XCTAssertEqual(self.transport.requestCount, 10u);
+    XCTAssertEqual(self.transport.failureCount, 0u);
+}
+
+- (void)testDrainStopsAtTheFirstInjectedFailure
+{
+    self.configuration.maxInFlightBatches = 1;
+    [self.transport enqueueStatusCodes:@[ @200, @503 ]];
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithEvents:300];
+
+    XCTAssertEqual([self drain:integration], 100u);
+    XCTAssertEqual(self.transport.requestCount, 2u);
+}
+
+- (void)testOverflowSparesTheBatchBeingUploaded
+{
+    self.configuration.maxQueueSize = 150;
+    self.configuration.maxInFlightBatches = 1;
+    self.transport.latency = 0.3;
+    FPFreshpaintIntegration *integration = [self makeIntegrationWithEvents:100];
+
+    __block NSUInteger delivered = 0;
+    XCTestExpectation *drained = [self expectationWithDescription:@"drained"];
+    [integration drainWithCompletion:^(NSUInteger deliveredCount) {
+        delivered = deliveredCount;
+        [drained fulfill];
+    }];
+    // Queued behind the start of the drain, so while the transport holds its first request.
+    NSData *record = [NSJSONSerialization dataWithJSONObject:@{ @"type" : @"track", @"event" : @"Small" } options:0 error:nil];
+    [integration dispatchBackgroundAndWait:^{
+        for (NSUInteger i = 0; i < 100; i++) {
+            [integration queueRecord:record lane:FPEventLaneStandard];
+        }
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+
+    XCTAssertEqual(delivered, 150u, @"The uploading batch, then what is left of the new events");
+    XCTAssertEqual(self.analytics.deliveryMetrics.queueOverflowEventsDropped, 50u);
+    XCTAssertEqual(self.transport.requestCount, 2u);
+}
+
+- (void)testDrainThroughputPerformance
+{
+    self.transport.latency = 0.002;
+    [self measureMetrics:[[self class] defaultPerformanceMetrics] automaticallyStartMeasuring:NO forBlock:^{
+        FPFreshpaintIntegration *integration = [self makeIntegrationWithEvents:2000];
+        [self startMeasuring];
+        XCTAssertEqual([self drain:integration], 2000u);
+        [self stopMeasuring];
+        [[NSFileManager defaultManager] removeItemAtURL:self.folderURL error:nil];
+    }];
+}
+
+@end
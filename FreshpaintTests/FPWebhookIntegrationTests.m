@@ -0,0 +1,222 @@
+//
+//  FPWebhookIntegrationTests.m
+//  FreshpaintTests
+//
+
+#import <XCTest/XCTest.h>
+#import "FPAnalytics.h"
+#import "FPAnalyticsConfiguration.h"
+#import "FPDeliveryMetrics.h"
+#import "FPHTTPClient.h"
+#import "FPLoopbackTransport.h"
+#import "FPRetryScheduler.h"
+#import "FPEventQueue.h"
+#import "NSData+FPGZIP.h"
+
+@interface FPWebhookIntegration : NSObject
+@property (nonatomic, strong) FPEventQueue *queue;
+@property (nonatomic, strong) FPRetryScheduler *retryScheduler;
+- (instancetype)initWithAnalytics:(FPAnalytics *)analytics httpClient:(FPHTTPClient *)client webhookUrl:(NSString *)webhookUrl name:(NSString *)name folderURL:(NSURL *)folderURL batchSize:(NSUInteger)batchSize;
+- (void)dispatchBackgroundAndWait:(void (^)(void))block;
+- (void)queueRecord:(NSData *)record;
+- (void)flush;
+- (void)applicationWillTerminate;
+@end
+
+
+@interface FPWebhookIntegrationTests : XCTestCase
+@property (nonatomic, strong) FPAnalyticsConfiguration *configuration;
+@property (nonatomic, strong) FPAnalytics *analytics;
+@property (nonatomic, strong) NSURL *folderURL;
+@property (nonatomic, strong) FPLoopbackTransport *transport;
+@property (nonatomic, strong) NSMutableArray<NSURLRequest *> *requests;
+@property (nonatomic, strong) NSMutableArray<NSData *> *bodies;
+// Status codes of the next responses, then `statusCode` for the rest.
+@property (nonatomic, strong) NSMutableArray<NSNumber *> *statusCodes;
+@property (nonatomic, assign) NSInteger statusCode;
+@end
+
+@implementation FPWebhookIntegrationTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.configuration = [FPAnalyticsConfiguration configurationWithWriteKey:@"TEST_WRITE_KEY"];
+    self.folderURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    self.requests = [NSMutableArray array];
+    self.bodies = [NSMutableArray array];
+    self.statusCodes = [NSMutableArray array];
+    self.statusCode = 200;
+    self.transport = [[FPLoopbackTransport alloc] init];
+    __weak FPWebhookIntegrationTests *weakSelf = self;
+    self.transport.responseHandler = ^NSInteger(NSURLRequest *request, NSData *body, NSError **error) {
+        FPWebhookIntegrationTests *strongSelf = weakSelf;
+        @synchronized(strongSelf) {
+            [strongSelf.requests addObject:request];
+            [strongSelf.bodies addObject:body ?: [NSData data]];
+            NSNumber *statusCode = strongSelf.statusCodes.firstObject;
+            if (statusCode == nil) {
+                return strongSelf.statusCode;
+            }
+            [strongSelf.statusCodes removeObjectAtIndex:0];
+            return statusCode.integerValue;
+        }
+    };
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtURL:self.folderURL error:nil];
+    self.analytics = nil;
+    self.configuration = nil;
+    self.transport = nil;
+    [super tearDown];
+}
+
+- (FPWebhookIntegration *)makeIntegrationWithBatchSize:(NSUInteger)batchSize
+{
+    if (!self.analytics) {
+        self.analytics = [[FPAnalytics alloc] initWithConfiguration:self.configuration];
+    }
+    FPHTTPClient *client = [[FPHTTPClient alloc] initWithRequestFactory:nil];
+    client.transport = self.transport;
+    return [[FPWebhookIntegration alloc] initWithAnalytics:self.analytics
+                                                httpClient:client
+                                                webhookUrl:@"https://example.com/hook"
+                                                      name:@"test"
+                                                 folderURL:self.folderURL
+                                                 batchSize:batchSize];
+}
+
+- (void)queueRecords:(NSUInteger)count integration:(FPWebhookIntegration *)integration
+{
+    [integration dispatchBackgroundAndWait:^{
+        for (NSUInteger i = 0; i < count; i++) {
+            NSData *record = [NSJSONSerialization dataWithJSONObject:@{ @"type" : @"track", @"event" : @"Small", @"index" : @(i) } options:0 error:nil];
+            [integration queueRecord:record];
+        }
+    }];
+}
+
+- (NSUInteger)queueCountOfIntegration:(FPWebhookIntegration *)integration
+{
+    __block NSUInteger count = 0;
+    [integration dispatchBackgroundAndWait:^{
+        count = integration.queue.count;
+    }];
+    return count;
+}
+
+// Waits until the webhook has been sent `count` requests and the queue holds `queued` events.
+- (void)waitForRequests:(NSUInteger)count queued:(NSUInteger)queued integration:(FPWebhookIntegration *)integration
+{
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5];
+    while ((self.transport.requestCount < count || [self queueCountOfIntegration:integration] != queued) && [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    XCTAssertEqual(self.transport.requestCount, count);
+    XCTAssertEqual([self queueCountOfIntegration:integration], queued);
+}
+
+- (FPDeliveryMetrics *)destinationMetrics
+{
+    return self.analytics.deliveryMetrics.destinationMetrics[@"webhook_test"];
+}
+
+- (void)testSendsEachEventOnItsOwnByDefault
+{
+    FPWebhookIntegration *integration = [self makeIntegrationWithBatchSize:1];
+    [self queueRecords:3 integration:integration];
+    [self waitForRequests:3 queued:0 integration:integration];
+
+    for (NSUInteger i = 0; i < 3; i++) {
+        NSDictionary *event = [NSJSONSerialization JSONObjectWithData:self.bodies[i] options:0 error:nil];
+        XCTAssertEqualObjects(event[@"index"], @(i), @"events are sent one at a time, in order");
+        XCTAssertNil([self.requests[i] valueForHTTPHeaderField:@"Content-Encoding"]);
+    }
+    XCTAssertEqual([self destinationMetrics].uploadsSucceeded, 3u);
+}
+
+- (void)testBatchesEventsIntoOneGzippedRequest
+{
+    FPWebhookIntegration *integration = [self makeIntegrationWithBatchSize:5];
+    [self queueRecords:4 integration:integration];
+    XCTAssertEqual(self.transport.requestCount, 0u, @"a partial batch waits");
+
+    [self queueRecords:1 integration:integration];
+    [self waitForRequests:1 queued:0 integration:integration];
+
+    XCTAssertEqualObjects([self.requests.firstObject valueForHTTPHeaderField:@"Content-Encoding"], @"gzip");
+    NSDictionary *body = [NSJSONSerialization JSONObjectWithData:[self.bodies.firstObject seg_gunzippedData] options:0 error:nil];
+    XCTAssertEqual([body[@"batch"] count], 5u);
+    XCTAssertNotNil(body[@"sentAt"]);
+}
+
+- (void)testFlushSendsPartialBatch
+{
+    FPWebhookIntegration *integration = [self makeIntegrationWithBatchSize:10];
+    [self queueRecords:3 integration:integration];
+    [integration flush];
+    [self waitForRequests:1 queued:0 integration:integration];
+
+    NSDictionary *body = [NSJSONSerialization JSONObjectWithData:[self.bodies.firstObject seg_gunzippedData] options:0 error:nil];
+    XCTAssertEqual([body[@"batch"] count], 3u);
+}
+
+- (void)testKeepsQueuedEventsAcrossLaunches
+{
+    FPWebhookIntegration *integration = [self makeIntegrationWithBatchSize:10];
+    [self queueRecords:3 integration:integration];
+    [integration applicationWillTerminate];
+    integration = nil;
+
+    FPWebhookIntegration *relaunched = [self makeIntegrationWithBatchSize:10];
+    XCTAssertEqual([self queueCountOfIntegration:relaunched], 3u);
+    [relaunched flush];
+    [self waitForRequests:1 queued:0 integration:relaunched];
+
+    FPWebhookIntegration *again = [self makeIntegrationWithBatchSize:10];
+    XCTAssertEqual([self queueCountOfIntegration:again], 0u, @"delivered events are not sent again");
+}
+
+- (void)testRetriesAfterServerError
+{
+    [self.statusCodes addObject:@503];
+    FPWebhookIntegration *integration = [self makeIntegrationWithBatchSize:1];
+    integration.retryScheduler.baseDelay = 0.01;
+    [self queueRecords:1 integration:integration];
+    [self waitForRequests:2 queued:0 integration:integration];
+
+    XCTAssertEqualObjects(self.bodies[0], self.bodies[1], @"the same event is sent again");
+    XCTAssertEqual([self destinationMetrics].uploadsFailed, 1u);
+    XCTAssertEqual([self destinationMetrics].uploadsSucceeded, 1u);
+}
+
+- (void)testDropsEventsRejectedByServer
+{
+    self.statusCode = 400;
+    FPWebhookIntegration *integration = [self makeIntegrationWithBatchSize:1];
+    [self queueRecords:1 integration:integration];
+    [self waitForRequests:1 queued:0 integration:integration];
+
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+    XCTAssertEqual(self.transport.requestCount, 1u, @"a rejected event is not retried");
+    XCTAssertEqual([self destinationMetrics].uploadsFailed, 0u);
+}
+
+- (void)testOverflowEvictsOldestEvents
+{
+    self.configuration.maxQueueSize = 3;
+    FPWebhookIntegration *integration = [self makeIntegrationWithBatchSize:10];
+    [self queueRecords:5 integration:integration];
+    XCTAssertEqual([self queueCountOfIntegration:integration], 3u);
+    XCTAssertEqual([self destinationMetrics].queueOverflowEventsDropped, 2u);
+    XCTAssertEqual(self.analytics.deliveryMetrics.queueOverflowEventsDropped, 0u, @"webhook drops are counted apart");
+
+    [integration flush];
+    [self waitForRequests:1 queued:0 integration:integration];
+    NSDictionary *body = [NSJSONSerialization JSONObjectWithData:[self.bodies.firstObject seg_gunzippedData] options:0 error:nil];
+    XCTAssertEqualObjects([body[@"batch"] valueForKey:@"index"], (@[ @2, @3, @4 ]));
+}
+
+@end
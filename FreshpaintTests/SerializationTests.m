@@ -27,6 +27,10 @@ JSON_DICT FPCoerceDictionary(NSDictionary *_Nullable dict);
 @interface NSArray(SerializableDeepCopy) <SEGSerializableDeepCopy>
 @end
 
+@interface FPFreshpaintIntegration (Testing)
++ (NSData *)batchBodyWithRecords:(NSArray<NSData *> *)records sentAt:(NSString *)sentAt;
+@end
+
 @interface MyObject: NSObject <FPSerializable>
 @end
 
@@ -105,4 +109,20 @@ JSON_DICT FPCoerceDictionary(NSDictionary *_Nullable dict);
     XCTAssertThrows(FPCoerceDictionary(testCoersion2));
 }
 
+- (void)testBatchBodySplicesSerializedEvents {
+    NSArray *events = @[@{@"type": @"track", @"event": @"foo"}, @{@"type": @"screen", @"properties": @{@"name": @"Home \"1\""}}];
+    NSMutableArray<NSData *> *records = [NSMutableArray array];
+    for (NSDictionary *event in events) {
+        [records addObject:[NSJSONSerialization dataWithJSONObject:event options:0 error:nil]];
+    }
+
+    NSData *body = [FPFreshpaintIntegration batchBodyWithRecords:records sentAt:@"2016-07-19T19:25:06.000Z"];
+    NSDictionary *batch = [NSJSONSerialization JSONObjectWithData:body options:0 error:nil];
+    XCTAssertEqualObjects(batch[@"batch"], events);
+    XCTAssertEqualObjects(batch[@"sentAt"], @"2016-07-19T19:25:06.000Z");
+
+    NSData *empty = [FPFreshpaintIntegration batchBodyWithRecords:@[] sentAt:@"2016-07-19T19:25:06.000Z"];
+    XCTAssertEqualObjects([NSJSONSerialization JSONObjectWithData:empty options:0 error:nil][@"batch"], @[]);
+}
+
 @end
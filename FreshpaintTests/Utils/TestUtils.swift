@@ -71,14 +71,14 @@ extension FreshpaintIntegration {
     func test_traits() -> [String: AnyObject]? {
         return self.value(forKey: "traits") as? [String: AnyObject]
     }
-    func test_flushTimer() -> Timer? {
-        return self.value(forKey: "flushTimer") as? Timer
+    func test_flushTimerInterval() -> TimeInterval {
+        return (self.value(forKey: "flushTimerInterval") as? TimeInterval) ?? 0
     }
-    func test_batchRequest() -> URLSessionUploadTask? {
-        return self.value(forKey: "batchRequest") as? URLSessionUploadTask
+    func test_batchRequest() -> TransportTask? {
+        return self.value(forKey: "batchRequest") as? TransportTask
     }
-    func test_queue() -> [AnyObject]? {
-        return self.value(forKey: "queue") as? [AnyObject]
+    func test_queueCount() -> Int {
+        return (self.value(forKeyPath: "queue.count") as? Int) ?? 0
     }
     func test_dispatchBackground(block: @escaping @convention(block) () -> Void) {
         self.perform(Selector(("dispatchBackground:")), with: block)